@@ -1,3 +1,6 @@
 %VULKAN_SDK%\Bin\glslc.exe resource\shader\simple_shader.vert -o resource\shader\simple_shader.vert.spv
 %VULKAN_SDK%\Bin\glslc.exe resource\shader\simple_shader.frag -o resource\shader\simple_shader.frag.spv
+%VULKAN_SDK%\Bin\glslc.exe resource\shader\simple_shader_packed.vert -o resource\shader\simple_shader_packed.vert.spv
+%VULKAN_SDK%\Bin\glslc.exe resource\shader\depth_only.vert -o resource\shader\depth_only.vert.spv
+%VULKAN_SDK%\Bin\glslc.exe resource\shader\cull.comp -o resource\shader\cull.comp.spv
 pause
\ No newline at end of file
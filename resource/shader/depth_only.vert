@@ -0,0 +1,30 @@
+#version 450 
+
+// 只写深度的pass，只读取position数据流
+layout(location=0) in vec3 position;
+
+// 每个实例的数据，同一个模型的所有实例一次draw，按gl_InstanceIndex读取
+struct InstanceData
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+    vec4 color;
+};
+
+layout(set=2, binding=0) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+layout(set=0, binding=0) uniform GlobalUbo {
+    mat4 projectionView;
+    vec3 directionToLight;
+} ubo;
+
+// 和着色pass的计算完全一致，保证着色pass的LESS_OR_EQUAL深度测试通过
+invariant gl_Position;
+
+void main()
+{
+    InstanceData instance = instances[gl_InstanceIndex];
+    gl_Position = ubo.projectionView * instance.modelMatrix * vec4(position, 1.0);
+}
@@ -1,14 +1,13 @@
 #version 450
 
 layout(location=0) in vec3 fragColor;
+layout(location=1) in vec2 fragUv;
 layout(location=0) out vec4 outColor;
 
-layout(push_constant) uniform Push{
-    mat4 modelMatrix;
-    mat4 normalMatrix;
-} push;
+// 漫反射贴图，没有贴图的物体绑定1x1的白色贴图
+layout(set=1, binding=0) uniform sampler2D diffuseMap;
 
 void main()
 {
-    outColor = vec4(fragColor,1);
+    outColor = vec4(fragColor * texture(diffuseMap, fragUv).rgb, 1);
 }
\ No newline at end of file
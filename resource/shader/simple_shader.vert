@@ -6,11 +6,19 @@ layout(location=2) in vec3 normal;
 layout(location=3) in vec2 uv;
 
 layout(location=0) out vec3 fragColor;
+layout(location=1) out vec2 fragUv;
 
-layout(push_constant) uniform Push{
+// 每个实例的数据，同一个模型的所有实例一次draw，按gl_InstanceIndex读取
+struct InstanceData
+{
     mat4 modelMatrix;
     mat4 normalMatrix;
-} push;
+    vec4 color;
+};
+
+layout(set=2, binding=0) readonly buffer Instances {
+    InstanceData instances[];
+};
 
 // descriptor set
 layout(set=0, binding=0) uniform GlobalUbo {
@@ -18,13 +26,19 @@ layout(set=0, binding=0) uniform GlobalUbo {
     vec3 directionToLight;
 } ubo;
 
+// 和depth_only.vert的计算完全一致，深度prepass写入的深度才能通过LESS_OR_EQUAL测试
+invariant gl_Position;
+
 const float AMBIENT = 0.02;
 
 void main()
 {
-    gl_Position = ubo.projectionView * push.modelMatrix * vec4(position, 1.0);
-    vec3 normalWorldSpace = normalize(mat3(push.normalMatrix) * normal);
+    InstanceData instance = instances[gl_InstanceIndex];
+    gl_Position = ubo.projectionView * instance.modelMatrix * vec4(position, 1.0);
+    vec3 normalWorldSpace = normalize(mat3(instance.normalMatrix) * normal);
     float lightIntensity = AMBIENT + max(dot(normalWorldSpace, ubo.directionToLight), 0);
 
-    fragColor = lightIntensity*color;
+    fragColor = lightIntensity*color*instance.color.rgb;
+    // obj和assimp的uv原点在左下角，贴图的第一行是顶部
+    fragUv = vec2(uv.x, 1.0 - uv.y);
 }
\ No newline at end of file
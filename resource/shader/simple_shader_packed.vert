@@ -0,0 +1,56 @@
+#version 450 
+
+// 压缩顶点格式：position为float或者相对包围盒的unorm16（反量化合并在modelMatrix中）
+// color为rgba8，normal为八面体编码的snorm16，uv为half，硬件取顶点时已经转换成float
+layout(location=0) in vec3 position;
+layout(location=1) in vec3 color;
+layout(location=2) in vec2 normalOct;
+layout(location=3) in vec2 uv;
+
+layout(location=0) out vec3 fragColor;
+layout(location=1) out vec2 fragUv;
+
+// 每个实例的数据，同一个模型的所有实例一次draw，按gl_InstanceIndex读取
+struct InstanceData
+{
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+    vec4 color;
+};
+
+layout(set=2, binding=0) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+// descriptor set
+layout(set=0, binding=0) uniform GlobalUbo {
+    mat4 projectionView;
+    vec3 directionToLight;
+} ubo;
+
+// 和depth_only.vert的计算完全一致，深度prepass写入的深度才能通过LESS_OR_EQUAL测试
+invariant gl_Position;
+
+const float AMBIENT = 0.02;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+void main()
+{
+    InstanceData instance = instances[gl_InstanceIndex];
+    gl_Position = ubo.projectionView * instance.modelMatrix * vec4(position, 1.0);
+    vec3 normalWorldSpace = normalize(mat3(instance.normalMatrix) * octDecode(normalOct));
+    float lightIntensity = AMBIENT + max(dot(normalWorldSpace, ubo.directionToLight), 0);
+
+    fragColor = lightIntensity*color*instance.color.rgb;
+    // obj和assimp的uv原点在左下角，贴图的第一行是顶部
+    fragUv = vec2(uv.x, 1.0 - uv.y);
+}
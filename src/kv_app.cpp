@@ -1,9 +1,19 @@
 #include "kv_app.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
 
 #include "keyboard_movement.h"
+#include "kv_defragmenter.h"
+#include "kv_frame_allocator.h"
 #include "kv_simple_render_system.h"
+#include "kv_staging_ring.h"
 #include "glm/ext/matrix_transform.hpp"
 
 using namespace kong;
@@ -14,12 +24,91 @@ struct GlobalUbo
     glm::vec3 lightDirection = glm::normalize(glm::vec3{1., -3., -1.});
 };
 
-KongApp::KongApp()
+KongAppSettings KongAppSettings::fromCommandLine(int argc, char** argv)
+{
+    KongAppSettings settings{};
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--vertex-format" && hasValue)
+        {
+            if (!KongVertexFormats::fromName(argv[++i], settings.vertexLayout.format))
+            {
+                throw std::runtime_error(std::string("unknown vertex format: ") + argv[i]);
+            }
+        }
+        else if (arg == "--grid" && hasValue)
+        {
+            settings.gridSize = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (arg == "--split-positions")
+        {
+            settings.vertexLayout.splitPositions = true;
+        }
+        else if (arg == "--depth-prepass")
+        {
+            settings.depthPrepass = true;
+        }
+        else if (arg == "--sync-load")
+        {
+            settings.asyncLoad = false;
+        }
+        else if (arg == "--no-geometry-pool")
+        {
+            settings.geometryPool = false;
+        }
+        else if (arg == "--no-texture-streaming")
+        {
+            settings.streamTextures = false;
+        }
+        else if (arg == "--texture-budget" && hasValue)
+        {
+            settings.textureBudgetMB = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (arg == "--no-transfer-queue")
+        {
+            settings.transferQueue = false;
+        }
+        else if (arg == "--stress-streaming")
+        {
+            settings.streamingStress = true;
+        }
+        else if (arg == "--no-instancing")
+        {
+            settings.instancing = false;
+        }
+        else if (arg == "--no-frustum-culling")
+        {
+            settings.frustumCulling = false;
+        }
+        else if (arg == "--gpu-culling")
+        {
+            settings.gpuCulling = true;
+        }
+        else if (arg == "--bvh")
+        {
+            settings.bvhCulling = true;
+        }
+    }
+    return settings;
+}
+
+KongApp::KongApp(const KongAppSettings& settings) : m_settings(settings)
 {
     m_globalPool = KongDescriptorPool::Builder(m_device)
                     .setMaxSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT)
-                    .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+                    .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, KongSwapChain::MAX_FRAMES_IN_FLIGHT)
                     .build();
+    m_samplerCache = std::make_unique<KongSamplerCache>(m_device);
+    if (m_settings.geometryPool)
+    {
+        m_geometryPool = std::make_unique<KongGeometryPool>(m_device);
+    }
+    m_assetLoader = std::make_unique<KongAssetLoader>(m_device, *m_samplerCache, m_geometryPool.get());
+    KongTextureStreamerSettings streamerSettings{};
+    streamerSettings.budgetBytes = static_cast<uint64_t>(m_settings.textureBudgetMB) << 20;
+    m_textureStreamer = std::make_unique<KongTextureStreamer>(m_device, *m_samplerCache, streamerSettings);
     
     loadGameobjects();
 }
@@ -29,50 +118,71 @@ KongApp::~KongApp()
 
 void KongApp::run()
 {
-    std::vector<std::unique_ptr<KongBuffer>> uboBuffers(KongSwapChain::MAX_FRAMES_IN_FLIGHT);
-    for (int i = 0; i < uboBuffers.size(); i++)
-    {
-        uboBuffers[i] = std::make_unique<KongBuffer>(
-            m_device,
-            sizeof(GlobalUbo),
-            1,
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        uboBuffers[i]->map();
-    }
-    // KongBuffer globalUboBuffer{
-    // m_device,
-    // sizeof(GlobalUbo),
-    //     KongSwapChain::MAX_FRAMES_IN_FLIGHT,    //和swapchain同时在渲染的frame数量匹配，这样每个frame都可以使用不同的ubo，不需要进行同步操作
-    //     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-    //     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-    //     m_device.properties.limits.minUniformBufferOffsetAlignment,
-    // };
-    //
-    // globalUboBuffer.map();
+    // GlobalUbo和其他每帧的临时数据都从frame allocator中分配，用dynamic offset绑定
+    // 每个物体的实例数据144字节，32MB够--grid 400（16万个物体）使用
+    KongFrameAllocator frameAllocator{m_device, KongSwapChain::MAX_FRAMES_IN_FLIGHT, 32ull << 20};
 
     auto globalSetLayout = KongDescriptorSetLayout::Builder(m_device)
-                    .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+                    .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
                     .build();
     
     std::vector<VkDescriptorSet> globalDiscriptorSets{KongSwapChain::MAX_FRAMES_IN_FLIGHT};
     for (int i = 0; i < globalDiscriptorSets.size(); i++)
     {
-        auto bufferInfo = uboBuffers[i]->descriptorInfo();
+        auto bufferInfo = frameAllocator.descriptorInfo(i, sizeof(GlobalUbo));
         KongDescriptorWriter(*globalSetLayout, *m_globalPool)
         .writeBuffer(0, &bufferInfo)
         .build(globalDiscriptorSets[i]);
     }
     
+    // 要比simpleRenderSystem活得久
+    KongSceneBvh sceneBvh{};
     SimpleRenderSystem simpleRenderSystem{m_device, m_renderer.getSwapChainRenderPass(),
-        globalSetLayout->getDescriptorSetLayout()};
+        globalSetLayout->getDescriptorSetLayout(), *m_samplerCache};
+    simpleRenderSystem.setDepthPrepass(m_settings.depthPrepass);
+    simpleRenderSystem.setInstancing(m_settings.instancing);
+    simpleRenderSystem.setFrustumCulling(m_settings.frustumCulling);
+    simpleRenderSystem.setGpuCulling(m_settings.gpuCulling);
+    if (m_settings.bvhCulling)
+    {
+        simpleRenderSystem.setSceneBvh(&sceneBvh);
+    }
     KongCamera camera{};
     camera.SetViewDirection(glm::vec3(0), glm::vec3(0.5, 0.1, 1));
 
     auto viewerObject = KongGameObject::CreateGameObject();
     KeyboardMovementController cameraController{};
     
+    // 后台不停地上传，每次16MB，超过staging ring单次上传的大小，同时测试分块
+    std::atomic<bool> stopStreamingStress{false};
+    std::thread streamingStressThread;
+    std::unique_ptr<KongBuffer> streamingStressTarget;
+    if (m_settings.streamingStress)
+    {
+        constexpr VkDeviceSize STRESS_UPLOAD_SIZE = 16ull << 20;
+        streamingStressTarget = std::make_unique<KongBuffer>(m_device, STRESS_UPLOAD_SIZE, 1,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        streamingStressThread = std::thread([&]()
+        {
+            std::vector<uint8_t> data(STRESS_UPLOAD_SIZE, 0x5a);
+            KongStagingRing& stagingRing = m_device.stagingRing();
+            while (!stopStreamingStress)
+            {
+                stagingRing.wait(stagingRing.uploadBuffer(streamingStressTarget->getBuffer(), 0, data.data(), data.size()));
+            }
+        });
+        std::cout << "streaming stress: uploading " << STRESS_UPLOAD_SIZE / (1 << 20) << " MB repeatedly on the "
+            << (m_device.stagingRing().usesTransferQueue() ? "transfer" : "graphics") << " queue" << std::endl;
+    }
+    
     auto currentTime = std::chrono::high_resolution_clock::now();
+    float lodStatsTimer = 0.0f;
+    uint32_t statsFrameCount = 0;
+    // 统计周期内帧时间的最大值和平方和，用于衡量抖动
+    float maxFrameTime = 0.0f;
+    double frameTimeSquares = 0.0;
+    bool firstFramePresented = false;
+    bool allModelsResident = false;
     
     while (!m_window.ShouldClose())
     {
@@ -88,25 +198,36 @@ void KongApp::run()
         float aspect = m_renderer.getAspectRatio();
         //camera.SetOrthographicProjection(-aspect, aspect, -1, 1, -1, 1);
         camera.SetPerspectiveProjection(glm::radians(50.f), aspect, 0.1f, 10.0f);
+
+        // 按上一帧登记的屏幕大小升级/降级贴图mip
+        m_textureStreamer->update();
         
         if (auto commandBuffer = m_renderer.beginFrame())
         {
             int frameIndex = m_renderer.getFrameIndex();
+            // beginFrame已经等待了这一帧上一次的fence，可以回收它的临时数据
+            frameAllocator.beginFrame(frameIndex);
+            // 碎片整理在帧的边界切换移动完成的buffer，之后录制的命令使用新的位置
+            m_device.defragmenter().update();
+
+            // 更新ubo数据
+            GlobalUbo ubo{};
+            ubo.projectionView = camera.GetProjectionMatrix() * camera.GetViewMatrix();
+            const KongFrameAllocation uboAllocation = frameAllocator.pushUniform(ubo);
+            if (!uboAllocation)
+            {
+                throw std::runtime_error("frame allocator has no room for the global ubo!");
+            }
             FrameInfo frameInfo{
                 frameIndex,
                 frameTime,
                 commandBuffer,
                 camera,
                 globalDiscriptorSets[frameIndex],
+                uboAllocation.offset,
+                frameAllocator,
+                m_renderer.getSwapChainExtent(),
             };
-
-            // 更新ubo数据
-            GlobalUbo ubo{};
-            ubo.projectionView = camera.GetProjectionMatrix() * camera.GetViewMatrix();
-            // globalUboBuffer.writeToBuffer(&ubo, frameIndex);
-            // globalUboBuffer.flushIndex(frameIndex);
-            uboBuffers[frameIndex]->writeToBuffer(&ubo);
-            uboBuffers[frameIndex]->flush();
             
             // render
             /* 每个frame之间可以有多个render pass，比如
@@ -116,18 +237,112 @@ void KongApp::run()
              * // reflection
              * // post process
              */
+            // GPU剔除的dispatch要在render pass之外录制
+            simpleRenderSystem.prepareFrame(frameInfo, m_gameObjects);
             m_renderer.beginSwapChainRenderPass(commandBuffer);
             simpleRenderSystem.renderGameObjects(frameInfo, m_gameObjects);
             m_renderer.endSwapChainRenderPass(commandBuffer);
             m_renderer.endFrame();
+
+            const float sinceStart = std::chrono::duration<float, std::milli>(
+                std::chrono::high_resolution_clock::now() - m_startTime).count();
+            const uint32_t pendingObjects = simpleRenderSystem.getPendingObjectCount();
+            if (!firstFramePresented)
+            {
+                firstFramePresented = true;
+                std::cout << "time to first frame: " << sinceStart << " ms ("
+                    << pendingObjects << " objects still loading)" << std::endl;
+            }
+            if (!allModelsResident && pendingObjects == 0)
+            {
+                allModelsResident = true;
+                std::cout << "all models resident: " << sinceStart << " ms" << std::endl;
+            }
+
+            lodStatsTimer += frameTime;
+            statsFrameCount++;
+            maxFrameTime = std::max(maxFrameTime, frameTime);
+            frameTimeSquares += static_cast<double>(frameTime) * frameTime;
+            if (lodStatsTimer > 2.0f)
+            {
+                const double meanFrameTime = lodStatsTimer / statsFrameCount;
+                const double frameTimeStddev = std::sqrt(std::max(frameTimeSquares / statsFrameCount - meanFrameTime * meanFrameTime, 0.0));
+                const auto& lodStats = simpleRenderSystem.getLodStats();
+                std::cout << "frame " << meanFrameTime * 1000.0 << " ms (max " << maxFrameTime * 1000.0f << " ms, stddev "
+                    << frameTimeStddev * 1000.0 << " ms, "
+                    << KongVertexFormats::name(m_settings.vertexLayout.format) << " vertices), lod: "
+                    << lodStats.drawnTriangles << " triangles drawn, " << lodStats.savedTriangles << " saved" << std::endl;
+                const auto& drawStats = simpleRenderSystem.getDrawStats();
+                std::cout << "draw: " << drawStats.drawnObjects << " objects (" << drawStats.culledObjects << " culled) in "
+                    << drawStats.drawCalls << " draw calls"
+                    << (m_settings.depthPrepass ? " + " + std::to_string(drawStats.prepassDrawCalls) + " prepass" : std::string())
+                    << (simpleRenderSystem.gpuCullingEnabled() ? " (gpu culled), " : m_settings.instancing ? " (instanced), " : ", ")
+                    << drawStats.geometryBinds << " geometry binds"
+                    << (m_geometryPool ? " (geometry pool)" : " (buffers per model)") << std::endl;
+                if (m_settings.bvhCulling)
+                {
+                    const KongSceneBvhStats& bvhStats = sceneBvh.stats();
+                    std::cout << "bvh: " << sceneBvh.size() << " objects, cost ratio " << bvhStats.costRatio << ", "
+                        << bvhStats.refitNodes << " nodes refit, " << bvhStats.rebuildCount << " rebuilds"
+                        << (bvhStats.rebuilding ? " (rebuilding)" : "") << std::endl;
+                }
+                const KongMemoryStats memoryStats = m_device.allocator().stats();
+                std::cout << "device memory: " << memoryStats.allocationCount << " allocations in "
+                    << memoryStats.blockCount + memoryStats.dedicatedCount << " vkAllocateMemory, "
+                    << memoryStats.usedBytes / (1024.0 * 1024.0) << " / " << memoryStats.reservedBytes / (1024.0 * 1024.0)
+                    << " MB used, fragmentation " << memoryStats.fragmentation << std::endl;
+                const KongDefragmenterStats defragStats = m_device.defragmenter().stats();
+                std::cout << "defragmenter: " << defragStats.movedBytes / (1024.0 * 1024.0) << " MB in "
+                    << defragStats.moveCount << " moves over " << defragStats.passCount << " passes, "
+                    << defragStats.pendingMoves << " pending" << std::endl;
+                const std::vector<KongHeapBudget> heapBudgets = m_device.allocator().heapBudgets();
+                for (size_t heap = 0; heap < heapBudgets.size(); heap++)
+                {
+                    if (heapBudgets[heap].reservedBytes == 0)
+                    {
+                        continue;
+                    }
+                    std::cout << "  heap " << heap << (heapBudgets[heap].deviceLocal ? " (device local): " : ": ")
+                        << heapBudgets[heap].usage / (1024.0 * 1024.0) << " / " << heapBudgets[heap].budget / (1024.0 * 1024.0)
+                        << " MB budget" << (m_device.supportsMemoryBudget() ? "" : " (estimated)") << ", "
+                        << heapBudgets[heap].reservedBytes / (1024.0 * 1024.0) << " MB ours" << std::endl;
+                }
+                const KongStagingRingStats stagingStats = m_device.stagingRing().stats();
+                std::cout << "staging ring: " << stagingStats.uploadedBytes / (1024.0 * 1024.0) << " MB in "
+                    << stagingStats.uploadCount << " uploads, " << stagingStats.submitCount << " submits, "
+                    << stagingStats.stallCount << " stalls ("
+                    << (m_device.stagingRing().usesTransferQueue() ? "transfer" : "graphics") << " queue)" << std::endl;
+                const KongFrameAllocatorStats& frameAllocatorStats = frameAllocator.stats();
+                std::cout << "frame allocator: " << frameAllocatorStats.lastFrameBytes / 1024.0 << " KB last frame, "
+                    << frameAllocatorStats.highWaterMark / 1024.0 << " KB peak of " << frameAllocatorStats.capacity / 1024.0
+                    << " KB, " << frameAllocatorStats.overflowCount << " overflows" << std::endl;
+                const auto& streamerStats = m_textureStreamer->stats();
+                if (streamerStats.textureCount > 0)
+                {
+                    std::cout << "texture streaming: " << streamerStats.residentBytes / (1024.0 * 1024.0) << " MB resident, "
+                        << streamerStats.pendingRequests << " pending, " << streamerStats.mipMisses << " mip misses, "
+                        << streamerStats.evictions << " evictions" << std::endl;
+                }
+                lodStatsTimer = 0.0f;
+                statsFrameCount = 0;
+                maxFrameTime = 0.0f;
+                frameTimeSquares = 0.0;
+            }
         }
     }
 
-    // cpu等待所有gpu任务完成
+    if (streamingStressThread.joinable())
+    {
+        stopStreamingStress = true;
+        streamingStressThread.join();
+    }
+
+    // cpu等待所有gpu任务完成，加载线程可能还在提交上传命令
+    std::lock_guard<std::mutex> lock(m_device.queueMutex());
     vkDeviceWaitIdle(m_device.device());
 }
 
-std::unique_ptr<KongModel> createCubeModel(KongDevice& device, glm::vec3 offset) {
+std::unique_ptr<KongModel> createCubeModel(KongDevice& device, KongGeometryPool* geometryPool, glm::vec3 offset) {
     KongModel::Builder modelBuilder{};
     modelBuilder.vertices = {
         // left face (white)
@@ -173,19 +388,69 @@ std::unique_ptr<KongModel> createCubeModel(KongDevice& device, glm::vec3 offset)
     modelBuilder.indices = {0,  1,  2,  0,  3,  1,  4,  5,  6,  4,  7,  5,  8,  9,  10, 8,  11, 9,
                             12, 13, 14, 12, 15, 13, 16, 17, 18, 16, 19, 17, 20, 21, 22, 20, 23, 21};
  
-    return std::make_unique<KongModel>(device, modelBuilder);
+    return std::make_unique<KongModel>(device, modelBuilder, KongVertexLayout{}, geometryPool);
 }
 
 void KongApp::loadGameobjects()
 {
- //   std::shared_ptr<KongModel> model = createCubeModel(m_device, {0.0, 0.0, 0.0});
-    std::shared_ptr<KongModel> model = KongModel::createModelFromFile(m_device, "../resource/model/diablo3/diablo3_pose.obj");
-    auto gameObject = KongGameObject::CreateGameObject();
-    gameObject.model = model;
-    gameObject.color = glm::vec3(1.0f, 0.3f, 0.8f);
-    gameObject.transform.translation = {0.0, 0.0, 1.5};
-    gameObject.transform.scale = {0.5f, 0.5f, 0.5f};
-    //cube.transform.rotation = 0.5 * glm::two_pi<float>();
-
-    m_gameObjects.push_back(std::move(gameObject));
+    const std::string modelPath = "../resource/model/diablo3/diablo3_pose.obj";
+    const std::string texturePath = "../resource/model/diablo3/diablo3_pose_diffuse.tga";
+    std::shared_ptr<KongModel> model{};
+    std::shared_ptr<KongModelHandle> modelHandle{};
+    std::shared_ptr<KongTexture> texture{};
+    std::shared_ptr<KongTextureHandle> textureHandle{};
+    // 有cook过的.kvtex时按mip流式加载，否则整张加载
+    std::shared_ptr<KongStreamedTexture> streamedTexture{};
+    if (m_settings.streamTextures)
+    {
+        streamedTexture = m_textureStreamer->load(texturePath);
+    }
+    if (m_settings.asyncLoad)
+    {
+        // 加载完成之前先画一个立方体占位，贴图加载完成之前用白色默认贴图
+        model = createCubeModel(m_device, m_geometryPool.get(), {0.0, 0.0, 0.0});
+        modelHandle = m_assetLoader->loadModel(modelPath, m_settings.vertexLayout);
+        if (!streamedTexture)
+        {
+            textureHandle = m_assetLoader->loadTexture(texturePath);
+        }
+    }
+    else
+    {
+        model = KongModel::createModelFromFile(m_device, modelPath, m_settings.vertexLayout, m_geometryPool.get());
+        if (!streamedTexture)
+        {
+            texture = KongTexture::createTextureFromFile(m_device, *m_samplerCache, texturePath);
+        }
+    }
+    const auto& layout = m_settings.vertexLayout;
+    std::cout << "vertex format: " << KongVertexFormats::name(layout.format) << ", "
+        << KongVertexFormats::stride(layout.format) << " bytes per vertex";
+    if (layout.splitPositions)
+    {
+        std::cout << " (" << KongVertexFormats::streamStride(layout, KongVertexFormats::STREAM_POSITION)
+            << " bytes in the position stream)";
+    }
+    std::cout << (m_settings.depthPrepass ? ", depth prepass" : "") << std::endl;
+
+    // 阵列中的物体共用同一个模型，间距和模型缩放后的大小差不多
+    const uint32_t gridSize = m_settings.gridSize;
+    for (uint32_t x = 0; x < gridSize; x++)
+    {
+        for (uint32_t z = 0; z < gridSize; z++)
+        {
+            auto gameObject = KongGameObject::CreateGameObject();
+            gameObject.model = model;
+            gameObject.pendingModel = modelHandle;
+            gameObject.texture = texture;
+            gameObject.pendingTexture = textureHandle;
+            gameObject.streamedTexture = streamedTexture;
+            gameObject.transform.translation = {
+                static_cast<float>(x) - static_cast<float>(gridSize - 1) * 0.5f, 0.0f, 1.5f + static_cast<float>(z)};
+            gameObject.transform.scale = {0.5f, 0.5f, 0.5f};
+            //cube.transform.rotation = 0.5 * glm::two_pi<float>();
+
+            m_gameObjects.push_back(std::move(gameObject));
+        }
+    }
 }
@@ -1,19 +1,57 @@
 #pragma once
+#include <chrono>
 #include <memory>
 
 #include "kv_descriptor.h"
 #include "kv_game_object.h"
+#include "kv_asset_loader.h"
 #include "kv_pipeline.h"
 #include "kv_renderer.h"
 #include "kv_swap_chain.h"
+#include "kv_texture.h"
+#include "kv_texture_streamer.h"
 #include "kv_window.h"
 
 namespace kong
 {
+    // 命令行启动参数
+    struct KongAppSettings
+    {
+        // --vertex-format full|packed|quantized，--split-positions把position单独存放
+        KongVertexLayout vertexLayout{};
+        // --depth-prepass：先只用position数据流画一遍深度，着色pass中被遮挡的片元不再执行fragment shader
+        bool depthPrepass = false;
+        // --sync-load：在构造函数中同步加载所有模型，用于和异步加载比较首帧时间
+        bool asyncLoad = true;
+        // --grid N：把模型摆成N x N的阵列，用于在密集场景下比较帧时间
+        uint32_t gridSize = 1;
+        // --no-geometry-pool：每个模型单独创建vertex/index buffer，用于比较每帧的bind次数
+        // 几何数据只有在这个模式下才会被碎片整理，pool的页不会移动（见KongGeometryPool::setMovable）
+        bool geometryPool = true;
+        // --no-texture-streaming：贴图有.kvtex时也一次性加载全部mip
+        bool streamTextures = true;
+        // --texture-budget MB：流式贴图驻留mip的显存上限
+        uint32_t textureBudgetMB = 256;
+        // --no-transfer-queue：有专用的transfer queue时也在graphics queue上上传
+        bool transferQueue = true;
+        // --stress-streaming：后台线程不停地上传数据，用于观察上传对帧时间抖动的影响
+        bool streamingStress = false;
+        // --no-instancing：每个物体单独一次draw，用于对比instancing的CPU开销
+        bool instancing = true;
+        // --no-frustum-culling：CPU路径上不做视锥剔除，屏幕外的物体也提交绘制
+        bool frustumCulling = true;
+        // --gpu-culling：视锥剔除和LOD选择在compute shader中完成，用indirect draw提交
+        bool gpuCulling = false;
+        // --bvh：CPU视锥剔除在场景BVH上查询，代替逐个物体测试
+        bool bvhCulling = false;
+
+        static KongAppSettings fromCommandLine(int argc, char** argv);
+    };
+
     class KongApp
     {
     public:
-        KongApp();
+        explicit KongApp(const KongAppSettings& settings = {});
         ~KongApp();
     
         KongApp(const KongApp&) = delete;
@@ -27,11 +65,20 @@ namespace kong
     private:
         void loadGameobjects();
         
+        KongAppSettings m_settings;
+        // 用于统计首帧时间，包括创建窗口和device的时间
+        std::chrono::high_resolution_clock::time_point m_startTime = std::chrono::high_resolution_clock::now();
         KongWindow m_window {window_width, window_height, "kong vulkan"};
-        KongDevice m_device{m_window};
+        KongDevice m_device{m_window, m_settings.transferQueue};
         KongRenderer m_renderer{m_window, m_device};
 
         std::unique_ptr<KongDescriptorPool> m_globalPool{};
+        // 在m_device之后声明，保证先于device析构
+        std::unique_ptr<KongSamplerCache> m_samplerCache{};
+        // 在m_assetLoader之前声明，模型释放时还要归还池中的范围
+        std::unique_ptr<KongGeometryPool> m_geometryPool{};
+        std::unique_ptr<KongAssetLoader> m_assetLoader{};
+        std::unique_ptr<KongTextureStreamer> m_textureStreamer{};
         std::vector<KongGameObject> m_gameObjects; 
     };
 }
@@ -0,0 +1,82 @@
+#include "kv_asset_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace kong;
+
+KongAssetLoader::KongAssetLoader(KongDevice& device, KongSamplerCache& samplerCache, KongGeometryPool* geometryPool,
+    KongThreadPool& threadPool)
+    : m_device(device), m_samplerCache(samplerCache), m_geometryPool(geometryPool), m_threadPool(threadPool)
+{
+}
+
+KongAssetLoader::~KongAssetLoader()
+{
+    m_cancelled.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& future : m_loads)
+    {
+        future.wait();
+    }
+}
+
+std::shared_ptr<KongModelHandle> KongAssetLoader::loadModel(const std::string& filepath, const KongVertexLayout& vertexLayout)
+{
+    return enqueue<KongModel>(filepath, [this, filepath, vertexLayout]()
+    {
+        return KongModel::createModelFromFile(m_device, filepath, vertexLayout, m_geometryPool);
+    });
+}
+
+std::shared_ptr<KongTextureHandle> KongAssetLoader::loadTexture(const std::string& filepath, const KongTextureSettings& settings)
+{
+    return enqueue<KongTexture>(filepath, [this, filepath, settings]()
+    {
+        return KongTexture::createTextureFromFile(m_device, m_samplerCache, filepath, settings);
+    });
+}
+
+template <typename T>
+std::shared_ptr<KongAssetHandle<T>> KongAssetLoader::enqueue(const std::string& filepath, std::function<std::unique_ptr<T>()> create)
+{
+    auto handle = std::make_shared<KongAssetHandle<T>>(filepath);
+    m_pendingCount.fetch_add(1, std::memory_order_acq_rel);
+
+    auto load = [this, handle, create = std::move(create)]()
+    {
+        using State = typename KongAssetHandle<T>::State;
+        if (m_cancelled.load(std::memory_order_acquire))
+        {
+            handle->m_state.store(State::Failed, std::memory_order_release);
+            m_pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+            return;
+        }
+
+        using clock = std::chrono::high_resolution_clock;
+        const auto startTime = clock::now();
+        handle->m_state.store(State::Loading, std::memory_order_release);
+        try
+        {
+            handle->m_asset = create();
+            handle->m_loadMilliseconds = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+            handle->m_state.store(State::Resident, std::memory_order_release);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "failed to load " << handle->m_filepath << ": " << e.what() << std::endl;
+            handle->m_state.store(State::Failed, std::memory_order_release);
+        }
+        m_pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+    };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 已经完成的future不再需要，顺便清理掉
+    m_loads.erase(std::remove_if(m_loads.begin(), m_loads.end(), [](const std::future<void>& future)
+    {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), m_loads.end());
+    m_loads.push_back(m_threadPool.submit(std::move(load)));
+    return handle;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "kv_model.h"
+#include "kv_texture.h"
+#include "kv_thread_pool.h"
+
+namespace kong
+{
+    /*
+     * 异步加载的资源，load返回后立刻可用，加载完成前get()为空
+     * 状态只会从Queued -> Loading -> Resident/Failed单向变化，可以在渲染线程每帧查询
+     */
+    template <typename T>
+    class KongAssetHandle
+    {
+    public:
+        enum class State : uint32_t
+        {
+            Queued,
+            Loading,
+            Resident,
+            Failed
+        };
+
+        explicit KongAssetHandle(std::string filepath) : m_filepath(std::move(filepath)) {}
+
+        State state() const { return m_state.load(std::memory_order_acquire); }
+        bool isResident() const { return state() == State::Resident; }
+        bool isDone() const { return state() == State::Resident || state() == State::Failed; }
+        // 不是Resident时返回空
+        std::shared_ptr<T> get() const { return isResident() ? m_asset : nullptr; }
+        const std::string& filepath() const { return m_filepath; }
+        // 从开始加载到上传完成的时间，不包括排队时间
+        float loadMilliseconds() const { return m_loadMilliseconds; }
+
+    private:
+        friend class KongAssetLoader;
+
+        std::string m_filepath;
+        std::atomic<State> m_state{State::Queued};
+        // 在状态变为Resident之前写入，之后只读
+        std::shared_ptr<T> m_asset{};
+        float m_loadMilliseconds = 0.0f;
+    };
+
+    using KongModelHandle = KongAssetHandle<KongModel>;
+    using KongTextureHandle = KongAssetHandle<KongTexture>;
+
+    /*
+     * 在线程池中解析模型、解码贴图并上传到GPU，不阻塞渲染线程
+     * 上传使用每个线程各自的command pool，提交时和渲染线程共用KongDevice::queueMutex
+     */
+    class KongAssetLoader
+    {
+    public:
+        // 模型的顶点和index放进geometryPool，为空时每个模型单独创建buffer
+        KongAssetLoader(KongDevice& device, KongSamplerCache& samplerCache, KongGeometryPool* geometryPool = nullptr,
+            KongThreadPool& threadPool = KongThreadPool::global());
+        // 取消还在排队的加载并等待正在进行的加载结束，必须在KongDevice之前析构
+        ~KongAssetLoader();
+
+        KongAssetLoader(const KongAssetLoader&) = delete;
+        KongAssetLoader& operator=(const KongAssetLoader&) = delete;
+
+        std::shared_ptr<KongModelHandle> loadModel(const std::string& filepath, const KongVertexLayout& vertexLayout = {});
+        std::shared_ptr<KongTextureHandle> loadTexture(const std::string& filepath, const KongTextureSettings& settings = {});
+        // 还没有加载完成（包括排队中）的资源数量
+        size_t pendingCount() const { return m_pendingCount.load(std::memory_order_acquire); }
+
+    private:
+        template <typename T>
+        std::shared_ptr<KongAssetHandle<T>> enqueue(const std::string& filepath, std::function<std::unique_ptr<T>()> create);
+
+        KongDevice& m_device;
+        KongSamplerCache& m_samplerCache;
+        KongGeometryPool* m_geometryPool;
+        KongThreadPool& m_threadPool;
+        std::atomic<bool> m_cancelled{false};
+        std::atomic<size_t> m_pendingCount{0};
+
+        std::mutex m_mutex;
+        std::vector<std::future<void>> m_loads;
+    };
+}
@@ -0,0 +1,347 @@
+#include "kv_assimp_importer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include <assimp/Importer.hpp>
+#include <assimp/material.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include "kv_mesh_optimizer.h"
+#include "kv_mesh_simplifier.h"
+#include "kv_process_stats.h"
+
+using namespace kong;
+
+namespace
+{
+    // 只开启需要的后处理：合并重复顶点、三角化，以及缺失法线时补上平滑法线（已有法线的mesh会跳过这一步）
+    constexpr unsigned int IMPORT_FLAGS = aiProcess_JoinIdenticalVertices | aiProcess_Triangulate
+        | aiProcess_GenSmoothNormals | aiProcess_SortByPType;
+
+    // 场景中的一个mesh实例，位置和法线需要变换到模型空间
+    struct MeshInstance
+    {
+        const aiMesh* mesh;
+        aiMatrix4x4 transform;
+        aiMatrix3x3 normalTransform;
+        glm::vec3 color;
+        // 优化过的三角形index（相对于这个实例）和新顶点编号到aiMesh顶点的映射
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> vertexOrder;
+        std::vector<KongMeshSimplifier::LodLevel> lodChain;
+    };
+
+    glm::vec3 materialColor(const aiScene* scene, const aiMesh* mesh)
+    {
+        aiColor4D diffuse;
+        if (mesh->mMaterialIndex < scene->mNumMaterials
+            && aiGetMaterialColor(scene->mMaterials[mesh->mMaterialIndex], AI_MATKEY_COLOR_DIFFUSE, &diffuse) == AI_SUCCESS)
+        {
+            return {diffuse.r, diffuse.g, diffuse.b};
+        }
+        // 和obj没有顶点颜色时一致
+        return {0.7f, 0.7f, 0.7f};
+    }
+
+    void collectInstances(const aiScene* scene, const aiNode* node, const aiMatrix4x4& parentTransform,
+        std::vector<MeshInstance>& instances)
+    {
+        const aiMatrix4x4 transform = parentTransform * node->mTransformation;
+        aiMatrix3x3 normalTransform{transform};
+        normalTransform.Inverse().Transpose();
+
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            // SortByPType之后点和线会被拆到单独的mesh里，这里只保留三角形
+            if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0 || mesh->mNumVertices == 0)
+            {
+                continue;
+            }
+            instances.push_back({mesh, transform, normalTransform, materialColor(scene, mesh), {}, {}, {}});
+        }
+
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            collectInstances(scene, node->mChildren[i], transform, instances);
+        }
+    }
+
+    void extractTriangles(MeshInstance& instance)
+    {
+        const aiMesh* mesh = instance.mesh;
+        instance.indices.reserve(static_cast<size_t>(mesh->mNumFaces) * 3);
+        for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+        {
+            const aiFace& face = mesh->mFaces[f];
+            if (face.mNumIndices == 3)
+            {
+                instance.indices.insert(instance.indices.end(), face.mIndices, face.mIndices + 3);
+            }
+        }
+    }
+
+    // 做vertex cache/overdraw/vertex fetch优化，和Builder::optimizeMesh的效果相同
+    void optimizeInstance(MeshInstance& instance, KongVertexCacheStats& before, KongVertexCacheStats& after)
+    {
+        const aiMesh* mesh = instance.mesh;
+        before += KongMeshOptimizer::analyzeVertexCache(instance.indices.data(), instance.indices.size(), mesh->mNumVertices);
+        instance.vertexOrder = KongMeshOptimizer::optimize(instance.indices.data(), instance.indices.size(),
+            &mesh->mVertices[0].x, sizeof(aiVector3D), mesh->mNumVertices);
+        after += KongMeshOptimizer::analyzeVertexCache(instance.indices.data(), instance.indices.size(), instance.vertexOrder.size());
+    }
+
+    const aiScene* readScene(Assimp::Importer& importer, const std::string& filepath)
+    {
+        // 点和线直接在SortByPType阶段丢掉
+        importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+        const aiScene* scene = importer.ReadFile(filepath, IMPORT_FLAGS);
+        if (scene == nullptr || scene->mRootNode == nullptr || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE))
+        {
+            throw std::runtime_error("failed to import " + filepath + ": " + importer.GetErrorString());
+        }
+        return scene;
+    }
+
+    std::vector<MeshInstance> prepareInstances(const aiScene* scene, const std::string& filepath, bool optimize)
+    {
+        std::vector<MeshInstance> instances;
+        collectInstances(scene, scene->mRootNode, aiMatrix4x4{}, instances);
+
+        KongVertexCacheStats before{}, after{};
+        size_t triangleCount = 0;
+        for (auto& instance : instances)
+        {
+            extractTriangles(instance);
+            triangleCount += instance.indices.size() / 3;
+            if (optimize)
+            {
+                optimizeInstance(instance, before, after);
+            }
+            else
+            {
+                instance.vertexOrder.resize(instance.mesh->mNumVertices);
+                std::iota(instance.vertexOrder.begin(), instance.vertexOrder.end(), 0u);
+            }
+        }
+        if (triangleCount == 0)
+        {
+            throw std::runtime_error("no triangle meshes in " + filepath);
+        }
+
+        if (optimize)
+        {
+            std::cout << "optimize mesh: ACMR " << before.acmr() << " -> " << after.acmr()
+                << ", ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+        }
+        return instances;
+    }
+
+    KongModel::Vertex makeVertex(const MeshInstance& instance, uint32_t i)
+    {
+        const aiMesh* mesh = instance.mesh;
+        KongModel::Vertex vertex{};
+        const aiVector3D position = instance.transform * mesh->mVertices[i];
+        vertex.position = {position.x, position.y, position.z};
+        if (mesh->HasNormals())
+        {
+            aiVector3D normal = instance.normalTransform * mesh->mNormals[i];
+            normal.Normalize();
+            vertex.normal = {normal.x, normal.y, normal.z};
+        }
+        if (mesh->HasVertexColors(0))
+        {
+            vertex.color = {mesh->mColors[0][i].r, mesh->mColors[0][i].g, mesh->mColors[0][i].b};
+        }
+        else
+        {
+            vertex.color = instance.color;
+        }
+        if (mesh->HasTextureCoords(0))
+        {
+            vertex.uv = {mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y};
+        }
+        return vertex;
+    }
+
+    /*
+     * 按模型空间的顶点位置生成LOD链和LOD0的meshlet，同时累加包围盒
+     * baseVertex是这个实例在整个vertex buffer中的起始顶点
+     */
+    void buildInstanceLodsAndMeshlets(MeshInstance& instance, const KongLodSettings& settings, uint32_t baseVertex,
+        KongMeshletData& meshlets, glm::vec3& boundsMin, glm::vec3& boundsMax)
+    {
+        std::vector<glm::vec3> positions;
+        positions.reserve(instance.vertexOrder.size());
+        for (uint32_t i : instance.vertexOrder)
+        {
+            const aiVector3D position = instance.transform * instance.mesh->mVertices[i];
+            positions.emplace_back(position.x, position.y, position.z);
+            boundsMin = glm::min(boundsMin, positions.back());
+            boundsMax = glm::max(boundsMax, positions.back());
+        }
+        if (positions.empty())
+        {
+            return;
+        }
+        instance.lodChain = KongMeshSimplifier::buildLodChain(instance.indices.data(), instance.indices.size(),
+            &positions[0].x, sizeof(glm::vec3), positions.size(), settings);
+        KongMeshletBuilder::build(instance.indices.data(), instance.indices.size(), &positions[0].x, sizeof(glm::vec3),
+            positions.size(), baseVertex, meshlets);
+    }
+
+    template <typename IndexType>
+    void writeIndexBlocks(const std::vector<const std::vector<uint32_t>*>& blocks, void* indices, uint32_t first, uint32_t count)
+    {
+        // 只写出和[first, first + count)重叠的部分
+        auto* out = static_cast<IndexType*>(indices);
+        const uint32_t last = first + count;
+        uint32_t blockFirst = 0;
+        for (const auto* block : blocks)
+        {
+            const uint32_t blockLast = blockFirst + static_cast<uint32_t>(block->size());
+            for (uint32_t i = std::max(first, blockFirst); i < std::min(last, blockLast); i++)
+            {
+                *out++ = static_cast<IndexType>((*block)[i - blockFirst]);
+            }
+            blockFirst = blockLast;
+        }
+    }
+
+    float toMegabytes(size_t bytes)
+    {
+        return static_cast<float>(bytes) / (1024.0f * 1024.0f);
+    }
+}
+
+std::unique_ptr<KongModel> KongAssimpImporter::importModel(KongDevice& device, const std::string& filepath,
+    const KongVertexLayout& vertexLayout, KongGeometryPool* geometryPool)
+{
+    using clock = std::chrono::high_resolution_clock;
+    auto startTime = clock::now();
+    const size_t peakBefore = queryPeakResidentBytes();
+
+    Assimp::Importer importer;
+    const aiScene* scene = readScene(importer, filepath);
+    const float importMs = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+    auto instances = prepareInstances(scene, filepath, true);
+
+    KongModel::StreamedMesh mesh{};
+    mesh.boundsMin = glm::vec3{std::numeric_limits<float>::max()};
+    mesh.boundsMax = glm::vec3{std::numeric_limits<float>::lowest()};
+    size_t levelCount = 1;
+    uint32_t baseVertex = 0;
+    for (auto& instance : instances)
+    {
+        buildInstanceLodsAndMeshlets(instance, KongLodSettings{}, baseVertex, mesh.meshlets, mesh.boundsMin, mesh.boundsMax);
+        levelCount = std::max(levelCount, instance.lodChain.size() + 1);
+        baseVertex += static_cast<uint32_t>(instance.vertexOrder.size());
+    }
+
+    /*
+     * index buffer依次存放各级LOD的所有实例，层数不够的实例复用自己最后一级的range
+     * 每个实例的index都是相对于自己的vertexOffset，所以只要单个mesh的顶点数不超过65535就能用16位index
+     */
+    std::vector<const std::vector<uint32_t>*> indexBlocks;
+    uint32_t indexCount = 0;
+    bool shortIndex = true;
+    for (size_t level = 0; level < levelCount; level++)
+    {
+        KongModel::Lod lod{static_cast<uint32_t>(mesh.drawRanges.size()), static_cast<uint32_t>(instances.size()), 0.0f, 0};
+        uint32_t vertexOffset = 0;
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            const auto& instance = instances[i];
+            const size_t instanceLevel = std::min(level, instance.lodChain.size());
+            if (level > 0 && instanceLevel < level)
+            {
+                const KongModel::DrawRange previous = mesh.drawRanges[mesh.lods.back().firstRange + i];
+                mesh.drawRanges.push_back(previous);
+            }
+            else
+            {
+                const auto& levelIndices = level == 0 ? instance.indices : instance.lodChain[level - 1].indices;
+                mesh.drawRanges.push_back({indexCount, static_cast<uint32_t>(levelIndices.size()), static_cast<int32_t>(vertexOffset)});
+                indexBlocks.push_back(&levelIndices);
+                indexCount += static_cast<uint32_t>(levelIndices.size());
+            }
+            if (instanceLevel > 0)
+            {
+                lod.error = std::max(lod.error, instance.lodChain[instanceLevel - 1].error);
+            }
+
+            const auto instanceVertexCount = static_cast<uint32_t>(instance.vertexOrder.size());
+            vertexOffset += instanceVertexCount;
+            shortIndex = shortIndex && instanceVertexCount <= std::numeric_limits<uint16_t>::max();
+        }
+        mesh.vertexCount = vertexOffset;
+        mesh.lods.push_back(lod);
+    }
+
+    mesh.indexType = shortIndex ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    mesh.vertexLayout = vertexLayout;
+    mesh.writeVertices = [&](KongModel::Vertex* vertices, uint32_t first, uint32_t count)
+    {
+        const uint32_t last = first + count;
+        uint32_t instanceFirst = 0;
+        for (const auto& instance : instances)
+        {
+            const uint32_t instanceLast = instanceFirst + static_cast<uint32_t>(instance.vertexOrder.size());
+            for (uint32_t v = std::max(first, instanceFirst); v < std::min(last, instanceLast); v++)
+            {
+                *vertices++ = makeVertex(instance, instance.vertexOrder[v - instanceFirst]);
+            }
+            instanceFirst = instanceLast;
+        }
+    };
+    mesh.writeIndices = [&](void* indices, uint32_t first, uint32_t count)
+    {
+        if (shortIndex)
+        {
+            writeIndexBlocks<uint16_t>(indexBlocks, indices, first, count);
+        }
+        else
+        {
+            writeIndexBlocks<uint32_t>(indexBlocks, indices, first, count);
+        }
+    };
+
+    auto model = std::make_unique<KongModel>(device, mesh, geometryPool);
+
+    // 峰值内存是进程级别的，和导入前的峰值相减得到这个资源带来的增量
+    const size_t peakAfter = queryPeakResidentBytes();
+    std::cout << "load " << filepath << " (assimp): "
+        << std::chrono::duration<float, std::milli>(clock::now() - startTime).count() << " ms"
+        << " (import " << importMs << " ms), "
+        << instances.size() << " meshes, " << levelCount << " lods, " << mesh.meshlets.meshlets.size() << " meshlets, vertex size:" << mesh.vertexCount << ", index size:" << indexCount
+        << ", peak RSS " << toMegabytes(peakAfter) << " MB (+" << toMegabytes(peakAfter - peakBefore) << " MB)" << std::endl;
+    return model;
+}
+
+void KongAssimpImporter::loadBuilder(const std::string& filepath, KongModel::Builder& builder)
+{
+    Assimp::Importer importer;
+    const aiScene* scene = readScene(importer, filepath);
+    const auto instances = prepareInstances(scene, filepath, false);
+
+    builder.vertices.clear();
+    builder.indices.clear();
+    builder.drawRanges.clear();
+    for (const auto& instance : instances)
+    {
+        builder.drawRanges.push_back({static_cast<uint32_t>(builder.indices.size()),
+            static_cast<uint32_t>(instance.indices.size()), static_cast<int32_t>(builder.vertices.size())});
+        for (uint32_t i : instance.vertexOrder)
+        {
+            builder.vertices.push_back(makeVertex(instance, i));
+        }
+        builder.indices.insert(builder.indices.end(), instance.indices.begin(), instance.indices.end());
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <memory>
+#include <string>
+
+#include "kv_model.h"
+
+namespace kong
+{
+    /*
+     * 用Assimp导入.blend/.fbx/.gltf等多mesh资源
+     * 每个aiMesh（按节点实例）对应共享vertex/index buffer中的一个draw range，
+     * 顶点和index直接从aiScene写进staging buffer，不再拼成一个Builder
+     */
+    class KongAssimpImporter
+    {
+    public:
+        static std::unique_ptr<KongModel> importModel(KongDevice& device, const std::string& filepath,
+            const KongVertexLayout& vertexLayout = {}, KongGeometryPool* geometryPool = nullptr);
+        // 不创建GPU资源也不做优化，把所有mesh按draw range拼进builder，供离线工具和benchmark使用
+        static void loadBuilder(const std::string& filepath, KongModel::Builder& builder);
+    };
+}
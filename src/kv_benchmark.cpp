@@ -0,0 +1,1605 @@
+#include "kv_benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+#include <stdexcept>
+
+#include "tiny_obj_loader.h"
+#include "kv_assimp_importer.h"
+#include "kv_buffer.h"
+#include "kv_bvh.h"
+#include "kv_camera.h"
+#include "kv_descriptor.h"
+#include "kv_frame_allocator.h"
+#include "kv_frustum_culler.h"
+#include "kv_game_object.h"
+#include "kv_gpu_culler.h"
+#include "kv_memory_allocator.h"
+#include "kv_mesh_cache.h"
+#include "kv_mesh_optimizer.h"
+#include "kv_meshlet.h"
+#include "kv_model.h"
+#include "kv_obj_parser.h"
+#include "kv_renderer.h"
+#include "kv_simple_render_system.h"
+#include "kv_staging_ring.h"
+#include "kv_texture.h"
+#include "kv_texture_compressor.h"
+#include "kv_thread_pool.h"
+#include "kv_vertex_format.h"
+#include "kv_window.h"
+
+using namespace kong;
+
+namespace
+{
+    constexpr int REPEAT_COUNT = 3;
+
+    // 仓库自带的模型，作为mesh优化的回归测试集
+    const std::vector<std::string> BUNDLED_MODELS{
+        "../resource/model/diablo3/diablo3_pose.obj",
+        "../resource/model/nanosuit/nanosuit.blend",
+        "../resource/model/cyborg/cyborg.blend",
+    };
+
+    // 和simple_shader.vert中的GlobalUbo一致
+    struct BenchmarkUbo
+    {
+        glm::mat4 projectionView{1.0f};
+        glm::vec3 lightDirection = glm::normalize(glm::vec3{1.0f, -3.0f, -1.0f});
+    };
+
+    // 边长为size的立方体，每个面4个顶点，法线朝外
+    KongModel::Builder cubeBuilder(float size, const glm::vec3& color)
+    {
+        KongModel::Builder builder{};
+        const float h = size * 0.5f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (float sign : {-1.0f, 1.0f})
+            {
+                glm::vec3 normal{0.0f};
+                normal[axis] = sign;
+                const glm::vec3 u = glm::vec3(normal[1] + normal[2] != 0.0f ? 1.0f : 0.0f, normal[0] != 0.0f ? 1.0f : 0.0f, 0.0f);
+                const glm::vec3 v = glm::cross(normal, u);
+                const auto first = static_cast<uint32_t>(builder.vertices.size());
+                const glm::vec2 corners[] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+                for (const glm::vec2& corner : corners)
+                {
+                    KongModel::Vertex vertex{};
+                    vertex.position = (normal + u * corner.x + v * corner.y) * h;
+                    vertex.color = color;
+                    vertex.normal = normal;
+                    vertex.uv = corner * 0.5f + 0.5f;
+                    builder.vertices.push_back(vertex);
+                }
+                for (uint32_t index : {0u, 1u, 2u, 2u, 3u, 0u})
+                {
+                    builder.indices.push_back(first + index);
+                }
+            }
+        }
+        return builder;
+    }
+
+    // 重复执行几次取最快的一次，减少文件缓存和调度的干扰
+    template <typename Func>
+    double bestSeconds(Func&& func)
+    {
+        using clock = std::chrono::high_resolution_clock;
+        double best = 0.0;
+        for (int i = 0; i < REPEAT_COUNT; i++)
+        {
+            auto startTime = clock::now();
+            func();
+            double seconds = std::chrono::duration<double>(clock::now() - startTime).count();
+            best = i == 0 ? seconds : std::min(best, seconds);
+        }
+        return best;
+    }
+
+    // 命令行没有指定时使用仓库中所有模型的png/tga
+    std::vector<std::string> texturePaths(const std::vector<std::string>& args)
+    {
+        std::vector<std::string> filepaths = args;
+        if (filepaths.empty())
+        {
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::recursive_directory_iterator("../resource/model", ec))
+            {
+                const std::string extension = entry.path().extension().string();
+                if (extension == ".png" || extension == ".tga")
+                {
+                    filepaths.push_back(entry.path().string());
+                }
+            }
+            std::sort(filepaths.begin(), filepaths.end());
+        }
+        return filepaths;
+    }
+
+    // obj走自己的解析器，其余格式交给Assimp，两者都不做优化
+    KongVertexCacheStats analyzeBuilder(const KongModel::Builder& builder)
+    {
+        KongVertexCacheStats stats{};
+        if (builder.drawRanges.empty())
+        {
+            return KongMeshOptimizer::analyzeVertexCache(builder.indices.data(), builder.indices.size(), builder.vertices.size());
+        }
+        for (const auto& range : builder.drawRanges)
+        {
+            stats += KongMeshOptimizer::analyzeVertexCache(builder.indices.data() + range.firstIndex, range.indexCount,
+                builder.vertices.size() - range.vertexOffset);
+        }
+        return stats;
+    }
+
+    // 未焊接时obj的一个角对应的顶点，作为焊接结果的参照，normal和uv用各自的index
+    KongModel::Vertex objCorner(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index)
+    {
+        KongModel::Vertex vertex{};
+        if (index.vertex_index >= 0)
+        {
+            const size_t v = 3 * static_cast<size_t>(index.vertex_index);
+            vertex.position = {attrib.vertices[v], attrib.vertices[v + 1], attrib.vertices[v + 2]};
+            vertex.color = v + 2 < attrib.colors.size() ? glm::vec3{attrib.colors[v], attrib.colors[v + 1], attrib.colors[v + 2]}
+                : glm::vec3{0.7f, 0.7f, 0.7f};
+        }
+        if (index.normal_index >= 0)
+        {
+            const size_t n = 3 * static_cast<size_t>(index.normal_index);
+            vertex.normal = {attrib.normals[n], attrib.normals[n + 1], attrib.normals[n + 2]};
+        }
+        if (index.texcoord_index >= 0)
+        {
+            const size_t t = 2 * static_cast<size_t>(index.texcoord_index);
+            vertex.uv = {attrib.texcoords[t], attrib.texcoords[t + 1]};
+        }
+        return vertex;
+    }
+
+    // 每个batch的命令集合，用(firstInstance, firstIndex)标识，和写入的顺序无关
+    std::vector<std::set<uint64_t>> collectCommands(const KongGpuCullParams& params, const std::vector<KongGpuCullMesh>& meshes,
+        const std::vector<uint32_t>& counts, const std::vector<VkDrawIndexedIndirectCommand>& commands)
+    {
+        std::vector<uint32_t> firstCommands(params.batchCount, 0);
+        for (const auto& mesh : meshes)
+        {
+            firstCommands[mesh.batch] = mesh.firstCommand;
+        }
+        std::vector<std::set<uint64_t>> batches(params.batchCount);
+        for (uint32_t b = 0; b < params.batchCount; b++)
+        {
+            for (uint32_t c = 0; c < counts[b] && firstCommands[b] + c < commands.size(); c++)
+            {
+                const VkDrawIndexedIndirectCommand& command = commands[firstCommands[b] + c];
+                batches[b].insert(static_cast<uint64_t>(command.firstInstance) << 32 | command.firstIndex);
+            }
+        }
+        return batches;
+    }
+}
+
+bool KongBenchmark::run(int argc, char** argv)
+{
+    const std::map<std::string, std::function<void(const std::vector<std::string>&)>> benchmarks{
+        {"bvh", bvh},
+        {"frustum_cull", frustumCull},
+        {"gpu_cull", gpuCull},
+        {"instancing", instancing},
+        {"memory_allocator", memoryAllocator},
+        {"mesh_cache", meshCache},
+        {"mesh_optimize", meshOptimize},
+        {"meshlet_cull", meshletCull},
+        {"obj_parse", objParse},
+        {"staging_upload", stagingUpload},
+        {"texture_compress", textureCompress},
+        {"texture_decode", textureDecode},
+        {"upload_batch", uploadBatch},
+        {"vertex_format", vertexFormat},
+        {"weld", weld},
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) != "--bench")
+        {
+            continue;
+        }
+        if (i + 1 >= argc || benchmarks.find(argv[i + 1]) == benchmarks.end())
+        {
+            std::cerr << "available benchmarks:";
+            for (const auto& benchmark : benchmarks)
+            {
+                std::cerr << " " << benchmark.first;
+            }
+            std::cerr << std::endl;
+            return true;
+        }
+
+        std::vector<std::string> args(argv + i + 2, argv + argc);
+        benchmarks.at(argv[i + 1])(args);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * OBJ解析的多核扩展性：分别用1、2、4...个线程解析同一个文件，和tinyobj对比吞吐量
+ * 参数：obj文件路径，默认使用场景里的diablo3模型
+ */
+void KongBenchmark::objParse(const std::vector<std::string>& args)
+{
+    const std::string filepath = args.empty() ? "../resource/model/diablo3/diablo3_pose.obj" : args[0];
+    std::error_code ec;
+    const auto fileSize = std::filesystem::file_size(filepath, ec);
+    if (ec)
+    {
+        throw std::runtime_error("failed to open " + filepath);
+    }
+    const double megabytes = static_cast<double>(fileSize) / (1024.0 * 1024.0);
+    std::cout << "obj_parse: " << filepath << " (" << megabytes << " MB)" << std::endl;
+
+    double tinyobjSeconds = bestSeconds([&]()
+    {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
+        {
+            throw std::runtime_error(warn + err);
+        }
+    });
+    std::cout << "  tinyobj:    " << megabytes / tinyobjSeconds << " MB/s" << std::endl;
+
+    const uint32_t maxThreads = KongThreadPool::global().threadCount();
+    for (uint32_t threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        bool supported = true;
+        double seconds = bestSeconds([&]()
+        {
+            KongObjData data;
+            supported = KongObjParser::parseFile(filepath, data, threads);
+        });
+        if (!supported)
+        {
+            std::cout << "  file uses features not supported by KongObjParser" << std::endl;
+            return;
+        }
+        std::cout << "  threads " << threads << ": " << megabytes / seconds << " MB/s ("
+            << tinyobjSeconds / seconds << "x tinyobj)" << std::endl;
+
+        if (threads == maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * 顶点焊接的回归测试：把Builder::loadModel的结果按index展开，和tinyobj解析出的未焊接的三角形角逐个比较，
+ * 两者完全相同说明渲染出的几何不变
+ * 参数：obj文件路径，默认使用仓库自带的obj模型
+ */
+void KongBenchmark::weld(const std::vector<std::string>& args)
+{
+    std::vector<std::string> files = args;
+    if (files.empty())
+    {
+        std::copy_if(BUNDLED_MODELS.begin(), BUNDLED_MODELS.end(), std::back_inserter(files),
+            [](const std::string& filepath) { return std::filesystem::path(filepath).extension() == ".obj"; });
+    }
+
+    for (const auto& filepath : files)
+    {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
+        {
+            std::cout << "weld: " << filepath << " skipped: " << warn + err << std::endl;
+            continue;
+        }
+        std::vector<KongModel::Vertex> corners;
+        for (const auto& shape : shapes)
+        {
+            for (const auto& index : shape.mesh.indices)
+            {
+                corners.push_back(objCorner(attrib, index));
+            }
+        }
+
+        KongModel::Builder builder;
+        builder.loadModel(filepath);
+        size_t mismatches = corners.size() > builder.indices.size() ? corners.size() - builder.indices.size() : 0;
+        for (size_t i = 0; i < builder.indices.size(); i++)
+        {
+            mismatches += i >= corners.size() || !(builder.vertices[builder.indices[i]] == corners[i]);
+        }
+        std::cout << "weld: " << filepath << ": " << corners.size() << " corners -> " << builder.vertices.size() << " vertices ("
+            << static_cast<double>(builder.vertices.size()) / std::max<size_t>(corners.size(), 1) << ")" << std::endl
+            << "  " << (mismatches == 0 ? "match" : "MISMATCH") << ": " << mismatches << " differing corners" << std::endl;
+    }
+}
+
+/*
+ * index buffer优化的回归测试：对每个模型统计优化前后的ACMR/ATVR，优化后变差时标记REGRESSION
+ * 参数：模型文件路径，默认使用仓库自带的模型
+ */
+void KongBenchmark::meshOptimize(const std::vector<std::string>& args)
+{
+    using clock = std::chrono::high_resolution_clock;
+    const auto& files = args.empty() ? BUNDLED_MODELS : args;
+
+    for (const auto& filepath : files)
+    {
+        KongModel::Builder builder;
+        try
+        {
+            builder.loadAsset(filepath);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "mesh_optimize: " << filepath << " skipped: " << e.what() << std::endl;
+            continue;
+        }
+
+        const auto before = analyzeBuilder(builder);
+        auto startTime = clock::now();
+        builder.optimizeMesh();
+        const double ms = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+        const auto after = analyzeBuilder(builder);
+
+        const bool regressed = after.acmr() > before.acmr() || after.triangleCount != before.triangleCount;
+        std::cout << "mesh_optimize: " << filepath << " (" << before.triangleCount << " triangles, " << ms << " ms)" << std::endl
+            << "  ACMR " << before.acmr() << " -> " << after.acmr()
+            << ", ATVR " << before.atvr() << " -> " << after.atvr()
+            << (regressed ? "  REGRESSION" : "") << std::endl;
+    }
+}
+
+/*
+ * .kvmesh缓存带来的加载时间差别：导入+cook+上传，和打开缓存+上传，都等到上传完成
+ * 缓存写在临时目录中，不影响程序启动时读取的缓存
+ * 参数：模型文件路径，默认使用仓库自带的模型
+ */
+void KongBenchmark::meshCache(const std::vector<std::string>& args)
+{
+    const auto& files = args.empty() ? BUNDLED_MODELS : args;
+    KongWindow window{320, 240, "mesh_cache"};
+    KongDevice device{window};
+
+    for (const auto& filepath : files)
+    {
+        KongModel::Builder builder;
+        double importSeconds = 0.0;
+        try
+        {
+            importSeconds = bestSeconds([&]()
+            {
+                builder = {};
+                builder.loadAsset(filepath);
+                builder.cook();
+                KongModel model{device, builder};
+            });
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "mesh_cache: " << filepath << " skipped: " << e.what() << std::endl;
+            continue;
+        }
+
+        const std::string cachePath = (std::filesystem::temp_directory_path()
+            / (std::filesystem::path(filepath).filename().string() + ".kvmesh")).string();
+        if (!KongMeshCache::write(cachePath, filepath, builder))
+        {
+            std::cout << "mesh_cache: " << filepath << " skipped: failed to write " << cachePath << std::endl;
+            continue;
+        }
+        const double cacheSeconds = bestSeconds([&]()
+        {
+            KongMeshCache cache;
+            if (!cache.open(cachePath, filepath))
+            {
+                throw std::runtime_error("failed to open " + cachePath);
+            }
+            KongModel model{device, cache};
+        });
+        std::error_code ec;
+        std::filesystem::remove(cachePath, ec);
+
+        std::cout << "mesh_cache: " << filepath << " (" << builder.vertices.size() << " vertices, "
+            << builder.indices.size() << " indices)" << std::endl
+            << "  import + cook + upload: " << importSeconds * 1e3 << " ms" << std::endl
+            << "  kvmesh + upload: " << cacheSeconds * 1e3 << " ms (" << importSeconds / cacheSeconds << "x faster)" << std::endl;
+    }
+}
+
+/*
+ * 压缩顶点格式的对比：每种格式的顶点大小（以及position分开存放时深度pass读取的大小）、vertex buffer大小、
+ * 打包耗时和压缩带来的最大误差
+ * position误差相对于包围盒最大边长，normal误差为角度，uv误差为绝对值
+ * 参数：模型文件路径，默认使用仓库自带的模型
+ */
+void KongBenchmark::vertexFormat(const std::vector<std::string>& args)
+{
+    const auto& files = args.empty() ? BUNDLED_MODELS : args;
+
+    for (const auto& filepath : files)
+    {
+        KongModel::Builder builder;
+        try
+        {
+            builder.loadAsset(filepath);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "vertex_format: " << filepath << " skipped: " << e.what() << std::endl;
+            continue;
+        }
+
+        const auto& vertices = builder.vertices;
+        const auto vertexCount = static_cast<uint32_t>(vertices.size());
+        glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+        glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+        for (const auto& vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+        const glm::vec3 extent = boundsMax - boundsMin;
+        const float boundsSize = std::max({extent.x, extent.y, extent.z, 1e-6f});
+
+        std::cout << "vertex_format: " << filepath << " (" << vertexCount << " vertices)" << std::endl;
+        for (uint32_t f = 0; f < static_cast<uint32_t>(KongVertexFormat::Count); f++)
+        {
+            const auto format = static_cast<KongVertexFormat>(f);
+            const uint32_t stride = KongVertexFormats::stride(format);
+            std::vector<uint8_t> packed(static_cast<size_t>(stride) * vertexCount);
+            const double seconds = bestSeconds([&]()
+            {
+                KongModel::packVertices(vertices.data(), vertexCount, KongVertexLayout{format}, boundsMin, boundsMax, packed.data());
+            });
+
+            // 在CPU上按shader的方式解码，统计误差
+            float positionError = 0.0f, normalError = 0.0f, uvError = 0.0f;
+            if (format != KongVertexFormat::Full)
+            {
+                const glm::mat4 dequantize = KongVertexFormats::dequantizeMatrix(boundsMin, boundsMax);
+                for (uint32_t i = 0; i < vertexCount; i++)
+                {
+                    const uint8_t* data = packed.data() + static_cast<size_t>(stride) * i;
+                    glm::vec3 position;
+                    const int16_t* normal;
+                    const uint16_t* uv;
+                    if (format == KongVertexFormat::Packed)
+                    {
+                        const auto* vertex = reinterpret_cast<const KongPackedVertex*>(data);
+                        position = glm::vec3{vertex->position[0], vertex->position[1], vertex->position[2]};
+                        normal = vertex->normal;
+                        uv = vertex->uv;
+                    }
+                    else
+                    {
+                        const auto* vertex = reinterpret_cast<const KongQuantizedVertex*>(data);
+                        position = glm::vec3(dequantize * glm::vec4(glm::vec3{vertex->position[0], vertex->position[1],
+                            vertex->position[2]} / 65535.0f, 1.0f));
+                        normal = vertex->normal;
+                        uv = vertex->uv;
+                    }
+
+                    positionError = std::max(positionError, glm::length(position - vertices[i].position) / boundsSize);
+                    if (glm::length(vertices[i].normal) > 0.0f)
+                    {
+                        const glm::vec3 decoded = KongVertexFormats::octDecode(glm::vec2{
+                            glm::unpackSnorm1x16(static_cast<uint16_t>(normal[0])), glm::unpackSnorm1x16(static_cast<uint16_t>(normal[1]))});
+                        const float cosAngle = glm::clamp(glm::dot(decoded, glm::normalize(vertices[i].normal)), -1.0f, 1.0f);
+                        normalError = std::max(normalError, glm::degrees(std::acos(cosAngle)));
+                    }
+                    const glm::vec2 decodedUv{glm::unpackHalf1x16(uv[0]), glm::unpackHalf1x16(uv[1])};
+                    uvError = std::max(uvError, glm::length(decodedUv - vertices[i].uv));
+                }
+            }
+
+            std::cout << "  " << KongVertexFormats::name(format) << ": " << stride << " bytes/vertex ("
+                << KongVertexFormats::positionSize(format) << " in the position stream), "
+                << static_cast<double>(packed.size()) / (1024.0 * 1024.0) << " MB, pack " << seconds * 1000.0 << " ms";
+            if (format != KongVertexFormat::Full)
+            {
+                std::cout << ", max error: position " << positionError << ", normal " << normalError << " deg, uv " << uvError;
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+/*
+ * meshlet剔除的效果：沿固定的相机路径对每个模型做CPU剔除，统计被视锥和法线锥剔除的三角形比例
+ * 路径：orbit在包围球外环绕，close在包围球内环绕（大量meshlet在视锥外），flyby从模型旁边平移经过
+ * 参数：模型文件路径，默认使用仓库自带的模型
+ */
+void KongBenchmark::meshletCull(const std::vector<std::string>& args)
+{
+    using clock = std::chrono::high_resolution_clock;
+    constexpr int FRAME_COUNT = 64;
+    const auto& files = args.empty() ? BUNDLED_MODELS : args;
+
+    for (const auto& filepath : files)
+    {
+        KongModel::Builder builder;
+        try
+        {
+            builder.loadAsset(filepath);
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "meshlet_cull: " << filepath << " skipped: " << e.what() << std::endl;
+            continue;
+        }
+        builder.optimizeMesh();
+        builder.buildMeshlets();
+        const auto& meshlets = builder.meshlets;
+
+        glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+        glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+        for (const auto& vertex : builder.vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+        const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        const float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+        struct CameraPath
+        {
+            const char* name;
+            std::function<void(int frame, glm::vec3& eye, glm::vec3& target)> pose;
+        };
+        const std::vector<CameraPath> paths{
+            {"orbit", [&](int frame, glm::vec3& eye, glm::vec3& target)
+            {
+                const float angle = glm::two_pi<float>() * static_cast<float>(frame) / FRAME_COUNT;
+                eye = center + glm::vec3{std::cos(angle), 0.3f, std::sin(angle)} * radius * 2.5f;
+                target = center;
+            }},
+            {"close", [&](int frame, glm::vec3& eye, glm::vec3& target)
+            {
+                const float angle = glm::two_pi<float>() * static_cast<float>(frame) / FRAME_COUNT;
+                eye = center + glm::vec3{std::cos(angle), 0.1f, std::sin(angle)} * radius * 0.8f;
+                target = center;
+            }},
+            {"flyby", [&](int frame, glm::vec3& eye, glm::vec3& target)
+            {
+                const float t = static_cast<float>(frame) / (FRAME_COUNT - 1) * 2.0f - 1.0f;
+                eye = center + glm::vec3{t * radius * 3.0f, 0.0f, -radius * 1.5f};
+                target = eye + glm::vec3{1.0f, 0.0f, 0.5f};
+            }},
+        };
+
+        std::cout << "meshlet_cull: " << filepath << " (" << meshlets.meshlets.size() << " meshlets, "
+            << meshlets.triangles.size() / 3 << " triangles)" << std::endl;
+        std::vector<uint32_t> visibleIndices;
+        for (const auto& path : paths)
+        {
+            KongMeshletCullStats total{};
+            double seconds = 0.0;
+            for (int frame = 0; frame < FRAME_COUNT; frame++)
+            {
+                glm::vec3 eye, target;
+                path.pose(frame, eye, target);
+                KongCamera camera{};
+                camera.SetPerspectiveProjection(glm::radians(50.0f), 4.0f / 3.0f, radius * 0.01f, radius * 10.0f);
+                camera.SetViewTarget(eye, target);
+                const glm::mat4 viewProjection = camera.GetProjectionMatrix() * camera.GetViewMatrix();
+
+                auto startTime = clock::now();
+                total += KongMeshletCuller::cull(meshlets, viewProjection, eye, &visibleIndices);
+                seconds += std::chrono::duration<double>(clock::now() - startTime).count();
+            }
+
+            std::cout << "  " << path.name << ": " << total.culledRatio() * 100.0f << "% triangles culled"
+                << " (frustum " << static_cast<float>(total.frustumCulled) / total.meshletCount * 100.0f << "% of meshlets"
+                << ", backface " << static_cast<float>(total.backfaceCulled) / total.meshletCount * 100.0f << "% of meshlets)"
+                << ", " << seconds * 1000.0 / FRAME_COUNT << " ms/frame" << std::endl;
+        }
+    }
+}
+
+/*
+ * 贴图解码：逐张统计单线程的解码时间，再把所有贴图丢进线程池，和串行的总时间比较
+ * 参数：贴图文件路径，默认使用仓库中所有模型的png/tga
+ */
+void KongBenchmark::textureDecode(const std::vector<std::string>& args)
+{
+    const std::vector<std::string> filepaths = texturePaths(args);
+
+    using clock = std::chrono::high_resolution_clock;
+    double serialSeconds = 0.0;
+    uint64_t pixelCount = 0;
+    for (const auto& filepath : filepaths)
+    {
+        KongImageData image;
+        const auto startTime = clock::now();
+        if (!KongImageData::decodeFile(filepath, image))
+        {
+            std::cout << "  " << filepath << ": failed to decode" << std::endl;
+            continue;
+        }
+        const double seconds = std::chrono::duration<double>(clock::now() - startTime).count();
+        serialSeconds += seconds;
+        pixelCount += static_cast<uint64_t>(image.width) * image.height;
+        std::cout << "  " << filepath << ": " << image.width << "x" << image.height << ", "
+            << seconds * 1000.0 << " ms" << std::endl;
+    }
+
+    const auto startTime = clock::now();
+    std::vector<std::future<bool>> futures;
+    for (const auto& filepath : filepaths)
+    {
+        futures.push_back(KongThreadPool::global().submit([filepath]()
+        {
+            KongImageData image;
+            return KongImageData::decodeFile(filepath, image);
+        }));
+    }
+    for (auto& future : futures)
+    {
+        future.get();
+    }
+    const double parallelSeconds = std::chrono::duration<double>(clock::now() - startTime).count();
+
+    std::cout << "texture_decode: " << filepaths.size() << " textures, " << pixelCount / 1000000.0 << " MPixels, serial "
+        << serialSeconds * 1000.0 << " ms, " << KongThreadPool::global().threadCount() << " threads "
+        << parallelSeconds * 1000.0 << " ms (" << serialSeconds / parallelSeconds << "x)" << std::endl;
+}
+
+/*
+ * BC压缩的质量和速度：按kv_assetc的规则给每张贴图选择格式，颜色贴图同时测试BC7和BC1
+ * 输出mip0的PSNR、单线程和多线程的编码吞吐量，以及完整mip链相对RGBA8的显存占用
+ * 参数：贴图文件路径，默认使用仓库中所有模型的png/tga
+ */
+void KongBenchmark::textureCompress(const std::vector<std::string>& args)
+{
+    const std::vector<std::string> filepaths = texturePaths(args);
+    const uint32_t maxThreads = KongThreadPool::global().threadCount();
+    uint64_t rgbaBytes = 0, compressedBytes = 0;
+    for (const auto& filepath : filepaths)
+    {
+        KongImageData image;
+        if (!KongImageData::decodeFile(filepath, image))
+        {
+            std::cout << "  " << filepath << ": failed to decode" << std::endl;
+            continue;
+        }
+
+        const KongTextureEncodeSettings settings = KongTextureCompressor::settingsForFile(filepath, image);
+        std::vector<KongTextureFormat> formats{settings.format};
+        if (settings.srgb)
+        {
+            formats.push_back(KongTextureCompressor::settingsForFile(filepath, image, KongTextureFormat::BC1).format);
+        }
+
+        const double megapixels = static_cast<double>(image.width) * image.height / 1000000.0;
+        std::cout << "  " << filepath << " (" << image.width << "x" << image.height << ")" << std::endl;
+        for (KongTextureFormat format : formats)
+        {
+            std::vector<uint8_t> data;
+            const double singleSeconds = bestSeconds([&]() { data = KongTextureCompressor::encode(image, format, 1); });
+            const double parallelSeconds = maxThreads > 1
+                ? bestSeconds([&]() { data = KongTextureCompressor::encode(image, format, maxThreads); })
+                : singleSeconds;
+            const KongImageData decoded = KongTextureCompressor::decode(data.data(), format, image.width, image.height);
+            std::cout << "    " << KongTextureFormats::name(format) << ": PSNR "
+                << KongTextureCompressor::psnr(image, decoded, KongTextureFormats::channelCount(format)) << " dB, 1 thread "
+                << megapixels / singleSeconds << " MPix/s, " << maxThreads << " threads " << megapixels / parallelSeconds << " MPix/s" << std::endl;
+        }
+
+        // 显存按kv_assetc默认选择的格式统计
+        const uint32_t mipCount = KongTextureFormats::mipCount(image.width, image.height);
+        for (uint32_t mip = 0; mip < mipCount; mip++)
+        {
+            const uint32_t width = std::max(image.width >> mip, 1u);
+            const uint32_t height = std::max(image.height >> mip, 1u);
+            rgbaBytes += KongTextureFormats::imageBytes(KongTextureFormat::RGBA8, width, height);
+            compressedBytes += KongTextureFormats::imageBytes(settings.format, width, height);
+        }
+    }
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << "texture_compress: " << filepaths.size() << " textures, VRAM with mips " << rgbaBytes / megabyte
+        << " MB as RGBA8 -> " << compressedBytes / megabyte << " MB ("
+        << static_cast<double>(rgbaBytes) / static_cast<double>(std::max<uint64_t>(compressedBytes, 1)) << "x smaller)" << std::endl;
+}
+
+/*
+ * 设备内存子分配的压力测试：模拟场景流式加载卸载时大小、对齐各不相同的buffer/image反复申请释放
+ * 和KongMemoryAllocator一样按64MB分块、每块用TLSF分配，统计每次操作的耗时、需要的块数和碎片
+ * 参数：操作次数，默认1000000
+ */
+void KongBenchmark::memoryAllocator(const std::vector<std::string>& args)
+{
+    const uint64_t operationCount = args.empty() ? 1000000 : std::stoull(args[0]);
+    constexpr uint64_t BLOCK_SIZE = KongMemoryAllocator::DEFAULT_BLOCK_SIZE;
+    // 常驻资源数量在这个值附近波动，超过了多数驱动maxMemoryAllocationCount的4096
+    constexpr uint64_t TARGET_LIVE = 6000;
+
+    // 先生成操作序列，计时只包括分配器本身
+    struct Operation
+    {
+        bool allocate;
+        uint64_t size;
+        uint64_t alignment;
+        uint64_t pick;
+    };
+    std::vector<Operation> operations(operationCount);
+    {
+        std::mt19937_64 random(42);
+        // 大小按对数均匀分布在256B到4MB之间，小的uniform/顶点buffer多，大的贴图少
+        std::uniform_real_distribution<double> logSize(8.0, 22.0);
+        const uint64_t alignments[] = {16, 256, 4096, 65536};
+        uint64_t liveCount = 0;
+        for (auto& operation : operations)
+        {
+            // 资源越多释放的概率越大，数量稳定在TARGET_LIVE附近
+            operation.allocate = liveCount == 0 || random() % (liveCount + TARGET_LIVE) < TARGET_LIVE;
+            operation.size = static_cast<uint64_t>(std::exp2(logSize(random)));
+            operation.alignment = alignments[random() % 4];
+            operation.pick = random();
+            operation.allocate ? liveCount++ : liveCount--;
+        }
+    }
+
+    struct Live
+    {
+        KongTlsfAllocator* block;
+        uint64_t offset;
+    };
+    std::vector<std::unique_ptr<KongTlsfAllocator>> blocks;
+    std::vector<Live> live;
+    uint64_t allocateCount = 0, blockAllocations = 0;
+    size_t peakLive = 0, peakBlocks = 0;
+
+    using clock = std::chrono::high_resolution_clock;
+    const auto startTime = clock::now();
+    for (const auto& operation : operations)
+    {
+        if (operation.allocate)
+        {
+            Live allocation{nullptr, 0};
+            for (auto& block : blocks)
+            {
+                if (block->allocate(operation.size, operation.alignment, allocation.offset))
+                {
+                    allocation.block = block.get();
+                    break;
+                }
+            }
+            if (!allocation.block)
+            {
+                blocks.push_back(std::make_unique<KongTlsfAllocator>(BLOCK_SIZE));
+                blocks.back()->allocate(operation.size, operation.alignment, allocation.offset);
+                allocation.block = blocks.back().get();
+                blockAllocations++;
+            }
+            live.push_back(allocation);
+            allocateCount++;
+            peakLive = std::max(peakLive, live.size());
+            peakBlocks = std::max(peakBlocks, blocks.size());
+            continue;
+        }
+
+        const size_t index = operation.pick % live.size();
+        KongTlsfAllocator* block = live[index].block;
+        block->free(live[index].offset);
+        live[index] = live.back();
+        live.pop_back();
+        // 和KongMemoryAllocator一样只保留一个空块
+        if (block->empty())
+        {
+            const bool hasOtherEmptyBlock = std::any_of(blocks.begin(), blocks.end(), [block](const std::unique_ptr<KongTlsfAllocator>& b)
+            {
+                return b.get() != block && b->empty();
+            });
+            if (hasOtherEmptyBlock)
+            {
+                blocks.erase(std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<KongTlsfAllocator>& b) { return b.get() == block; }));
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(clock::now() - startTime).count();
+
+    uint64_t usedBytes = 0, freeBytes = 0, scatteredBytes = 0, freeRegions = 0;
+    for (const auto& block : blocks)
+    {
+        usedBytes += block->usedBytes();
+        freeBytes += block->freeBytes();
+        scatteredBytes += block->freeBytes() - block->largestFreeRegion();
+        freeRegions += block->freeRegionCount();
+    }
+    const double megabyte = 1024.0 * 1024.0;
+    const uint64_t reservedBytes = blocks.size() * BLOCK_SIZE;
+    std::cout << "memory_allocator: " << operationCount << " operations (" << allocateCount << " allocations), "
+        << seconds * 1e9 / static_cast<double>(std::max<uint64_t>(operationCount, 1)) << " ns per operation" << std::endl;
+    std::cout << "  vkAllocateMemory: " << allocateCount << " calls and up to " << peakLive << " live allocations per resource -> "
+        << blockAllocations << " calls and up to " << peakBlocks << " live " << BLOCK_SIZE / (1 << 20) << " MB blocks" << std::endl;
+    std::cout << "  final: " << live.size() << " resources, " << usedBytes / megabyte << " MB used / " << reservedBytes / megabyte
+        << " MB reserved (" << (reservedBytes - usedBytes) / megabyte << " MB wasted), " << freeRegions << " free regions, fragmentation "
+        << (freeBytes > 0 ? static_cast<double>(scatteredBytes) / static_cast<double>(freeBytes) : 0.0) << std::endl;
+}
+
+/*
+ * 上传吞吐量：每次上传新建staging buffer并等待拷贝完成，和通过staging ring上传最后只等待一次对比
+ * 分别测试大量小块上传和少量超过ring大小、需要分块的大块上传
+ * 需要真正的Vulkan设备，会打开一个小窗口
+ * 参数：小块上传的次数，默认16384次4KB
+ */
+void KongBenchmark::stagingUpload(const std::vector<std::string>& args)
+{
+    const uint32_t smallCount = args.empty() ? 16384 : static_cast<uint32_t>(std::stoul(args[0]));
+    constexpr VkDeviceSize SMALL_SIZE = 4 << 10;
+    constexpr VkDeviceSize LARGE_SIZE = 48ull << 20;
+    constexpr uint32_t LARGE_COUNT = 8;
+
+    KongWindow window{320, 240, "staging_upload"};
+    KongDevice device{window};
+    KongStagingRing& stagingRing = device.stagingRing();
+    KongBuffer target{device, LARGE_SIZE, 1, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    const std::vector<uint8_t> data(LARGE_SIZE, 0x5a);
+
+    const auto report = [](const char* name, uint32_t count, VkDeviceSize size, double seconds)
+    {
+        const double megabytes = static_cast<double>(size) * count / (1024.0 * 1024.0);
+        std::cout << "  " << name << ": " << megabytes / seconds << " MB/s, "
+            << seconds * 1e6 / count << " us per upload" << std::endl;
+    };
+
+    const auto perUploadStaging = [&](uint32_t count, VkDeviceSize size)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            KongBuffer staging{device, size, 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+            staging.map();
+            std::memcpy(staging.getMappedMemory(), data.data(), static_cast<size_t>(size));
+            device.copyBuffer(staging.getBuffer(), target.getBuffer(), size);
+        }
+    };
+    const auto ringUpload = [&](uint32_t count, VkDeviceSize size)
+    {
+        uint64_t ticket = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // 小块依次写到target的不同位置，模拟很多模型各自上传自己的数据
+            const VkDeviceSize dstOffset = (static_cast<VkDeviceSize>(i) * size) % (LARGE_SIZE - size + 1);
+            ticket = stagingRing.uploadBuffer(target.getBuffer(), dstOffset, data.data(), size);
+        }
+        stagingRing.wait(ticket);
+    };
+
+    const KongStagingRingStats startStats = stagingRing.stats();
+    std::cout << "staging_upload: " << stagingRing.size() / (1 << 20) << " MB ring, chunks up to "
+        << stagingRing.maxUploadSize() / (1 << 20) << " MB" << std::endl;
+    std::cout << " " << smallCount << " x " << SMALL_SIZE / 1024 << " KB" << std::endl;
+    report("staging buffer per upload", smallCount, SMALL_SIZE, bestSeconds([&]() { perUploadStaging(smallCount, SMALL_SIZE); }));
+    report("staging ring", smallCount, SMALL_SIZE, bestSeconds([&]() { ringUpload(smallCount, SMALL_SIZE); }));
+    std::cout << " " << LARGE_COUNT << " x " << LARGE_SIZE / (1 << 20) << " MB" << std::endl;
+    report("staging buffer per upload", LARGE_COUNT, LARGE_SIZE, bestSeconds([&]() { perUploadStaging(LARGE_COUNT, LARGE_SIZE); }));
+    report("staging ring", LARGE_COUNT, LARGE_SIZE, bestSeconds([&]() { ringUpload(LARGE_COUNT, LARGE_SIZE); }));
+
+    const KongStagingRingStats stats = stagingRing.stats();
+    std::cout << "  ring: " << stats.uploadCount - startStats.uploadCount << " copies in "
+        << stats.submitCount - startStats.submitCount << " submits, " << stats.stallCount - startStats.stallCount
+        << " stalls waiting for the GPU" << std::endl;
+}
+
+/*
+ * 一次性命令的提交次数：加载很多小mesh时每次拷贝单独提交、等待，和录进一个upload batch只提交等待一次对比
+ * staging ring的结果作为参考，它也把所有拷贝合并成少数几次提交
+ * 需要真正的Vulkan设备，会打开一个小窗口
+ * 参数：mesh的个数，默认1000个立方体
+ */
+void KongBenchmark::uploadBatch(const std::vector<std::string>& args)
+{
+    const uint32_t meshCount = args.empty() ? 1000 : static_cast<uint32_t>(std::stoul(args[0]));
+    constexpr uint32_t VERTEX_COUNT = 24;
+    constexpr uint32_t INDEX_COUNT = 36;
+    constexpr VkDeviceSize VERTEX_BYTES = sizeof(KongModel::Vertex) * VERTEX_COUNT;
+    constexpr VkDeviceSize INDEX_BYTES = sizeof(uint32_t) * INDEX_COUNT;
+    constexpr VkDeviceSize MESH_BYTES = VERTEX_BYTES + INDEX_BYTES;
+
+    KongWindow window{320, 240, "upload_batch"};
+    KongDevice device{window};
+    KongStagingRing& stagingRing = device.stagingRing();
+
+    // 所有mesh的数据事先写进一个staging buffer，只比较提交和等待的开销
+    std::vector<uint8_t> data(static_cast<size_t>(MESH_BYTES * meshCount));
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 31);
+    }
+    KongBuffer staging{device, data.size(), 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+    staging.map();
+    std::memcpy(staging.getMappedMemory(), data.data(), data.size());
+
+    // 每个mesh各自的vertex/index buffer，和不使用geometry pool时加载模型一样
+    std::vector<std::unique_ptr<KongBuffer>> vertexBuffers;
+    std::vector<std::unique_ptr<KongBuffer>> indexBuffers;
+    for (uint32_t i = 0; i < meshCount; i++)
+    {
+        vertexBuffers.push_back(std::make_unique<KongBuffer>(device, VERTEX_BYTES, 1,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+        indexBuffers.push_back(std::make_unique<KongBuffer>(device, INDEX_BYTES, 1,
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+    }
+
+    const auto perCopy = [&]()
+    {
+        for (uint32_t i = 0; i < meshCount; i++)
+        {
+            VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
+            device.recordCopyBuffer(commandBuffer, staging.getBuffer(), vertexBuffers[i]->getBuffer(), VERTEX_BYTES, MESH_BYTES * i);
+            device.endSingleTimeCommands(commandBuffer);
+            commandBuffer = device.beginSingleTimeCommands();
+            device.recordCopyBuffer(commandBuffer, staging.getBuffer(), indexBuffers[i]->getBuffer(), INDEX_BYTES, MESH_BYTES * i + VERTEX_BYTES);
+            device.endSingleTimeCommands(commandBuffer);
+        }
+    };
+    const auto batched = [&]()
+    {
+        VkCommandBuffer commandBuffer = device.beginUploadBatch();
+        for (uint32_t i = 0; i < meshCount; i++)
+        {
+            device.recordCopyBuffer(commandBuffer, staging.getBuffer(), vertexBuffers[i]->getBuffer(), VERTEX_BYTES, MESH_BYTES * i);
+            device.recordCopyBuffer(commandBuffer, staging.getBuffer(), indexBuffers[i]->getBuffer(), INDEX_BYTES, MESH_BYTES * i + VERTEX_BYTES);
+        }
+        device.endUploadBatch(commandBuffer);
+    };
+    const auto ring = [&]()
+    {
+        uint64_t ticket = 0;
+        for (uint32_t i = 0; i < meshCount; i++)
+        {
+            stagingRing.uploadBuffer(vertexBuffers[i]->getBuffer(), 0, data.data() + MESH_BYTES * i, VERTEX_BYTES);
+            ticket = stagingRing.uploadBuffer(indexBuffers[i]->getBuffer(), 0, data.data() + MESH_BYTES * i + VERTEX_BYTES, INDEX_BYTES);
+        }
+        stagingRing.wait(ticket);
+    };
+
+    std::cout << "upload_batch: " << meshCount << " meshes, " << 2 * meshCount << " copies of "
+        << VERTEX_BYTES << " + " << INDEX_BYTES << " bytes" << std::endl;
+    const auto measure = [&](const char* name, const std::function<void()>& func)
+    {
+        // 先单独执行一次统计提交次数，之后的计时不受统计的影响
+        const KongOneShotStats startStats = device.oneShotStats();
+        const KongStagingRingStats startRingStats = stagingRing.stats();
+        func();
+        const KongOneShotStats stats = device.oneShotStats();
+        const KongStagingRingStats ringStats = stagingRing.stats();
+        const uint64_t submits = stats.submitCount - startStats.submitCount + ringStats.submitCount - startRingStats.submitCount;
+        const double seconds = bestSeconds(func);
+        std::cout << "  " << name << ": " << seconds * 1e3 << " ms, " << submits << " submits, "
+            << seconds * 1e6 / meshCount << " us per mesh" << std::endl;
+    };
+    measure("submit per copy", perCopy);
+    measure("upload batch", batched);
+    measure("staging ring", ring);
+
+    const KongOneShotStats stats = device.oneShotStats();
+    std::cout << "  one-shot: " << stats.commandCount << " commands in " << stats.submitCount << " submits, "
+        << stats.commandBufferAllocations << " command buffers allocated" << std::endl;
+}
+
+/*
+ * 大量物体时录制命令的CPU开销：每个物体一次draw和同一个模型的物体合并成一次instanced draw对比
+ * 计时只包括SimpleRenderSystem::renderGameObjects（分组、写实例数据和录制），不包括等待GPU和present
+ * 需要真正的Vulkan设备，会打开一个小窗口
+ * 参数：物体的个数，默认100000个，分布在8种立方体上
+ */
+void KongBenchmark::instancing(const std::vector<std::string>& args)
+{
+    const uint32_t objectCount = args.empty() ? 100000 : static_cast<uint32_t>(std::stoul(args[0]));
+    constexpr uint32_t MODEL_COUNT = 8;
+    constexpr int FRAME_COUNT = 200;
+
+    KongWindow window{320, 240, "instancing"};
+    KongDevice device{window};
+    KongRenderer renderer{window, device};
+    KongSamplerCache samplerCache{device};
+    // 每个实例144字节，留出GlobalUbo和对齐的空间
+    KongFrameAllocator frameAllocator{device, KongSwapChain::MAX_FRAMES_IN_FLIGHT,
+        std::max<VkDeviceSize>(KongFrameAllocator::DEFAULT_CAPACITY,
+            sizeof(KongInstanceData) * (objectCount + 1) + (1ull << 20))};
+
+    auto globalSetLayout = KongDescriptorSetLayout::Builder(device)
+        .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+        .build();
+    auto globalPool = KongDescriptorPool::Builder(device)
+        .setMaxSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .build();
+    std::vector<VkDescriptorSet> globalSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < globalSets.size(); i++)
+    {
+        auto bufferInfo = frameAllocator.descriptorInfo(static_cast<int>(i), sizeof(BenchmarkUbo));
+        KongDescriptorWriter(*globalSetLayout, *globalPool)
+            .writeBuffer(0, &bufferInfo)
+            .build(globalSets[i]);
+    }
+    SimpleRenderSystem renderSystem{device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(), samplerCache};
+
+    std::vector<std::shared_ptr<KongModel>> models;
+    for (uint32_t i = 0; i < MODEL_COUNT; i++)
+    {
+        const float t = static_cast<float>(i) / MODEL_COUNT;
+        models.push_back(std::make_shared<KongModel>(device, cubeBuilder(0.3f + 0.05f * i, glm::vec3(1.0f - t, 0.5f, t))));
+    }
+    // 正方形阵列，相邻的物体使用不同的模型
+    const auto gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objectCount))));
+    std::vector<KongGameObject> gameObjects;
+    gameObjects.reserve(objectCount);
+    for (uint32_t i = 0; i < objectCount; i++)
+    {
+        auto object = KongGameObject::CreateGameObject();
+        object.model = models[i % MODEL_COUNT];
+        object.transform.translation = {static_cast<float>(i % gridSize) - gridSize * 0.5f, 0.0f, static_cast<float>(i / gridSize) + 1.0f};
+        gameObjects.push_back(std::move(object));
+    }
+
+    KongCamera camera{};
+    camera.SetViewTarget(glm::vec3(0.0f, -20.0f, -10.0f), glm::vec3(0.0f, 0.0f, gridSize * 0.5f));
+    camera.SetPerspectiveProjection(glm::radians(50.0f), renderer.getAspectRatio(), 0.1f, gridSize * 2.0f);
+
+    std::cout << "instancing: " << objectCount << " objects, " << MODEL_COUNT << " models, " << FRAME_COUNT << " frames" << std::endl;
+    for (bool instanced : {false, true})
+    {
+        renderSystem.setInstancing(instanced);
+        using clock = std::chrono::high_resolution_clock;
+        double recordSeconds = 0.0;
+        double maxRecordSeconds = 0.0;
+        int recordedFrames = 0;
+        const auto startTime = clock::now();
+        for (int frame = 0; frame < FRAME_COUNT; frame++)
+        {
+            glfwPollEvents();
+            VkCommandBuffer commandBuffer = renderer.beginFrame();
+            if (!commandBuffer)
+            {
+                continue;
+            }
+            const int frameIndex = renderer.getFrameIndex();
+            frameAllocator.beginFrame(frameIndex);
+            BenchmarkUbo ubo{};
+            ubo.projectionView = camera.GetProjectionMatrix() * camera.GetViewMatrix();
+            const KongFrameAllocation uboAllocation = frameAllocator.pushUniform(ubo);
+            FrameInfo frameInfo{frameIndex, 0.0f, commandBuffer, camera, globalSets[frameIndex], uboAllocation.offset,
+                frameAllocator, renderer.getSwapChainExtent()};
+
+            renderer.beginSwapChainRenderPass(commandBuffer);
+            const auto recordStart = clock::now();
+            renderSystem.renderGameObjects(frameInfo, gameObjects);
+            const double seconds = std::chrono::duration<double>(clock::now() - recordStart).count();
+            renderer.endSwapChainRenderPass(commandBuffer);
+            renderer.endFrame();
+
+            recordSeconds += seconds;
+            maxRecordSeconds = std::max(maxRecordSeconds, seconds);
+            recordedFrames++;
+        }
+        vkDeviceWaitIdle(device.device());
+        const double totalSeconds = std::chrono::duration<double>(clock::now() - startTime).count();
+
+        const auto& drawStats = renderSystem.getDrawStats();
+        const int frames = std::max(recordedFrames, 1);
+        std::cout << "  " << (instanced ? "instanced" : "draw per object") << ": record " << recordSeconds * 1e3 / frames
+            << " ms per frame (max " << maxRecordSeconds * 1e3 << " ms), frame " << totalSeconds * 1e3 / frames << " ms, "
+            << drawStats.drawCalls << " draw calls for " << drawStats.drawnObjects << " objects" << std::endl;
+    }
+}
+
+void KongBenchmark::gpuCull(const std::vector<std::string>& args)
+{
+    const uint32_t instanceCount = args.empty() ? 100000 : static_cast<uint32_t>(std::stoul(args[0]));
+    constexpr uint32_t MESH_COUNT = 16;
+    constexpr uint32_t BATCH_COUNT = 4;
+    constexpr uint32_t LOD_COUNT = 3;
+    constexpr int FRAME_COUNT = 200;
+    // 包围球半径放大和缩小这个比例，只在其中一边可见或者换了LOD的实例算作边界情况
+    constexpr float BORDERLINE_SCALE = 1e-4f;
+
+    KongWindow window{320, 240, "gpu cull"};
+    KongDevice device{window};
+    if (!KongGpuCuller::isSupported(device))
+    {
+        std::cout << "gpu_cull: the device does not support multiDrawIndirect" << std::endl;
+        return;
+    }
+    KongRenderer renderer{window, device};
+    KongSamplerCache samplerCache{device};
+    // 剔除的输入和渲染系统的实例数据都从frame allocator分配
+    KongFrameAllocator frameAllocator{device, KongSwapChain::MAX_FRAMES_IN_FLIGHT,
+        std::max<VkDeviceSize>(KongFrameAllocator::DEFAULT_CAPACITY,
+            (sizeof(KongInstanceData) + sizeof(uint32_t)) * (instanceCount + 1) + (4ull << 20))};
+    KongGpuCuller culler{device, KongSwapChain::MAX_FRAMES_IN_FLIGHT};
+
+    // 随机场景：每个mesh有3级LOD，每级1到3个draw range，mesh轮流分到各个batch
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<KongGpuCullMesh> meshes(MESH_COUNT);
+    std::vector<KongGpuCullLod> lods;
+    std::vector<KongGpuDrawTemplate> templates;
+    std::vector<glm::mat4> positionTransforms(MESH_COUNT);
+    std::vector<uint32_t> maxTemplates(MESH_COUNT, 0);
+    for (uint32_t m = 0; m < MESH_COUNT; m++)
+    {
+        // 一半的mesh模拟量化的position
+        positionTransforms[m] = m % 2 == 0 ? glm::mat4{1.0f}
+            : glm::translate(glm::mat4{1.0f}, glm::vec3(-1.0f)) * glm::scale(glm::mat4{1.0f}, glm::vec3(2.0f / 65535.0f));
+        meshes[m].inversePositionTransform = glm::inverse(positionTransforms[m]);
+        meshes[m].boundingSphere = glm::vec4(0.1f * unit(rng), 0.0f, 0.0f, 0.5f + unit(rng));
+        meshes[m].firstLod = static_cast<uint32_t>(lods.size());
+        meshes[m].lodCount = LOD_COUNT;
+        meshes[m].batch = m % BATCH_COUNT;
+        for (uint32_t l = 0; l < LOD_COUNT; l++)
+        {
+            const uint32_t rangeCount = 1 + (m + l) % 3;
+            lods.push_back({static_cast<uint32_t>(templates.size()), rangeCount, l * 0.01f, 0});
+            maxTemplates[m] = std::max(maxTemplates[m], rangeCount);
+            for (uint32_t r = 0; r < rangeCount; r++)
+            {
+                // firstIndex在所有模板中唯一，用来识别命令画的是哪个range
+                const auto index = static_cast<uint32_t>(templates.size());
+                templates.push_back({36, index * 36, static_cast<int32_t>(m * 24), 0});
+            }
+        }
+    }
+    std::vector<KongInstanceData> instances(instanceCount);
+    std::vector<uint32_t> instanceMeshes(instanceCount);
+    std::vector<uint32_t> batchCapacities(BATCH_COUNT, 0);
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        instanceMeshes[i] = static_cast<uint32_t>(rng() % MESH_COUNT);
+        batchCapacities[meshes[instanceMeshes[i]].batch] += maxTemplates[instanceMeshes[i]];
+        const glm::mat4 world = glm::translate(glm::mat4{1.0f}, glm::vec3(position(rng), position(rng), position(rng)))
+            * glm::rotate(glm::mat4{1.0f}, unit(rng) * glm::two_pi<float>(), glm::normalize(glm::vec3(unit(rng), 1.0f, unit(rng))))
+            * glm::scale(glm::mat4{1.0f}, glm::vec3(0.5f + 1.5f * unit(rng), 0.5f + unit(rng), 1.0f));
+        instances[i].modelMatrix = world * positionTransforms[instanceMeshes[i]];
+    }
+    std::vector<uint32_t> batchFirstCommands(BATCH_COUNT, 0);
+    uint32_t commandCount = 0;
+    for (uint32_t b = 0; b < BATCH_COUNT; b++)
+    {
+        batchFirstCommands[b] = commandCount;
+        commandCount += batchCapacities[b];
+    }
+    for (auto& mesh : meshes)
+    {
+        mesh.firstCommand = batchFirstCommands[mesh.batch];
+    }
+
+    KongCamera camera{};
+    camera.SetViewTarget(glm::vec3(0.0f, 0.0f, -120.0f), glm::vec3(10.0f, 5.0f, 0.0f));
+    camera.SetPerspectiveProjection(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 180.0f);
+    KongGpuCullParams params{};
+    params.setCamera(camera.GetProjectionMatrix(), camera.GetViewMatrix());
+    params.projectionScale = std::abs(camera.GetProjectionMatrix()[1][1]) * 0.5f;
+    params.maxScreenError = 0.002f;
+    params.instanceCount = instanceCount;
+    params.batchCount = BATCH_COUNT;
+    params.commandCount = commandCount;
+
+    // 不经过交换链，直接用一个单次提交的command buffer录制剔除
+    frameAllocator.beginFrame(0);
+    auto upload = [&](const auto& source, uint32_t& firstElement)
+    {
+        using Element = typename std::decay_t<decltype(source)>::value_type;
+        KongFrameAllocation allocation = frameAllocator.allocateElements(sizeof(Element), static_cast<uint32_t>(source.size()), firstElement);
+        if (!allocation)
+        {
+            throw std::runtime_error("frame allocator has no room for the cull input!");
+        }
+        std::memcpy(allocation.data, source.data(), sizeof(Element) * source.size());
+    };
+    upload(instances, params.instanceBase);
+    upload(instanceMeshes, params.instanceMeshBase);
+    upload(meshes, params.meshBase);
+    upload(lods, params.lodBase);
+    upload(templates, params.templateBase);
+    uint32_t paramsIndex = 0;
+    upload(std::vector<KongGpuCullParams>{params}, paramsIndex);
+
+    using clock = std::chrono::high_resolution_clock;
+    VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
+    FrameInfo frameInfo{0, 0.0f, commandBuffer, camera, VK_NULL_HANDLE, 0, frameAllocator, {1280, 720}};
+    const auto gpuStart = clock::now();
+    culler.cull(frameInfo, params, paramsIndex);
+    device.endSingleTimeCommands(commandBuffer);
+    const double gpuSeconds = std::chrono::duration<double>(clock::now() - gpuStart).count();
+    std::vector<uint32_t> gpuCounts;
+    std::vector<VkDrawIndexedIndirectCommand> gpuCommands;
+    culler.readBack(0, BATCH_COUNT, commandCount, gpuCounts, gpuCommands);
+
+    // CPU参考实现，实例的位置是相对于输入数组的
+    KongGpuCullParams referenceParams = params;
+    referenceParams.instanceBase = 0;
+    const KongGpuCullInput input{instances.data(), instanceMeshes.data(), meshes.data(), lods.data(), templates.data()};
+    std::vector<uint32_t> referenceCounts;
+    std::vector<VkDrawIndexedIndirectCommand> referenceCommands;
+    const auto cpuStart = clock::now();
+    KongGpuCuller::cullReference(referenceParams, input, referenceCounts, referenceCommands);
+    const double cpuSeconds = std::chrono::duration<double>(clock::now() - cpuStart).count();
+    for (auto& command : referenceCommands)
+    {
+        command.firstInstance += params.instanceBase;
+    }
+
+    auto referenceWithRadius = [&](float radiusScale)
+    {
+        std::vector<KongGpuCullMesh> scaled = meshes;
+        for (auto& mesh : scaled)
+        {
+            mesh.boundingSphere.w *= radiusScale;
+        }
+        KongGpuCullInput scaledInput = input;
+        scaledInput.meshes = scaled.data();
+        std::vector<uint32_t> counts;
+        std::vector<VkDrawIndexedIndirectCommand> commands;
+        KongGpuCuller::cullReference(referenceParams, scaledInput, counts, commands);
+        for (auto& command : commands)
+        {
+            command.firstInstance += params.instanceBase;
+        }
+        return collectCommands(params, meshes, counts, commands);
+    };
+    const auto gpuBatches = collectCommands(params, meshes, gpuCounts, gpuCommands);
+    const auto referenceBatches = collectCommands(params, meshes, referenceCounts, referenceCommands);
+    const auto looseBatches = referenceWithRadius(1.0f + BORDERLINE_SCALE);
+    const auto tightBatches = referenceWithRadius(1.0f - BORDERLINE_SCALE);
+    uint64_t visibleCommands = 0;
+    uint64_t borderline = 0;
+    uint64_t mismatches = 0;
+    for (uint32_t b = 0; b < BATCH_COUNT; b++)
+    {
+        visibleCommands += gpuCounts[b];
+        // 计数和区间中不重复的命令数不一致说明原子计数或者写入的位置有问题
+        if (gpuBatches[b].size() != gpuCounts[b])
+        {
+            mismatches += gpuCounts[b] - std::min<uint64_t>(gpuCounts[b], gpuBatches[b].size());
+        }
+        std::vector<uint64_t> difference;
+        std::set_symmetric_difference(gpuBatches[b].begin(), gpuBatches[b].end(),
+            referenceBatches[b].begin(), referenceBatches[b].end(), std::back_inserter(difference));
+        for (uint64_t command : difference)
+        {
+            if (looseBatches[b].count(command) != tightBatches[b].count(command))
+            {
+                borderline++;
+            }
+            else
+            {
+                mismatches++;
+            }
+        }
+    }
+    std::cout << "gpu_cull: " << instanceCount << " instances, " << MESH_COUNT << " meshes in " << BATCH_COUNT << " batches, "
+        << visibleCommands << " visible draws" << std::endl;
+    std::cout << "  gpu: " << gpuSeconds * 1e3 << " ms including submit, cpu reference: " << cpuSeconds * 1e3 << " ms ("
+        << instanceCount / std::max(cpuSeconds * 1e3, 1e-9) << " instances per ms)" << std::endl;
+    std::cout << "  " << (mismatches == 0 ? "match" : "MISMATCH") << ": " << mismatches << " differing draws, "
+        << borderline << " borderline" << std::endl;
+
+    // 渲染系统中CPU instancing和GPU剔除的录制时间
+    auto globalSetLayout = KongDescriptorSetLayout::Builder(device)
+        .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+        .build();
+    auto globalPool = KongDescriptorPool::Builder(device)
+        .setMaxSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .build();
+    std::vector<VkDescriptorSet> globalSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < globalSets.size(); i++)
+    {
+        auto bufferInfo = frameAllocator.descriptorInfo(static_cast<int>(i), sizeof(BenchmarkUbo));
+        KongDescriptorWriter(*globalSetLayout, *globalPool)
+            .writeBuffer(0, &bufferInfo)
+            .build(globalSets[i]);
+    }
+    SimpleRenderSystem renderSystem{device, renderer.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(), samplerCache};
+    std::vector<std::shared_ptr<KongModel>> models;
+    for (uint32_t m = 0; m < MESH_COUNT; m++)
+    {
+        const float t = static_cast<float>(m) / MESH_COUNT;
+        models.push_back(std::make_shared<KongModel>(device, cubeBuilder(0.3f + 0.05f * m, glm::vec3(1.0f - t, 0.5f, t))));
+    }
+    std::vector<KongGameObject> gameObjects;
+    gameObjects.reserve(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        auto object = KongGameObject::CreateGameObject();
+        object.model = models[instanceMeshes[i]];
+        object.transform.translation = glm::vec3(instances[i].modelMatrix[3]);
+        gameObjects.push_back(std::move(object));
+    }
+    camera.SetPerspectiveProjection(glm::radians(60.0f), renderer.getAspectRatio(), 0.1f, 180.0f);
+
+    for (bool gpuCulling : {false, true})
+    {
+        renderSystem.setGpuCulling(gpuCulling);
+        double recordSeconds = 0.0;
+        int recordedFrames = 0;
+        const auto startTime = clock::now();
+        for (int frame = 0; frame < FRAME_COUNT; frame++)
+        {
+            glfwPollEvents();
+            VkCommandBuffer frameCommandBuffer = renderer.beginFrame();
+            if (!frameCommandBuffer)
+            {
+                continue;
+            }
+            const int frameIndex = renderer.getFrameIndex();
+            frameAllocator.beginFrame(frameIndex);
+            BenchmarkUbo ubo{};
+            ubo.projectionView = camera.GetProjectionMatrix() * camera.GetViewMatrix();
+            const KongFrameAllocation uboAllocation = frameAllocator.pushUniform(ubo);
+            FrameInfo renderFrameInfo{frameIndex, 0.0f, frameCommandBuffer, camera, globalSets[frameIndex], uboAllocation.offset,
+                frameAllocator, renderer.getSwapChainExtent()};
+
+            const auto recordStart = clock::now();
+            renderSystem.prepareFrame(renderFrameInfo, gameObjects);
+            double seconds = std::chrono::duration<double>(clock::now() - recordStart).count();
+            renderer.beginSwapChainRenderPass(frameCommandBuffer);
+            const auto drawStart = clock::now();
+            renderSystem.renderGameObjects(renderFrameInfo, gameObjects);
+            seconds += std::chrono::duration<double>(clock::now() - drawStart).count();
+            renderer.endSwapChainRenderPass(frameCommandBuffer);
+            renderer.endFrame();
+            recordSeconds += seconds;
+            recordedFrames++;
+        }
+        vkDeviceWaitIdle(device.device());
+        const double totalSeconds = std::chrono::duration<double>(clock::now() - startTime).count();
+
+        const auto& drawStats = renderSystem.getDrawStats();
+        const int frames = std::max(recordedFrames, 1);
+        std::cout << "  " << (gpuCulling ? "gpu culling" : "cpu instancing") << ": record " << recordSeconds * 1e3 / frames
+            << " ms per frame, frame " << totalSeconds * 1e3 / frames << " ms, "
+            << drawStats.drawCalls << " draw calls for " << drawStats.drawnObjects << " objects" << std::endl;
+    }
+}
+
+void KongBenchmark::frustumCull(const std::vector<std::string>& args)
+{
+    const size_t objectCount = args.empty() ? 1000000 : std::stoul(args[0]);
+
+    // 随机摆放、旋转和缩放的单位立方体，大约三分之一在视锥内
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    KongCullingBounds bounds;
+    bounds.resize(objectCount);
+    for (size_t i = 0; i < objectCount; i++)
+    {
+        const glm::mat4 world = glm::translate(glm::mat4{1.0f}, glm::vec3(position(rng), position(rng), position(rng)))
+            * glm::rotate(glm::mat4{1.0f}, unit(rng) * glm::two_pi<float>(), glm::normalize(glm::vec3(unit(rng), 1.0f, unit(rng))))
+            * glm::scale(glm::mat4{1.0f}, glm::vec3(0.1f + 3.0f * unit(rng), 0.1f + unit(rng), 0.1f + unit(rng)));
+        bounds.set(i, world, glm::vec3(-1.0f), glm::vec3(1.0f));
+    }
+
+    KongCamera camera{};
+    camera.SetViewTarget(glm::vec3(0.0f, 0.0f, -150.0f), glm::vec3(10.0f, 5.0f, 0.0f));
+    camera.SetPerspectiveProjection(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    const std::array<glm::vec4, 6> planes = camera.GetFrustumPlanes();
+
+    std::vector<uint32_t> visible;
+    std::vector<uint32_t> reference;
+    visible.reserve(objectCount);
+    reference.reserve(objectCount);
+    const double simdSeconds = bestSeconds([&] { KongFrustumCuller::cull(planes, bounds, visible); });
+    const double scalarSeconds = bestSeconds([&] { KongFrustumCuller::cullScalar(planes, bounds, reference); });
+
+    // 两种实现的计算顺序相同，可见列表应该完全一致
+    std::vector<uint32_t> difference;
+    std::set_symmetric_difference(visible.begin(), visible.end(), reference.begin(), reference.end(), std::back_inserter(difference));
+    std::cout << "frustum_cull: " << objectCount << " objects, " << visible.size() << " visible" << std::endl;
+    std::cout << "  " << KongFrustumCuller::simdName() << ": " << simdSeconds * 1e3 << " ms ("
+        << objectCount / (simdSeconds * 1e3) << " objects per ms)" << std::endl;
+    std::cout << "  scalar: " << scalarSeconds * 1e3 << " ms (" << objectCount / (scalarSeconds * 1e3) << " objects per ms), speedup "
+        << scalarSeconds / simdSeconds << "x" << std::endl;
+    std::cout << "  " << (difference.empty() ? "match" : "MISMATCH") << ": " << difference.size() << " differing objects" << std::endl;
+}
+
+void KongBenchmark::bvh(const std::vector<std::string>& args)
+{
+    const size_t objectCount = args.empty() ? 1000000 : std::stoul(args[0]);
+
+    // 和frustum_cull相同的场景，同时写入SoA用于对比线性扫描
+    std::mt19937 rng{42};
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<KongAabb> boxes(objectCount);
+    KongCullingBounds cullingBounds;
+    cullingBounds.resize(objectCount);
+    for (size_t i = 0; i < objectCount; i++)
+    {
+        const glm::mat4 world = glm::translate(glm::mat4{1.0f}, glm::vec3(position(rng), position(rng), position(rng)))
+            * glm::rotate(glm::mat4{1.0f}, unit(rng) * glm::two_pi<float>(), glm::normalize(glm::vec3(unit(rng), 1.0f, unit(rng))))
+            * glm::scale(glm::mat4{1.0f}, glm::vec3(0.1f + 3.0f * unit(rng), 0.1f + unit(rng), 0.1f + unit(rng)));
+        boxes[i] = KongAabb::transform(world, glm::vec3(-1.0f), glm::vec3(1.0f));
+        cullingBounds.set(i, world, glm::vec3(-1.0f), glm::vec3(1.0f));
+    }
+
+    KongBvh tree{};
+    const double buildSeconds = bestSeconds([&] { tree.build(boxes); });
+    std::cout << "bvh: " << objectCount << " objects, " << tree.nodes().size() << " nodes of " << sizeof(KongBvhNode)
+        << " bytes, SAH cost " << tree.cost() << std::endl;
+    std::cout << "  build: " << buildSeconds * 1e3 << " ms (" << objectCount / (buildSeconds * 1e3) << " objects per ms)" << std::endl;
+
+    // 每次移动一部分物体再refit，计时包含setBounds
+    std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+    const auto moveAndRefit = [&](size_t step)
+    {
+        uint32_t refitNodes = 0;
+        const double seconds = bestSeconds([&]
+        {
+            for (size_t i = 0; i < objectCount; i += step)
+            {
+                KongAabb box = tree.bounds(static_cast<uint32_t>(i));
+                const glm::vec3 offset{jitter(rng), jitter(rng), jitter(rng)};
+                box.min += offset;
+                box.max += offset;
+                tree.setBounds(static_cast<uint32_t>(i), box);
+            }
+            refitNodes = tree.refit();
+        });
+        std::cout << "  refit " << 100.0 / step << "% moved: " << seconds * 1e3 << " ms, " << refitNodes << " nodes, cost ratio "
+            << tree.costRatio() << std::endl;
+    };
+    moveAndRefit(100);
+    moveAndRefit(1);
+
+    KongCamera camera{};
+    camera.SetViewTarget(glm::vec3(0.0f, 0.0f, -150.0f), glm::vec3(10.0f, 5.0f, 0.0f));
+    camera.SetPerspectiveProjection(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    const std::array<glm::vec4, 6> planes = camera.GetFrustumPlanes();
+
+    // 树重建之后和逐个AABB测试的结果比较；线性扫描用的是移动之前的包围体，只比较时间
+    tree.build(tree.allBounds());
+    std::vector<uint32_t> visible;
+    std::vector<uint32_t> linear;
+    visible.reserve(objectCount);
+    linear.reserve(objectCount);
+    const double querySeconds = bestSeconds([&] { tree.queryFrustum(planes, visible); });
+    const double linearSeconds = bestSeconds([&] { KongFrustumCuller::cull(planes, cullingBounds, linear); });
+    std::vector<uint32_t> reference;
+    for (uint32_t i = 0; i < objectCount; i++)
+    {
+        const KongAabb& box = tree.bounds(i);
+        const glm::vec3 center = box.center();
+        const glm::vec3 extent = (box.max - box.min) * 0.5f;
+        const bool outside = std::any_of(planes.begin(), planes.end(), [&](const glm::vec4& plane)
+        {
+            const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+            return distance < -(std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z);
+        });
+        if (!outside)
+        {
+            reference.push_back(i);
+        }
+    }
+    std::sort(visible.begin(), visible.end());
+    std::cout << "  frustum: " << querySeconds * 1e3 << " ms, " << visible.size() << " visible ("
+        << (visible == reference ? "match" : "MISMATCH") << "), " << KongFrustumCuller::simdName() << " linear scan "
+        << linearSeconds * 1e3 << " ms, speedup " << linearSeconds / querySeconds << "x" << std::endl;
+
+    // 小范围的AABB查询和射线，抽查一部分和暴力结果比较
+    constexpr uint32_t QUERY_COUNT = 10000;
+    constexpr uint32_t CHECK_COUNT = 20;
+    std::vector<KongAabb> queryBoxes(QUERY_COUNT);
+    std::vector<glm::vec3> rayOrigins(QUERY_COUNT);
+    std::vector<glm::vec3> rayDirections(QUERY_COUNT);
+    for (uint32_t q = 0; q < QUERY_COUNT; q++)
+    {
+        const glm::vec3 center{position(rng), position(rng), position(rng)};
+        queryBoxes[q] = {center - glm::vec3(5.0f), center + glm::vec3(5.0f)};
+        rayOrigins[q] = {position(rng), position(rng), position(rng)};
+        rayDirections[q] = glm::normalize(glm::vec3(jitter(rng), jitter(rng), jitter(rng)) + glm::vec3(0.0f, 0.0f, 0.001f));
+    }
+    std::vector<uint32_t> overlapping;
+    size_t overlapTotal = 0;
+    const double aabbSeconds = bestSeconds([&]
+    {
+        overlapTotal = 0;
+        for (const KongAabb& box : queryBoxes)
+        {
+            tree.queryAabb(box, overlapping);
+            overlapTotal += overlapping.size();
+        }
+    });
+    uint32_t hitCount = 0;
+    const double raySeconds = bestSeconds([&]
+    {
+        hitCount = 0;
+        KongBvhRayHit hit{};
+        for (uint32_t q = 0; q < QUERY_COUNT; q++)
+        {
+            hitCount += tree.raycast(rayOrigins[q], rayDirections[q], 1000.0f, hit) ? 1 : 0;
+        }
+    });
+
+    uint32_t mismatches = 0;
+    for (uint32_t q = 0; q < CHECK_COUNT; q++)
+    {
+        tree.queryAabb(queryBoxes[q], overlapping);
+        std::sort(overlapping.begin(), overlapping.end());
+        KongBvhRayHit hit{};
+        const bool hasHit = tree.raycast(rayOrigins[q], rayDirections[q], 1000.0f, hit);
+        std::vector<uint32_t> expectedOverlap;
+        float nearest = 1000.0f;
+        bool expectedHit = false;
+        const glm::vec3 inverseDirection = 1.0f / rayDirections[q];
+        for (uint32_t i = 0; i < objectCount; i++)
+        {
+            const KongAabb& box = tree.bounds(i);
+            if (box.overlaps(queryBoxes[q]))
+            {
+                expectedOverlap.push_back(i);
+            }
+            const glm::vec3 t0 = (box.min - rayOrigins[q]) * inverseDirection;
+            const glm::vec3 t1 = (box.max - rayOrigins[q]) * inverseDirection;
+            const glm::vec3 entries = glm::min(t0, t1);
+            const glm::vec3 exits = glm::max(t0, t1);
+            const float entry = std::max({entries.x, entries.y, entries.z, 0.0f});
+            const float exit = std::min({exits.x, exits.y, exits.z, nearest});
+            if (entry <= exit && (!expectedHit || entry < nearest))
+            {
+                nearest = entry;
+                expectedHit = true;
+            }
+        }
+        mismatches += overlapping != expectedOverlap;
+        mismatches += hasHit != expectedHit || (hasHit && hit.distance != nearest);
+    }
+    std::cout << "  aabb: " << QUERY_COUNT / (aabbSeconds * 1e3) << " queries per ms, " << overlapTotal / QUERY_COUNT
+        << " objects per query" << std::endl;
+    std::cout << "  raycast: " << QUERY_COUNT / (raySeconds * 1e3) << " rays per ms, " << hitCount << " hits" << std::endl;
+    std::cout << "  " << (mismatches == 0 ? "match" : "MISMATCH") << ": " << mismatches << " of " << CHECK_COUNT * 2
+        << " spot-checked queries differ from brute force" << std::endl;
+
+    // 所有物体持续移动，代价超过阈值之后在线程池中重建，重建期间继续refit
+    KongSceneBvh scene{};
+    scene.build(boxes);
+    uint32_t frames = 0;
+    float worstRatio = 1.0f;
+    const auto frameStart = std::chrono::high_resolution_clock::now();
+    while (scene.stats().rebuildCount == 0 && frames < 200)
+    {
+        for (uint32_t i = 0; i < objectCount; i += 10)
+        {
+            KongAabb box = scene.bvh().bounds(i);
+            const glm::vec3 offset{jitter(rng) * 4.0f, jitter(rng) * 4.0f, jitter(rng) * 4.0f};
+            box.min += offset;
+            box.max += offset;
+            scene.setBounds(i, box);
+        }
+        scene.update();
+        worstRatio = std::max(worstRatio, scene.stats().costRatio);
+        frames++;
+    }
+    const double frameSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameStart).count();
+    std::cout << "  scene: " << scene.stats().rebuildCount << " background rebuilds in " << frames << " frames moving 10% of objects ("
+        << frameSeconds * 1e3 / frames << " ms per frame), cost ratio " << worstRatio << " -> " << scene.stats().costRatio
+        << std::endl;
+}
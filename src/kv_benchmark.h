@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace kong
+{
+    /*
+     * 命令行性能测试入口，除了上传测试都不需要创建窗口和Vulkan设备
+     * 用法：KongVulkan --bench <name> [args...]
+     */
+    class KongBenchmark
+    {
+    public:
+        // 命令行中带有--bench时执行对应的测试并返回true，否则返回false正常启动程序
+        static bool run(int argc, char** argv);
+
+    private:
+        static void objParse(const std::vector<std::string>& args);
+        static void weld(const std::vector<std::string>& args);
+        static void meshOptimize(const std::vector<std::string>& args);
+        static void meshCache(const std::vector<std::string>& args);
+        static void meshletCull(const std::vector<std::string>& args);
+        static void memoryAllocator(const std::vector<std::string>& args);
+        static void stagingUpload(const std::vector<std::string>& args);
+        static void uploadBatch(const std::vector<std::string>& args);
+        static void instancing(const std::vector<std::string>& args);
+        static void gpuCull(const std::vector<std::string>& args);
+        static void frustumCull(const std::vector<std::string>& args);
+        static void bvh(const std::vector<std::string>& args);
+        static void vertexFormat(const std::vector<std::string>& args);
+        static void textureDecode(const std::vector<std::string>& args);
+        static void textureCompress(const std::vector<std::string>& args);
+    };
+}
@@ -7,9 +7,12 @@
  
 #include "kv_buffer.h"
  
+#include "kv_staging_ring.h"
+
 // std
 #include <cassert>
 #include <cstring>
+#include <stdexcept>
  
 using namespace kong;
  
@@ -43,39 +46,105 @@ KongBuffer::KongBuffer(
       memoryPropertyFlags{memoryPropertyFlags} {
   alignmentSize = getAlignment(instanceSize, minOffsetAlignment);
   bufferSize = alignmentSize * instanceCount;
-  device.createBuffer(bufferSize, usageFlags, memoryPropertyFlags, buffer, memory);
+  // Device-local buffers can be copied out of and into when the defragmenter moves them
+  if (!(memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+    this->usageFlags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  }
+  device.createBuffer(bufferSize, this->usageFlags, memoryPropertyFlags, buffer, memory);
 }
  
 KongBuffer::~KongBuffer() {
+  if (movable) {
+    // A copy into movedBuffer may still be running on the GPU
+    const uint64_t moveTicket = lveDevice.defragmenter().unregisterResource(this);
+    if (movedBuffer != VK_NULL_HANDLE) {
+      lveDevice.stagingRing().wait(moveTicket);
+      vkDestroyBuffer(lveDevice.device(), movedBuffer, nullptr);
+      lveDevice.allocator().free(movedMemory);
+    }
+  }
   unmap();
   vkDestroyBuffer(lveDevice.device(), buffer, nullptr);
-  vkFreeMemory(lveDevice.device(), memory, nullptr);
+  lveDevice.allocator().free(memory);
+}
+
+void KongBuffer::setMovable() {
+  assert(!(memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && "only device-local buffers can move");
+  if (movable || !memory.block) {
+    // Dedicated allocations have a VkDeviceMemory of their own and never fragment a block
+    return;
+  }
+  movable = true;
+  lveDevice.defragmenter().registerResource(this);
+}
+
+VkMemoryRequirements KongBuffer::memoryRequirements() const {
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(lveDevice.device(), buffer, &requirements);
+  return requirements;
+}
+
+void KongBuffer::beginMove(VkCommandBuffer commandBuffer, const KongAllocation &newAllocation) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = bufferSize;
+  bufferInfo.usage = usageFlags;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(lveDevice.device(), &bufferInfo, nullptr, &movedBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer!");
+  }
+  movedMemory = newAllocation;
+  vkBindBufferMemory(lveDevice.device(), movedBuffer, movedMemory.memory, movedMemory.offset);
+
+  VkBufferCopy copyRegion{};
+  copyRegion.size = bufferSize;
+  vkCmdCopyBuffer(commandBuffer, buffer, movedBuffer, 1, &copyRegion);
+}
+
+std::function<void()> KongBuffer::endMove() {
+  VkBuffer oldBuffer = buffer;
+  KongAllocation oldMemory = memory;
+  buffer = movedBuffer;
+  memory = movedMemory;
+  movedBuffer = VK_NULL_HANDLE;
+  movedMemory = {};
+
+  KongDevice &device = lveDevice;
+  return [&device, oldBuffer, oldMemory]() mutable {
+    vkDestroyBuffer(device.device(), oldBuffer, nullptr);
+    device.allocator().free(oldMemory);
+  };
 }
  
 /**
  * Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
  *
  * @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete
- * buffer range.
+ * buffer range. The memory is persistently mapped, so size only bounds-checks offset + size.
  * @param offset (Optional) Byte offset from beginning
  *
  * @return VkResult of the buffer mapping call
  */
 VkResult KongBuffer::map(VkDeviceSize size, VkDeviceSize offset) {
-  assert(buffer && memory && "Called map on buffer before create");
-  return vkMapMemory(lveDevice.device(), memory, offset, size, 0, &mapped);
+  assert(buffer && memory.memory && "Called map on buffer before create");
+  assert(
+      (size == VK_WHOLE_SIZE ? offset <= bufferSize : offset + size <= bufferSize) &&
+      "Mapped range exceeds buffer size");
+  // Host visible memory blocks stay mapped for their whole lifetime
+  if (!memory.mapped) {
+    return VK_ERROR_MEMORY_MAP_FAILED;
+  }
+  mapped = static_cast<char *>(memory.mapped) + offset;
+  return VK_SUCCESS;
 }
  
 /**
  * Unmap a mapped memory range
  *
- * @note Does not return a result as vkUnmapMemory can't fail
+ * @note The memory block itself stays mapped until the allocator frees it
  */
 void KongBuffer::unmap() {
-  if (mapped) {
-    vkUnmapMemory(lveDevice.device(), memory);
-    mapped = nullptr;
-  }
+  mapped = nullptr;
 }
  
 /**
@@ -111,11 +180,8 @@ void KongBuffer::writeToBuffer(void *data, VkDeviceSize size, VkDeviceSize offse
  * @return VkResult of the flush call
  */
 VkResult KongBuffer::flush(VkDeviceSize size, VkDeviceSize offset) {
-  VkMappedMemoryRange mappedRange = {};
-  mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-  mappedRange.memory = memory;
-  mappedRange.offset = offset;
-  mappedRange.size = size;
+  // The buffer shares its VkDeviceMemory with others, so the range is rebased onto the block
+  VkMappedMemoryRange mappedRange = lveDevice.allocator().mappedRange(memory, size, offset);
   return vkFlushMappedMemoryRanges(lveDevice.device(), 1, &mappedRange);
 }
  
@@ -131,11 +197,7 @@ VkResult KongBuffer::flush(VkDeviceSize size, VkDeviceSize offset) {
  * @return VkResult of the invalidate call
  */
 VkResult KongBuffer::invalidate(VkDeviceSize size, VkDeviceSize offset) {
-  VkMappedMemoryRange mappedRange = {};
-  mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-  mappedRange.memory = memory;
-  mappedRange.offset = offset;
-  mappedRange.size = size;
+  VkMappedMemoryRange mappedRange = lveDevice.allocator().mappedRange(memory, size, offset);
   return vkInvalidateMappedMemoryRanges(lveDevice.device(), 1, &mappedRange);
 }
  
@@ -1,10 +1,11 @@
 #pragma once
  
+#include "kv_defragmenter.h"
 #include "kv_device.h"
  
 namespace kong {
  
-class KongBuffer {
+class KongBuffer : public KongMovableResource {
  public:
   KongBuffer(
       KongDevice& device,
@@ -39,6 +40,16 @@ class KongBuffer {
   VkBufferUsageFlags getUsageFlags() const { return usageFlags; }
   VkMemoryPropertyFlags getMemoryPropertyFlags() const { return memoryPropertyFlags; }
   VkDeviceSize getBufferSize() const { return bufferSize; }
+
+  // Lets the defragmenter move a device-local buffer once its contents are final.
+  // Only for buffers whose users call getBuffer() on every use instead of caching the handle.
+  void setMovable();
+
+  // KongMovableResource
+  const KongAllocation &allocation() const override { return memory; }
+  VkMemoryRequirements memoryRequirements() const override;
+  void beginMove(VkCommandBuffer commandBuffer, const KongAllocation &newAllocation) override;
+  std::function<void()> endMove() override;
  
  private:
   static VkDeviceSize getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment);
@@ -46,7 +57,7 @@ class KongBuffer {
   KongDevice& lveDevice;
   void* mapped = nullptr;
   VkBuffer buffer = VK_NULL_HANDLE;
-  VkDeviceMemory memory = VK_NULL_HANDLE;
+  KongAllocation memory{};
  
   VkDeviceSize bufferSize;
   uint32_t instanceCount;
@@ -54,6 +65,11 @@ class KongBuffer {
   VkDeviceSize alignmentSize;
   VkBufferUsageFlags usageFlags;
   VkMemoryPropertyFlags memoryPropertyFlags;
+
+  bool movable = false;
+  // Copy target while a move is in flight
+  VkBuffer movedBuffer = VK_NULL_HANDLE;
+  KongAllocation movedMemory{};
 };
  
 }  // namespace kong
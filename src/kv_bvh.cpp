@@ -0,0 +1,617 @@
+#include "kv_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <queue>
+
+using namespace kong;
+
+static_assert(sizeof(KongBvhNode) == 32, "KongBvhNode should stay 32 bytes, two nodes per cache line");
+
+namespace
+{
+    // 超过这个深度之后不再按SAH分割，直接按数量对半分，再加上最多32层，遍历的栈不会超过STACK_SIZE
+    constexpr uint32_t MAX_SAH_DEPTH = 64;
+    constexpr uint32_t STACK_SIZE = 128;
+    constexpr uint32_t MAX_BINS = 32;
+
+    KongAabb nodeBounds(const KongBvhNode& node)
+    {
+        return {node.boundsMin, node.boundsMax};
+    }
+
+    void setNodeBounds(KongBvhNode& node, const KongAabb& bounds)
+    {
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    }
+
+    // 包围盒中心到平面的距离和包围盒在平面法线上投影的半径
+    void planeDistance(const glm::vec4& plane, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float& distance, float& reach)
+    {
+        const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        const glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+        distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+        reach = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+    }
+
+    // slab测试，返回进入包围盒的距离，不相交时返回false
+    bool intersectRay(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance,
+        const glm::vec3& boundsMin, const glm::vec3& boundsMax, float& entry)
+    {
+        const glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+        const glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+        const glm::vec3 near = glm::min(t0, t1);
+        const glm::vec3 far = glm::max(t0, t1);
+        entry = std::max({near.x, near.y, near.z, 0.0f});
+        const float exit = std::min({far.x, far.y, far.z, maxDistance});
+        return entry <= exit;
+    }
+}
+
+KongAabb KongAabb::transform(const glm::mat4& world, const glm::vec3& localMin, const glm::vec3& localMax)
+{
+    // 中心变换到世界空间，半边长在每个世界轴上的投影取绝对值相加
+    const glm::vec3 center = glm::vec3(world * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+    const glm::vec3 halfSize = (localMax - localMin) * 0.5f;
+    glm::vec3 extent{};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent[axis] = std::abs(world[0][axis]) * halfSize.x + std::abs(world[1][axis]) * halfSize.y
+            + std::abs(world[2][axis]) * halfSize.z;
+    }
+    return {center - extent, center + extent};
+}
+
+KongBvh::KongBvh(const KongBvhSettings& settings) : m_settings(settings)
+{
+}
+
+void KongBvh::build(std::vector<KongAabb> bounds)
+{
+    m_bounds = std::move(bounds);
+    m_nodes.clear();
+    m_parents.clear();
+    m_primitives.clear();
+    m_objectLeaves.assign(m_bounds.size(), INVALID_NODE);
+    m_dirtyLeaves.clear();
+    m_missingObjects = false;
+
+    // 构建时把包围盒和中心复制到连续的数组中，和物体编号一起分区
+    std::vector<BuildPrimitive> primitives;
+    for (uint32_t object = 0; object < m_bounds.size(); object++)
+    {
+        if (!m_bounds[object].empty())
+        {
+            primitives.push_back({m_bounds[object], m_bounds[object].center(), object});
+        }
+    }
+    m_primitives.resize(primitives.size());
+
+    // 二叉树最多2n - 1个节点，提前分配好，递归过程中不会重新分配
+    const auto primitiveCount = static_cast<uint32_t>(m_primitives.size());
+    m_nodes.reserve(std::max(primitiveCount * 2, 1u));
+    m_parents.reserve(m_nodes.capacity());
+    if (primitiveCount == 0)
+    {
+        // 空树也保留一个空的根节点，计算代价和refit时不用特殊处理
+        m_nodes.push_back({});
+        setNodeBounds(m_nodes[0], KongAabb{});
+        m_parents.push_back(INVALID_NODE);
+    }
+    else
+    {
+        buildNode(0, primitiveCount, 0, primitives);
+    }
+    m_nodes.shrink_to_fit();
+    m_parents.shrink_to_fit();
+    m_dirtyNodes.assign(m_nodes.size(), 0);
+
+    m_costSum = 0.0;
+    for (const auto& node : m_nodes)
+    {
+        m_costSum += nodeCost(node);
+    }
+    m_buildCost = cost();
+}
+
+uint32_t KongBvh::buildNode(uint32_t begin, uint32_t end, uint32_t depth, std::vector<BuildPrimitive>& primitives)
+{
+    const auto nodeIndex = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back({});
+    m_parents.push_back(INVALID_NODE);
+
+    KongAabb bounds{};
+    KongAabb centroidBounds{};
+    for (uint32_t i = begin; i < end; i++)
+    {
+        bounds.expand(primitives[i].bounds);
+        centroidBounds.expand(primitives[i].centroid);
+    }
+    setNodeBounds(m_nodes[nodeIndex], bounds);
+
+    const uint32_t count = end - begin;
+    if (count == 1)
+    {
+        makeLeaf(nodeIndex, begin, end, primitives);
+        return nodeIndex;
+    }
+
+    // 在中心分布最长的轴上分桶，桶的边界处估算SAH代价：traversalCost + (左表面积 * 左物体数 + 右表面积 * 右物体数) / 节点表面积
+    // 只分一个轴比三个轴都试快得多，树的质量差别不大
+    // 物体比桶少时多余的桶都是空的
+    const uint32_t binCount = std::clamp(std::min(m_settings.binCount, count), 2u, MAX_BINS);
+    const glm::vec3 centroidSize = centroidBounds.max - centroidBounds.min;
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    std::array<KongAabb, MAX_BINS> binBounds;
+    std::array<uint32_t, MAX_BINS> binCounts;
+    std::array<float, MAX_BINS> rightCosts;
+    const glm::vec3 binScale = static_cast<float>(binCount) / centroidSize;
+    auto binOf = [&](const glm::vec3& centroid, int axis)
+    {
+        const float t = (centroid[axis] - centroidBounds.min[axis]) * binScale[axis];
+        return std::min(static_cast<uint32_t>(t), binCount - 1);
+    };
+    const int axis = centroidSize.x >= centroidSize.y && centroidSize.x >= centroidSize.z ? 0 : (centroidSize.y >= centroidSize.z ? 1 : 2);
+    if (centroidSize[axis] > 0.0f && depth < MAX_SAH_DEPTH)
+    {
+        std::fill_n(binBounds.begin(), binCount, KongAabb{});
+        std::fill_n(binCounts.begin(), binCount, 0u);
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const uint32_t bin = binOf(primitives[i].centroid, axis);
+            binBounds[bin].expand(primitives[i].bounds);
+            binCounts[bin]++;
+        }
+        // 从右向左累积右半部分的代价，再从左向右扫描分割位置
+        KongAabb right{};
+        uint32_t rightCount = 0;
+        for (uint32_t bin = binCount - 1; bin > 0; bin--)
+        {
+            right.expand(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightCosts[bin] = right.surfaceArea() * rightCount;
+        }
+        KongAabb left{};
+        uint32_t leftCount = 0;
+        for (uint32_t split = 1; split < binCount; split++)
+        {
+            left.expand(binBounds[split - 1]);
+            leftCount += binCounts[split - 1];
+            if (leftCount == 0 || leftCount == count)
+            {
+                continue;
+            }
+            const float splitCost = left.surfaceArea() * leftCount + rightCosts[split];
+            if (splitCost < bestCost)
+            {
+                bestCost = splitCost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    const float area = bounds.surfaceArea();
+    const float leafCost = static_cast<float>(count);
+    const bool foundSplit = bestAxis >= 0;
+    if (foundSplit && area > 0.0f)
+    {
+        bestCost = m_settings.traversalCost + bestCost / area;
+    }
+    if (count <= m_settings.maxLeafSize && (!foundSplit || bestCost >= leafCost))
+    {
+        makeLeaf(nodeIndex, begin, end, primitives);
+        return nodeIndex;
+    }
+
+    uint32_t middle = begin;
+    if (foundSplit)
+    {
+        middle = static_cast<uint32_t>(std::partition(primitives.begin() + begin, primitives.begin() + end,
+            [&](const BuildPrimitive& primitive) { return binOf(primitive.centroid, bestAxis) < bestSplit; }) - primitives.begin());
+    }
+    else
+    {
+        // 所有中心重合或者树太深，只能按数量对半分
+        middle = begin + count / 2;
+    }
+
+    buildNode(begin, middle, depth + 1, primitives);
+    m_parents[nodeIndex + 1] = nodeIndex;
+    const uint32_t rightChild = buildNode(middle, end, depth + 1, primitives);
+    m_parents[rightChild] = nodeIndex;
+    m_nodes[nodeIndex].offset = rightChild;
+    m_nodes[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+void KongBvh::makeLeaf(uint32_t node, uint32_t begin, uint32_t end, const std::vector<BuildPrimitive>& primitives)
+{
+    m_nodes[node].offset = begin;
+    m_nodes[node].count = end - begin;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        m_primitives[i] = primitives[i].object;
+        m_objectLeaves[primitives[i].object] = node;
+    }
+}
+
+double KongBvh::nodeCost(const KongBvhNode& node) const
+{
+    const double area = nodeBounds(node).surfaceArea();
+    return node.isLeaf() ? area * node.count : area * m_settings.traversalCost;
+}
+
+bool KongBvh::setBounds(uint32_t object, const KongAabb& bounds)
+{
+    if (m_bounds[object] == bounds)
+    {
+        return false;
+    }
+    m_bounds[object] = bounds;
+    const uint32_t leaf = m_objectLeaves[object];
+    if (leaf == INVALID_NODE)
+    {
+        m_missingObjects = m_missingObjects || !bounds.empty();
+        return true;
+    }
+    if (!m_dirtyNodes[leaf])
+    {
+        m_dirtyNodes[leaf] = 1;
+        m_dirtyLeaves.push_back(leaf);
+    }
+    return true;
+}
+
+KongAabb KongBvh::computeBounds(uint32_t index) const
+{
+    const KongBvhNode& node = m_nodes[index];
+    if (!node.isLeaf())
+    {
+        KongAabb bounds = nodeBounds(m_nodes[index + 1]);
+        bounds.expand(nodeBounds(m_nodes[node.offset]));
+        return bounds;
+    }
+    KongAabb bounds{};
+    for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+    {
+        bounds.expand(m_bounds[m_primitives[i]]);
+    }
+    return bounds;
+}
+
+uint32_t KongBvh::refit()
+{
+    if (m_primitives.empty())
+    {
+        return 0;
+    }
+    // 子节点的编号总是大于父节点，按编号从大到小处理时子节点一定先于父节点更新
+    // 修改的叶子很多时路径几乎覆盖整棵树，直接顺序更新所有节点比逐条路径向上更快
+    if (m_dirtyLeaves.size() * 8 > m_nodes.size())
+    {
+        m_costSum = 0.0;
+        for (uint32_t index = static_cast<uint32_t>(m_nodes.size()); index-- > 0;)
+        {
+            setNodeBounds(m_nodes[index], computeBounds(index));
+            m_costSum += nodeCost(m_nodes[index]);
+        }
+        for (uint32_t leaf : m_dirtyLeaves)
+        {
+            m_dirtyNodes[leaf] = 0;
+        }
+        m_dirtyLeaves.clear();
+        return static_cast<uint32_t>(m_nodes.size());
+    }
+
+    std::priority_queue<uint32_t> pending(std::less<uint32_t>{}, std::move(m_dirtyLeaves));
+    m_dirtyLeaves = {};
+    uint32_t refitCount = 0;
+    while (!pending.empty())
+    {
+        const uint32_t index = pending.top();
+        pending.pop();
+        m_dirtyNodes[index] = 0;
+        refitCount++;
+        KongBvhNode& node = m_nodes[index];
+        const KongAabb bounds = computeBounds(index);
+        if (bounds == nodeBounds(node))
+        {
+            continue;
+        }
+        m_costSum -= nodeCost(node);
+        setNodeBounds(node, bounds);
+        m_costSum += nodeCost(node);
+
+        const uint32_t parent = m_parents[index];
+        if (parent != INVALID_NODE && !m_dirtyNodes[parent])
+        {
+            m_dirtyNodes[parent] = 1;
+            pending.push(parent);
+        }
+    }
+    return refitCount;
+}
+
+float KongBvh::cost() const
+{
+    const float rootArea = nodeBounds(m_nodes[0]).surfaceArea();
+    return rootArea > 0.0f ? static_cast<float>(m_costSum / rootArea) : 0.0f;
+}
+
+float KongBvh::costRatio() const
+{
+    if (m_missingObjects)
+    {
+        return std::numeric_limits<float>::infinity();
+    }
+    return m_buildCost > 0.0f ? cost() / m_buildCost : 1.0f;
+}
+
+void KongBvh::appendSubtree(uint32_t node, std::vector<uint32_t>& objects) const
+{
+    // 子树的物体在primitives中是连续的，从最左边的叶子到最右边的叶子
+    uint32_t leftmost = node;
+    while (!m_nodes[leftmost].isLeaf())
+    {
+        leftmost++;
+    }
+    uint32_t rightmost = node;
+    while (!m_nodes[rightmost].isLeaf())
+    {
+        rightmost = m_nodes[rightmost].offset;
+    }
+    objects.insert(objects.end(), m_primitives.begin() + m_nodes[leftmost].offset,
+        m_primitives.begin() + m_nodes[rightmost].offset + m_nodes[rightmost].count);
+}
+
+void KongBvh::queryFrustum(const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& objects) const
+{
+    objects.clear();
+    if (m_primitives.empty())
+    {
+        return;
+    }
+    constexpr uint32_t ALL_PLANES = (1u << 6) - 1;
+    // 每个节点带着还需要测试的平面
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t planeMask;
+    };
+    Entry stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = {0, ALL_PLANES};
+    while (stackSize > 0)
+    {
+        const Entry entry = stack[--stackSize];
+        const KongBvhNode& node = m_nodes[entry.node];
+        uint32_t planeMask = entry.planeMask;
+        bool outside = false;
+        for (uint32_t p = 0; p < 6 && !outside; p++)
+        {
+            if (!(planeMask & (1u << p)))
+            {
+                continue;
+            }
+            float distance = 0.0f;
+            float reach = 0.0f;
+            planeDistance(planes[p], node.boundsMin, node.boundsMax, distance, reach);
+            outside = distance < -reach;
+            if (distance >= reach)
+            {
+                planeMask &= ~(1u << p);
+            }
+        }
+        if (outside)
+        {
+            continue;
+        }
+        if (planeMask == 0)
+        {
+            appendSubtree(entry.node, objects);
+            continue;
+        }
+        if (!node.isLeaf())
+        {
+            stack[stackSize++] = {node.offset, planeMask};
+            stack[stackSize++] = {entry.node + 1, planeMask};
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+        {
+            const KongAabb& bounds = m_bounds[m_primitives[i]];
+            bool visible = true;
+            for (uint32_t p = 0; p < 6 && visible; p++)
+            {
+                float distance = 0.0f;
+                float reach = 0.0f;
+                planeDistance(planes[p], bounds.min, bounds.max, distance, reach);
+                visible = (planeMask & (1u << p)) == 0 || distance >= -reach;
+            }
+            if (visible)
+            {
+                objects.push_back(m_primitives[i]);
+            }
+        }
+    }
+}
+
+void KongBvh::queryAabb(const KongAabb& box, std::vector<uint32_t>& objects) const
+{
+    objects.clear();
+    if (m_primitives.empty())
+    {
+        return;
+    }
+    uint32_t stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const uint32_t index = stack[--stackSize];
+        const KongBvhNode& node = m_nodes[index];
+        if (!nodeBounds(node).overlaps(box))
+        {
+            continue;
+        }
+        if (!node.isLeaf())
+        {
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = index + 1;
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+        {
+            if (m_bounds[m_primitives[i]].overlaps(box))
+            {
+                objects.push_back(m_primitives[i]);
+            }
+        }
+    }
+}
+
+bool KongBvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, KongBvhRayHit& hit) const
+{
+    // 分量为0时倒数是无穷大，slab测试仍然成立
+    const glm::vec3 inverseDirection = 1.0f / direction;
+    float closest = maxDistance;
+    bool found = false;
+
+    float entry = 0.0f;
+    if (m_primitives.empty() || !intersectRay(origin, inverseDirection, closest, m_nodes[0].boundsMin, m_nodes[0].boundsMax, entry))
+    {
+        return false;
+    }
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = {0, entry};
+    while (stackSize > 0)
+    {
+        const Entry current = stack[--stackSize];
+        // 入栈之后找到了更近的交点
+        if (current.distance > closest)
+        {
+            continue;
+        }
+        const KongBvhNode& node = m_nodes[current.node];
+        if (node.isLeaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                const KongAabb& bounds = m_bounds[m_primitives[i]];
+                float distance = 0.0f;
+                if (intersectRay(origin, inverseDirection, closest, bounds.min, bounds.max, distance)
+                    && (!found || distance < closest))
+                {
+                    closest = distance;
+                    hit = {m_primitives[i], distance};
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // 近的子节点后入栈，先被访问
+        const uint32_t children[2] = {current.node + 1, node.offset};
+        float distances[2] = {0.0f, 0.0f};
+        bool hits[2];
+        for (int c = 0; c < 2; c++)
+        {
+            const KongBvhNode& child = m_nodes[children[c]];
+            hits[c] = intersectRay(origin, inverseDirection, closest, child.boundsMin, child.boundsMax, distances[c]);
+        }
+        const int nearChild = hits[0] && hits[1] ? (distances[0] <= distances[1] ? 0 : 1) : (hits[0] ? 0 : 1);
+        const int farChild = 1 - nearChild;
+        if (hits[farChild])
+        {
+            stack[stackSize++] = {children[farChild], distances[farChild]};
+        }
+        if (hits[nearChild])
+        {
+            stack[stackSize++] = {children[nearChild], distances[nearChild]};
+        }
+    }
+    return found;
+}
+
+KongSceneBvh::KongSceneBvh(const KongBvhSettings& settings, KongThreadPool& threadPool)
+    : m_settings(settings), m_threadPool(threadPool), m_bvh(std::make_unique<KongBvh>(settings))
+{
+    m_bvh->build({});
+}
+
+void KongSceneBvh::build(std::vector<KongAabb> bounds)
+{
+    // 进行中的任务只持有快照，丢弃future不会等待它
+    m_rebuild = {};
+    m_changedDuringRebuild.clear();
+    m_bvh->build(std::move(bounds));
+}
+
+void KongSceneBvh::setBounds(uint32_t object, const KongAabb& bounds)
+{
+    if (m_bvh->setBounds(object, bounds) && m_rebuild.valid())
+    {
+        m_changedDuringRebuild.push_back(object);
+    }
+}
+
+void KongSceneBvh::update()
+{
+    if (m_rebuild.valid() && m_rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        swapInRebuild();
+    }
+    m_stats.refitNodes = m_bvh->refit();
+    m_stats.costRatio = m_bvh->costRatio();
+    // 有物体不在树中时查询会漏掉它，不能等后台重建
+    if (std::isinf(m_stats.costRatio))
+    {
+        build(m_bvh->allBounds());
+        m_stats.costRatio = m_bvh->costRatio();
+    }
+
+    if (!m_rebuild.valid() && m_stats.costRatio > m_settings.rebuildCostRatio)
+    {
+        m_rebuild = m_threadPool.submit([settings = m_settings, snapshot = m_bvh->allBounds()]() mutable
+        {
+            auto bvh = std::make_unique<KongBvh>(settings);
+            bvh->build(std::move(snapshot));
+            return bvh;
+        });
+    }
+    m_stats.rebuilding = m_rebuild.valid();
+}
+
+void KongSceneBvh::finishRebuild()
+{
+    if (m_rebuild.valid())
+    {
+        swapInRebuild();
+        m_stats.costRatio = m_bvh->costRatio();
+        m_stats.rebuilding = false;
+    }
+}
+
+void KongSceneBvh::swapInRebuild()
+{
+    std::unique_ptr<KongBvh> rebuilt = m_rebuild.get();
+    for (uint32_t object : m_changedDuringRebuild)
+    {
+        rebuilt->setBounds(object, m_bvh->bounds(object));
+    }
+    m_changedDuringRebuild.clear();
+    rebuilt->refit();
+    m_bvh = std::move(rebuilt);
+    m_stats.rebuildCount++;
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "kv_thread_pool.h"
+
+namespace kong
+{
+    struct KongAabb
+    {
+        // 默认是空盒子，expand任何点之后才有意义
+        glm::vec3 min{std::numeric_limits<float>::max()};
+        glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+        bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+        glm::vec3 center() const { return (min + max) * 0.5f; }
+        void expand(const glm::vec3& point)
+        {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+        void expand(const KongAabb& other)
+        {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+        float surfaceArea() const
+        {
+            if (empty())
+            {
+                return 0.0f;
+            }
+            const glm::vec3 size = max - min;
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+        bool overlaps(const KongAabb& other) const
+        {
+            return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y
+                && min.z <= other.max.z && max.z >= other.min.z;
+        }
+        bool operator==(const KongAabb& other) const { return min == other.min && max == other.max; }
+        bool operator!=(const KongAabb& other) const { return !(*this == other); }
+
+        // 模型空间的包围盒变换到世界空间之后的包围盒
+        static KongAabb transform(const glm::mat4& world, const glm::vec3& localMin, const glm::vec3& localMax);
+    };
+
+    /*
+     * 32字节的节点，按深度优先顺序存放：内部节点的左子节点紧跟在它之后，offset是右子节点
+     * 叶子的物体在primitives的[offset, offset + count)中
+     */
+    struct KongBvhNode
+    {
+        glm::vec3 boundsMin{};
+        uint32_t offset = 0;
+        glm::vec3 boundsMax{};
+        // 叶子中的物体数，内部节点为0
+        uint32_t count = 0;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    struct KongBvhSettings
+    {
+        uint32_t maxLeafSize = 4;
+        // SAH在每个轴上分成这么多个桶估算代价，最多32个
+        uint32_t binCount = 16;
+        // 访问一个内部节点的代价，相对于测试一个物体
+        float traversalCost = 1.0f;
+        // refit之后SAH代价超过构建时的这么多倍就在后台重建
+        float rebuildCostRatio = 1.5f;
+    };
+
+    struct KongBvhRayHit
+    {
+        uint32_t object = 0;
+        // 沿direction的距离，起点在包围盒内时为0
+        float distance = 0.0f;
+    };
+
+    /*
+     * 场景物体世界包围盒上的BVH，用分桶的SAH自顶向下构建
+     * 物体用构建时的编号表示，包围盒为空的物体不放进树中，之后变成非空时需要重建
+     * 不是线程安全的：修改和查询要在同一个线程，或者由调用者加锁
+     */
+    class KongBvh
+    {
+    public:
+        static constexpr uint32_t INVALID_NODE = std::numeric_limits<uint32_t>::max();
+
+        explicit KongBvh(const KongBvhSettings& settings = {});
+
+        void build(std::vector<KongAabb> bounds);
+        size_t size() const { return m_bounds.size(); }
+        const KongAabb& bounds(uint32_t object) const { return m_bounds[object]; }
+        const std::vector<KongAabb>& allBounds() const { return m_bounds; }
+        const std::vector<KongBvhNode>& nodes() const { return m_nodes; }
+
+        // 修改一个物体的包围盒，下一次refit时生效，没有变化时返回false
+        bool setBounds(uint32_t object, const KongAabb& bounds);
+        // 只从修改过的叶子向上更新到根，返回更新的节点数
+        uint32_t refit();
+
+        // SAH代价（根节点表面积归一化），树在refit之后会逐渐变差
+        float cost() const;
+        // 当前代价相对于构建时的比值；有物体从空变成非空（不在树中）时为无穷大
+        float costRatio() const;
+
+        // 和KongFrustumCuller相同的平面约定，整个在某个平面内侧的子树不再测试这个平面
+        void queryFrustum(const std::array<glm::vec4, 6>& planes, std::vector<uint32_t>& objects) const;
+        void queryAabb(const KongAabb& box, std::vector<uint32_t>& objects) const;
+        // 最近的和射线相交的物体包围盒，direction不需要归一化，距离以direction的长度为单位
+        bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, KongBvhRayHit& hit) const;
+
+    private:
+        struct BuildPrimitive
+        {
+            KongAabb bounds;
+            glm::vec3 centroid;
+            uint32_t object;
+        };
+        uint32_t buildNode(uint32_t begin, uint32_t end, uint32_t depth, std::vector<BuildPrimitive>& primitives);
+        void makeLeaf(uint32_t node, uint32_t begin, uint32_t end, const std::vector<BuildPrimitive>& primitives);
+        // 叶子为其中物体的包围盒的并集，内部节点为两个子节点的并集
+        KongAabb computeBounds(uint32_t index) const;
+        // 节点对SAH代价的贡献（未归一化）
+        double nodeCost(const KongBvhNode& node) const;
+        // 把子树中的所有物体加入结果，不做测试
+        void appendSubtree(uint32_t node, std::vector<uint32_t>& objects) const;
+
+        KongBvhSettings m_settings;
+        std::vector<KongAabb> m_bounds;
+        std::vector<KongBvhNode> m_nodes;
+        std::vector<uint32_t> m_parents;
+        // 叶子中的物体编号
+        std::vector<uint32_t> m_primitives;
+        // 物体所在的叶子，不在树中的物体为INVALID_NODE
+        std::vector<uint32_t> m_objectLeaves;
+
+        std::vector<uint8_t> m_dirtyNodes;
+        std::vector<uint32_t> m_dirtyLeaves;
+        double m_costSum = 0.0;
+        float m_buildCost = 0.0f;
+        // 有物体需要加入树中，只能重建
+        bool m_missingObjects = false;
+    };
+
+    struct KongSceneBvhStats
+    {
+        // 后台重建完成的次数
+        uint32_t rebuildCount = 0;
+        uint32_t refitNodes = 0;    // 上一次update中refit的节点数
+        float costRatio = 1.0f;
+        bool rebuilding = false;
+    };
+
+    /*
+     * 场景的BVH：每帧refit，质量下降到阈值之后在线程池中用当时的包围盒快照重建
+     * 重建期间继续在旧的树上refit和查询，完成之后把快照之后修改过的物体重新应用到新树上再换入
+     */
+    class KongSceneBvh
+    {
+    public:
+        explicit KongSceneBvh(const KongBvhSettings& settings = {}, KongThreadPool& threadPool = KongThreadPool::global());
+
+        KongSceneBvh(const KongSceneBvh&) = delete;
+        KongSceneBvh& operator=(const KongSceneBvh&) = delete;
+
+        // 同步构建，物体数量变化时调用，丢弃进行中的后台重建
+        void build(std::vector<KongAabb> bounds);
+        size_t size() const { return m_bvh->size(); }
+        void setBounds(uint32_t object, const KongAabb& bounds);
+        // 每帧调用一次：换入完成的重建结果，refit，需要时开始后台重建；有物体不在树中时同步重建
+        void update();
+        // 等待进行中的重建完成并换入
+        void finishRebuild();
+
+        const KongBvh& bvh() const { return *m_bvh; }
+        const KongSceneBvhStats& stats() const { return m_stats; }
+
+    private:
+        void swapInRebuild();
+
+        KongBvhSettings m_settings;
+        KongThreadPool& m_threadPool;
+        std::unique_ptr<KongBvh> m_bvh;
+        std::future<std::unique_ptr<KongBvh>> m_rebuild;
+        // 开始重建之后修改过的物体
+        std::vector<uint32_t> m_changedDuringRebuild;
+        KongSceneBvhStats m_stats{};
+    };
+}
@@ -85,3 +85,26 @@ void KongCamera::SetViewYXZ(const glm::vec3& position, const glm::vec3& rotation
     m_viewMatrix[3][1] = -glm::dot(v, position);
     m_viewMatrix[3][2] = -glm::dot(w, position);
 }
+
+std::array<glm::vec4, 6> KongCamera::GetFrustumPlanes() const
+{
+    return ExtractFrustumPlanes(m_projectionMatrix * m_viewMatrix);
+}
+
+std::array<glm::vec4, 6> KongCamera::ExtractFrustumPlanes(const glm::mat4& projectionView)
+{
+    auto row = [&](int i)
+    {
+        return glm::vec4{projectionView[0][i], projectionView[1][i], projectionView[2][i], projectionView[3][i]};
+    };
+    std::array<glm::vec4, 6> planes{
+        row(3) + row(0), row(3) - row(0),
+        row(3) + row(1), row(3) - row(1),
+        row(2), row(3) - row(2)
+    };
+    for (auto& plane : planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return planes;
+}
@@ -3,6 +3,7 @@
 // depth from 0 to 1, not -1 to 1 (opengl)
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
+#include <array>
 
 namespace kong
 {
@@ -21,6 +22,11 @@ namespace kong
         
         const glm::mat4& GetProjectionMatrix() const {return m_projectionMatrix;}
         const glm::mat4& GetViewMatrix() const {return m_viewMatrix;}
+
+        // 世界空间的6个视锥平面（左右下上近远），xyz为指向视锥内部的单位法线
+        std::array<glm::vec4, 6> GetFrustumPlanes() const;
+        // 从裁剪矩阵中提取平面（Gribb & Hartmann），深度范围为[0, 1]
+        static std::array<glm::vec4, 6> ExtractFrustumPlanes(const glm::mat4& projectionView);
         
     private:
         glm::mat4 m_projectionMatrix{1.0f};
@@ -0,0 +1,158 @@
+#include "kv_defragmenter.h"
+
+#include <algorithm>
+
+#include "kv_device.h"
+#include "kv_staging_ring.h"
+
+using namespace kong;
+
+KongDefragmenter::KongDefragmenter(KongDevice& device, uint32_t framesInFlight, const KongDefragmenterSettings& settings)
+    : m_device(device), m_framesInFlight(framesInFlight), m_settings(settings)
+{
+}
+
+KongDefragmenter::~KongDefragmenter()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_moves.empty())
+    {
+        m_device.stagingRing().wait(m_moveTicket);
+        finishMoves();
+    }
+    // 销毁时GPU已经空闲
+    for (auto& release : m_releases)
+    {
+        release.release();
+    }
+}
+
+void KongDefragmenter::registerResource(KongMovableResource* resource)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_resources.insert(resource);
+}
+
+uint64_t KongDefragmenter::unregisterResource(KongMovableResource* resource)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_resources.erase(resource);
+    auto it = std::find_if(m_moves.begin(), m_moves.end(), [resource](const Move& move) { return move.resource == resource; });
+    if (it == m_moves.end())
+    {
+        return 0;
+    }
+    m_moves.erase(it);
+    return m_moveTicket;
+}
+
+void KongDefragmenter::update()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frame++;
+
+    // 切换之后又过了framesInFlight帧，之前录制的帧都已经执行完
+    auto due = std::partition(m_releases.begin(), m_releases.end(),
+        [this](const Release& release) { return release.frame + m_framesInFlight > m_frame; });
+    for (auto it = due; it != m_releases.end(); ++it)
+    {
+        it->release();
+    }
+    m_releases.erase(due, m_releases.end());
+
+    if (!m_moves.empty())
+    {
+        if (m_device.stagingRing().isComplete(m_moveTicket))
+        {
+            finishMoves();
+        }
+        return;
+    }
+    if (m_enabled && m_frame - m_lastPassFrame >= m_settings.intervalFrames)
+    {
+        m_lastPassFrame = m_frame;
+        startMoves();
+    }
+}
+
+void KongDefragmenter::finishMoves()
+{
+    for (const Move& move : m_moves)
+    {
+        m_releases.push_back({m_frame, move.resource->endMove()});
+        m_stats.movedBytes += move.destination.size;
+        m_stats.moveCount++;
+    }
+    m_moves.clear();
+}
+
+void KongDefragmenter::startMoves()
+{
+    KongMemoryAllocator& allocator = m_device.allocator();
+    for (const KongBlockUsage& usage : allocator.sparseBlocks(m_settings.maxBlockUsage))
+    {
+        // 块中有不能移动的资源时清空不了，移动其余的资源也没有意义
+        std::vector<KongMovableResource*> resources;
+        for (KongMovableResource* resource : m_resources)
+        {
+            if (resource->allocation().block == usage.block)
+            {
+                resources.push_back(resource);
+            }
+        }
+        if (resources.size() != usage.allocationCount)
+        {
+            continue;
+        }
+
+        VkDeviceSize passBytes = 0;
+        for (KongMovableResource* resource : resources)
+        {
+            if (passBytes >= m_settings.maxBytesPerPass)
+            {
+                break;
+            }
+            KongAllocation destination{};
+            if (!allocator.allocateForMove(resource->allocation(), resource->memoryRequirements(), destination))
+            {
+                break;
+            }
+            m_moves.push_back({resource, destination});
+            passBytes += destination.size;
+        }
+        if (!m_moves.empty())
+        {
+            break;
+        }
+    }
+    if (m_moves.empty())
+    {
+        return;
+    }
+
+    // 在graphics queue上拷贝，源资源的所有权已经在graphics queue上，不需要再转移
+    KongStagingRing& stagingRing = m_device.stagingRing();
+    m_moveTicket = stagingRing.recordGraphics([this](VkCommandBuffer commandBuffer)
+    {
+        for (const Move& move : m_moves)
+        {
+            move.resource->beginMove(commandBuffer, move.destination);
+        }
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+    });
+    stagingRing.flush(m_moveTicket);
+    m_stats.passCount++;
+}
+
+KongDefragmenterStats KongDefragmenter::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    KongDefragmenterStats stats = m_stats;
+    stats.pendingMoves = static_cast<uint32_t>(m_moves.size() + m_releases.size());
+    return stats;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "kv_memory_allocator.h"
+
+namespace kong
+{
+    class KongDevice;
+
+    /*
+     * 可以被碎片整理移动的资源，由资源自己创建新的Vulkan对象和录制拷贝
+     * 使用者每次都要通过资源查询句柄，不能缓存（比如写进descriptor set），否则移动之后会用到已经释放的对象
+     */
+    class KongMovableResource
+    {
+    public:
+        virtual ~KongMovableResource() = default;
+
+        virtual const KongAllocation& allocation() const = 0;
+        virtual VkMemoryRequirements memoryRequirements() const = 0;
+        // 在newAllocation处创建新的资源，把从旧资源拷贝的命令录制到commandBuffer中
+        virtual void beginMove(VkCommandBuffer commandBuffer, const KongAllocation& newAllocation) = 0;
+        // 拷贝已经执行完，切换到新的资源，返回的函数在旧资源不再被正在渲染的帧使用之后释放它
+        virtual std::function<void()> endMove() = 0;
+    };
+
+    struct KongDefragmenterSettings
+    {
+        // 使用率低于这个比例的块才会被清空
+        float maxBlockUsage = 0.5f;
+        // 每次整理最多移动这么多字节，分摊到多帧中
+        VkDeviceSize maxBytesPerPass = 16ull << 20;
+        // 两次整理之间至少间隔的帧数
+        uint32_t intervalFrames = 30;
+    };
+
+    struct KongDefragmenterStats
+    {
+        uint64_t movedBytes = 0;
+        uint64_t moveCount = 0;
+        uint64_t passCount = 0;
+        // 正在GPU上拷贝或者等待释放旧资源的移动
+        uint32_t pendingMoves = 0;
+    };
+
+    /*
+     * 后台增量碎片整理：每隔几帧挑一个使用率低、所有资源都可以移动的块，
+     * 把其中的资源移动到同一个pool中更满的块，块清空后由分配器释放
+     * 拷贝录制在staging ring的graphics部分中，和上传一样异步执行；拷贝完成后在帧的边界（update）切换资源，
+     * 旧资源在所有同时在渲染的帧都结束之后释放
+     * 只处理buffer，image被descriptor set引用，移动之后需要重写descriptor，不在这里处理
+     * 几何数据默认放在KongGeometryPool的页中，页不会移动，所以模型的buffer只有在--no-geometry-pool时才会被整理
+     */
+    class KongDefragmenter
+    {
+    public:
+        KongDefragmenter(KongDevice& device, uint32_t framesInFlight, const KongDefragmenterSettings& settings = {});
+        // 等待正在进行的移动并释放所有旧资源
+        ~KongDefragmenter();
+
+        KongDefragmenter(const KongDefragmenter&) = delete;
+        KongDefragmenter& operator=(const KongDefragmenter&) = delete;
+
+        // 资源的内容已经上传完成、之后不会再被写入时注册
+        void registerResource(KongMovableResource* resource);
+        // 资源销毁时调用，正在移动时返回拷贝所在的staging ring ticket，资源需要等待它之后再释放新旧两份对象
+        uint64_t unregisterResource(KongMovableResource* resource);
+
+        // 每帧在渲染线程中调用一次，在开始录制这一帧之前
+        void update();
+
+        void setEnabled(bool enabled) { m_enabled = enabled; }
+        KongDefragmenterStats stats() const;
+
+    private:
+        struct Move
+        {
+            KongMovableResource* resource;
+            KongAllocation destination;
+        };
+        struct Release
+        {
+            uint64_t frame;
+            std::function<void()> release;
+        };
+
+        // 以下函数都需要持有m_mutex
+        void finishMoves();
+        void startMoves();
+
+        KongDevice& m_device;
+        uint32_t m_framesInFlight;
+        KongDefragmenterSettings m_settings;
+        bool m_enabled = true;
+
+        mutable std::mutex m_mutex;
+        std::unordered_set<KongMovableResource*> m_resources;
+        std::vector<Move> m_moves;
+        uint64_t m_moveTicket = 0;
+        std::vector<Release> m_releases;
+        uint64_t m_frame = 0;
+        uint64_t m_lastPassFrame = 0;
+        KongDefragmenterStats m_stats{};
+    };
+}
@@ -1,4 +1,7 @@
 #include "kv_device.h"
+#include "kv_defragmenter.h"
+#include "kv_staging_ring.h"
+#include "kv_swap_chain.h"
 
 // std headers
 #include <cstring>
@@ -47,16 +50,28 @@ void DestroyDebugUtilsMessengerEXT(
 }
 
 // class member functions
-KongDevice::KongDevice(KongWindow &window) : window{window} {
+KongDevice::KongDevice(KongWindow &window, bool useTransferQueue)
+    : window{window}, useTransferQueue_{useTransferQueue} {
   createInstance();
   setupDebugMessenger();
   createSurface(); 
   pickPhysicalDevice();
   createLogicalDevice();
   createCommandPool();
+  stagingRing_ = std::make_unique<KongStagingRing>(*this);
+  defragmenter_ = std::make_unique<KongDefragmenter>(*this, KongSwapChain::MAX_FRAMES_IN_FLIGHT);
 }
 
 KongDevice::~KongDevice() {
+  defragmenter_.reset();
+  stagingRing_.reset();
+  allocator_.reset();
+  for (auto &entry : threadCommandContexts_) {
+    for (VkFence fence : entry.second->freeFences) {
+      vkDestroyFence(device_, fence, nullptr);
+    }
+    vkDestroyCommandPool(device_, entry.second->pool, nullptr);
+  }
   vkDestroyCommandPool(device_, commandPool, nullptr);
   vkDestroyDevice(device_, nullptr);
 
@@ -79,7 +94,8 @@ void KongDevice::createInstance() {
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  // 1.2 for timeline semaphores; devices that only support 1.0/1.1 still work without them
+  appInfo.apiVersion = VK_API_VERSION_1_2;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -136,8 +152,26 @@ void KongDevice::pickPhysicalDevice() {
 void KongDevice::createLogicalDevice() {
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
+  // Timeline semaphores are core in 1.2 but still optional before that
+  VkPhysicalDeviceVulkan12Features supportedFeatures12 = {};
+  supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  if (properties.apiVersion >= VK_API_VERSION_1_2) {
+    VkPhysicalDeviceFeatures2 supportedFeatures2 = {};
+    supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures2.pNext = &supportedFeatures12;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+  }
+  timelineSemaphore_ = supportedFeatures12.timelineSemaphore == VK_TRUE;
+  drawIndirectCount_ = supportedFeatures12.drawIndirectCount == VK_TRUE;
+
+  // Uploads on a separate queue are synchronized with rendering through the timeline semaphore
+  graphicsFamily_ = indices.graphicsFamily;
+  transferFamily_ = useTransferQueue_ && timelineSemaphore_ && indices.transferFamilyHasValue
+      ? indices.transferFamily
+      : indices.graphicsFamily;
+
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily, transferFamily_};
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -149,18 +183,42 @@ void KongDevice::createLogicalDevice() {
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  // Optional: cooked .kvtex textures fall back to decoding the source image without it
+  textureCompressionBC_ = supportedFeatures.textureCompressionBC == VK_TRUE;
+  // Optional: GPU culling falls back to CPU-recorded draws without them
+  multiDrawIndirect_ = supportedFeatures.multiDrawIndirect == VK_TRUE &&
+      supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
+  deviceFeatures.textureCompressionBC = textureCompressionBC_ ? VK_TRUE : VK_FALSE;
+  deviceFeatures.multiDrawIndirect = multiDrawIndirect_ ? VK_TRUE : VK_FALSE;
+  deviceFeatures.drawIndirectFirstInstance = multiDrawIndirect_ ? VK_TRUE : VK_FALSE;
+
+  VkPhysicalDeviceVulkan12Features deviceFeatures12 = {};
+  deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  deviceFeatures12.timelineSemaphore = timelineSemaphore_ ? VK_TRUE : VK_FALSE;
+  deviceFeatures12.drawIndirectCount = drawIndirectCount_ ? VK_TRUE : VK_FALSE;
 
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = timelineSemaphore_ || drawIndirectCount_ ? &deviceFeatures12 : nullptr;
 
   createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
+  // Optional: without it heap budgets are estimated from the heap sizes
+  std::vector<const char *> enabledExtensions = deviceExtensions;
+  memoryBudget_ = isExtensionAvailable(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if (memoryBudget_) {
+    enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
   // might not really be necessary anymore because device specific validation layers
   // have been deprecated
@@ -177,6 +235,15 @@ void KongDevice::createLogicalDevice() {
 
   vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
   vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+  vkGetDeviceQueue(device_, transferFamily_, 0, &transferQueue_);
+  if (hasDedicatedTransferQueue()) {
+    std::cout << "uploads on transfer queue family " << transferFamily_ << std::endl;
+  } else {
+    std::cout << "uploads on the graphics queue"
+              << (indices.transferFamilyHasValue ? "" : " (no transfer-only queue family)") << std::endl;
+  }
+
+  allocator_ = std::make_unique<KongMemoryAllocator>(physicalDevice, device_, memoryBudget_);
 }
 
 void KongDevice::createCommandPool() {
@@ -193,6 +260,29 @@ void KongDevice::createCommandPool() {
   }
 }
 
+KongDevice::ThreadCommandContext &KongDevice::getThreadCommandContext() {
+  std::lock_guard<std::mutex> lock(threadCommandPoolMutex_);
+  auto &context = threadCommandContexts_[std::this_thread::get_id()];
+  if (context) {
+    return *context;
+  }
+
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = findPhysicalQueueFamilies().graphicsFamily;
+  // Recycled command buffers are reset individually by vkBeginCommandBuffer
+  poolInfo.flags =
+      VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+  auto created = std::make_unique<ThreadCommandContext>();
+  if (vkCreateCommandPool(device_, &poolInfo, nullptr, &created->pool) != VK_SUCCESS) {
+    threadCommandContexts_.erase(std::this_thread::get_id());
+    throw std::runtime_error("failed to create command pool!");
+  }
+  context = std::move(created);
+  return *context;
+}
+
 void KongDevice::createSurface() { window.createWindowSurface(instance, &surface_); }
 
 bool KongDevice::isDeviceSuitable(VkPhysicalDevice device) {
@@ -317,6 +407,25 @@ bool KongDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   return requiredExtensions.empty();
 }
 
+bool KongDevice::isExtensionAvailable(VkPhysicalDevice device, const char *extensionName) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(
+      device,
+      nullptr,
+      &extensionCount,
+      availableExtensions.data());
+
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 QueueFamilyIndices KongDevice::findQueueFamilies(VkPhysicalDevice device) {
   QueueFamilyIndices indices;
 
@@ -328,18 +437,27 @@ QueueFamilyIndices KongDevice::findQueueFamilies(VkPhysicalDevice device) {
 
   int i = 0;
   for (const auto &queueFamily : queueFamilies) {
-    if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      indices.graphicsFamily = i;
-      indices.graphicsFamilyHasValue = true;
-    }
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
-    if (queueFamily.queueCount > 0 && presentSupport) {
-      indices.presentFamily = i;
-      indices.presentFamilyHasValue = true;
+    if (!indices.isComplete()) {
+      if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        indices.graphicsFamily = i;
+        indices.graphicsFamilyHasValue = true;
+      }
+      VkBool32 presentSupport = false;
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+      if (queueFamily.queueCount > 0 && presentSupport) {
+        indices.presentFamily = i;
+        indices.presentFamilyHasValue = true;
+      }
     }
-    if (indices.isComplete()) {
-      break;
+
+    // Texture uploads copy arbitrary rows, so only use families without an image transfer granularity
+    const VkQueueFlags flags = queueFamily.queueFlags;
+    const VkExtent3D &granularity = queueFamily.minImageTransferGranularity;
+    if (!indices.transferFamilyHasValue && queueFamily.queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && granularity.width == 1 &&
+        granularity.height == 1 && granularity.depth == 1) {
+      indices.transferFamily = i;
+      indices.transferFamilyHasValue = true;
     }
 
     i++;
@@ -374,6 +492,21 @@ SwapChainSupportDetails KongDevice::querySwapChainSupport(VkPhysicalDevice devic
   return details;
 }
 
+bool KongDevice::supportsLinearBlit(VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+  const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (props.optimalTilingFeatures & required) == required;
+}
+
+bool KongDevice::supportsSampledFormat(VkFormat format) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+  const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (props.optimalTilingFeatures & required) == required;
+}
+
 VkFormat KongDevice::findSupportedFormat(
     const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
   for (VkFormat format : candidates) {
@@ -408,7 +541,7 @@ void KongDevice::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer &buffer,
-    VkDeviceMemory &bufferMemory) {
+    KongAllocation &bufferMemory) {
   VkBufferCreateInfo bufferInfo{};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
@@ -422,27 +555,27 @@ void KongDevice::createBuffer(
   VkMemoryRequirements memRequirements;
   vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate vertex buffer memory!");
-  }
-
-  vkBindBufferMemory(device_, buffer, bufferMemory, 0);
+  bufferMemory = allocator_->allocate(memRequirements, properties, true);
+  vkBindBufferMemory(device_, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-VkCommandBuffer KongDevice::beginSingleTimeCommands() {
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
-  allocInfo.commandBufferCount = 1;
-
+VkCommandBuffer KongDevice::beginUploadBatch() {
+  ThreadCommandContext &context = getThreadCommandContext();
   VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer);
+  if (!context.freeCommandBuffers.empty()) {
+    commandBuffer = context.freeCommandBuffers.back();
+    context.freeCommandBuffers.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = context.pool;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffer!");
+    }
+    oneShotAllocations_++;
+  }
 
   VkCommandBufferBeginInfo beginInfo{};
   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -452,7 +585,8 @@ VkCommandBuffer KongDevice::beginSingleTimeCommands() {
   return commandBuffer;
 }
 
-void KongDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+void KongDevice::endUploadBatch(VkCommandBuffer commandBuffer) {
+  ThreadCommandContext &context = getThreadCommandContext();
   vkEndCommandBuffer(commandBuffer);
 
   VkSubmitInfo submitInfo{};
@@ -460,28 +594,53 @@ void KongDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffer;
 
-  vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(graphicsQueue_);
+  // Wait on a fence rather than vkQueueWaitIdle so an upload doesn't also wait for in-flight frames
+  VkFence fence;
+  if (!context.freeFences.empty()) {
+    fence = context.freeFences.back();
+    context.freeFences.pop_back();
+  } else {
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create fence!");
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    vkQueueSubmit(graphicsQueue_, 1, &submitInfo, fence);
+  }
+  oneShotSubmits_++;
+  vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);
+  vkResetFences(device_, 1, &fence);
 
-  vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
+  context.freeFences.push_back(fence);
+  context.freeCommandBuffers.push_back(commandBuffer);
 }
 
-void KongDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
+void KongDevice::recordCopyBuffer(
+    VkCommandBuffer commandBuffer,
+    VkBuffer srcBuffer,
+    VkBuffer dstBuffer,
+    VkDeviceSize size,
+    VkDeviceSize srcOffset,
+    VkDeviceSize dstOffset) {
   VkBufferCopy copyRegion{};
-  copyRegion.srcOffset = 0;  // Optional
-  copyRegion.dstOffset = 0;  // Optional
+  copyRegion.srcOffset = srcOffset;
+  copyRegion.dstOffset = dstOffset;
   copyRegion.size = size;
   vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-  endSingleTimeCommands(commandBuffer);
+  oneShotCommands_++;
 }
 
-void KongDevice::copyBufferToImage(
-    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
+void KongDevice::recordCopyBufferToImage(
+    VkCommandBuffer commandBuffer,
+    VkBuffer buffer,
+    VkImage image,
+    uint32_t width,
+    uint32_t height,
+    uint32_t layerCount) {
   VkBufferImageCopy region{};
   region.bufferOffset = 0;
   region.bufferRowLength = 0;
@@ -502,14 +661,78 @@ void KongDevice::copyBufferToImage(
       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
       1,
       &region);
-  endSingleTimeCommands(commandBuffer);
+  oneShotCommands_++;
+}
+
+void KongDevice::recordImageLayoutTransition(
+    VkCommandBuffer commandBuffer,
+    VkImage image,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    uint32_t mipLevels,
+    uint32_t layerCount) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = mipLevels;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = layerCount;
+
+  // The two transitions around an upload get precise masks, anything else a conservative full barrier
+  VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  } else if (
+      oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
+      newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+  oneShotCommands_++;
+}
+
+void KongDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+  VkCommandBuffer commandBuffer = beginUploadBatch();
+  recordCopyBuffer(commandBuffer, srcBuffer, dstBuffer, size);
+  endUploadBatch(commandBuffer);
+}
+
+void KongDevice::copyBufferToImage(
+    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount) {
+  VkCommandBuffer commandBuffer = beginUploadBatch();
+  recordCopyBufferToImage(commandBuffer, buffer, image, width, height, layerCount);
+  endUploadBatch(commandBuffer);
+}
+
+KongOneShotStats KongDevice::oneShotStats() const {
+  KongOneShotStats stats{};
+  stats.submitCount = oneShotSubmits_;
+  stats.commandCount = oneShotCommands_;
+  stats.commandBufferAllocations = oneShotAllocations_;
+  return stats;
 }
 
 void KongDevice::createImageWithInfo(
     const VkImageCreateInfo &imageInfo,
     VkMemoryPropertyFlags properties,
     VkImage &image,
-    VkDeviceMemory &imageMemory) {
+    KongAllocation &imageMemory) {
   if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS) {
     throw std::runtime_error("failed to create image!");
   }
@@ -517,16 +740,9 @@ void KongDevice::createImageWithInfo(
   VkMemoryRequirements memRequirements;
   vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate image memory!");
-  }
-
-  if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS) {
+  imageMemory = allocator_->allocate(
+      memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
+  if (vkBindImageMemory(device_, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS) {
     throw std::runtime_error("failed to bind image memory!");
   }
 }
@@ -1,25 +1,47 @@
 #pragma once
 
+#include "kv_memory_allocator.h"
 #include "kv_window.h"
 
 // std lib headers
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
 namespace kong {
 
+class KongDefragmenter;
+class KongStagingRing;
+
 struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
   std::vector<VkSurfaceFormatKHR> formats;
   std::vector<VkPresentModeKHR> presentModes;
 };
 
+// Counters for one-shot command submission (beginUploadBatch/endUploadBatch and the helpers built on it)
+struct KongOneShotStats {
+  // Every submit is followed by one fence wait
+  uint64_t submitCount = 0;
+  // Commands recorded through the record* helpers
+  uint64_t commandCount = 0;
+  // Command buffers actually allocated; recycled ones are not counted again
+  uint64_t commandBufferAllocations = 0;
+};
+
 struct QueueFamilyIndices {
   uint32_t graphicsFamily;
   uint32_t presentFamily;
+  // Transfer-only family (no graphics or compute), usually a separate DMA engine
+  uint32_t transferFamily;
   bool graphicsFamilyHasValue = false;
   bool presentFamilyHasValue = false;
+  bool transferFamilyHasValue = false;
   bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
 };
 
@@ -31,7 +53,8 @@ class KongDevice {
   const bool enableValidationLayers = true;
 #endif
 
-  KongDevice(KongWindow &window);
+  // useTransferQueue = false keeps uploads on the graphics queue even if a transfer-only family exists
+  KongDevice(KongWindow &window, bool useTransferQueue = true);
   ~KongDevice();
 
   // Not copyable or movable
@@ -45,12 +68,40 @@ class KongDevice {
   VkSurfaceKHR surface() { return surface_; }
   VkQueue graphicsQueue() { return graphicsQueue_; }
   VkQueue presentQueue() { return presentQueue_; }
+  // Queue submission must be externally synchronized; loader threads upload on the graphics queue too
+  std::mutex &queueMutex() { return queueMutex_; }
+  // Uploads go to a transfer-only queue when the device has one and supports timeline semaphores,
+  // otherwise these return the graphics queue and its mutex
+  VkQueue transferQueue() { return transferQueue_; }
+  std::mutex &transferQueueMutex() { return hasDedicatedTransferQueue() ? transferQueueMutex_ : queueMutex_; }
+  uint32_t graphicsQueueFamily() const { return graphicsFamily_; }
+  uint32_t transferQueueFamily() const { return transferFamily_; }
+  bool hasDedicatedTransferQueue() const { return transferFamily_ != graphicsFamily_; }
+  bool supportsTimelineSemaphore() const { return timelineSemaphore_; }
 
   SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
   uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
   QueueFamilyIndices findPhysicalQueueFamilies() { return findQueueFamilies(physicalDevice); }
   VkFormat findSupportedFormat(
       const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
+  // Whether vkCmdBlitImage can use VK_FILTER_LINEAR on optimal tiling images of this format (mip generation)
+  bool supportsLinearBlit(VkFormat format);
+  // Whether optimal tiling images of this format can be sampled with linear filtering (BC formats need textureCompressionBC)
+  bool supportsSampledFormat(VkFormat format);
+  bool supportsTextureCompressionBC() const { return textureCompressionBC_; }
+  // GPU-driven draws need multiDrawIndirect and a non-zero firstInstance in indirect commands
+  bool supportsMultiDrawIndirect() const { return multiDrawIndirect_; }
+  // vkCmdDrawIndexedIndirectCount (Vulkan 1.2 drawIndirectCount feature)
+  bool supportsDrawIndirectCount() const { return drawIndirectCount_; }
+
+  // Buffers and images are sub-allocated from large blocks; release their memory with allocator().free
+  KongMemoryAllocator &allocator() { return *allocator_; }
+  // Persistently mapped staging ring shared by all uploads
+  KongStagingRing &stagingRing() { return *stagingRing_; }
+  // Moves movable buffers out of sparse memory blocks; update() it once per frame
+  KongDefragmenter &defragmenter() { return *defragmenter_; }
+  // Heap budgets come from the driver when VK_EXT_memory_budget is available
+  bool supportsMemoryBudget() const { return memoryBudget_; }
 
   // Buffer Helper Functions
   void createBuffer(
@@ -58,18 +109,51 @@ class KongDevice {
       VkBufferUsageFlags usage,
       VkMemoryPropertyFlags properties,
       VkBuffer &buffer,
-      VkDeviceMemory &bufferMemory);
-  VkCommandBuffer beginSingleTimeCommands();
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+      KongAllocation &bufferMemory);
+
+  // Upload batch: record any number of copies and layout transitions into one command buffer,
+  // then endUploadBatch submits it once and waits on a single fence.
+  // Command buffers and fences are recycled per thread instead of being allocated and freed per call.
+  VkCommandBuffer beginUploadBatch();
+  void endUploadBatch(VkCommandBuffer commandBuffer);
+  // A batch holding a single command
+  VkCommandBuffer beginSingleTimeCommands() { return beginUploadBatch(); }
+  void endSingleTimeCommands(VkCommandBuffer commandBuffer) { endUploadBatch(commandBuffer); }
+
+  // Record into an open batch
+  void recordCopyBuffer(
+      VkCommandBuffer commandBuffer,
+      VkBuffer srcBuffer,
+      VkBuffer dstBuffer,
+      VkDeviceSize size,
+      VkDeviceSize srcOffset = 0,
+      VkDeviceSize dstOffset = 0);
+  void recordCopyBufferToImage(
+      VkCommandBuffer commandBuffer,
+      VkBuffer buffer,
+      VkImage image,
+      uint32_t width,
+      uint32_t height,
+      uint32_t layerCount);
+  void recordImageLayoutTransition(
+      VkCommandBuffer commandBuffer,
+      VkImage image,
+      VkImageLayout oldLayout,
+      VkImageLayout newLayout,
+      uint32_t mipLevels = 1,
+      uint32_t layerCount = 1);
+
+  // Each of these is a whole batch: one submit and one wait
   void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
   void copyBufferToImage(
       VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
+  KongOneShotStats oneShotStats() const;
 
   void createImageWithInfo(
       const VkImageCreateInfo &imageInfo,
       VkMemoryPropertyFlags properties,
       VkImage &image,
-      VkDeviceMemory &imageMemory);
+      KongAllocation &imageMemory);
 
   VkPhysicalDeviceProperties properties;
 
@@ -80,6 +164,13 @@ class KongDevice {
   void pickPhysicalDevice();
   void createLogicalDevice();
   void createCommandPool();
+  // Command pools are not thread safe, so upload batches use one pool per thread
+  struct ThreadCommandContext {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    std::vector<VkFence> freeFences;
+  };
+  ThreadCommandContext &getThreadCommandContext();
 
   // helper functions
   bool isDeviceSuitable(VkPhysicalDevice device);
@@ -89,6 +180,7 @@ class KongDevice {
   void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
   void hasGflwRequiredInstanceExtensions();
   bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+  bool isExtensionAvailable(VkPhysicalDevice device, const char *extensionName);
   SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
   VkInstance instance;
@@ -101,6 +193,27 @@ class KongDevice {
   VkSurfaceKHR surface_;
   VkQueue graphicsQueue_;
   VkQueue presentQueue_;
+  std::mutex queueMutex_;
+  VkQueue transferQueue_;
+  std::mutex transferQueueMutex_;
+  uint32_t graphicsFamily_ = 0;
+  uint32_t transferFamily_ = 0;
+  bool useTransferQueue_;
+  bool textureCompressionBC_ = false;
+  bool timelineSemaphore_ = false;
+  bool memoryBudget_ = false;
+  bool multiDrawIndirect_ = false;
+  bool drawIndirectCount_ = false;
+  std::unique_ptr<KongMemoryAllocator> allocator_;
+  std::unique_ptr<KongStagingRing> stagingRing_;
+  std::unique_ptr<KongDefragmenter> defragmenter_;
+
+  std::mutex threadCommandPoolMutex_;
+  // Only the owning thread touches its context after creation
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadCommandContext>> threadCommandContexts_;
+  std::atomic<uint64_t> oneShotSubmits_{0};
+  std::atomic<uint64_t> oneShotCommands_{0};
+  std::atomic<uint64_t> oneShotAllocations_{0};
 
   const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
   const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
@@ -0,0 +1,82 @@
+#include "kv_frame_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+using namespace kong;
+
+KongFrameAllocator::KongFrameAllocator(KongDevice& device, uint32_t frameCount, VkDeviceSize capacity)
+    : m_device(device), m_capacity(capacity)
+{
+    const VkPhysicalDeviceLimits& limits = m_device.properties.limits;
+    m_uniformAlignment = std::max<VkDeviceSize>(limits.minUniformBufferOffsetAlignment, 16);
+    m_storageAlignment = std::max<VkDeviceSize>(limits.minStorageBufferOffsetAlignment, 16);
+    m_stats.capacity = m_capacity;
+    // coherent内存不需要flush，写入之后提交的命令就能看到
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        auto buffer = std::make_unique<KongBuffer>(m_device, m_capacity, 1,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        buffer->map();
+        m_buffers.push_back(std::move(buffer));
+    }
+}
+
+void KongFrameAllocator::beginFrame(int frameIndex)
+{
+    assert(frameIndex >= 0 && frameIndex < static_cast<int>(m_buffers.size()) && "frame index out of range");
+    m_stats.lastFrameBytes = m_head;
+    m_frameIndex = frameIndex;
+    m_head = 0;
+}
+
+KongFrameAllocation KongFrameAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert((alignment & (alignment - 1)) == 0 && "alignment must be a power of two");
+    const VkDeviceSize offset = (m_head + alignment - 1) & ~(alignment - 1);
+    if (offset + size > m_capacity)
+    {
+        m_stats.overflowCount++;
+        if (!m_overflowReported)
+        {
+            m_overflowReported = true;
+            std::cout << "frame allocator overflow: " << size << " bytes requested, " << m_capacity - std::min(m_head, m_capacity)
+                << " of " << m_capacity << " left" << std::endl;
+        }
+        return {};
+    }
+    m_head = offset + size;
+    m_stats.highWaterMark = std::max(m_stats.highWaterMark, m_head);
+
+    KongBuffer& buffer = *m_buffers[m_frameIndex];
+    KongFrameAllocation allocation{};
+    allocation.data = static_cast<uint8_t*>(buffer.getMappedMemory()) + offset;
+    allocation.buffer = buffer.getBuffer();
+    allocation.offset = static_cast<uint32_t>(offset);
+    allocation.size = size;
+    return allocation;
+}
+
+KongFrameAllocation KongFrameAllocator::allocateElements(VkDeviceSize elementSize, uint32_t count, uint32_t& firstElement)
+{
+    assert(elementSize % 4 == 0 && "element size must be a multiple of 4");
+    // 多分配一个元素的空间，用于把起点对齐到elementSize
+    KongFrameAllocation allocation = allocate(elementSize * (static_cast<VkDeviceSize>(count) + 1), 4);
+    if (!allocation)
+    {
+        return allocation;
+    }
+    firstElement = static_cast<uint32_t>((allocation.offset + elementSize - 1) / elementSize);
+    const VkDeviceSize padding = firstElement * elementSize - allocation.offset;
+    allocation.data = static_cast<uint8_t*>(allocation.data) + padding;
+    allocation.offset += static_cast<uint32_t>(padding);
+    allocation.size = elementSize * count;
+    return allocation;
+}
+
+VkDescriptorBufferInfo KongFrameAllocator::descriptorInfo(int frameIndex, VkDeviceSize range) const
+{
+    return m_buffers[frameIndex]->descriptorInfo(range, 0);
+}
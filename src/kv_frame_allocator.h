@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "kv_buffer.h"
+#include "kv_device.h"
+
+namespace kong
+{
+    // 一帧之内有效的一段内存，data写入后GPU在这一帧中读取
+    struct KongFrameAllocation
+    {
+        void* data = nullptr;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        // 绑定descriptor set时作为dynamic offset
+        uint32_t offset = 0;
+        VkDeviceSize size = 0;
+
+        // 空间不足时data为空
+        explicit operator bool() const { return data != nullptr; }
+    };
+
+    struct KongFrameAllocatorStats
+    {
+        // 每帧可用的字节数
+        VkDeviceSize capacity = 0;
+        // 上一帧用掉的字节数（包括对齐）
+        VkDeviceSize lastFrameBytes = 0;
+        // 从创建开始单帧用掉的最大字节数
+        VkDeviceSize highWaterMark = 0;
+        // 空间不足分配失败的次数
+        uint64_t overflowCount = 0;
+    };
+
+    /*
+     * 每帧临时数据（UBO/SSBO）的线性分配器，每个同时在渲染的frame一个常驻映射的buffer
+     * 分配只是把写指针后移，beginFrame时这一帧上一次的fence已经signal，整段内存一起回收
+     * 所有分配都在同一个buffer中，descriptor set只需要写一次，用dynamic offset选择这一帧的数据
+     * 只在渲染线程中使用，没有加锁
+     */
+    class KongFrameAllocator
+    {
+    public:
+        static constexpr VkDeviceSize DEFAULT_CAPACITY = 4ull << 20;
+
+        KongFrameAllocator(KongDevice& device, uint32_t frameCount, VkDeviceSize capacity = DEFAULT_CAPACITY);
+
+        KongFrameAllocator(const KongFrameAllocator&) = delete;
+        KongFrameAllocator& operator=(const KongFrameAllocator&) = delete;
+
+        // 在KongRenderer::beginFrame之后调用，这时frameIndex上一次提交的命令已经执行完
+        void beginFrame(int frameIndex);
+
+        // alignment必须是2的幂，空间不足时返回空的分配并计入overflowCount
+        KongFrameAllocation allocate(VkDeviceSize size, VkDeviceSize alignment);
+        // 按minUniformBufferOffsetAlignment/minStorageBufferOffsetAlignment对齐，可以直接作为dynamic offset
+        KongFrameAllocation allocateUniform(VkDeviceSize size) { return allocate(size, m_uniformAlignment); }
+        KongFrameAllocation allocateStorage(VkDeviceSize size) { return allocate(size, m_storageAlignment); }
+
+        template <typename T>
+        KongFrameAllocation pushUniform(const T& value)
+        {
+            KongFrameAllocation allocation = allocateUniform(sizeof(T));
+            if (allocation)
+            {
+                std::memcpy(allocation.data, &value, sizeof(T));
+            }
+            return allocation;
+        }
+
+        /*
+         * 分配count个elementSize大小的元素，起点对齐到elementSize的整数倍（不必是2的幂）
+         * 着色器把整个buffer当作元素数组时用firstElement索引，比如作为firstInstance传给draw命令
+         */
+        KongFrameAllocation allocateElements(VkDeviceSize elementSize, uint32_t count, uint32_t& firstElement);
+
+        // 写descriptor set用，range为着色器一次读取的大小，dynamic offset加range不能超过buffer的大小
+        VkDescriptorBufferInfo descriptorInfo(int frameIndex, VkDeviceSize range) const;
+
+        const KongFrameAllocatorStats& stats() const { return m_stats; }
+
+    private:
+        KongDevice& m_device;
+        VkDeviceSize m_capacity;
+        VkDeviceSize m_uniformAlignment;
+        VkDeviceSize m_storageAlignment;
+        std::vector<std::unique_ptr<KongBuffer>> m_buffers;
+
+        int m_frameIndex = 0;
+        VkDeviceSize m_head = 0;
+        bool m_overflowReported = false;
+        KongFrameAllocatorStats m_stats{};
+    };
+}
@@ -1,9 +1,18 @@
 #pragma once
 #include "kv_buffer.h"
 #include "kv_camera.h"
+#include "kv_frame_allocator.h"
 
 namespace kong
 {
+    // 每个实例在storage buffer中的数据，和shader中的InstanceData一致（std430）
+    struct KongInstanceData
+    {
+        glm::mat4 modelMatrix{1.0f};
+        glm::mat4 normalMatrix{1.0f};
+        glm::vec4 color{1.0f};
+    };
+
     struct FrameInfo
     {
         int frameIndex;
@@ -11,5 +20,11 @@ namespace kong
         VkCommandBuffer commandBuffer;
         KongCamera& camera;
         VkDescriptorSet globalDescriptorSet;
+        // globalDescriptorSet中GlobalUbo的dynamic offset
+        uint32_t globalUboOffset;
+        // 这一帧的临时UBO/SSBO数据从这里分配
+        KongFrameAllocator& frameAllocator;
+        // 交换链的大小，用于把物体的投影大小换算成像素
+        VkExtent2D extent;
     };
 }
@@ -0,0 +1,199 @@
+#include "kv_frustum_culler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define KV_CULL_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KV_CULL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace kong;
+
+namespace
+{
+    constexpr size_t BATCH_SIZE = KongCullingBounds::BATCH_SIZE;
+
+    // 按mask的位从低到高追加可见物体的编号
+    void appendVisible(uint32_t mask, size_t first, std::vector<uint32_t>& visible)
+    {
+        for (uint32_t lane = 0; mask != 0; lane++, mask >>= 1)
+        {
+            if (mask & 1)
+            {
+                visible.push_back(static_cast<uint32_t>(first + lane));
+            }
+        }
+    }
+
+#if defined(KV_CULL_AVX2)
+    // 平面的分量预先广播到8个通道，法线的绝对值用于AABB投影
+    struct PlaneLanes
+    {
+        __m256 x, y, z, w;
+        __m256 absX, absY, absZ;
+    };
+
+    // 返回8个物体的可见mask，第i位对应first + i
+    uint32_t testBatch(const PlaneLanes (&planes)[6], const KongCullingBounds& bounds, size_t first)
+    {
+        const __m256 centerX = _mm256_loadu_ps(bounds.centerX() + first);
+        const __m256 centerY = _mm256_loadu_ps(bounds.centerY() + first);
+        const __m256 centerZ = _mm256_loadu_ps(bounds.centerZ() + first);
+        const __m256 extentX = _mm256_loadu_ps(bounds.extentX() + first);
+        const __m256 extentY = _mm256_loadu_ps(bounds.extentY() + first);
+        const __m256 extentZ = _mm256_loadu_ps(bounds.extentZ() + first);
+        const __m256 radius = _mm256_loadu_ps(bounds.radius() + first);
+        const __m256 zero = _mm256_setzero_ps();
+
+        __m256 outside = zero;
+        for (const PlaneLanes& plane : planes)
+        {
+            const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(plane.x, centerX), _mm256_mul_ps(plane.y, centerY)), _mm256_mul_ps(plane.z, centerZ)), plane.w);
+            const __m256 projected = _mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(plane.absX, extentX), _mm256_mul_ps(plane.absY, extentY)), _mm256_mul_ps(plane.absZ, extentZ));
+            const __m256 reach = _mm256_min_ps(radius, projected);
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_sub_ps(zero, reach), _CMP_LT_OQ));
+        }
+        return ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFFu;
+    }
+#elif defined(KV_CULL_SSE2)
+    struct PlaneLanes
+    {
+        __m128 x, y, z, w;
+        __m128 absX, absY, absZ;
+    };
+
+    // 返回4个物体的可见mask，第i位对应first + i
+    uint32_t testHalf(const PlaneLanes (&planes)[6], const KongCullingBounds& bounds, size_t first)
+    {
+        const __m128 centerX = _mm_loadu_ps(bounds.centerX() + first);
+        const __m128 centerY = _mm_loadu_ps(bounds.centerY() + first);
+        const __m128 centerZ = _mm_loadu_ps(bounds.centerZ() + first);
+        const __m128 extentX = _mm_loadu_ps(bounds.extentX() + first);
+        const __m128 extentY = _mm_loadu_ps(bounds.extentY() + first);
+        const __m128 extentZ = _mm_loadu_ps(bounds.extentZ() + first);
+        const __m128 radius = _mm_loadu_ps(bounds.radius() + first);
+        const __m128 zero = _mm_setzero_ps();
+
+        __m128 outside = zero;
+        for (const PlaneLanes& plane : planes)
+        {
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(plane.x, centerX), _mm_mul_ps(plane.y, centerY)), _mm_mul_ps(plane.z, centerZ)), plane.w);
+            const __m128 projected = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(plane.absX, extentX), _mm_mul_ps(plane.absY, extentY)), _mm_mul_ps(plane.absZ, extentZ));
+            const __m128 reach = _mm_min_ps(radius, projected);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_sub_ps(zero, reach)));
+        }
+        return ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xFu;
+    }
+
+    // 一批8个物体分成两组4个
+    uint32_t testBatch(const PlaneLanes (&planes)[6], const KongCullingBounds& bounds, size_t first)
+    {
+        return testHalf(planes, bounds, first) | testHalf(planes, bounds, first + 4) << 4;
+    }
+#endif
+}
+
+void KongCullingBounds::resize(size_t count)
+{
+    m_count = count;
+    // 补齐的部分不会被读出结果，不用清零
+    const size_t padded = (count + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+    for (auto* component : {&m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ, &m_radius})
+    {
+        component->resize(padded);
+    }
+}
+
+void KongCullingBounds::set(size_t index, const glm::mat4& world, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    const glm::vec3 center = glm::vec3(world * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+    const glm::vec3 halfSize = (boundsMax - boundsMin) * 0.5f;
+    // 变换之后的AABB：每个轴的半边长是三个半边长在这个轴上投影的绝对值之和
+    glm::vec3 extent{};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent[axis] = std::abs(world[0][axis]) * halfSize.x + std::abs(world[1][axis]) * halfSize.y
+            + std::abs(world[2][axis]) * halfSize.z;
+    }
+    const float scale = std::max({glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))});
+
+    m_centerX[index] = center.x;
+    m_centerY[index] = center.y;
+    m_centerZ[index] = center.z;
+    m_extentX[index] = extent.x;
+    m_extentY[index] = extent.y;
+    m_extentZ[index] = extent.z;
+    m_radius[index] = glm::length(halfSize) * scale;
+}
+
+void KongFrustumCuller::cull(const std::array<glm::vec4, 6>& planes, const KongCullingBounds& bounds, std::vector<uint32_t>& visible)
+{
+#if defined(KV_CULL_AVX2) || defined(KV_CULL_SSE2)
+    PlaneLanes lanes[6];
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        const glm::vec4& plane = planes[i];
+#if defined(KV_CULL_AVX2)
+        lanes[i] = {_mm256_set1_ps(plane.x), _mm256_set1_ps(plane.y), _mm256_set1_ps(plane.z), _mm256_set1_ps(plane.w),
+            _mm256_set1_ps(std::abs(plane.x)), _mm256_set1_ps(std::abs(plane.y)), _mm256_set1_ps(std::abs(plane.z))};
+#else
+        lanes[i] = {_mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z), _mm_set1_ps(plane.w),
+            _mm_set1_ps(std::abs(plane.x)), _mm_set1_ps(std::abs(plane.y)), _mm_set1_ps(std::abs(plane.z))};
+#endif
+    }
+
+    visible.clear();
+    const size_t count = bounds.size();
+    for (size_t first = 0; first < count; first += BATCH_SIZE)
+    {
+        uint32_t mask = testBatch(lanes, bounds, first);
+        // 最后一批中补齐的部分
+        if (count - first < BATCH_SIZE)
+        {
+            mask &= (1u << (count - first)) - 1;
+        }
+        appendVisible(mask, first, visible);
+    }
+#else
+    cullScalar(planes, bounds, visible);
+#endif
+}
+
+void KongFrustumCuller::cullScalar(const std::array<glm::vec4, 6>& planes, const KongCullingBounds& bounds, std::vector<uint32_t>& visible)
+{
+    visible.clear();
+    for (size_t i = 0; i < bounds.size(); i++)
+    {
+        const bool outside = std::any_of(planes.begin(), planes.end(), [&](const glm::vec4& plane)
+        {
+            const float distance = plane.x * bounds.centerX()[i] + plane.y * bounds.centerY()[i] + plane.z * bounds.centerZ()[i] + plane.w;
+            const float projected = std::abs(plane.x) * bounds.extentX()[i] + std::abs(plane.y) * bounds.extentY()[i]
+                + std::abs(plane.z) * bounds.extentZ()[i];
+            const float reach = bounds.radius()[i] < projected ? bounds.radius()[i] : projected;
+            return distance < -reach;
+        });
+        if (!outside)
+        {
+            visible.push_back(static_cast<uint32_t>(i));
+        }
+    }
+}
+
+const char* KongFrustumCuller::simdName()
+{
+#if defined(KV_CULL_AVX2)
+    return "avx2";
+#elif defined(KV_CULL_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace kong
+{
+    /*
+     * 世界空间包围体的SoA存储，每个物体一个包围球和一个AABB，同一分量连续存放，SIMD一次读取8个物体
+     * 数组的长度补齐到BATCH_SIZE的整数倍，补齐的部分不会出现在剔除结果中
+     */
+    class KongCullingBounds
+    {
+    public:
+        static constexpr size_t BATCH_SIZE = 8;
+
+        void resize(size_t count);
+        size_t size() const { return m_count; }
+
+        // 把模型空间的AABB变换到世界空间；包围球以AABB中心为球心，半径按最大的缩放放大
+        void set(size_t index, const glm::mat4& world, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        // 以下数组的长度都是补齐之后的长度
+        const float* centerX() const { return m_centerX.data(); }
+        const float* centerY() const { return m_centerY.data(); }
+        const float* centerZ() const { return m_centerZ.data(); }
+        const float* extentX() const { return m_extentX.data(); }
+        const float* extentY() const { return m_extentY.data(); }
+        const float* extentZ() const { return m_extentZ.data(); }
+        const float* radius() const { return m_radius.data(); }
+
+    private:
+        size_t m_count = 0;
+        // AABB的中心同时也是包围球的球心
+        std::vector<float> m_centerX;
+        std::vector<float> m_centerY;
+        std::vector<float> m_centerZ;
+        // AABB的半边长
+        std::vector<float> m_extentX;
+        std::vector<float> m_extentY;
+        std::vector<float> m_extentZ;
+        std::vector<float> m_radius;
+    };
+
+    /*
+     * CPU视锥剔除：对每个平面取包围球半径和AABB在法线上投影的半径中较小的一个，中心到平面的距离小于它的负值时不可见
+     * 编译时开启AVX2（KONG_AVX2）时一次测试8个物体，否则用SSE2分成两组4个，两者都没有时逐个测试
+     */
+    class KongFrustumCuller
+    {
+    public:
+        // planes为KongCamera::GetFrustumPlanes的结果，把可见物体的编号按顺序写入visible
+        static void cull(const std::array<glm::vec4, 6>& planes, const KongCullingBounds& bounds, std::vector<uint32_t>& visible);
+        // 逐个物体的参考实现，计算顺序和SIMD版本一致，结果应该完全相同
+        static void cullScalar(const std::array<glm::vec4, 6>& planes, const KongCullingBounds& bounds, std::vector<uint32_t>& visible);
+
+        // 编译进来的实现："avx2"、"sse2"或者"scalar"
+        static const char* simdName();
+    };
+}
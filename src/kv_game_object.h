@@ -2,6 +2,8 @@
 #include <memory>
 
 #include "kv_model.h"
+#include "kv_asset_loader.h"
+#include "kv_texture_streamer.h"
 #include "glm/ext/matrix_transform.hpp"
 
 namespace kong
@@ -66,8 +68,18 @@ namespace kong
         id_t getId() const {return id;}
 
         std::shared_ptr<KongModel> model{};
-        glm::vec3 color{};
+        // 异步加载中的模型，加载完成后由渲染系统替换掉model；在此之前model是代理模型，为空时不绘制
+        std::shared_ptr<KongModelHandle> pendingModel{};
+        // 漫反射贴图，为空时使用渲染系统的白色默认贴图
+        std::shared_ptr<KongTexture> texture{};
+        std::shared_ptr<KongTextureHandle> pendingTexture{};
+        // 按mip流式加载的漫反射贴图，有可用的mip时优先于texture
+        std::shared_ptr<KongStreamedTexture> streamedTexture{};
+        // 和顶点颜色、贴图相乘
+        glm::vec3 color{1.0f, 1.0f, 1.0f};
         TransformComponent transform{};
+        // 上一帧使用的LOD，用于切换时的滞后判断
+        uint32_t currentLod = 0;
     private:
         KongGameObject(id_t objId) : id(objId) {};
 
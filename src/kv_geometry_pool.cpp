@@ -0,0 +1,266 @@
+#include "kv_geometry_pool.h"
+
+#include <algorithm>
+
+using namespace kong;
+
+namespace
+{
+    uint32_t indexSize(VkIndexType indexType)
+    {
+        return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    bool sameLayout(const KongVertexLayout& a, const KongVertexLayout& b)
+    {
+        return a.format == b.format && a.splitPositions == b.splitPositions;
+    }
+
+    // TLSF按16个单位对齐，页的容量也取16的倍数
+    uint32_t roundCapacity(uint64_t count)
+    {
+        const uint64_t alignment = KongTlsfAllocator::MIN_ALIGNMENT;
+        return static_cast<uint32_t>(std::max<uint64_t>((count + alignment - 1) & ~(alignment - 1), alignment));
+    }
+
+    // 单独占一页的模型释放之后整页释放，普通页留给之后加载的模型
+    template <typename Page>
+    void releaseIfEmpty(std::vector<std::unique_ptr<Page>>& pages, Page* page)
+    {
+        if (!page->dedicated || !page->allocator.empty())
+        {
+            return;
+        }
+        pages.erase(std::find_if(pages.begin(), pages.end(), [page](const std::unique_ptr<Page>& p) { return p.get() == page; }));
+    }
+}
+
+KongGeometryPool::KongGeometryPool(KongDevice& device, const KongGeometryPoolSettings& settings)
+    : m_device(device), m_settings(settings)
+{
+}
+
+KongGeometryPool::~KongGeometryPool() = default;
+
+KongGeometryVertexPage& KongGeometryPool::createVertexPage(const KongVertexLayout& layout, uint32_t capacity, bool dedicated)
+{
+    auto page = std::make_unique<KongGeometryVertexPage>(capacity);
+    page->layout = layout;
+    page->dedicated = dedicated;
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (layout.splitPositions)
+    {
+        page->positions = std::make_unique<KongBuffer>(m_device, KongVertexFormats::positionSize(layout.format), capacity,
+            usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    page->vertices = std::make_unique<KongBuffer>(m_device,
+        KongVertexFormats::streamStride(layout, KongVertexFormats::STREAM_ATTRIBUTES), capacity, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_vertexPages.push_back(std::move(page));
+    return *m_vertexPages.back();
+}
+
+KongGeometryIndexPage& KongGeometryPool::createIndexPage(VkIndexType indexType, uint32_t capacity, bool dedicated)
+{
+    auto page = std::make_unique<KongGeometryIndexPage>(capacity);
+    page->indexType = indexType;
+    page->dedicated = dedicated;
+    page->buffer = std::make_unique<KongBuffer>(m_device, indexSize(indexType), capacity,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_indexPages.push_back(std::move(page));
+    return *m_indexPages.back();
+}
+
+void KongGeometryPool::allocateVertices(KongGeometryRange& range, const KongVertexLayout& layout, uint32_t vertexCount)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t first = 0;
+    for (auto& page : m_vertexPages)
+    {
+        if (!page->dedicated && sameLayout(page->layout, layout) && page->allocator.allocate(vertexCount, 1, first))
+        {
+            range.vertexPage = page.get();
+            range.firstVertex = static_cast<uint32_t>(first);
+            range.vertexCount = vertexCount;
+            return;
+        }
+    }
+
+    // 比一页还大的模型单独占一页
+    const uint32_t pageCapacity = m_settings.vertexPageBytes > 0
+        ? roundCapacity(m_settings.vertexPageBytes / KongVertexFormats::stride(layout.format))
+        : 0;
+    const bool dedicated = vertexCount > pageCapacity;
+    KongGeometryVertexPage& page = createVertexPage(layout, dedicated ? roundCapacity(vertexCount) : pageCapacity, dedicated);
+    page.allocator.allocate(vertexCount, 1, first);
+    range.vertexPage = &page;
+    range.firstVertex = static_cast<uint32_t>(first);
+    range.vertexCount = vertexCount;
+}
+
+void KongGeometryPool::allocateIndices(KongGeometryRange& range, VkIndexType indexType, uint32_t indexCount)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t first = 0;
+    for (auto& page : m_indexPages)
+    {
+        if (!page->dedicated && page->indexType == indexType && page->allocator.allocate(indexCount, 1, first))
+        {
+            range.indexPage = page.get();
+            range.firstIndex = static_cast<uint32_t>(first);
+            range.indexCount = indexCount;
+            return;
+        }
+    }
+
+    const uint32_t pageCapacity = m_settings.indexPageBytes > 0 ? roundCapacity(m_settings.indexPageBytes / indexSize(indexType)) : 0;
+    const bool dedicated = indexCount > pageCapacity;
+    KongGeometryIndexPage& page = createIndexPage(indexType, dedicated ? roundCapacity(indexCount) : pageCapacity, dedicated);
+    page.allocator.allocate(indexCount, 1, first);
+    range.indexPage = &page;
+    range.firstIndex = static_cast<uint32_t>(first);
+    range.indexCount = indexCount;
+}
+
+void KongGeometryPool::free(KongGeometryRange& range)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (range.vertexPage)
+    {
+        range.vertexPage->allocator.free(range.firstVertex);
+        releaseIfEmpty(m_vertexPages, range.vertexPage);
+    }
+    if (range.indexPage)
+    {
+        range.indexPage->allocator.free(range.firstIndex);
+        releaseIfEmpty(m_indexPages, range.indexPage);
+    }
+    range = {};
+}
+
+uint64_t KongGeometryPool::upload(uint32_t count, const std::vector<UploadStream>& streams, const Fill& fill)
+{
+    KongStagingRing& stagingRing = m_device.stagingRing();
+    VkDeviceSize elementSize = 0;
+    for (const auto& stream : streams)
+    {
+        elementSize += stream.stride;
+    }
+    // 比ring的单次上传还大时按元素分块，每块直接写进ring，不经过临时内存
+    const auto chunkCount = static_cast<uint32_t>(std::max<VkDeviceSize>(stagingRing.maxUploadSize() / elementSize, 1));
+    uint64_t ticket = 0;
+    std::vector<KongStagingRing::BufferRegion> regions(streams.size());
+    for (uint32_t first = 0; first < count; first += chunkCount)
+    {
+        const uint32_t chunk = std::min(chunkCount, count - first);
+        // 只交出这个模型的范围，页中其他模型的数据还在被渲染使用；拷贝和release由ring在同一批中录制
+        for (size_t i = 0; i < streams.size(); i++)
+        {
+            regions[i] = {streams[i].buffer, streams[i].dstOffset + streams[i].stride * first, streams[i].stride * chunk};
+        }
+        ticket = stagingRing.uploadBuffers(regions,
+            [&](void* mapped, VkDeviceSize, VkDeviceSize) { fill(mapped, first, chunk); });
+    }
+    return ticket;
+}
+
+uint64_t KongGeometryPool::uploadVertices(const KongGeometryRange& range, const Fill& fill)
+{
+    const KongVertexLayout& layout = range.vertexPage->layout;
+    const VkDeviceSize attributeStride = KongVertexFormats::streamStride(layout, KongVertexFormats::STREAM_ATTRIBUTES);
+    std::vector<UploadStream> streams;
+    if (layout.splitPositions)
+    {
+        const VkDeviceSize positionStride = KongVertexFormats::positionSize(layout.format);
+        streams.push_back({range.vertexPage->positions->getBuffer(), positionStride * range.firstVertex, positionStride});
+    }
+    streams.push_back({range.vertexPage->vertices->getBuffer(), attributeStride * range.firstVertex, attributeStride});
+    return upload(range.vertexCount, streams, fill);
+}
+
+uint64_t KongGeometryPool::uploadIndices(const KongGeometryRange& range, const Fill& fill)
+{
+    const VkDeviceSize stride = indexSize(range.indexPage->indexType);
+    return upload(range.indexCount, {{range.indexPage->buffer->getBuffer(), stride * range.firstIndex, stride}}, fill);
+}
+
+void KongGeometryPool::setMovable(const KongGeometryRange& range)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // 共享的页之后还会上传其他模型的数据，不能移动
+    // 单独的页大于一整页，默认设置下总是单独分配的内存，这里的setMovable不会生效，只是在页大小调小之后让它们也能被整理
+    if (range.vertexPage && range.vertexPage->dedicated)
+    {
+        if (range.vertexPage->positions)
+        {
+            range.vertexPage->positions->setMovable();
+        }
+        range.vertexPage->vertices->setMovable();
+    }
+    if (range.indexPage && range.indexPage->dedicated)
+    {
+        range.indexPage->buffer->setMovable();
+    }
+}
+
+void KongGeometryPool::bind(VkCommandBuffer commandBuffer, const KongGeometryRange& range, uint32_t streams, KongGeometryBindState& state)
+{
+    const KongGeometryVertexPage* vertexPage = range.vertexPage;
+    if (!vertexPage->layout.splitPositions)
+    {
+        streams = KongVertexFormats::STREAM_ALL;
+    }
+    // 同一页已经绑定过需要的数据流时不用再绑定
+    if (vertexPage != state.vertexPage || (streams & ~state.vertexStreams) != 0)
+    {
+        VkBuffer buffers[] = {
+            vertexPage->positions ? vertexPage->positions->getBuffer() : vertexPage->vertices->getBuffer(),
+            vertexPage->vertices->getBuffer()
+        };
+        VkDeviceSize offsets[] = {0, 0};
+        if (!vertexPage->layout.splitPositions)
+        {
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+        }
+        else if (streams == KongVertexFormats::STREAM_ALL)
+        {
+            vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+        }
+        else
+        {
+            const uint32_t binding = streams == KongVertexFormats::STREAM_POSITION ? 0 : 1;
+            vkCmdBindVertexBuffers(commandBuffer, binding, 1, &buffers[binding], &offsets[binding]);
+        }
+        state.vertexStreams = vertexPage == state.vertexPage ? state.vertexStreams | streams : streams;
+        state.vertexPage = vertexPage;
+        state.bindCount++;
+    }
+
+    if (range.indexPage && range.indexPage != state.indexPage)
+    {
+        vkCmdBindIndexBuffer(commandBuffer, range.indexPage->buffer->getBuffer(), 0, range.indexPage->indexType);
+        state.indexPage = range.indexPage;
+        state.bindCount++;
+    }
+}
+
+KongGeometryPoolStats KongGeometryPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    KongGeometryPoolStats stats{};
+    for (const auto& page : m_vertexPages)
+    {
+        const uint64_t stride = KongVertexFormats::stride(page->layout.format);
+        stats.pageCount++;
+        stats.rangeCount += page->allocator.allocationCount();
+        stats.usedBytes += page->allocator.usedBytes() * stride;
+        stats.reservedBytes += page->allocator.size() * stride;
+    }
+    for (const auto& page : m_indexPages)
+    {
+        const uint64_t stride = indexSize(page->indexType);
+        stats.pageCount++;
+        stats.usedBytes += page->allocator.usedBytes() * stride;
+        stats.reservedBytes += page->allocator.size() * stride;
+    }
+    return stats;
+}
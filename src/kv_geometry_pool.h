@@ -0,0 +1,133 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "kv_buffer.h"
+#include "kv_device.h"
+#include "kv_memory_allocator.h"
+#include "kv_staging_ring.h"
+#include "kv_vertex_format.h"
+
+namespace kong
+{
+    struct KongGeometryPoolSettings
+    {
+        // 每页vertex/index buffer的大小，为0时每次分配单独创建刚好大小的buffer，相当于不使用池
+        VkDeviceSize vertexPageBytes = 64ull << 20;
+        VkDeviceSize indexPageBytes = 32ull << 20;
+    };
+
+    // 同一种顶点布局共用的一页vertex buffer，position分开存放时position和其余属性各一个buffer
+    struct KongGeometryVertexPage
+    {
+        KongGeometryVertexPage(uint32_t capacity) : allocator(capacity) {}
+
+        KongVertexLayout layout{};
+        std::unique_ptr<KongBuffer> positions{};
+        // 交错存放的完整顶点，或者position分开存放时的其余属性
+        std::unique_ptr<KongBuffer> vertices{};
+        // 以顶点个数为单位
+        KongTlsfAllocator allocator;
+        bool dedicated = false;
+    };
+
+    struct KongGeometryIndexPage
+    {
+        KongGeometryIndexPage(uint32_t capacity) : allocator(capacity) {}
+
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        std::unique_ptr<KongBuffer> buffer{};
+        // 以index个数为单位
+        KongTlsfAllocator allocator;
+        bool dedicated = false;
+    };
+
+    // 一个模型在池中占用的顶点和index，draw时加在DrawRange的vertexOffset/firstIndex上
+    struct KongGeometryRange
+    {
+        KongGeometryVertexPage* vertexPage = nullptr;
+        uint32_t firstVertex = 0;
+        uint32_t vertexCount = 0;
+        KongGeometryIndexPage* indexPage = nullptr;
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+    };
+
+    // 录制一个pass时当前绑定的几何buffer，和上一个物体相同时跳过bind
+    struct KongGeometryBindState
+    {
+        const KongGeometryVertexPage* vertexPage = nullptr;
+        uint32_t vertexStreams = 0;
+        const KongGeometryIndexPage* indexPage = nullptr;
+        // vkCmdBindVertexBuffers和vkCmdBindIndexBuffer的调用次数
+        uint32_t bindCount = 0;
+    };
+
+    struct KongGeometryPoolStats
+    {
+        uint32_t pageCount = 0;
+        uint32_t rangeCount = 0;
+        uint64_t usedBytes = 0;
+        uint64_t reservedBytes = 0;
+    };
+
+    /*
+     * 所有模型共用的几个大vertex/index buffer，模型只记录自己在其中的范围
+     * 每种顶点布局一组vertex页，16位和32位index各一组index页，一页放不下时再开新页
+     * 页内用TLSF按元素个数分配，TLSF的16对齐相当于每段范围从16个元素的边界开始
+     * 一个pass中所有模型共用同一页时只需要绑定一次，也是之后合并成indirect draw的前提
+     * 可以在加载线程中分配和上传
+     */
+    class KongGeometryPool
+    {
+    public:
+        KongGeometryPool(KongDevice& device, const KongGeometryPoolSettings& settings = {});
+        ~KongGeometryPool();
+
+        KongGeometryPool(const KongGeometryPool&) = delete;
+        KongGeometryPool& operator=(const KongGeometryPool&) = delete;
+
+        void allocateVertices(KongGeometryRange& range, const KongVertexLayout& layout, uint32_t vertexCount);
+        void allocateIndices(KongGeometryRange& range, VkIndexType indexType, uint32_t indexCount);
+        void free(KongGeometryRange& range);
+
+        // fill把第first个开始的count个元素直接写进staging ring，超过ring单次上传大小时按元素分块，每块调用一次
+        using Fill = std::function<void(void* dst, uint32_t first, uint32_t count)>;
+        // fill写入的数据和KongModel::packVertices的输出一致：position分开存放时先是count个position，再是count个其余属性
+        // 通过设备的staging ring上传，返回的ticket交给KongStagingRing::wait等待上传完成
+        uint64_t uploadVertices(const KongGeometryRange& range, const Fill& fill);
+        uint64_t uploadIndices(const KongGeometryRange& range, const Fill& fill);
+
+        // 上传完成之后调用：单独占一页的范围不会再被写入，交给碎片整理移动；bind每次都重新查询buffer，移动之后不需要更新
+        // 注意：共享的页永远不会移动，单独的页比一整页还大，超过分配器块大小的一半，总是使用单独的VkDeviceMemory，碎片整理也会跳过
+        // 所以默认设置下几何数据实际上不会被移动，只有--no-geometry-pool时每个模型的buffer才会被碎片整理
+        void setMovable(const KongGeometryRange& range);
+
+        // streams为pipeline读取的数据流，position分开存放时只绑定需要的binding
+        static void bind(VkCommandBuffer commandBuffer, const KongGeometryRange& range, uint32_t streams, KongGeometryBindState& state);
+
+        KongGeometryPoolStats stats() const;
+
+    private:
+        KongGeometryVertexPage& createVertexPage(const KongVertexLayout& layout, uint32_t capacity, bool dedicated);
+        KongGeometryIndexPage& createIndexPage(VkIndexType indexType, uint32_t capacity, bool dedicated);
+        // 元素在一个目标buffer中的数据流：每个元素stride字节，第0个元素在dstOffset
+        struct UploadStream
+        {
+            VkBuffer buffer;
+            VkDeviceSize dstOffset;
+            VkDeviceSize stride;
+        };
+        // 从staging ring拷贝到一个或两个目标buffer，每块在ring中依次是各个数据流的这一段元素
+        uint64_t upload(uint32_t count, const std::vector<UploadStream>& streams, const Fill& fill);
+
+        KongDevice& m_device;
+        KongGeometryPoolSettings m_settings;
+
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<KongGeometryVertexPage>> m_vertexPages;
+        std::vector<std::unique_ptr<KongGeometryIndexPage>> m_indexPages;
+    };
+}
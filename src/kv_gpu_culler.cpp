@@ -0,0 +1,270 @@
+#include "kv_gpu_culler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace kong;
+
+namespace
+{
+    constexpr VkDeviceSize COMMAND_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+
+    // 前6个binding是frame allocator中的输入数组，之后是命令和计数
+    constexpr uint32_t INPUT_BINDING_COUNT = 6;
+    constexpr uint32_t COMMANDS_BINDING = 6;
+    constexpr uint32_t COUNTS_BINDING = 7;
+
+    struct CullPushConstants
+    {
+        uint32_t paramsIndex;
+    };
+}
+
+static_assert(sizeof(KongGpuCullMesh) == 96, "KongGpuCullMesh must match the std430 layout in cull.comp");
+static_assert(sizeof(KongGpuCullLod) == 16, "KongGpuCullLod must match the std430 layout in cull.comp");
+static_assert(sizeof(KongGpuDrawTemplate) == 16, "KongGpuDrawTemplate must match the std430 layout in cull.comp");
+static_assert(sizeof(KongGpuCullParams) == 160, "KongGpuCullParams must match the std430 layout in cull.comp");
+
+void KongGpuCullParams::setCamera(const glm::mat4& projection, const glm::mat4& view)
+{
+    planes = KongCamera::ExtractFrustumPlanes(projection * view);
+    cameraPosition = glm::vec4(glm::vec3(glm::inverse(view)[3]), 1.0f);
+}
+
+KongGpuCuller::KongGpuCuller(KongDevice& device, uint32_t framesInFlight) : m_device(device), m_frames(framesInFlight)
+{
+    createPipeline();
+}
+
+KongGpuCuller::~KongGpuCuller()
+{
+    vkDestroyPipelineLayout(m_device.device(), m_pipelineLayout, nullptr);
+}
+
+bool KongGpuCuller::isSupported(const KongDevice& device)
+{
+    return device.supportsMultiDrawIndirect();
+}
+
+void KongGpuCuller::createPipeline()
+{
+    KongDescriptorSetLayout::Builder layoutBuilder(m_device);
+    for (uint32_t binding = 0; binding <= COUNTS_BINDING; binding++)
+    {
+        layoutBuilder.addBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+    m_setLayout = layoutBuilder.build();
+    const auto frameCount = static_cast<uint32_t>(m_frames.size());
+    m_pool = KongDescriptorPool::Builder(m_device)
+        .setMaxSets(frameCount)
+        .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frameCount * (COUNTS_BINDING + 1))
+        .build();
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstants);
+
+    VkDescriptorSetLayout setLayout = m_setLayout->getDescriptorSetLayout();
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(m_device.device(), &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create cull pipeline layout!");
+    }
+    m_pipeline = std::make_unique<KongComputePipeline>(m_device, "../resource/shader/cull.comp.spv", m_pipelineLayout);
+}
+
+void KongGpuCuller::prepareFrame(const FrameInfo& frameInfo, uint32_t commandCount, uint32_t batchCount)
+{
+    FrameResources& frame = m_frames[frameInfo.frameIndex];
+    // beginFrame已经等待了这一帧上一次的fence，旧的buffer不再被使用，可以直接替换
+    bool changed = frame.descriptorSet == VK_NULL_HANDLE;
+    if (commandCount > frame.commandCapacity)
+    {
+        frame.commandCapacity = std::max(commandCount, frame.commandCapacity * 2);
+        frame.commands = std::make_unique<KongBuffer>(m_device, COMMAND_STRIDE, frame.commandCapacity,
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        changed = true;
+    }
+    if (batchCount > frame.batchCapacity)
+    {
+        frame.batchCapacity = std::max(batchCount, frame.batchCapacity * 2);
+        frame.counts = std::make_unique<KongBuffer>(m_device, sizeof(uint32_t), frame.batchCapacity,
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        changed = true;
+    }
+    VkDescriptorBufferInfo inputInfo = frameInfo.frameAllocator.descriptorInfo(frameInfo.frameIndex, VK_WHOLE_SIZE);
+    if (inputInfo.buffer != frame.frameBuffer)
+    {
+        frame.frameBuffer = inputInfo.buffer;
+        changed = true;
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    VkDescriptorBufferInfo commandsInfo = frame.commands->descriptorInfo();
+    VkDescriptorBufferInfo countsInfo = frame.counts->descriptorInfo();
+    KongDescriptorWriter writer(*m_setLayout, *m_pool);
+    for (uint32_t binding = 0; binding < INPUT_BINDING_COUNT; binding++)
+    {
+        writer.writeBuffer(binding, &inputInfo);
+    }
+    writer.writeBuffer(COMMANDS_BINDING, &commandsInfo)
+        .writeBuffer(COUNTS_BINDING, &countsInfo);
+    if (frame.descriptorSet == VK_NULL_HANDLE)
+    {
+        if (!writer.build(frame.descriptorSet))
+        {
+            throw std::runtime_error("failed to allocate cull descriptor set!");
+        }
+    }
+    else
+    {
+        writer.overwrite(frame.descriptorSet);
+    }
+}
+
+void KongGpuCuller::cull(const FrameInfo& frameInfo, const KongGpuCullParams& params, uint32_t paramsIndex)
+{
+    // 空的batch也要有一条命令的位置，buffer不能为空
+    prepareFrame(frameInfo, std::max(params.commandCount, 1u), std::max(params.batchCount, 1u));
+    const FrameResources& frame = m_frames[frameInfo.frameIndex];
+    VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+
+    // 不支持drawIndirectCount时整个区间都会被画，没有写入的命令需要是0
+    vkCmdFillBuffer(commandBuffer, frame.commands->getBuffer(), 0, COMMAND_STRIDE * std::max(params.commandCount, 1u), 0);
+    vkCmdFillBuffer(commandBuffer, frame.counts->getBuffer(), 0, sizeof(uint32_t) * std::max(params.batchCount, 1u), 0);
+    VkMemoryBarrier fillBarrier{};
+    fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+
+    if (params.instanceCount > 0)
+    {
+        m_pipeline->bind(commandBuffer);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout,
+            0, 1, &frame.descriptorSet, 0, nullptr);
+        CullPushConstants push{paramsIndex};
+        vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(commandBuffer, (params.instanceCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+    }
+
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void KongGpuCuller::drawBatch(VkCommandBuffer commandBuffer, int frameIndex, uint32_t batch, uint32_t firstCommand,
+    uint32_t commandCapacity)
+{
+    const FrameResources& frame = m_frames[frameIndex];
+    const VkDeviceSize offset = COMMAND_STRIDE * firstCommand;
+    if (m_device.supportsDrawIndirectCount())
+    {
+        vkCmdDrawIndexedIndirectCount(commandBuffer, frame.commands->getBuffer(), offset,
+            frame.counts->getBuffer(), sizeof(uint32_t) * batch, commandCapacity, static_cast<uint32_t>(COMMAND_STRIDE));
+        return;
+    }
+    // 画满整个区间，单次的命令数不能超过maxDrawIndirectCount
+    const uint32_t maxDrawCount = std::max(m_device.properties.limits.maxDrawIndirectCount, 1u);
+    for (uint32_t first = 0; first < commandCapacity; first += maxDrawCount)
+    {
+        vkCmdDrawIndexedIndirect(commandBuffer, frame.commands->getBuffer(), offset + COMMAND_STRIDE * first,
+            std::min(maxDrawCount, commandCapacity - first), static_cast<uint32_t>(COMMAND_STRIDE));
+    }
+}
+
+void KongGpuCuller::readBack(int frameIndex, uint32_t batchCount, uint32_t commandCount, std::vector<uint32_t>& counts,
+    std::vector<VkDrawIndexedIndirectCommand>& commands)
+{
+    const FrameResources& frame = m_frames[frameIndex];
+    const VkDeviceSize countBytes = sizeof(uint32_t) * batchCount;
+    const VkDeviceSize commandBytes = COMMAND_STRIDE * commandCount;
+    counts.assign(batchCount, 0);
+    commands.assign(commandCount, {});
+    if (countBytes == 0 || commandBytes == 0)
+    {
+        return;
+    }
+
+    KongBuffer readback{m_device, countBytes + commandBytes, 1, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+    readback.map();
+    VkCommandBuffer commandBuffer = m_device.beginSingleTimeCommands();
+    m_device.recordCopyBuffer(commandBuffer, frame.counts->getBuffer(), readback.getBuffer(), countBytes);
+    m_device.recordCopyBuffer(commandBuffer, frame.commands->getBuffer(), readback.getBuffer(), commandBytes, 0, countBytes);
+    m_device.endSingleTimeCommands(commandBuffer);
+
+    const auto* data = static_cast<const uint8_t*>(readback.getMappedMemory());
+    std::memcpy(counts.data(), data, static_cast<size_t>(countBytes));
+    std::memcpy(commands.data(), data + countBytes, static_cast<size_t>(commandBytes));
+}
+
+void KongGpuCuller::cullReference(const KongGpuCullParams& params, const KongGpuCullInput& input, std::vector<uint32_t>& counts,
+    std::vector<VkDrawIndexedIndirectCommand>& commands)
+{
+    counts.assign(params.batchCount, 0);
+    commands.assign(params.commandCount, {});
+    for (uint32_t index = 0; index < params.instanceCount; index++)
+    {
+        const KongGpuCullMesh& mesh = input.meshes[input.instanceMeshes[index]];
+        if (mesh.lodCount == 0)
+        {
+            continue;
+        }
+        const glm::mat4 world = input.instances[index].modelMatrix * mesh.inversePositionTransform;
+
+        const float scale = std::max(std::max(glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1]))),
+            glm::length(glm::vec3(world[2])));
+        const glm::vec3 center = glm::vec3(world * glm::vec4(glm::vec3(mesh.boundingSphere), 1.0f));
+        const float radius = mesh.boundingSphere.w * scale;
+        const bool outside = std::any_of(params.planes.begin(), params.planes.end(), [&](const glm::vec4& plane)
+        {
+            return glm::dot(glm::vec3(plane), center) + plane.w < -radius;
+        });
+        if (outside)
+        {
+            continue;
+        }
+
+        uint32_t lod = 0;
+        const float distance = glm::length(center - glm::vec3(params.cameraPosition)) - radius;
+        if (distance > 0.0f)
+        {
+            const float errorToScreen = scale * params.projectionScale / distance;
+            while (lod + 1 < mesh.lodCount && input.lods[mesh.firstLod + lod + 1].error * errorToScreen <= params.maxScreenError)
+            {
+                lod++;
+            }
+        }
+
+        const KongGpuCullLod& selected = input.lods[mesh.firstLod + lod];
+        const uint32_t slot = counts[mesh.batch];
+        counts[mesh.batch] += selected.templateCount;
+        for (uint32_t i = 0; i < selected.templateCount; i++)
+        {
+            const KongGpuDrawTemplate& drawTemplate = input.templates[selected.firstTemplate + i];
+            VkDrawIndexedIndirectCommand& command = commands[mesh.firstCommand + slot + i];
+            command.indexCount = drawTemplate.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = drawTemplate.firstIndex;
+            command.vertexOffset = drawTemplate.vertexOffset;
+            command.firstInstance = params.instanceBase + index;
+        }
+    }
+}
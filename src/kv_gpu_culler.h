@@ -0,0 +1,144 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "kv_buffer.h"
+#include "kv_descriptor.h"
+#include "kv_frame_info.h"
+#include "kv_pipeline.h"
+
+namespace kong
+{
+    /*
+     * 以下结构和cull.comp中的同名结构一致（std430），都从frame allocator中用allocateElements分配
+     * 一个batch是使用同一个pipeline、贴图和几何页的一组实例，可以属于不同的模型（mesh），在主pass中用一次indirect draw画出
+     */
+    struct KongGpuCullMesh
+    {
+        // 实例的modelMatrix包含position的反量化，乘上它的逆得到物体的世界矩阵
+        glm::mat4 inversePositionTransform{1.0f};
+        // 模型空间的包围球，xyz为球心，w为半径
+        glm::vec4 boundingSphere{};
+        uint32_t firstLod = 0;
+        uint32_t lodCount = 0;
+        // 所在的batch和batch的命令在命令buffer中的起点，batch的容量为每个实例各级LOD中最多的draw range数之和
+        uint32_t batch = 0;
+        uint32_t firstCommand = 0;
+    };
+
+    struct KongGpuCullLod
+    {
+        uint32_t firstTemplate = 0;
+        uint32_t templateCount = 0;
+        float error = 0.0f;
+        uint32_t padding = 0;
+    };
+
+    // 一个draw range的indirect命令中不随实例变化的部分，firstIndex和vertexOffset已经加上几何池中的位置
+    struct KongGpuDrawTemplate
+    {
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        int32_t vertexOffset = 0;
+        uint32_t padding = 0;
+    };
+
+    struct KongGpuCullParams
+    {
+        // 世界空间的6个视锥平面，xyz为指向视锥内部的单位法线
+        std::array<glm::vec4, 6> planes{};
+        glm::vec4 cameraPosition{};
+        // LOD选择，含义和SimpleRenderSystem::LodSelectionSettings相同
+        float projectionScale = 0.0f;
+        float maxScreenError = 0.0f;
+        uint32_t instanceCount = 0;
+        uint32_t batchCount = 0;
+        // 各个数组在frame allocator buffer中的第一个元素
+        uint32_t instanceBase = 0;
+        uint32_t instanceMeshBase = 0;
+        uint32_t meshBase = 0;
+        uint32_t lodBase = 0;
+        uint32_t templateBase = 0;
+        uint32_t commandCount = 0;
+        uint32_t padding0 = 0;
+        uint32_t padding1 = 0;
+
+        // 从投影矩阵乘以视图矩阵中提取视锥平面，从视图矩阵中取出相机位置
+        void setCamera(const glm::mat4& projection, const glm::mat4& view);
+    };
+
+    // 剔除输入在CPU上的地址，每个指针指向数组的第一个元素（对应params中的base）
+    struct KongGpuCullInput
+    {
+        const KongInstanceData* instances = nullptr;
+        const uint32_t* instanceMeshes = nullptr;
+        const KongGpuCullMesh* meshes = nullptr;
+        const KongGpuCullLod* lods = nullptr;
+        const KongGpuDrawTemplate* templates = nullptr;
+    };
+
+    /*
+     * GPU视锥剔除和multi-draw-indirect：compute shader读取每个实例的矩阵和所属mesh的包围球，
+     * 可见的实例按选中LOD的每个draw range写一条VkDrawIndexedIndirectCommand，用原子计数紧凑地排在batch的区间中
+     * 主pass中每个batch一次vkCmdDrawIndexedIndirectCount；不支持drawIndirectCount时画满整个区间，
+     * 区间在剔除之前清零，没有写入的命令indexCount和instanceCount都是0
+     * 命令和计数buffer每个同时在渲染的frame一份，只在渲染线程中使用
+     */
+    class KongGpuCuller
+    {
+    public:
+        static constexpr uint32_t GROUP_SIZE = 64;
+
+        KongGpuCuller(KongDevice& device, uint32_t framesInFlight);
+        ~KongGpuCuller();
+
+        KongGpuCuller(const KongGpuCuller&) = delete;
+        KongGpuCuller& operator=(const KongGpuCuller&) = delete;
+
+        // 需要multiDrawIndirect和drawIndirectFirstInstance
+        static bool isSupported(const KongDevice& device);
+
+        /*
+         * 在render pass之外录制：清零这一帧的命令和计数，dispatch剔除，再用barrier让indirect draw读取结果
+         * params已经写入frame allocator，paramsIndex是它的元素编号
+         */
+        void cull(const FrameInfo& frameInfo, const KongGpuCullParams& params, uint32_t paramsIndex);
+        // 在render pass中录制batch的indirect draw，调用之前绑定好pipeline、descriptor set和几何数据
+        void drawBatch(VkCommandBuffer commandBuffer, int frameIndex, uint32_t batch, uint32_t firstCommand, uint32_t commandCapacity);
+
+        /*
+         * 读回frameIndex最近一次剔除的结果，调用之前GPU要已经执行完这一帧，用于和cullReference对比
+         * commands中每个batch的有效命令在[firstCommand, firstCommand + counts[batch])，顺序由原子操作决定
+         */
+        void readBack(int frameIndex, uint32_t batchCount, uint32_t commandCount, std::vector<uint32_t>& counts,
+            std::vector<VkDrawIndexedIndirectCommand>& commands);
+
+        // CPU上的参考实现，和cull.comp的计算一一对应，可见实例按实例顺序写入
+        static void cullReference(const KongGpuCullParams& params, const KongGpuCullInput& input, std::vector<uint32_t>& counts,
+            std::vector<VkDrawIndexedIndirectCommand>& commands);
+
+    private:
+        struct FrameResources
+        {
+            std::unique_ptr<KongBuffer> commands;
+            std::unique_ptr<KongBuffer> counts;
+            uint32_t commandCapacity = 0;
+            uint32_t batchCapacity = 0;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            VkBuffer frameBuffer = VK_NULL_HANDLE;
+        };
+
+        void createPipeline();
+        // 容量不够时重新创建这一帧的buffer，并把descriptor set指向新的buffer
+        void prepareFrame(const FrameInfo& frameInfo, uint32_t commandCount, uint32_t batchCount);
+
+        KongDevice& m_device;
+        std::unique_ptr<KongDescriptorSetLayout> m_setLayout;
+        std::unique_ptr<KongDescriptorPool> m_pool;
+        VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+        std::unique_ptr<KongComputePipeline> m_pipeline;
+        std::vector<FrameResources> m_frames;
+    };
+}
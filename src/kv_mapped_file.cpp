@@ -0,0 +1,194 @@
+#include "kv_mapped_file.h"
+
+#include <filesystem>
+#include <utility>
+
+#include "kv_utils.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace kong;
+
+namespace
+{
+    bool querySourceFile(const std::string& sourcePath, uint64_t& size, int64_t& writeTime)
+    {
+        std::error_code ec;
+        auto fileSize = std::filesystem::file_size(sourcePath, ec);
+        if (ec)
+        {
+            return false;
+        }
+        auto fileWriteTime = std::filesystem::last_write_time(sourcePath, ec);
+        if (ec)
+        {
+            return false;
+        }
+
+        size = static_cast<uint64_t>(fileSize);
+        writeTime = static_cast<int64_t>(fileWriteTime.time_since_epoch().count());
+        return true;
+    }
+
+    uint64_t hashSourceFile(const std::string& sourcePath)
+    {
+        KongMappedFile source{sourcePath};
+        if (!source.isOpen())
+        {
+            return 0;
+        }
+        return hashBytes(source.data(), source.size());
+    }
+}
+
+KongMappedFile::KongMappedFile(const std::string& filepath)
+{
+    open(filepath);
+}
+
+KongMappedFile::~KongMappedFile()
+{
+    close();
+}
+
+KongMappedFile::KongMappedFile(KongMappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+KongMappedFile& KongMappedFile::operator=(KongMappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+#ifdef _WIN32
+        std::swap(m_fileHandle, other.m_fileHandle);
+        std::swap(m_mappingHandle, other.m_mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+bool KongMappedFile::open(const std::string& filepath)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_fileHandle = file;
+    m_mappingHandle = mapping;
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat{};
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // mapping建立之后fd就不再需要了
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(view, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+    return true;
+}
+
+void KongMappedFile::close()
+{
+    if (m_data == nullptr)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+    CloseHandle(static_cast<HANDLE>(m_fileHandle));
+    m_mappingHandle = nullptr;
+    m_fileHandle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+KongSourceStamp KongSourceStamp::compute(const std::string& sourcePath)
+{
+    KongSourceStamp stamp{};
+    if (querySourceFile(sourcePath, stamp.size, stamp.writeTime))
+    {
+        stamp.hash = hashSourceFile(sourcePath);
+    }
+    return stamp;
+}
+
+bool KongSourceStamp::matches(const std::string& sourcePath) const
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceWriteTime = 0;
+    if (!querySourceFile(sourcePath, sourceSize, sourceWriteTime))
+    {
+        return true;
+    }
+    if (sourceSize != size)
+    {
+        return false;
+    }
+    return sourceWriteTime == writeTime || hashSourceFile(sourcePath) == hash;
+}
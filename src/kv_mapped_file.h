@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kong
+{
+    /*
+     * 只读的内存映射文件，Windows下使用CreateFileMapping，其他平台使用mmap
+     * 文件内容由操作系统按页载入，不需要先读到std::vector里再拷贝
+     */
+    class KongMappedFile
+    {
+    public:
+        KongMappedFile() = default;
+        explicit KongMappedFile(const std::string& filepath);
+        ~KongMappedFile();
+
+        KongMappedFile(const KongMappedFile&) = delete;
+        KongMappedFile& operator=(const KongMappedFile&) = delete;
+        KongMappedFile(KongMappedFile&& other) noexcept;
+        KongMappedFile& operator=(KongMappedFile&& other) noexcept;
+
+        bool open(const std::string& filepath);
+        void close();
+
+        bool isOpen() const { return m_data != nullptr; }
+        const uint8_t* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const uint8_t* m_data = nullptr;
+        size_t m_size = 0;
+#ifdef _WIN32
+        void* m_fileHandle = nullptr;
+        void* m_mappingHandle = nullptr;
+#endif
+    };
+
+    /*
+     * 缓存文件中记录的源文件信息，.kvmesh和.kvtex都用它判断缓存是否过期
+     * 大小和修改时间都没变就认为内容没变，否则重新计算内容hash
+     */
+    struct KongSourceStamp
+    {
+        uint64_t hash = 0;
+        uint64_t size = 0;
+        int64_t writeTime = 0;
+
+        // 读取并hash整个源文件，文件不存在时返回全0
+        static KongSourceStamp compute(const std::string& sourcePath);
+        // 源文件不存在时（比如只发布了缓存文件）也返回true
+        bool matches(const std::string& sourcePath) const;
+    };
+}
@@ -0,0 +1,648 @@
+#include "kv_memory_allocator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace kong;
+
+namespace
+{
+    uint32_t lowestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    uint32_t highestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return 63u - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+    }
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+KongTlsfAllocator::KongTlsfAllocator(uint64_t size) : m_size(size & ~(MIN_ALIGNMENT - 1))
+{
+    for (auto& heads : m_heads)
+    {
+        std::fill(std::begin(heads), std::end(heads), NONE);
+    }
+    const uint32_t index = createRegion();
+    m_regions[index].size = m_size;
+    insertFree(index);
+}
+
+void KongTlsfAllocator::mapping(uint64_t size, uint32_t& fl, uint32_t& sl)
+{
+    if (size < (1ull << FL_SHIFT))
+    {
+        fl = 0;
+        sl = static_cast<uint32_t>(size / MIN_ALIGNMENT);
+        return;
+    }
+    const uint32_t msb = highestBit(size);
+    fl = msb - FL_SHIFT + 1;
+    sl = static_cast<uint32_t>(size >> (msb - SL_BITS)) - SL_COUNT;
+}
+
+uint32_t KongTlsfAllocator::findFree(uint64_t size) const
+{
+    // 向上取到下一个链表的下限，这样找到的链表中的区间都放得下
+    if (size >= (1ull << FL_SHIFT))
+    {
+        const uint64_t round = (1ull << (highestBit(size) - SL_BITS)) - 1;
+        if (size > UINT64_MAX - round)
+        {
+            return NONE;
+        }
+        size += round;
+    }
+    uint32_t fl, sl;
+    mapping(size, fl, sl);
+    if (fl >= FL_COUNT)
+    {
+        return NONE;
+    }
+
+    uint32_t slMap = m_slBitmap[fl] & (~0u << sl);
+    if (slMap == 0)
+    {
+        const uint64_t flMap = fl + 1 < 64 ? m_flBitmap & (~0ull << (fl + 1)) : 0;
+        if (flMap == 0)
+        {
+            return NONE;
+        }
+        fl = lowestBit(flMap);
+        slMap = m_slBitmap[fl];
+    }
+    return m_heads[fl][lowestBit(slMap)];
+}
+
+bool KongTlsfAllocator::allocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+    size = alignUp(std::max<uint64_t>(size, 1), MIN_ALIGNMENT);
+    alignment = std::max(alignment, MIN_ALIGNMENT);
+    if (size > m_size)
+    {
+        return false;
+    }
+
+    // 先按原大小找，表头的区间对齐之后放不下时再按最坏情况的对齐填充重新找
+    uint32_t index = findFree(size);
+    if (index != NONE && alignUp(m_regions[index].offset, alignment) + size > m_regions[index].offset + m_regions[index].size)
+    {
+        index = findFree(size + alignment - MIN_ALIGNMENT);
+    }
+    if (index == NONE)
+    {
+        return false;
+    }
+    removeFree(index);
+
+    // 对齐留下的空隙作为空闲区间留在前面，前一个区间一定不是空闲的，所以不用合并
+    const uint64_t padding = alignUp(m_regions[index].offset, alignment) - m_regions[index].offset;
+    if (padding > 0)
+    {
+        const uint32_t aligned = split(index, padding);
+        insertFree(index);
+        index = aligned;
+    }
+    if (m_regions[index].size > size)
+    {
+        insertFree(split(index, size));
+    }
+
+    m_regions[index].free = false;
+    m_usedBytes += size;
+    offset = m_regions[index].offset;
+    m_allocations.emplace(offset, index);
+    return true;
+}
+
+void KongTlsfAllocator::free(uint64_t offset)
+{
+    auto it = m_allocations.find(offset);
+    if (it == m_allocations.end())
+    {
+        throw std::runtime_error("freeing an offset that was not allocated");
+    }
+    uint32_t index = it->second;
+    m_allocations.erase(it);
+    m_usedBytes -= m_regions[index].size;
+    m_regions[index].free = true;
+
+    const uint32_t next = m_regions[index].nextPhysical;
+    if (next != NONE && m_regions[next].free)
+    {
+        removeFree(next);
+        absorb(index, next);
+    }
+    const uint32_t prev = m_regions[index].prevPhysical;
+    if (prev != NONE && m_regions[prev].free)
+    {
+        removeFree(prev);
+        absorb(prev, index);
+        index = prev;
+    }
+    insertFree(index);
+}
+
+uint64_t KongTlsfAllocator::largestFreeRegion() const
+{
+    if (m_flBitmap == 0)
+    {
+        return 0;
+    }
+    // 最大的区间在最高的非空链表里，同一个链表中的区间大小不一样，需要遍历
+    const uint32_t fl = highestBit(m_flBitmap);
+    const uint32_t sl = highestBit(m_slBitmap[fl]);
+    uint64_t largest = 0;
+    for (uint32_t index = m_heads[fl][sl]; index != NONE; index = m_regions[index].nextFree)
+    {
+        largest = std::max(largest, m_regions[index].size);
+    }
+    return largest;
+}
+
+uint32_t KongTlsfAllocator::createRegion()
+{
+    if (!m_unusedRegions.empty())
+    {
+        const uint32_t index = m_unusedRegions.back();
+        m_unusedRegions.pop_back();
+        m_regions[index] = Region{};
+        return index;
+    }
+    m_regions.emplace_back();
+    return static_cast<uint32_t>(m_regions.size() - 1);
+}
+
+void KongTlsfAllocator::insertFree(uint32_t index)
+{
+    Region& region = m_regions[index];
+    uint32_t fl, sl;
+    mapping(region.size, fl, sl);
+    region.free = true;
+    region.prevFree = NONE;
+    region.nextFree = m_heads[fl][sl];
+    if (region.nextFree != NONE)
+    {
+        m_regions[region.nextFree].prevFree = index;
+    }
+    m_heads[fl][sl] = index;
+    m_slBitmap[fl] |= 1u << sl;
+    m_flBitmap |= 1ull << fl;
+    m_freeRegionCount++;
+}
+
+void KongTlsfAllocator::removeFree(uint32_t index)
+{
+    Region& region = m_regions[index];
+    uint32_t fl, sl;
+    mapping(region.size, fl, sl);
+    if (region.prevFree != NONE)
+    {
+        m_regions[region.prevFree].nextFree = region.nextFree;
+    }
+    else
+    {
+        m_heads[fl][sl] = region.nextFree;
+        if (region.nextFree == NONE)
+        {
+            m_slBitmap[fl] &= ~(1u << sl);
+            if (m_slBitmap[fl] == 0)
+            {
+                m_flBitmap &= ~(1ull << fl);
+            }
+        }
+    }
+    if (region.nextFree != NONE)
+    {
+        m_regions[region.nextFree].prevFree = region.prevFree;
+    }
+    region.prevFree = region.nextFree = NONE;
+    region.free = false;
+    m_freeRegionCount--;
+}
+
+uint32_t KongTlsfAllocator::split(uint32_t index, uint64_t size)
+{
+    // createRegion可能让m_regions扩容，不能提前取引用
+    const uint32_t tail = createRegion();
+    Region& region = m_regions[index];
+    Region& tailRegion = m_regions[tail];
+    tailRegion.offset = region.offset + size;
+    tailRegion.size = region.size - size;
+    tailRegion.prevPhysical = index;
+    tailRegion.nextPhysical = region.nextPhysical;
+    if (region.nextPhysical != NONE)
+    {
+        m_regions[region.nextPhysical].prevPhysical = tail;
+    }
+    region.size = size;
+    region.nextPhysical = tail;
+    return tail;
+}
+
+void KongTlsfAllocator::absorb(uint32_t index, uint32_t next)
+{
+    Region& region = m_regions[index];
+    const Region& nextRegion = m_regions[next];
+    region.size += nextRegion.size;
+    region.nextPhysical = nextRegion.nextPhysical;
+    if (nextRegion.nextPhysical != NONE)
+    {
+        m_regions[nextRegion.nextPhysical].prevPhysical = index;
+    }
+    m_unusedRegions.push_back(next);
+}
+
+KongMemoryAllocator::KongMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize)
+    : m_physicalDevice(physicalDevice), m_device(device), m_memoryBudget(memoryBudget), m_blockSize(blockSize)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+    m_nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+    m_pools.resize(m_memoryProperties.memoryTypeCount * 2);
+}
+
+KongMemoryAllocator::~KongMemoryAllocator()
+{
+    uint32_t leaked = static_cast<uint32_t>(m_dedicated.size());
+    for (auto& pool : m_pools)
+    {
+        for (auto& block : pool)
+        {
+            leaked += block->allocator.allocationCount();
+            vkFreeMemory(m_device, block->memory, nullptr);
+        }
+    }
+    for (auto& dedicated : m_dedicated)
+    {
+        vkFreeMemory(m_device, dedicated.first, nullptr);
+    }
+    if (leaked > 0)
+    {
+        std::cerr << "memory allocator destroyed with " << leaked << " live allocations" << std::endl;
+    }
+}
+
+uint32_t KongMemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+VkDeviceSize KongMemoryAllocator::blockSizeFor(uint32_t memoryType) const
+{
+    // 比较小的heap（比如256MB的BAR）不能一次占掉太多
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize blockSize = m_blockSize;
+    while (blockSize > (1ull << 20) && blockSize > heapSize / 8)
+    {
+        blockSize /= 2;
+    }
+    return blockSize;
+}
+
+VkDeviceMemory KongMemoryAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size, void*& mapped)
+{
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+
+    mapped = nullptr;
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        if (vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        {
+            vkFreeMemory(m_device, memory, nullptr);
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+    return memory;
+}
+
+KongAllocation KongMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+    KongAllocation allocation{};
+    allocation.memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+    // flush/invalidate的范围要按nonCoherentAtomSize对齐，host visible的分配首尾都对齐到atom，对齐之后不会碰到相邻的分配
+    VkDeviceSize size = requirements.size;
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    if (m_memoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        alignment = std::max(alignment, m_nonCoherentAtomSize);
+        size = alignUp(size, m_nonCoherentAtomSize);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const VkDeviceSize blockSize = blockSizeFor(allocation.memoryType);
+    if (size > blockSize / 2)
+    {
+        allocation.memory = allocateMemory(allocation.memoryType, size, allocation.mapped);
+        allocation.size = size;
+        m_dedicated.emplace(allocation.memory, DedicatedMemory{size, allocation.memoryType});
+        return allocation;
+    }
+
+    // bufferImageGranularity为1时不需要区分
+    const bool optimal = !linear && m_bufferImageGranularity > 1;
+    Pool& pool = m_pools[allocation.memoryType * 2 + (optimal ? 1 : 0)];
+    uint64_t offset = 0;
+    KongMemoryBlock* target = nullptr;
+    for (auto& block : pool)
+    {
+        if (block->allocator.allocate(size, alignment, offset))
+        {
+            target = block.get();
+            break;
+        }
+    }
+    if (!target)
+    {
+        void* mapped = nullptr;
+        VkDeviceMemory memory = allocateMemory(allocation.memoryType, blockSize, mapped);
+        pool.push_back(std::make_unique<KongMemoryBlock>(memory, blockSize, mapped));
+        target = pool.back().get();
+        target->allocator.allocate(size, alignment, offset);
+    }
+
+    allocation.memory = target->memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = target->mapped ? static_cast<char*>(target->mapped) + offset : nullptr;
+    allocation.block = target;
+    return allocation;
+}
+
+void KongMemoryAllocator::free(KongAllocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!allocation.block)
+    {
+        m_dedicated.erase(allocation.memory);
+        vkFreeMemory(m_device, allocation.memory, nullptr);
+        allocation = {};
+        return;
+    }
+
+    KongMemoryBlock* block = allocation.block;
+    block->allocator.free(allocation.offset);
+    allocation = {};
+    if (!block->allocator.empty())
+    {
+        return;
+    }
+
+    // 每个pool保留一个空块，避免反复加载卸载时来回申请释放
+    for (auto& pool : m_pools)
+    {
+        auto it = std::find_if(pool.begin(), pool.end(), [block](const std::unique_ptr<KongMemoryBlock>& b) { return b.get() == block; });
+        if (it == pool.end())
+        {
+            continue;
+        }
+        const bool hasOtherEmptyBlock = std::any_of(pool.begin(), pool.end(), [block](const std::unique_ptr<KongMemoryBlock>& b)
+        {
+            return b.get() != block && b->allocator.empty();
+        });
+        if (hasOtherEmptyBlock)
+        {
+            vkFreeMemory(m_device, block->memory, nullptr);
+            pool.erase(it);
+        }
+        break;
+    }
+}
+
+bool KongMemoryAllocator::allocateForMove(const KongAllocation& source, const VkMemoryRequirements& requirements, KongAllocation& result)
+{
+    const KongMemoryBlock* sourceBlock = source.block;
+    if (!sourceBlock)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& pool : m_pools)
+    {
+        const bool inPool = std::any_of(pool.begin(), pool.end(),
+            [sourceBlock](const std::unique_ptr<KongMemoryBlock>& b) { return b.get() == sourceBlock; });
+        if (!inPool)
+        {
+            continue;
+        }
+
+        // 只往比源块更满的块中搬，越满的块越优先，空闲空间逐渐集中到少数几个块中
+        std::vector<KongMemoryBlock*> targets;
+        for (auto& block : pool)
+        {
+            if (block.get() != sourceBlock && block->allocator.usedBytes() > sourceBlock->allocator.usedBytes())
+            {
+                targets.push_back(block.get());
+            }
+        }
+        std::sort(targets.begin(), targets.end(), [](const KongMemoryBlock* a, const KongMemoryBlock* b)
+        {
+            return a->allocator.usedBytes() > b->allocator.usedBytes();
+        });
+
+        VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+        if (m_memoryProperties.memoryTypes[source.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            alignment = std::max(alignment, m_nonCoherentAtomSize);
+        }
+        for (KongMemoryBlock* block : targets)
+        {
+            uint64_t offset = 0;
+            if (block->allocator.allocate(source.size, alignment, offset))
+            {
+                result = {};
+                result.memory = block->memory;
+                result.offset = offset;
+                result.size = source.size;
+                result.mapped = block->mapped ? static_cast<char*>(block->mapped) + offset : nullptr;
+                result.memoryType = source.memoryType;
+                result.block = block;
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+std::vector<KongBlockUsage> KongMemoryAllocator::sparseBlocks(float maxUsage) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<KongBlockUsage> blocks;
+    for (const auto& pool : m_pools)
+    {
+        if (pool.size() < 2)
+        {
+            continue;
+        }
+        for (const auto& block : pool)
+        {
+            const KongTlsfAllocator& allocator = block->allocator;
+            if (!allocator.empty() && static_cast<float>(allocator.usedBytes()) < maxUsage * static_cast<float>(allocator.size()))
+            {
+                blocks.push_back({block.get(), allocator.usedBytes(), allocator.size(), allocator.allocationCount()});
+            }
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const KongBlockUsage& a, const KongBlockUsage& b)
+    {
+        return a.usedBytes * b.size < b.usedBytes * a.size;
+    });
+    return blocks;
+}
+
+std::vector<KongHeapBudget> KongMemoryAllocator::heapBudgets() const
+{
+    std::vector<KongHeapBudget> heaps(m_memoryProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; i++)
+    {
+        heaps[i].size = m_memoryProperties.memoryHeaps[i].size;
+        heaps[i].deviceLocal = (m_memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_pools.size(); i++)
+        {
+            KongHeapBudget& heap = heaps[m_memoryProperties.memoryTypes[i / 2].heapIndex];
+            for (const auto& block : m_pools[i])
+            {
+                heap.reservedBytes += block->allocator.size();
+                heap.usedBytes += block->allocator.usedBytes();
+            }
+        }
+        for (const auto& dedicated : m_dedicated)
+        {
+            KongHeapBudget& heap = heaps[m_memoryProperties.memoryTypes[dedicated.second.memoryType].heapIndex];
+            heap.reservedBytes += dedicated.second.size;
+            heap.usedBytes += dedicated.second.size;
+        }
+    }
+
+    if (m_memoryBudget)
+    {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &properties2);
+        for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; i++)
+        {
+            heaps[i].budget = budgetProperties.heapBudget[i];
+            heaps[i].usage = budgetProperties.heapUsage[i];
+        }
+    }
+    else
+    {
+        for (auto& heap : heaps)
+        {
+            heap.budget = heap.size / 5 * 4;
+            heap.usage = heap.reservedBytes;
+        }
+    }
+    return heaps;
+}
+
+VkDeviceSize KongMemoryAllocator::availableBytes(VkMemoryPropertyFlags properties) const
+{
+    const uint32_t memoryType = findMemoryType(~0u, properties);
+    const KongHeapBudget heap = heapBudgets()[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+    const VkDeviceSize unreserved = heap.budget > heap.usage ? heap.budget - heap.usage : 0;
+    return unreserved + heap.reservedBytes - heap.usedBytes;
+}
+
+VkMappedMemoryRange KongMemoryAllocator::mappedRange(const KongAllocation& allocation, VkDeviceSize size, VkDeviceSize offset) const
+{
+    if (size == VK_WHOLE_SIZE)
+    {
+        size = allocation.size - offset;
+    }
+    // 分配的首尾已经按atom对齐，向外扩展不会超出这次分配
+    const VkDeviceSize begin = (allocation.offset + offset) & ~(m_nonCoherentAtomSize - 1);
+    const VkDeviceSize end = std::min(alignUp(allocation.offset + offset + size, m_nonCoherentAtomSize), allocation.offset + allocation.size);
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    return range;
+}
+
+KongMemoryStats KongMemoryAllocator::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    KongMemoryStats stats{};
+    // 每个块内部的碎片，空闲空间分散在不同块中不算碎片
+    uint64_t freeBytes = 0, scatteredBytes = 0;
+    for (const auto& pool : m_pools)
+    {
+        for (const auto& block : pool)
+        {
+            stats.blockCount++;
+            stats.allocationCount += block->allocator.allocationCount();
+            stats.reservedBytes += block->allocator.size();
+            stats.usedBytes += block->allocator.usedBytes();
+            freeBytes += block->allocator.freeBytes();
+            scatteredBytes += block->allocator.freeBytes() - block->allocator.largestFreeRegion();
+        }
+    }
+    for (const auto& dedicated : m_dedicated)
+    {
+        stats.dedicatedCount++;
+        stats.allocationCount++;
+        stats.reservedBytes += dedicated.second.size;
+        stats.usedBytes += dedicated.second.size;
+    }
+    stats.wastedBytes = stats.reservedBytes - stats.usedBytes;
+    stats.fragmentation = freeBytes > 0 ? static_cast<float>(scatteredBytes) / static_cast<float>(freeBytes) : 0.0f;
+    return stats;
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace kong
+{
+    /*
+     * TLSF（two-level segregated fit）偏移分配器，只管理[0, size)范围内的偏移，不接触真正的内存
+     * 空闲区间按大小分到两级链表中，用位图在常数时间内找到足够大的链表；释放时和物理上相邻的空闲区间合并
+     * 不是线程安全的，由使用者加锁
+     */
+    class KongTlsfAllocator
+    {
+    public:
+        // 所有偏移和大小都按这个值对齐
+        static constexpr uint64_t MIN_ALIGNMENT = 16;
+
+        explicit KongTlsfAllocator(uint64_t size);
+
+        KongTlsfAllocator(const KongTlsfAllocator&) = delete;
+        KongTlsfAllocator& operator=(const KongTlsfAllocator&) = delete;
+
+        // alignment必须是2的幂，空间不足时返回false
+        bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+        void free(uint64_t offset);
+
+        uint64_t size() const { return m_size; }
+        uint64_t usedBytes() const { return m_usedBytes; }
+        uint64_t freeBytes() const { return m_size - m_usedBytes; }
+        uint64_t largestFreeRegion() const;
+        uint32_t allocationCount() const { return static_cast<uint32_t>(m_allocations.size()); }
+        uint32_t freeRegionCount() const { return m_freeRegionCount; }
+        bool empty() const { return m_allocations.empty(); }
+
+    private:
+        // 第二级把每个2的幂区间再等分成SL_COUNT份
+        static constexpr uint32_t SL_BITS = 5;
+        static constexpr uint32_t SL_COUNT = 1u << SL_BITS;
+        // 小于2^FL_SHIFT的区间按MIN_ALIGNMENT线性分到第0级
+        static constexpr uint32_t FL_SHIFT = SL_BITS + 4;
+        static constexpr uint32_t FL_COUNT = 64 - FL_SHIFT + 1;
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        struct Region
+        {
+            uint64_t offset = 0;
+            uint64_t size = 0;
+            // 按偏移排列的相邻区间
+            uint32_t prevPhysical = NONE;
+            uint32_t nextPhysical = NONE;
+            // 同一个空闲链表中的前后区间
+            uint32_t prevFree = NONE;
+            uint32_t nextFree = NONE;
+            bool free = false;
+        };
+
+        static void mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+        // 链表中任意一个区间都不小于size的第一个非空链表的表头
+        uint32_t findFree(uint64_t size) const;
+
+        uint32_t createRegion();
+        void insertFree(uint32_t index);
+        void removeFree(uint32_t index);
+        // 从index的size处切开，返回后半段
+        uint32_t split(uint32_t index, uint64_t size);
+        // 把next并入index
+        void absorb(uint32_t index, uint32_t next);
+
+        uint64_t m_size;
+        uint64_t m_usedBytes = 0;
+        uint32_t m_freeRegionCount = 0;
+
+        std::vector<Region> m_regions;
+        std::vector<uint32_t> m_unusedRegions;
+        uint64_t m_flBitmap = 0;
+        uint32_t m_slBitmap[FL_COUNT]{};
+        uint32_t m_heads[FL_COUNT][SL_COUNT];
+        // 已分配区间的偏移 -> region
+        std::unordered_map<uint64_t, uint32_t> m_allocations;
+    };
+
+    // 一块vkAllocateMemory得到的内存，host visible的块在创建时就一直映射着
+    struct KongMemoryBlock
+    {
+        KongMemoryBlock(VkDeviceMemory memory, VkDeviceSize size, void* mapped) : memory(memory), mapped(mapped), allocator(size) {}
+
+        VkDeviceMemory memory;
+        void* mapped;
+        KongTlsfAllocator allocator;
+    };
+
+    // 一次子分配，bind时使用memory和offset
+    struct KongAllocation
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        // host visible内存中这次分配的起始地址，否则为空
+        void* mapped = nullptr;
+        uint32_t memoryType = 0;
+        // 所属的内存块，独占一块VkDeviceMemory时为空
+        KongMemoryBlock* block = nullptr;
+    };
+
+    struct KongMemoryStats
+    {
+        uint32_t blockCount = 0;
+        // 超过块大小一半的资源单独vkAllocateMemory
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0;
+        // 所有VkDeviceMemory的总大小
+        uint64_t reservedBytes = 0;
+        uint64_t usedBytes = 0;
+        // 块中没有被使用的部分，包括对齐留下的空隙
+        uint64_t wastedBytes = 0;
+        // 每个块中最大空闲区间以外的空闲空间占空闲总量的比例，0表示每个块的空闲空间都连成一片
+        float fragmentation = 0.0f;
+    };
+
+    // 一个memory heap的预算，有VK_EXT_memory_budget时来自驱动，包括其他进程和驱动内部的占用
+    struct KongHeapBudget
+    {
+        VkDeviceSize size = 0;
+        // 没有扩展时取heap大小的80%
+        VkDeviceSize budget = 0;
+        // 没有扩展时只有这个分配器申请的内存
+        VkDeviceSize usage = 0;
+        // 这个分配器申请的VkDeviceMemory总大小和其中被使用的部分
+        VkDeviceSize reservedBytes = 0;
+        VkDeviceSize usedBytes = 0;
+        bool deviceLocal = false;
+    };
+
+    // 碎片整理时挑选要清空的块用
+    struct KongBlockUsage
+    {
+        const KongMemoryBlock* block = nullptr;
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize size = 0;
+        uint32_t allocationCount = 0;
+    };
+
+    /*
+     * 设备内存分配器：每种memory type按需申请大块VkDeviceMemory，资源从块中用TLSF子分配
+     * 避免每个buffer/image都调用一次vkAllocateMemory，碰到maxMemoryAllocationCount的上限（通常只有4096）
+     * buffer和optimal tiling的image放在不同的块中，相邻资源不需要按bufferImageGranularity隔开
+     * 可以在加载线程中调用
+     */
+    class KongMemoryAllocator
+    {
+    public:
+        static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+        // memoryBudget表示设备启用了VK_EXT_memory_budget
+        KongMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget = false,
+            VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+        // 所有分配都应该已经释放
+        ~KongMemoryAllocator();
+
+        KongMemoryAllocator(const KongMemoryAllocator&) = delete;
+        KongMemoryAllocator& operator=(const KongMemoryAllocator&) = delete;
+
+        // linear为true表示buffer或者linear tiling的image
+        KongAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+        void free(KongAllocation& allocation);
+
+        /*
+         * 碎片整理：为source所在块中的资源在同一个pool里另一个更满的块中分配新的位置，不会申请新的块
+         * 放不下时返回false
+         */
+        bool allocateForMove(const KongAllocation& source, const VkMemoryRequirements& requirements, KongAllocation& result);
+        // 所在pool中还有其他块、使用率低于maxUsage的非空块，按使用率从低到高排列
+        std::vector<KongBlockUsage> sparseBlocks(float maxUsage) const;
+
+        // 下标为heap index
+        std::vector<KongHeapBudget> heapBudgets() const;
+        // 带有properties的内存在预算内还能分配多少，包括已经申请的块中的空闲空间，流式加载在分配之前查询
+        VkDeviceSize availableBytes(VkMemoryPropertyFlags properties) const;
+
+        // 把相对于分配起点的范围换算成vkFlushMappedMemoryRanges用的范围，按nonCoherentAtomSize对齐
+        VkMappedMemoryRange mappedRange(const KongAllocation& allocation, VkDeviceSize size, VkDeviceSize offset) const;
+
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+        KongMemoryStats stats() const;
+
+    private:
+        using Pool = std::vector<std::unique_ptr<KongMemoryBlock>>;
+        struct DedicatedMemory
+        {
+            VkDeviceSize size;
+            uint32_t memoryType;
+        };
+
+        VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+        VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size, void*& mapped);
+
+        VkPhysicalDevice m_physicalDevice;
+        VkDevice m_device;
+        bool m_memoryBudget;
+        VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+        VkDeviceSize m_blockSize;
+        VkDeviceSize m_bufferImageGranularity;
+        VkDeviceSize m_nonCoherentAtomSize;
+
+        mutable std::mutex m_mutex;
+        // 下标为memoryType * 2 + (optimal tiling的image ? 1 : 0)
+        std::vector<Pool> m_pools;
+        std::unordered_map<VkDeviceMemory, DedicatedMemory> m_dedicated;
+    };
+}
@@ -0,0 +1,192 @@
+#include "kv_mesh_cache.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+using namespace kong;
+
+namespace
+{
+    uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    void writePadding(std::ofstream& file, uint64_t from, uint64_t to)
+    {
+        static const char zeros[KongMeshCache::BLOB_ALIGNMENT]{};
+        file.write(zeros, static_cast<std::streamsize>(to - from));
+    }
+}
+
+bool KongMeshCache::write(const std::string& cachePath, const std::string& sourcePath, const KongModel::Builder& builder)
+{
+    if (builder.vertices.empty())
+    {
+        return false;
+    }
+
+    const auto source = KongSourceStamp::compute(sourcePath);
+    KongMeshFileHeader header{};
+    header.sourceHash = source.hash;
+    header.sourceSize = source.size;
+    header.sourceWriteTime = source.writeTime;
+
+    // 没有draw range/LOD信息时和KongModel一样，把整个index buffer作为LOD0
+    std::vector<KongModel::DrawRange> drawRanges = builder.drawRanges;
+    if (drawRanges.empty())
+    {
+        drawRanges.push_back({0, static_cast<uint32_t>(builder.indices.size()), 0});
+    }
+    std::vector<KongModel::Lod> lods = builder.lods;
+    if (lods.empty())
+    {
+        lods.push_back({0, static_cast<uint32_t>(drawRanges.size()), 0.0f, 0});
+    }
+
+    header.vertexCount = static_cast<uint32_t>(builder.vertices.size());
+    header.vertexStride = sizeof(KongModel::Vertex);
+    header.indexCount = static_cast<uint32_t>(builder.indices.size());
+    header.rangeCount = static_cast<uint32_t>(drawRanges.size());
+    header.lodCount = static_cast<uint32_t>(lods.size());
+    // 带draw range时index是相对值，按最大的index决定能否使用16位
+    const uint32_t maxIndex = builder.indices.empty() ? 0 : *std::max_element(builder.indices.begin(), builder.indices.end());
+    const bool shortIndex = maxIndex <= std::numeric_limits<uint16_t>::max();
+    header.indexSize = shortIndex ? sizeof(uint16_t) : sizeof(uint32_t);
+
+    glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+    glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+    for (const auto& vertex : builder.vertices)
+    {
+        boundsMin = glm::min(boundsMin, vertex.position);
+        boundsMax = glm::max(boundsMax, vertex.position);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+
+    const uint64_t vertexBytes = static_cast<uint64_t>(header.vertexCount) * header.vertexStride;
+    const uint64_t indexBytes = static_cast<uint64_t>(header.indexCount) * header.indexSize;
+    header.vertexOffset = alignOffset(sizeof(KongMeshFileHeader), BLOB_ALIGNMENT);
+    header.indexOffset = alignOffset(header.vertexOffset + vertexBytes, BLOB_ALIGNMENT);
+    const uint64_t rangeBytes = static_cast<uint64_t>(header.rangeCount) * sizeof(KongModel::DrawRange);
+    const uint64_t lodBytes = static_cast<uint64_t>(header.lodCount) * sizeof(KongModel::Lod);
+    header.rangeOffset = alignOffset(header.indexOffset + indexBytes, BLOB_ALIGNMENT);
+    header.lodOffset = alignOffset(header.rangeOffset + rangeBytes, BLOB_ALIGNMENT);
+
+    const auto& meshlets = builder.meshlets;
+    header.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size());
+    header.meshletVertexCount = static_cast<uint32_t>(meshlets.vertices.size());
+    header.meshletTriangleSize = static_cast<uint32_t>(meshlets.triangles.size());
+    const uint64_t meshletBytes = static_cast<uint64_t>(header.meshletCount) * sizeof(KongMeshlet);
+    const uint64_t meshletVertexBytes = static_cast<uint64_t>(header.meshletVertexCount) * sizeof(uint32_t);
+    header.meshletOffset = alignOffset(header.lodOffset + lodBytes, BLOB_ALIGNMENT);
+    header.meshletVertexOffset = alignOffset(header.meshletOffset + meshletBytes, BLOB_ALIGNMENT);
+    header.meshletTriangleOffset = alignOffset(header.meshletVertexOffset + meshletVertexBytes, BLOB_ALIGNMENT);
+
+    // 先写临时文件再rename，避免写到一半的缓存被下一次启动读到
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "failed to write mesh cache: " << cachePath << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writePadding(file, sizeof(header), header.vertexOffset);
+        file.write(reinterpret_cast<const char*>(builder.vertices.data()), static_cast<std::streamsize>(vertexBytes));
+        writePadding(file, header.vertexOffset + vertexBytes, header.indexOffset);
+
+        if (shortIndex)
+        {
+            std::vector<uint16_t> shortIndices(builder.indices.begin(), builder.indices.end());
+            file.write(reinterpret_cast<const char*>(shortIndices.data()), static_cast<std::streamsize>(indexBytes));
+        }
+        else
+        {
+            file.write(reinterpret_cast<const char*>(builder.indices.data()), static_cast<std::streamsize>(indexBytes));
+        }
+
+        writePadding(file, header.indexOffset + indexBytes, header.rangeOffset);
+        file.write(reinterpret_cast<const char*>(drawRanges.data()), static_cast<std::streamsize>(rangeBytes));
+        writePadding(file, header.rangeOffset + rangeBytes, header.lodOffset);
+        file.write(reinterpret_cast<const char*>(lods.data()), static_cast<std::streamsize>(lodBytes));
+        writePadding(file, header.lodOffset + lodBytes, header.meshletOffset);
+        file.write(reinterpret_cast<const char*>(meshlets.meshlets.data()), static_cast<std::streamsize>(meshletBytes));
+        writePadding(file, header.meshletOffset + meshletBytes, header.meshletVertexOffset);
+        file.write(reinterpret_cast<const char*>(meshlets.vertices.data()), static_cast<std::streamsize>(meshletVertexBytes));
+        writePadding(file, header.meshletVertexOffset + meshletVertexBytes, header.meshletTriangleOffset);
+        file.write(reinterpret_cast<const char*>(meshlets.triangles.data()), static_cast<std::streamsize>(header.meshletTriangleSize));
+
+        if (!file.good())
+        {
+            std::cerr << "failed to write mesh cache: " << cachePath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
+
+bool KongMeshCache::open(const std::string& cachePath, const std::string& sourcePath)
+{
+    if (!m_file.open(cachePath))
+    {
+        return false;
+    }
+
+    if (m_file.size() < sizeof(KongMeshFileHeader))
+    {
+        m_file.close();
+        return false;
+    }
+
+    const auto& fileHeader = header();
+    const uint64_t vertexBytes = static_cast<uint64_t>(fileHeader.vertexCount) * fileHeader.vertexStride;
+    const uint64_t indexBytes = static_cast<uint64_t>(fileHeader.indexCount) * fileHeader.indexSize;
+    const uint64_t rangeBytes = static_cast<uint64_t>(fileHeader.rangeCount) * sizeof(KongModel::DrawRange);
+    const uint64_t lodBytes = static_cast<uint64_t>(fileHeader.lodCount) * sizeof(KongModel::Lod);
+    const uint64_t meshletBytes = static_cast<uint64_t>(fileHeader.meshletCount) * sizeof(KongMeshlet);
+    const uint64_t meshletVertexBytes = static_cast<uint64_t>(fileHeader.meshletVertexCount) * sizeof(uint32_t);
+    const bool valid = fileHeader.magic == KongMeshFileHeader::MAGIC
+        && fileHeader.version == KongMeshFileHeader::VERSION
+        && fileHeader.vertexStride == sizeof(KongModel::Vertex)
+        && (fileHeader.indexSize == sizeof(uint16_t) || fileHeader.indexSize == sizeof(uint32_t))
+        && fileHeader.vertexOffset + vertexBytes <= m_file.size()
+        && fileHeader.indexOffset + indexBytes <= m_file.size()
+        && fileHeader.rangeCount > 0 && fileHeader.rangeOffset + rangeBytes <= m_file.size()
+        && fileHeader.lodCount > 0 && fileHeader.lodOffset + lodBytes <= m_file.size()
+        && fileHeader.meshletOffset + meshletBytes <= m_file.size()
+        && fileHeader.meshletVertexOffset + meshletVertexBytes <= m_file.size()
+        && fileHeader.meshletTriangleOffset + fileHeader.meshletTriangleSize <= m_file.size();
+    if (!valid || !std::all_of(lods(), lods() + fileHeader.lodCount, [&](const KongModel::Lod& lod)
+        {
+            return static_cast<uint64_t>(lod.firstRange) + lod.rangeCount <= fileHeader.rangeCount;
+        }))
+    {
+        m_file.close();
+        return false;
+    }
+
+    if (KongSourceStamp{fileHeader.sourceHash, fileHeader.sourceSize, fileHeader.sourceWriteTime}.matches(sourcePath))
+    {
+        return true;
+    }
+
+    m_file.close();
+    return false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+
+#include "kv_mapped_file.h"
+#include "kv_model.h"
+
+namespace kong
+{
+    /*
+     * .kvmesh二进制网格缓存
+     * 第一次加载OBJ之后把焊接好的顶点/index写成二进制文件，之后直接mmap缓存文件，
+     * 把数据块原样拷贝到staging buffer中，省去文本解析和中间的std::vector
+     *
+     * 文件布局: [KongMeshFileHeader][vertex blob][index blob][draw range表][LOD表][meshlet表][meshlet顶点][meshlet三角形]
+     * 数据块按BLOB_ALIGNMENT对齐
+     */
+    struct KongMeshFileHeader
+    {
+        static constexpr uint32_t MAGIC = 0x534d564b;   // "KVMS"
+        static constexpr uint32_t VERSION = 3;
+
+        uint32_t magic = MAGIC;
+        uint32_t version = VERSION;
+        // 源文件的内容hash，大小和修改时间用于快速判断是否需要重新hash
+        uint64_t sourceHash = 0;
+        uint64_t sourceSize = 0;
+        int64_t sourceWriteTime = 0;
+
+        uint32_t vertexCount = 0;
+        uint32_t vertexStride = 0;
+        uint32_t indexCount = 0;
+        uint32_t indexSize = 0;     // 2或者4字节
+
+        float boundsMin[3]{};
+        float boundsMax[3]{};
+
+        uint32_t rangeCount = 0;
+        uint32_t lodCount = 0;
+        uint32_t meshletCount = 0;
+        uint32_t meshletVertexCount = 0;
+        uint32_t meshletTriangleSize = 0;   // byte数，每个三角形3个byte
+        uint32_t reserved = 0;
+
+        uint64_t vertexOffset = 0;
+        uint64_t indexOffset = 0;
+        uint64_t rangeOffset = 0;
+        uint64_t lodOffset = 0;
+        uint64_t meshletOffset = 0;
+        uint64_t meshletVertexOffset = 0;
+        uint64_t meshletTriangleOffset = 0;
+    };
+
+    class KongMeshCache
+    {
+    public:
+        static constexpr uint64_t BLOB_ALIGNMENT = 64;
+
+        static std::string cachePathFor(const std::string& sourcePath) { return sourcePath + ".kvmesh"; }
+
+        // 将builder中的数据写成缓存文件，sourcePath用于记录源文件的hash
+        static bool write(const std::string& cachePath, const std::string& sourcePath, const KongModel::Builder& builder);
+
+        // 打开并校验缓存，源文件内容变化或者格式版本不一致时返回false
+        bool open(const std::string& cachePath, const std::string& sourcePath);
+
+        const KongMeshFileHeader& header() const { return *reinterpret_cast<const KongMeshFileHeader*>(m_file.data()); }
+        const void* vertexData() const { return m_file.data() + header().vertexOffset; }
+        const void* indexData() const { return m_file.data() + header().indexOffset; }
+        const KongModel::DrawRange* drawRanges() const { return reinterpret_cast<const KongModel::DrawRange*>(m_file.data() + header().rangeOffset); }
+        const KongModel::Lod* lods() const { return reinterpret_cast<const KongModel::Lod*>(m_file.data() + header().lodOffset); }
+        const KongMeshlet* meshlets() const { return reinterpret_cast<const KongMeshlet*>(m_file.data() + header().meshletOffset); }
+        const uint32_t* meshletVertices() const { return reinterpret_cast<const uint32_t*>(m_file.data() + header().meshletVertexOffset); }
+        const uint8_t* meshletTriangles() const { return reinterpret_cast<const uint8_t*>(m_file.data() + header().meshletTriangleOffset); }
+        VkIndexType indexType() const { return header().indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32; }
+
+    private:
+        KongMappedFile m_file;
+    };
+}
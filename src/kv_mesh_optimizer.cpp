@@ -0,0 +1,407 @@
+#include "kv_mesh_optimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+using namespace kong;
+
+namespace
+{
+    // 用时间戳模拟FIFO cache：顶点进入cache的时间和当前时间相差超过cacheSize就被挤出去了
+    class FifoCache
+    {
+    public:
+        FifoCache(size_t vertexCount, uint32_t cacheSize)
+            : m_timestamps(vertexCount, 0), m_cacheSize(cacheSize), m_time(cacheSize + 1)
+        {
+        }
+
+        // 返回这个三角形产生的cache miss数
+        uint32_t addTriangle(const uint32_t* triangle)
+        {
+            uint32_t misses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = triangle[k];
+                if (m_time - m_timestamps[v] > m_cacheSize)
+                {
+                    m_timestamps[v] = m_time++;
+                    misses++;
+                }
+            }
+            return misses;
+        }
+
+        void reset()
+        {
+            m_time += m_cacheSize + 1;
+        }
+
+    private:
+        std::vector<uint32_t> m_timestamps;
+        uint32_t m_cacheSize;
+        uint32_t m_time;
+    };
+
+    // 顶点到三角形的邻接表，CSR格式
+    struct TriangleAdjacency
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+        std::vector<uint32_t> liveCounts;
+
+        TriangleAdjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+            : offsets(vertexCount + 1, 0), triangles(indexCount), liveCounts(vertexCount, 0)
+        {
+            for (size_t i = 0; i < indexCount; i++)
+            {
+                liveCounts[indices[i]]++;
+            }
+            for (size_t v = 0; v < vertexCount; v++)
+            {
+                offsets[v + 1] = offsets[v] + liveCounts[v];
+            }
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indexCount; i++)
+            {
+                triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+    };
+
+    struct Float3
+    {
+        float x, y, z;
+    };
+
+    inline Float3 loadPosition(const float* positions, size_t positionStride, uint32_t vertex)
+    {
+        const auto* p = reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + vertex * positionStride);
+        return {p[0], p[1], p[2]};
+    }
+
+    // 在Tipsify的硬边界之间再切出ACMR不比整个cluster差太多的小cluster，cluster越小排序越自由
+    std::vector<uint32_t> splitSoftClusters(const uint32_t* indices, size_t triangleCount, size_t vertexCount,
+        const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold)
+    {
+        std::vector<uint32_t> softClusters;
+        FifoCache cache{vertexCount, cacheSize};
+        for (size_t c = 0; c < clusters.size(); c++)
+        {
+            const size_t begin = clusters[c];
+            const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+            cache.reset();
+            uint32_t clusterMisses = 0;
+            for (size_t t = begin; t < end; t++)
+            {
+                clusterMisses += cache.addTriangle(indices + t * 3);
+            }
+            const float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+            cache.reset();
+            softClusters.push_back(static_cast<uint32_t>(begin));
+            uint32_t misses = 0;
+            uint32_t faces = 0;
+            for (size_t t = begin; t < end; t++)
+            {
+                misses += cache.addTriangle(indices + t * 3);
+                faces++;
+                if (t + 1 < end && static_cast<float>(misses) <= clusterThreshold * faces)
+                {
+                    softClusters.push_back(static_cast<uint32_t>(t + 1));
+                    cache.reset();
+                    misses = 0;
+                    faces = 0;
+                }
+            }
+        }
+        return softClusters;
+    }
+
+    // 越朝外的cluster越先画，它们更可能遮挡住后面画的部分
+    std::vector<uint32_t> sortClusters(const uint32_t* indices, size_t indexCount, const float* positions,
+        size_t positionStride, const std::vector<uint32_t>& softClusters)
+    {
+        const size_t triangleCount = indexCount / 3;
+
+        // 计算每个cluster按面积加权的中心和平均法线
+        struct ClusterInfo
+        {
+            uint32_t begin;
+            uint32_t end;
+            float sortKey;
+        };
+        std::vector<ClusterInfo> infos(softClusters.size());
+        std::vector<Float3> centroids(softClusters.size());
+        std::vector<Float3> normals(softClusters.size());
+
+        Float3 meshCentroid{0.0f, 0.0f, 0.0f};
+        float meshArea = 0.0f;
+        for (size_t c = 0; c < softClusters.size(); c++)
+        {
+            const uint32_t begin = softClusters[c];
+            const uint32_t end = c + 1 < softClusters.size() ? softClusters[c + 1] : static_cast<uint32_t>(triangleCount);
+            infos[c] = {begin, end, 0.0f};
+
+            Float3 centroid{0.0f, 0.0f, 0.0f};
+            Float3 normal{0.0f, 0.0f, 0.0f};
+            float area = 0.0f;
+            for (uint32_t t = begin; t < end; t++)
+            {
+                Float3 p0 = loadPosition(positions, positionStride, indices[t * 3 + 0]);
+                Float3 p1 = loadPosition(positions, positionStride, indices[t * 3 + 1]);
+                Float3 p2 = loadPosition(positions, positionStride, indices[t * 3 + 2]);
+
+                Float3 e1{p1.x - p0.x, p1.y - p0.y, p1.z - p0.z};
+                Float3 e2{p2.x - p0.x, p2.y - p0.y, p2.z - p0.z};
+                Float3 n{e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x};
+                float triangleArea = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+
+                centroid.x += (p0.x + p1.x + p2.x) / 3.0f * triangleArea;
+                centroid.y += (p0.y + p1.y + p2.y) / 3.0f * triangleArea;
+                centroid.z += (p0.z + p1.z + p2.z) / 3.0f * triangleArea;
+                normal.x += n.x;
+                normal.y += n.y;
+                normal.z += n.z;
+                area += triangleArea;
+            }
+
+            meshCentroid.x += centroid.x;
+            meshCentroid.y += centroid.y;
+            meshCentroid.z += centroid.z;
+            meshArea += area;
+
+            float inverseArea = area > 0.0f ? 1.0f / area : 0.0f;
+            centroids[c] = {centroid.x * inverseArea, centroid.y * inverseArea, centroid.z * inverseArea};
+            float normalLength = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+            float inverseLength = normalLength > 0.0f ? 1.0f / normalLength : 0.0f;
+            normals[c] = {normal.x * inverseLength, normal.y * inverseLength, normal.z * inverseLength};
+        }
+
+        if (meshArea > 0.0f)
+        {
+            meshCentroid = {meshCentroid.x / meshArea, meshCentroid.y / meshArea, meshCentroid.z / meshArea};
+        }
+
+        for (size_t c = 0; c < infos.size(); c++)
+        {
+            Float3 d{centroids[c].x - meshCentroid.x, centroids[c].y - meshCentroid.y, centroids[c].z - meshCentroid.z};
+            infos[c].sortKey = d.x * normals[c].x + d.y * normals[c].y + d.z * normals[c].z;
+        }
+        std::stable_sort(infos.begin(), infos.end(), [](const ClusterInfo& a, const ClusterInfo& b)
+        {
+            return a.sortKey > b.sortKey;
+        });
+
+        std::vector<uint32_t> result;
+        result.reserve(indexCount);
+        for (const auto& info : infos)
+        {
+            result.insert(result.end(), indices + info.begin * 3, indices + info.end * 3);
+        }
+        return result;
+    }
+}
+
+void KongMeshOptimizer::optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount,
+    uint32_t cacheSize, std::vector<uint32_t>* clusters)
+{
+    assert(indexCount % 3 == 0);
+    const size_t triangleCount = indexCount / 3;
+    if (clusters)
+    {
+        clusters->clear();
+    }
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    TriangleAdjacency adjacency{indices, indexCount, vertexCount};
+    auto& liveCounts = adjacency.liveCounts;
+
+    std::vector<uint32_t> cacheTimes(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnds;
+    deadEnds.reserve(indexCount);
+    std::vector<uint32_t> candidates;
+    candidates.reserve(64);
+
+    std::vector<uint32_t> result;
+    result.reserve(indexCount);
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+
+    // 栈上没有还活着的顶点时按编号顺序找下一个，这种跳转也就是cluster的边界
+    auto skipDeadEnd = [&]() -> int64_t
+    {
+        while (!deadEnds.empty())
+        {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveCounts[v] > 0)
+            {
+                return v;
+            }
+        }
+        while (cursor < vertexCount)
+        {
+            if (liveCounts[cursor] > 0)
+            {
+                return static_cast<int64_t>(cursor);
+            }
+            cursor++;
+        }
+        return -1;
+    };
+
+    int64_t fanning = skipDeadEnd();
+    while (fanning >= 0)
+    {
+        candidates.clear();
+        const uint32_t f = static_cast<uint32_t>(fanning);
+        for (uint32_t a = adjacency.offsets[f]; a < adjacency.offsets[f + 1]; a++)
+        {
+            const uint32_t t = adjacency.triangles[a];
+            if (emitted[t])
+            {
+                continue;
+            }
+            emitted[t] = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                const uint32_t v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveCounts[v]--;
+                if (time - cacheTimes[v] > cacheSize)
+                {
+                    cacheTimes[v] = time++;
+                }
+            }
+        }
+
+        // 选择还在cache中、并且扇出后大概率仍然留在cache里的顶点
+        int64_t next = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveCounts[v] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTimes[v] + 2 * liveCounts[v] <= cacheSize)
+            {
+                priority = time - cacheTimes[v];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        if (next < 0)
+        {
+            next = skipDeadEnd();
+            if (clusters && next >= 0)
+            {
+                clusters->push_back(static_cast<uint32_t>(result.size() / 3));
+            }
+        }
+        fanning = next;
+    }
+
+    assert(result.size() == indexCount);
+    std::memcpy(indices, result.data(), indexCount * sizeof(uint32_t));
+
+    if (clusters)
+    {
+        clusters->insert(clusters->begin(), 0);
+    }
+}
+
+void KongMeshOptimizer::optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions,
+    size_t positionStride, size_t vertexCount, const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.empty())
+    {
+        return;
+    }
+
+    /*
+     * cluster重新排序之后，相邻cluster之间不再共享cache，ACMR会上升
+     * 先尝试更细的切分，整体ACMR超出threshold时退回只按硬边界排序，还不行就保持原来的顺序
+     */
+    const float maxAcmr = threshold * KongMeshOptimizer::analyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr();
+    const std::vector<uint32_t> candidates[] = {
+        splitSoftClusters(indices, triangleCount, vertexCount, clusters, cacheSize, threshold),
+        clusters
+    };
+    for (const auto& candidate : candidates)
+    {
+        auto result = sortClusters(indices, indexCount, positions, positionStride, candidate);
+        if (KongMeshOptimizer::analyzeVertexCache(result.data(), indexCount, vertexCount, cacheSize).acmr() <= maxAcmr)
+        {
+            std::memcpy(indices, result.data(), indexCount * sizeof(uint32_t));
+            return;
+        }
+    }
+}
+
+std::vector<uint32_t> KongMeshOptimizer::optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    constexpr uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(vertexCount, UNUSED);
+    std::vector<uint32_t> order;
+    order.reserve(vertexCount);
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t& newIndex = remap[indices[i]];
+        if (newIndex == UNUSED)
+        {
+            newIndex = static_cast<uint32_t>(order.size());
+            order.push_back(indices[i]);
+        }
+        indices[i] = newIndex;
+    }
+    return order;
+}
+
+std::vector<uint32_t> KongMeshOptimizer::optimize(uint32_t* indices, size_t indexCount, const float* positions,
+    size_t positionStride, size_t vertexCount)
+{
+    std::vector<uint32_t> clusters;
+    optimizeVertexCache(indices, indexCount, vertexCount, DEFAULT_CACHE_SIZE, &clusters);
+    optimizeOverdraw(indices, indexCount, positions, positionStride, vertexCount, clusters);
+    return optimizeVertexFetch(indices, indexCount, vertexCount);
+}
+
+KongVertexCacheStats KongMeshOptimizer::analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+    uint32_t cacheSize)
+{
+    KongVertexCacheStats stats{};
+    stats.triangleCount = indexCount / 3;
+
+    FifoCache cache{vertexCount, cacheSize};
+    std::vector<uint8_t> used(vertexCount, 0);
+    for (size_t t = 0; t < stats.triangleCount; t++)
+    {
+        stats.transformedVertices += cache.addTriangle(indices + t * 3);
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[t * 3 + k];
+            stats.uniqueVertices += used[v] ? 0 : 1;
+            used[v] = 1;
+        }
+    }
+    return stats;
+}
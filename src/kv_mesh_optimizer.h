@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kong
+{
+    // FIFO post-transform cache模拟的统计结果，可以累加多个mesh
+    struct KongVertexCacheStats
+    {
+        size_t transformedVertices = 0;     // cache miss次数，即顶点着色器的调用次数
+        size_t triangleCount = 0;
+        size_t uniqueVertices = 0;
+
+        // average cache miss ratio：每个三角形平均变换的顶点数，理想值接近0.5，最差为3
+        float acmr() const { return triangleCount ? static_cast<float>(transformedVertices) / triangleCount : 0.0f; }
+        // average transform to vertex ratio：每个顶点平均被变换的次数，理想值为1
+        float atvr() const { return uniqueVertices ? static_cast<float>(transformedVertices) / uniqueVertices : 0.0f; }
+
+        KongVertexCacheStats& operator+=(const KongVertexCacheStats& other)
+        {
+            transformedVertices += other.transformedVertices;
+            triangleCount += other.triangleCount;
+            uniqueVertices += other.uniqueVertices;
+            return *this;
+        }
+    };
+
+    /*
+     * 离线的index buffer优化，依次执行：
+     * 1. Tipsify三角形重排，提高post-transform cache命中率
+     * 2. 以Tipsify的cluster为单位按朝外程度排序，减少overdraw
+     * 3. 按首次使用的顺序重排顶点，提高vertex fetch的局部性
+     * 参考 Sander, Nehab, Barczak. Fast Triangle Reordering for Vertex Locality and Reduced Overdraw. 2007
+     */
+    class KongMeshOptimizer
+    {
+    public:
+        static constexpr uint32_t DEFAULT_CACHE_SIZE = 16;
+        // overdraw排序允许ACMR上升的比例，越大cluster切得越细，排序越自由
+        static constexpr float DEFAULT_OVERDRAW_THRESHOLD = 1.05f;
+
+        // clusters非空时输出Tipsify跳转点（三角形序号），供optimizeOverdraw使用
+        static void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount,
+            uint32_t cacheSize = DEFAULT_CACHE_SIZE, std::vector<uint32_t>* clusters = nullptr);
+
+        // indices需要是optimizeVertexCache的输出，positions为每个顶点的xyz，相邻顶点间隔positionStride字节
+        static void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+            size_t vertexCount, const std::vector<uint32_t>& clusters,
+            uint32_t cacheSize = DEFAULT_CACHE_SIZE, float threshold = DEFAULT_OVERDRAW_THRESHOLD);
+
+        /*
+         * 按首次使用的顺序给顶点重新编号并改写indices
+         * 返回新编号到原编号的映射，长度为实际用到的顶点数，没被引用的顶点会被丢掉
+         */
+        static std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+        // 依次执行上面三个步骤，返回值同optimizeVertexFetch
+        static std::vector<uint32_t> optimize(uint32_t* indices, size_t indexCount, const float* positions,
+            size_t positionStride, size_t vertexCount);
+
+        static KongVertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+            uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+    };
+}
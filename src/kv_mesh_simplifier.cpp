@@ -0,0 +1,410 @@
+#include "kv_mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include "kv_mesh_optimizer.h"
+
+using namespace kong;
+
+namespace
+{
+    struct Vec3
+    {
+        double x, y, z;
+    };
+
+    inline Vec3 sub(const Vec3& a, const Vec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+    inline Vec3 cross(const Vec3& a, const Vec3& b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+    inline double dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+    // 对称4x4矩阵只存上三角的10个元素，weight用于把误差归一化成距离的平方
+    struct Quadric
+    {
+        double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+        double weight = 0;
+
+        static Quadric fromPlane(const Vec3& normal, double d, double weight)
+        {
+            Quadric q;
+            q.a2 = normal.x * normal.x * weight;
+            q.b2 = normal.y * normal.y * weight;
+            q.c2 = normal.z * normal.z * weight;
+            q.ab = normal.x * normal.y * weight;
+            q.ac = normal.x * normal.z * weight;
+            q.bc = normal.y * normal.z * weight;
+            q.ad = normal.x * d * weight;
+            q.bd = normal.y * d * weight;
+            q.cd = normal.z * d * weight;
+            q.d2 = d * d * weight;
+            q.weight = weight;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& o)
+        {
+            a2 += o.a2; b2 += o.b2; c2 += o.c2;
+            ab += o.ab; ac += o.ac; bc += o.bc;
+            ad += o.ad; bd += o.bd; cd += o.cd;
+            d2 += o.d2;
+            weight += o.weight;
+            return *this;
+        }
+
+        // p到所有平面距离平方的加权平均
+        double error(const Vec3& p) const
+        {
+            double r = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z
+                + 2 * (ab * p.x * p.y + ac * p.x * p.z + bc * p.y * p.z)
+                + 2 * (ad * p.x + bd * p.y + cd * p.z) + d2;
+            return weight > 0 ? std::fabs(r) / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        double cost;
+    };
+
+    inline const float* loadPosition(const float* positions, size_t positionStride, uint32_t vertex)
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + vertex * positionStride);
+    }
+
+    // 被indices引用的顶点的包围盒，返回最大边长
+    double computeBounds(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+        double minimum[3])
+    {
+        double maximum[3];
+        for (int k = 0; k < 3; k++)
+        {
+            minimum[k] = std::numeric_limits<double>::max();
+            maximum[k] = std::numeric_limits<double>::lowest();
+        }
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            const float* p = loadPosition(positions, positionStride, indices[i]);
+            for (int k = 0; k < 3; k++)
+            {
+                minimum[k] = std::min(minimum[k], static_cast<double>(p[k]));
+                maximum[k] = std::max(maximum[k], static_cast<double>(p[k]));
+            }
+        }
+        return std::max({maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2]});
+    }
+
+    // 把顶点坐标归一化到包围盒最大边长为1的空间，误差也就自然是相对值
+    std::vector<Vec3> normalizePositions(const uint32_t* indices, size_t indexCount, const float* positions,
+        size_t positionStride, size_t vertexCount)
+    {
+        double minimum[3];
+        const double extent = computeBounds(indices, indexCount, positions, positionStride, minimum);
+        const double scale = extent > 0 ? 1.0 / extent : 1.0;
+
+        std::vector<Vec3> result(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            const float* p = loadPosition(positions, positionStride, v);
+            result[v] = {(p[0] - minimum[0]) * scale, (p[1] - minimum[1]) * scale, (p[2] - minimum[2]) * scale};
+        }
+        return result;
+    }
+
+    /*
+     * 找出不能移动的顶点：
+     * - 接缝：同一个位置上有多个顶点（uv或者法线不连续）
+     * - 边界：只被一个三角形使用的边的端点
+     */
+    std::vector<uint8_t> findLockedVertices(const uint32_t* indices, size_t indexCount, const float* positions,
+        size_t positionStride, size_t vertexCount)
+    {
+        struct PositionKey
+        {
+            float x, y, z;
+            bool operator==(const PositionKey& o) const { return x == o.x && y == o.y && z == o.z; }
+        };
+        struct PositionHash
+        {
+            size_t operator()(const PositionKey& k) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &k, sizeof(bits));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+
+        // 每个顶点映射到同位置的第一个顶点
+        std::vector<uint32_t> positionRemap(vertexCount);
+        std::vector<uint32_t> positionUsers(vertexCount, 0);
+        std::unordered_map<PositionKey, uint32_t, PositionHash> firstVertex;
+        firstVertex.reserve(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            const float* p = loadPosition(positions, positionStride, v);
+            positionRemap[v] = firstVertex.try_emplace(PositionKey{p[0], p[1], p[2]}, v).first->second;
+        }
+
+        std::vector<uint8_t> used(vertexCount, 0);
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            uint32_t v = indices[i];
+            if (!used[v])
+            {
+                used[v] = 1;
+                positionUsers[positionRemap[v]]++;
+            }
+        }
+
+        std::unordered_map<uint64_t, uint32_t> edgeCounts;
+        edgeCounts.reserve(indexCount);
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint64_t a = positionRemap[indices[i + k]];
+                uint64_t b = positionRemap[indices[i + (k + 1) % 3]];
+                edgeCounts[a < b ? (a << 32 | b) : (b << 32 | a)]++;
+            }
+        }
+
+        std::vector<uint8_t> lockedPositions(vertexCount, 0);
+        for (const auto& edge : edgeCounts)
+        {
+            if (edge.second == 1)
+            {
+                lockedPositions[edge.first >> 32] = 1;
+                lockedPositions[edge.first & 0xffffffffu] = 1;
+            }
+        }
+
+        std::vector<uint8_t> locked(vertexCount, 0);
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            uint32_t position = positionRemap[v];
+            locked[v] = lockedPositions[position] || positionUsers[position] > 1;
+        }
+        return locked;
+    }
+
+    inline Vec3 triangleNormal(const Vec3& p0, const Vec3& p1, const Vec3& p2)
+    {
+        return cross(sub(p1, p0), sub(p2, p0));
+    }
+}
+
+std::vector<uint32_t> KongMeshSimplifier::simplify(const uint32_t* indices, size_t indexCount, const float* positions,
+    size_t positionStride, size_t vertexCount, size_t targetIndexCount, float targetError, float* resultError)
+{
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    double maxCost = 0.0;
+    if (indexCount == 0)
+    {
+        if (resultError)
+        {
+            *resultError = 0.0f;
+        }
+        return result;
+    }
+
+    const auto points = normalizePositions(indices, indexCount, positions, positionStride, vertexCount);
+    const auto locked = findLockedVertices(indices, indexCount, positions, positionStride, vertexCount);
+    const double costLimit = static_cast<double>(targetError) * targetError;
+
+    // 每个顶点的quadric是周围三角形所在平面的面积加权和
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        const Vec3& p0 = points[result[i]];
+        Vec3 normal = triangleNormal(p0, points[result[i + 1]], points[result[i + 2]]);
+        double length = std::sqrt(dot(normal, normal));
+        if (length == 0.0)
+        {
+            continue;
+        }
+        normal = {normal.x / length, normal.y / length, normal.z / length};
+        Quadric q = Quadric::fromPlane(normal, -dot(normal, p0), length * 0.5);
+        for (int k = 0; k < 3; k++)
+        {
+            quadrics[result[i + k]] += q;
+        }
+    }
+
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+
+    while (result.size() > targetIndexCount)
+    {
+        // 顶点到三角形的邻接表，用来检查折叠后三角形是否翻转
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t v : result)
+        {
+            adjacencyOffsets[v + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        adjacency.resize(result.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++)
+            {
+                adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        // 所有可以折叠的有向边，按误差从小到大处理
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = result[i + k];
+                uint32_t b = result[i + (k + 1) % 3];
+                if (!locked[a])
+                {
+                    Quadric q = quadrics[a];
+                    q += quadrics[b];
+                    collapses.push_back({a, b, q.error(points[b])});
+                }
+                if (!locked[b])
+                {
+                    Quadric q = quadrics[b];
+                    q += quadrics[a];
+                    collapses.push_back({b, a, q.error(points[a])});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& l, const Collapse& r) { return l.cost < r.cost; });
+
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+
+        const size_t triangleCount = result.size() / 3;
+        const size_t targetTriangles = targetIndexCount / 3;
+        size_t removedTriangles = 0;
+        size_t collapseCount = 0;
+
+        for (const auto& collapse : collapses)
+        {
+            if (collapse.cost > costLimit || triangleCount - removedTriangles <= targetTriangles)
+            {
+                break;
+            }
+            const uint32_t from = collapse.from;
+            const uint32_t to = collapse.to;
+            if (touched[from] || touched[to])
+            {
+                continue;
+            }
+
+            // 折叠后from周围不包含to的三角形不能翻转或者退化
+            bool valid = true;
+            size_t removed = 0;
+            for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1] && valid; a++)
+            {
+                const uint32_t* triangle = &result[adjacency[a] * 3];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                {
+                    removed++;
+                    continue;
+                }
+                Vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = points[triangle[k]];
+                    after[k] = triangle[k] == from ? points[to] : before[k];
+                }
+                Vec3 n0 = triangleNormal(before[0], before[1], before[2]);
+                Vec3 n1 = triangleNormal(after[0], after[1], after[2]);
+                valid = dot(n0, n1) > 0.25 * std::sqrt(dot(n0, n0) * dot(n1, n1));
+            }
+            if (!valid || removed == 0)
+            {
+                continue;
+            }
+
+            remap[from] = to;
+            quadrics[to] += quadrics[from];
+            // from周围的顶点这一轮都不再参与折叠，保证上面的翻转检查在同一轮中仍然成立
+            for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++)
+            {
+                const uint32_t* triangle = &result[adjacency[a] * 3];
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+            }
+            removedTriangles += removed;
+            maxCost = std::max(maxCost, collapse.cost);
+            collapseCount++;
+        }
+
+        if (collapseCount == 0)
+        {
+            break;
+        }
+
+        // 应用折叠并去掉退化的三角形
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    if (resultError)
+    {
+        *resultError = static_cast<float>(std::sqrt(maxCost));
+    }
+    return result;
+}
+
+std::vector<KongMeshSimplifier::LodLevel> KongMeshSimplifier::buildLodChain(const uint32_t* indices, size_t indexCount,
+    const float* positions, size_t positionStride, size_t vertexCount, const KongLodSettings& settings)
+{
+    std::vector<LodLevel> levels;
+    if (indexCount == 0)
+    {
+        return levels;
+    }
+
+    double minimum[3];
+    const double extent = computeBounds(indices, indexCount, positions, positionStride, minimum);
+
+    std::vector<uint32_t> current(indices, indices + indexCount);
+    float accumulatedError = 0.0f;
+    for (uint32_t level = 1; level < settings.maxLodCount; level++)
+    {
+        const size_t target = static_cast<size_t>(current.size() / 3 * settings.reductionPerLevel) * 3;
+        float error = 0.0f;
+        auto simplified = simplify(current.data(), current.size(), positions, positionStride, vertexCount,
+            target, settings.maxError, &error);
+        if (simplified.empty() || simplified.size() > current.size() * settings.minReduction)
+        {
+            break;
+        }
+
+        KongMeshOptimizer::optimizeVertexCache(simplified.data(), simplified.size(), vertexCount);
+        // 每一级在上一级的基础上简化，误差累加得到相对原始网格的上界
+        accumulatedError += error * static_cast<float>(extent);
+        levels.push_back({simplified, accumulatedError});
+        current = std::move(simplified);
+    }
+    return levels;
+}
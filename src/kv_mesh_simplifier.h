@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kong
+{
+    // LOD链的生成参数
+    struct KongLodSettings
+    {
+        uint32_t maxLodCount = 4;           // 包括LOD0在内的最大层数
+        float reductionPerLevel = 0.5f;     // 每一级的目标三角形数相对上一级的比例
+        float maxError = 0.02f;             // 每一级允许的简化误差，相对于包围盒的最大边长
+        float minReduction = 0.8f;          // 简化后三角形数仍然超过上一级的这个比例时停止生成
+    };
+
+    /*
+     * 基于quadric error metric的网格简化（Garland & Heckbert 1997）
+     * 只做边折叠到已有顶点上，简化结果仍然引用原来的顶点，所有LOD可以共用一个vertex buffer
+     * 开放边界上的顶点和uv/法线接缝上的顶点（同一位置有多个顶点）保持不动，避免产生裂缝
+     */
+    class KongMeshSimplifier
+    {
+    public:
+        struct LodLevel
+        {
+            std::vector<uint32_t> indices;
+            float error;    // 相对原始网格的误差，单位和顶点坐标相同
+        };
+
+        /*
+         * 简化到不超过targetIndexCount个index，或者误差达到targetError（相对于包围盒最大边长）为止
+         * resultError输出实际的误差（同样是相对值）
+         */
+        static std::vector<uint32_t> simplify(const uint32_t* indices, size_t indexCount, const float* positions,
+            size_t positionStride, size_t vertexCount, size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+        // 逐级简化生成LOD1..N，每一级都做了vertex cache优化，不包括LOD0本身
+        static std::vector<LodLevel> buildLodChain(const uint32_t* indices, size_t indexCount, const float* positions,
+            size_t positionStride, size_t vertexCount, const KongLodSettings& settings);
+    };
+}
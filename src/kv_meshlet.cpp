@@ -0,0 +1,312 @@
+#include "kv_meshlet.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace kong;
+
+namespace
+{
+    constexpr uint8_t UNUSED_LOCAL_INDEX = 0xff;
+    // 三角形法线和锥轴的最小夹角余弦低于这个值时认为法线太分散，不生成有效的法线锥
+    constexpr float MIN_CONE_SPREAD = 0.1f;
+    // 挑选下一个三角形时法线偏离程度相对于新增顶点数的权重
+    constexpr float CONE_WEIGHT = 1.0f;
+
+    glm::vec3 readPosition(const float* positions, size_t positionStride, uint32_t index)
+    {
+        const auto* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + positionStride * index);
+        return glm::vec3{p[0], p[1], p[2]};
+    }
+
+    // 计算刚结束的meshlet的包围球和法线锥
+    void computeMeshletBounds(KongMeshlet& meshlet, const KongMeshletData& data, const float* positions,
+        size_t positionStride, uint32_t baseVertex)
+    {
+        auto position = [&](uint8_t localIndex)
+        {
+            return readPosition(positions, positionStride, data.vertices[meshlet.vertexOffset + localIndex] - baseVertex);
+        };
+
+        // 包围盒中心作为球心，对于meshlet这种小块已经足够紧
+        glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+        glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            const glm::vec3 p = position(static_cast<uint8_t>(i));
+            boundsMin = glm::min(boundsMin, p);
+            boundsMax = glm::max(boundsMax, p);
+        }
+        meshlet.center = (boundsMin + boundsMax) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            meshlet.radius = std::max(meshlet.radius, glm::length(position(static_cast<uint8_t>(i)) - meshlet.center));
+        }
+
+        // 法线锥：轴为各三角形单位法线的平均，按逆时针为正面
+        std::array<glm::vec3, KongMeshletBuilder::MAX_TRIANGLES> normals{};
+        std::array<glm::vec3, KongMeshletBuilder::MAX_TRIANGLES> corners{};
+        uint32_t normalCount = 0;
+        glm::vec3 axis{0.0f};
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+        {
+            const uint8_t* triangle = &data.triangles[meshlet.triangleOffset + t * 3];
+            const glm::vec3 p0 = position(triangle[0]);
+            const glm::vec3 normal = glm::cross(position(triangle[1]) - p0, position(triangle[2]) - p0);
+            const float area = glm::length(normal);
+            if (area == 0.0f || normalCount == normals.size())
+            {
+                continue;
+            }
+            normals[normalCount] = normal / area;
+            corners[normalCount] = p0;
+            axis += normals[normalCount];
+            normalCount++;
+        }
+
+        meshlet.coneApex = meshlet.center;
+        meshlet.coneAxis = glm::vec3{0.0f};
+        meshlet.coneCutoff = 1.0f;
+        const float axisLength = glm::length(axis);
+        if (normalCount == 0 || axisLength == 0.0f)
+        {
+            return;
+        }
+        axis /= axisLength;
+        meshlet.coneAxis = axis;
+
+        float minDot = 1.0f;
+        for (uint32_t i = 0; i < normalCount; i++)
+        {
+            minDot = std::min(minDot, glm::dot(normals[i], axis));
+        }
+        if (minDot <= MIN_CONE_SPREAD)
+        {
+            return;
+        }
+
+        // 锥顶沿轴从包围球心往后退，直到位于所有三角形所在平面的背面
+        float maxT = 0.0f;
+        for (uint32_t i = 0; i < normalCount; i++)
+        {
+            const float t = glm::dot(meshlet.center - corners[i], normals[i]) / glm::dot(axis, normals[i]);
+            maxT = std::max(maxT, t);
+        }
+        meshlet.coneApex = meshlet.center - axis * maxT;
+        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+void KongMeshletData::clear()
+{
+    meshlets.clear();
+    vertices.clear();
+    triangles.clear();
+}
+
+void KongMeshletBuilder::build(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+    size_t vertexCount, uint32_t baseVertex, KongMeshletData& out, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    assert(maxVertices >= 3 && maxVertices < UNUSED_LOCAL_INDEX && "meshlet vertex count must fit in 8 bits");
+    assert(maxTriangles >= 1 && maxTriangles <= MAX_TRIANGLES && "too many triangles per meshlet");
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // 顶点到相邻三角形的邻接表（CSR）
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        adjacencyOffsets[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+        {
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<glm::vec3> triangleNormals(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const glm::vec3 p0 = readPosition(positions, positionStride, indices[t * 3 + 0]);
+        const glm::vec3 normal = glm::cross(readPosition(positions, positionStride, indices[t * 3 + 1]) - p0,
+            readPosition(positions, positionStride, indices[t * 3 + 2]) - p0);
+        const float area = glm::length(normal);
+        triangleNormals[t] = area > 0.0f ? normal / area : glm::vec3{0.0f};
+    }
+
+    // 原始顶点编号到当前meshlet内部编号的映射
+    std::vector<uint8_t> localIndex(vertexCount, UNUSED_LOCAL_INDEX);
+    std::vector<bool> emitted(triangleCount, false);
+    size_t scanCursor = 0;
+    KongMeshlet meshlet{};
+    meshlet.vertexOffset = static_cast<uint32_t>(out.vertices.size());
+    meshlet.triangleOffset = static_cast<uint32_t>(out.triangles.size());
+    glm::vec3 normalSum{0.0f};
+
+    auto newVertexCount = [&](size_t t)
+    {
+        const uint32_t a = indices[t * 3 + 0], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+        return (localIndex[a] == UNUSED_LOCAL_INDEX)
+            + (localIndex[b] == UNUSED_LOCAL_INDEX && b != a)
+            + (localIndex[c] == UNUSED_LOCAL_INDEX && c != a && c != b);
+    };
+
+    auto finishMeshlet = [&]()
+    {
+        if (meshlet.triangleCount == 0)
+        {
+            return;
+        }
+        computeMeshletBounds(meshlet, out, positions, positionStride, baseVertex);
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            localIndex[out.vertices[meshlet.vertexOffset + i] - baseVertex] = UNUSED_LOCAL_INDEX;
+        }
+        out.meshlets.push_back(meshlet);
+
+        meshlet = KongMeshlet{};
+        meshlet.vertexOffset = static_cast<uint32_t>(out.vertices.size());
+        meshlet.triangleOffset = static_cast<uint32_t>(out.triangles.size());
+        normalSum = glm::vec3{0.0f};
+    };
+
+    /*
+     * 从meshlet已有顶点的相邻三角形中挑下一个：优先不引入新顶点的，其次法线和当前平均法线接近的，
+     * 这样meshlet更紧凑，法线锥也更窄；没有相邻三角形时按index顺序取下一个未输出的三角形
+     */
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        size_t best = triangleCount;
+        float bestScore = std::numeric_limits<float>::max();
+        const glm::vec3 axis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3{0.0f};
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++)
+        {
+            const uint32_t v = out.vertices[meshlet.vertexOffset + i] - baseVertex;
+            for (uint32_t j = adjacencyOffsets[v]; j < adjacencyOffsets[v + 1]; j++)
+            {
+                const uint32_t t = adjacency[j];
+                if (emitted[t])
+                {
+                    continue;
+                }
+                const float score = static_cast<float>(newVertexCount(t)) + CONE_WEIGHT * (1.0f - glm::dot(triangleNormals[t], axis));
+                if (score < bestScore)
+                {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+        if (best == triangleCount)
+        {
+            while (emitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            best = scanCursor;
+        }
+
+        if (meshlet.vertexCount + newVertexCount(best) > maxVertices || meshlet.triangleCount + 1 > maxTriangles)
+        {
+            finishMeshlet();
+            // 新的meshlet从下一个按顺序未输出的三角形开始，保持和vertex cache顺序的局部性
+            while (emitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            best = scanCursor;
+        }
+
+        for (size_t k = 0; k < 3; k++)
+        {
+            const uint32_t v = indices[best * 3 + k];
+            if (localIndex[v] == UNUSED_LOCAL_INDEX)
+            {
+                localIndex[v] = static_cast<uint8_t>(meshlet.vertexCount++);
+                out.vertices.push_back(baseVertex + v);
+            }
+            out.triangles.push_back(localIndex[v]);
+        }
+        emitted[best] = true;
+        normalSum += triangleNormals[best];
+        meshlet.triangleCount++;
+    }
+    finishMeshlet();
+}
+
+KongMeshletCullStats KongMeshletCuller::cull(const KongMeshletData& data, const glm::mat4& modelViewProjection,
+    const glm::vec3& cameraPosition, std::vector<uint32_t>* outIndices, bool backfaceCulling)
+{
+    // 从裁剪矩阵中提取模型空间的6个视锥平面（Gribb & Hartmann），深度范围为[0, 1]
+    auto row = [&](int i)
+    {
+        return glm::vec4{modelViewProjection[0][i], modelViewProjection[1][i], modelViewProjection[2][i], modelViewProjection[3][i]};
+    };
+    std::array<glm::vec4, 6> planes{
+        row(3) + row(0), row(3) - row(0),
+        row(3) + row(1), row(3) - row(1),
+        row(2), row(3) - row(2)
+    };
+    for (auto& plane : planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    KongMeshletCullStats stats{};
+    if (outIndices)
+    {
+        outIndices->clear();
+    }
+    for (const auto& meshlet : data.meshlets)
+    {
+        stats.meshletCount++;
+        stats.triangleCount += meshlet.triangleCount;
+
+        const bool outside = std::any_of(planes.begin(), planes.end(), [&](const glm::vec4& plane)
+        {
+            return glm::dot(glm::vec3(plane), meshlet.center) + plane.w < -meshlet.radius;
+        });
+        if (outside)
+        {
+            stats.frustumCulled++;
+            continue;
+        }
+
+        if (backfaceCulling && meshlet.coneCutoff < 1.0f)
+        {
+            const glm::vec3 toApex = meshlet.coneApex - cameraPosition;
+            const float distance = glm::length(toApex);
+            if (distance > 0.0f && glm::dot(toApex, meshlet.coneAxis) >= meshlet.coneCutoff * distance)
+            {
+                stats.backfaceCulled++;
+                continue;
+            }
+        }
+
+        stats.visibleTriangles += meshlet.triangleCount;
+        if (outIndices)
+        {
+            const uint8_t* triangles = &data.triangles[meshlet.triangleOffset];
+            for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+            {
+                outIndices->push_back(data.vertices[meshlet.vertexOffset + triangles[i]]);
+            }
+        }
+    }
+    return stats;
+}
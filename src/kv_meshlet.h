@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace kong
+{
+    /*
+     * 一个meshlet（cluster）：不超过MAX_VERTICES个顶点、MAX_TRIANGLES个三角形的一小块网格
+     * 布局按std430对齐，可以直接作为storage buffer给compute shader使用
+     */
+    struct KongMeshlet
+    {
+        uint32_t vertexOffset = 0;      // 在meshletVertices中的起始位置
+        uint32_t triangleOffset = 0;    // 在meshletTriangles中的起始位置，以byte计，每个三角形3个byte
+        uint32_t vertexCount = 0;
+        uint32_t triangleCount = 0;
+
+        // 模型空间的包围球
+        glm::vec3 center{};
+        float radius = 0.0f;
+
+        /*
+         * 法线锥，相机位于锥内时整个cluster都是背面：
+         * dot(normalize(coneApex - cameraPosition), coneAxis) >= coneCutoff
+         * 法线分布太散时coneCutoff为1，永远不会被剔除
+         */
+        glm::vec3 coneApex{};
+        float coneCutoff = 1.0f;
+        glm::vec3 coneAxis{};
+        float padding = 0.0f;
+    };
+
+    static_assert(sizeof(KongMeshlet) == 64, "KongMeshlet must match the std430 layout");
+
+    struct KongMeshletData
+    {
+        std::vector<KongMeshlet> meshlets;
+        // 每个meshlet引用的顶点，是整个vertex buffer中的绝对编号（已经加上draw range的vertexOffset）
+        std::vector<uint32_t> vertices;
+        // 每个三角形3个byte，是meshlet内部的顶点编号
+        std::vector<uint8_t> triangles;
+
+        bool empty() const { return meshlets.empty(); }
+        void clear();
+    };
+
+    class KongMeshletBuilder
+    {
+    public:
+        // 64个顶点、124个三角形是mesh shader常用的meshlet大小
+        static constexpr uint32_t MAX_VERTICES = 64;
+        static constexpr uint32_t MAX_TRIANGLES = 124;
+
+        /*
+         * 沿三角形邻接关系贪心地生长meshlet，indices最好已经做过vertex cache优化，新meshlet的起点按index顺序选取
+         * positions为每个顶点的xyz，相邻顶点间隔positionStride字节，baseVertex会加到输出的顶点编号上
+         */
+        static void build(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride,
+            size_t vertexCount, uint32_t baseVertex, KongMeshletData& out,
+            uint32_t maxVertices = MAX_VERTICES, uint32_t maxTriangles = MAX_TRIANGLES);
+    };
+
+    struct KongMeshletCullStats
+    {
+        size_t meshletCount = 0;
+        size_t frustumCulled = 0;
+        size_t backfaceCulled = 0;
+        size_t triangleCount = 0;
+        size_t visibleTriangles = 0;
+
+        float culledRatio() const { return triangleCount ? 1.0f - static_cast<float>(visibleTriangles) / triangleCount : 0.0f; }
+
+        KongMeshletCullStats& operator+=(const KongMeshletCullStats& other)
+        {
+            meshletCount += other.meshletCount;
+            frustumCulled += other.frustumCulled;
+            backfaceCulled += other.backfaceCulled;
+            triangleCount += other.triangleCount;
+            visibleTriangles += other.visibleTriangles;
+            return *this;
+        }
+    };
+
+    /*
+     * CPU上的meshlet剔除，作为compute shader实现的参考
+     * 用包围球做视锥剔除，用法线锥做背面剔除，把可见meshlet的三角形写成紧凑的index列表
+     */
+    class KongMeshletCuller
+    {
+    public:
+        /*
+         * modelViewProjection把模型空间变换到裁剪空间，cameraPosition是模型空间中的相机位置
+         * outIndices非空时输出可见三角形的index（绝对顶点编号），backfaceCulling只应该在pipeline本身剔除背面时开启
+         */
+        static KongMeshletCullStats cull(const KongMeshletData& data, const glm::mat4& modelViewProjection,
+            const glm::vec3& cameraPosition, std::vector<uint32_t>* outIndices, bool backfaceCulling = true);
+    };
+}
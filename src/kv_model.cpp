@@ -1,124 +1,631 @@
 #include "kv_model.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <unordered_map>
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_precision.hpp>
 
 #include "tiny_obj_loader.h"
+#include "kv_assimp_importer.h"
+#include "kv_mesh_cache.h"
+#include "kv_mesh_optimizer.h"
+#include "kv_obj_parser.h"
+#include "kv_utils.h"
 
 using namespace kong;
 
-std::vector<VkVertexInputBindingDescription> KongModel::Vertex::getBindingDescription()
+namespace std
+{
+    template <>
+    struct hash<KongModel::Vertex>
+    {
+        size_t operator()(const KongModel::Vertex& vertex) const
+        {
+            size_t seed = 0;
+            hashCombine(seed, vertex.position.x, vertex.position.y, vertex.position.z,
+                vertex.color.x, vertex.color.y, vertex.color.z,
+                vertex.normal.x, vertex.normal.y, vertex.normal.z,
+                vertex.uv.x, vertex.uv.y);
+            return seed;
+        }
+    };
+}
+
+namespace
 {
-    std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
-    bindingDescriptions[0].binding = 0;
-    bindingDescriptions[0].stride = sizeof(Vertex);
-    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    // 顶点焊接：相同的顶点只保留一份，输出对应的index
+    class VertexWelder
+    {
+    public:
+        VertexWelder(std::vector<KongModel::Vertex>& vertices, std::vector<uint32_t>& indices, size_t expectedCount)
+            : m_vertices(vertices), m_indices(indices)
+        {
+            m_uniqueVertices.reserve(expectedCount);
+            m_indices.reserve(expectedCount);
+        }
+
+        void add(const KongModel::Vertex& vertex)
+        {
+            auto result = m_uniqueVertices.try_emplace(vertex, static_cast<uint32_t>(m_vertices.size()));
+            if (result.second)
+            {
+                m_vertices.push_back(vertex);
+            }
+            m_indices.push_back(result.first->second);
+        }
+
+    private:
+        std::vector<KongModel::Vertex>& m_vertices;
+        std::vector<uint32_t>& m_indices;
+        std::unordered_map<KongModel::Vertex, uint32_t> m_uniqueVertices{};
+    };
+
+    /*
+     * 把obj的一个角转换成顶点，tinyobj::attrib_t和KongObjData的布局一样，两种解析结果共用这段代码
+     */
+    template <typename Attrib, typename Index>
+    KongModel::Vertex makeObjVertex(const Attrib& attrib, const Index& index)
+    {
+        KongModel::Vertex vertex{};
+        if (index.vertex_index >= 0)
+        {
+            vertex.position = {
+                attrib.vertices[3 * index.vertex_index + 0],
+                attrib.vertices[3 * index.vertex_index + 1],
+                attrib.vertices[3 * index.vertex_index + 2]
+            };
+
+            // color数据是可选的，接在vertex后面
+            auto colorIndex = 3 * index.vertex_index + 2;
+            if (colorIndex < attrib.colors.size())
+            {
+                vertex.color = {
+                    attrib.colors[colorIndex - 2],
+                    attrib.colors[colorIndex - 1],
+                    attrib.colors[colorIndex]
+                };  
+            }
+            else
+            {
+                vertex.color = {0.7, 0.7, 0.7};
+            }
+        }
+
+        // normal和uv有各自的index，不能用vertex_index去取
+        if (index.normal_index >= 0)
+        {
+            vertex.normal = {
+                attrib.normals[3 * index.normal_index + 0],
+                attrib.normals[3 * index.normal_index + 1],
+                attrib.normals[3 * index.normal_index + 2]
+            };
+        }
+
+        if (index.texcoord_index >= 0)
+        {
+            vertex.uv = {
+                attrib.texcoords[2 * index.texcoord_index + 0],
+                attrib.texcoords[2 * index.texcoord_index + 1]
+            };
+        }
+        return vertex;
+    }
+}
+
+// Full格式的attribute偏移写在KongVertexFormats中，需要和Vertex的布局保持一致
+static_assert(sizeof(KongModel::Vertex) == sizeof(float) * 11, "Vertex must be tightly packed");
+static_assert(offsetof(KongModel::Vertex, color) == sizeof(float) * 3 && offsetof(KongModel::Vertex, normal) == sizeof(float) * 6
+    && offsetof(KongModel::Vertex, uv) == sizeof(float) * 9, "Vertex layout does not match KongVertexFormat::Full");
 
-    return bindingDescriptions;
+std::vector<VkVertexInputBindingDescription> KongModel::Vertex::getBindingDescription()
+{
+    return KongVertexFormats::bindingDescriptions(KongVertexLayout{});
 }
 
 std::vector<VkVertexInputAttributeDescription> KongModel::Vertex::getAttributeDescription()
 {
-    std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
-    attributeDescriptions.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position)});
-    attributeDescriptions.push_back({1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color)});
-    attributeDescriptions.push_back({2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal)});
-    attributeDescriptions.push_back({3, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv)});
-    
-    // // position
-    // attributeDescriptions[0].binding = 0;
-    // attributeDescriptions[0].location = 0;                      // location = 0
-    // attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;  // vec3
-    // attributeDescriptions[0].offset = offsetof(Vertex, position);
-    // // color
-    // attributeDescriptions[1].binding = 0;
-    // attributeDescriptions[1].location = 1;
-    // attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    // attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    return attributeDescriptions;
+    return KongVertexFormats::attributeDescriptions(KongVertexLayout{});
 }
 
 void KongModel::Builder::loadModel(const std::string& filepath)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-
-    std::string warn, err;
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
-    {
-        throw std::runtime_error(warn + err);
-    }
+    using clock = std::chrono::high_resolution_clock;
+    auto startTime = clock::now();
 
     vertices.clear();
     indices.clear();
 
-    for (const auto& shape : shapes)
+    // 优先使用多线程解析器，遇到它不支持的内容再退回tinyobj
+    KongObjData objData;
+    if (KongObjParser::parseFile(filepath, objData))
+    {
+        VertexWelder welder{vertices, indices, objData.indices.size()};
+        for (const auto& index : objData.indices)
+        {
+            welder.add(makeObjVertex(objData, index));
+        }
+        std::cout << "weld vertices: " << objData.indices.size() << " -> " << vertices.size() << std::endl;
+    }
+    else
     {
-        for (const auto& index : shape.mesh.indices)
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+
+        std::string warn, err;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
         {
-            Vertex vertex{};
-            if (index.vertex_index >= 0)
+            throw std::runtime_error(warn + err);
+        }
+
+        size_t cornerCount = 0;
+        for (const auto& shape : shapes)
+        {
+            cornerCount += shape.mesh.indices.size();
+        }
+        VertexWelder welder{vertices, indices, cornerCount};
+
+        for (const auto& shape : shapes)
+        {
+            for (const auto& index : shape.mesh.indices)
             {
-                vertex.position = {
-                    attrib.vertices[3 * index.vertex_index + 0],
-                    attrib.vertices[3 * index.vertex_index + 1],
-                    attrib.vertices[3 * index.vertex_index + 2]
-                };
-
-                // color数据是可选的，接在vertex后面
-                auto colorIndex = 3 * index.vertex_index + 2;
-                if (colorIndex < attrib.colors.size())
-                {
-                    vertex.color = {
-                        attrib.colors[colorIndex - 2],
-                        attrib.colors[colorIndex - 1],
-                        attrib.colors[colorIndex]
-                    };  
-                }
-                else
-                {
-                    vertex.color = {0.7, 0.7, 0.7};
-                }
+                welder.add(makeObjVertex(attrib, index));
             }
+        }
+        std::cout << "weld vertices: " << cornerCount << " -> " << vertices.size() << " (tinyobj)" << std::endl;
+    }
 
-            if (index.normal_index >= 0)
+    std::error_code ec;
+    auto fileSize = std::filesystem::file_size(filepath, ec);
+    float seconds = std::chrono::duration<float>(clock::now() - startTime).count();
+    if (!ec && seconds > 0.0f)
+    {
+        std::cout << "parse " << filepath << ": " << static_cast<float>(fileSize) / (1024.0f * 1024.0f) / seconds << " MB/s" << std::endl;
+    }
+}
+
+void KongModel::Builder::optimizeMesh()
+{
+    // 生成LOD之后各级共用顶点，不能再按range重排顶点
+    assert(lods.empty() && "optimizeMesh must be called before generateLods");
+    if (indices.empty())
+    {
+        return;
+    }
+
+    std::vector<DrawRange> ranges = drawRanges;
+    if (ranges.empty())
+    {
+        ranges.push_back({0, static_cast<uint32_t>(indices.size()), 0});
+    }
+
+    // 每个range各自优化，没被引用的顶点在vertex fetch重排时会被丢掉，所以顶点数组要重新拼起来
+    std::vector<Vertex> optimizedVertices;
+    optimizedVertices.reserve(vertices.size());
+    KongVertexCacheStats before{}, after{};
+    for (auto& range : ranges)
+    {
+        // 空的range（导入的空mesh）不引用任何顶点
+        if (range.indexCount == 0)
+        {
+            range.vertexOffset = static_cast<int32_t>(optimizedVertices.size());
+            continue;
+        }
+        uint32_t* rangeIndices = indices.data() + range.firstIndex;
+        const Vertex* rangeVertices = vertices.data() + range.vertexOffset;
+        const size_t rangeVertexCount = static_cast<size_t>(*std::max_element(rangeIndices, rangeIndices + range.indexCount)) + 1;
+
+        before += KongMeshOptimizer::analyzeVertexCache(rangeIndices, range.indexCount, rangeVertexCount);
+        auto order = KongMeshOptimizer::optimize(rangeIndices, range.indexCount,
+            &rangeVertices->position.x, sizeof(Vertex), rangeVertexCount);
+        after += KongMeshOptimizer::analyzeVertexCache(rangeIndices, range.indexCount, order.size());
+
+        range.vertexOffset = static_cast<int32_t>(optimizedVertices.size());
+        for (uint32_t oldIndex : order)
+        {
+            optimizedVertices.push_back(rangeVertices[oldIndex]);
+        }
+    }
+
+    vertices = std::move(optimizedVertices);
+    if (!drawRanges.empty())
+    {
+        drawRanges = std::move(ranges);
+    }
+
+    std::cout << "optimize mesh: ACMR " << before.acmr() << " -> " << after.acmr()
+        << ", ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+}
+
+void KongModel::Builder::loadAsset(const std::string& filepath)
+{
+    std::string extension = std::filesystem::path(filepath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension == ".obj")
+    {
+        loadModel(filepath);
+    }
+    else
+    {
+        KongAssimpImporter::loadBuilder(filepath, *this);
+    }
+}
+
+void KongModel::Builder::cook(const KongLodSettings& settings)
+{
+    optimizeMesh();
+    generateLods(settings);
+    buildMeshlets();
+}
+
+void KongModel::Builder::generateLods(const KongLodSettings& settings)
+{
+    if (indices.empty() || !lods.empty())
+    {
+        return;
+    }
+
+    if (drawRanges.empty())
+    {
+        drawRanges.push_back({0, static_cast<uint32_t>(indices.size()), 0});
+    }
+    const std::vector<DrawRange> baseRanges = drawRanges;
+    lods.push_back({0, static_cast<uint32_t>(baseRanges.size()), 0.0f, 0});
+
+    // 每个range各自简化，层数不够的range在更粗的LOD里继续使用自己最后一级
+    std::vector<std::vector<KongMeshSimplifier::LodLevel>> chains;
+    size_t levelCount = 1;
+    for (const auto& range : baseRanges)
+    {
+        // 空的range没有可简化的三角形，空的链表示每级LOD都沿用它自己
+        if (range.indexCount == 0)
+        {
+            chains.emplace_back();
+            continue;
+        }
+        const uint32_t* rangeIndices = indices.data() + range.firstIndex;
+        const size_t rangeVertexCount = static_cast<size_t>(*std::max_element(rangeIndices, rangeIndices + range.indexCount)) + 1;
+        chains.push_back(KongMeshSimplifier::buildLodChain(rangeIndices, range.indexCount,
+            &vertices[range.vertexOffset].position.x, sizeof(Vertex), rangeVertexCount, settings));
+        levelCount = std::max(levelCount, chains.back().size() + 1);
+    }
+
+    std::cout << "generate lods: " << indices.size() / 3;
+    for (size_t level = 1; level < levelCount; level++)
+    {
+        Lod lod{static_cast<uint32_t>(drawRanges.size()), static_cast<uint32_t>(baseRanges.size()), 0.0f, 0};
+        size_t triangleCount = 0;
+        for (size_t r = 0; r < baseRanges.size(); r++)
+        {
+            const auto& chain = chains[r];
+            if (chain.empty())
             {
-                vertex.normal = {
-                    attrib.normals[3 * index.vertex_index + 0],
-                    attrib.normals[3 * index.vertex_index + 1],
-                    attrib.normals[3 * index.vertex_index + 2]
-                };
+                drawRanges.push_back(baseRanges[r]);
+                triangleCount += baseRanges[r].indexCount / 3;
+                continue;
             }
 
-            if (index.texcoord_index >= 0)
+            const auto& lodLevel = chain[std::min(level, chain.size()) - 1];
+            // 同一级被多个LOD复用时不重复追加index
+            if (level <= chain.size())
+            {
+                drawRanges.push_back({static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lodLevel.indices.size()),
+                    baseRanges[r].vertexOffset});
+                indices.insert(indices.end(), lodLevel.indices.begin(), lodLevel.indices.end());
+            }
+            else
             {
-                vertex.uv = {
-                    attrib.texcoords[2 * index.vertex_index + 0],
-                    attrib.texcoords[2 * index.vertex_index + 1]
-                };
+                const DrawRange previous = drawRanges[lods.back().firstRange + r];
+                drawRanges.push_back(previous);
             }
+            lod.error = std::max(lod.error, lodLevel.error);
+            triangleCount += lodLevel.indices.size() / 3;
+        }
+        lods.push_back(lod);
+        std::cout << " -> " << triangleCount << " (error " << lod.error << ")";
+    }
+    std::cout << std::endl;
+}
 
-            vertices.push_back(vertex);
+void KongModel::Builder::buildMeshlets()
+{
+    meshlets.clear();
+    if (indices.empty())
+    {
+        return;
+    }
+
+    // 只处理LOD0，更粗的LOD本身三角形就少，直接整体绘制
+    std::vector<DrawRange> ranges = drawRanges;
+    if (ranges.empty())
+    {
+        ranges.push_back({0, static_cast<uint32_t>(indices.size()), 0});
+    }
+    else if (!lods.empty())
+    {
+        ranges.assign(drawRanges.begin() + lods[0].firstRange, drawRanges.begin() + lods[0].firstRange + lods[0].rangeCount);
+    }
+
+    for (const auto& range : ranges)
+    {
+        if (range.indexCount == 0)
+        {
+            continue;
         }
+        const uint32_t* rangeIndices = indices.data() + range.firstIndex;
+        const size_t rangeVertexCount = static_cast<size_t>(*std::max_element(rangeIndices, rangeIndices + range.indexCount)) + 1;
+        KongMeshletBuilder::build(rangeIndices, range.indexCount, &vertices[range.vertexOffset].position.x, sizeof(Vertex),
+            rangeVertexCount, static_cast<uint32_t>(range.vertexOffset), meshlets);
+    }
+
+    if (meshlets.meshlets.empty())
+    {
+        return;
     }
+    std::cout << "build meshlets: " << meshlets.meshlets.size() << " meshlets, "
+        << static_cast<float>(meshlets.vertices.size()) / meshlets.meshlets.size() << " vertices and "
+        << static_cast<float>(meshlets.triangles.size() / 3) / meshlets.meshlets.size() << " triangles per meshlet" << std::endl;
 }
 
-KongModel::KongModel(KongDevice& device, const Builder& builder)
-    : m_kongDevice{device}
+KongModel::KongModel(KongDevice& device, const Builder& builder, const KongVertexLayout& vertexLayout, KongGeometryPool* geometryPool)
+    : m_kongDevice{device}, vertexLayout{vertexLayout}
 {
-    createVertexBuffer(builder.vertices);
+    initGeometryPool(geometryPool);
+    glm::vec3 boundsMin{std::numeric_limits<float>::max()};
+    glm::vec3 boundsMax{std::numeric_limits<float>::lowest()};
+    for (const auto& vertex : builder.vertices)
+    {
+        boundsMin = glm::min(boundsMin, vertex.position);
+        boundsMax = glm::max(boundsMax, vertex.position);
+    }
+    setBounds(boundsMin, boundsMax);
+
+    createVertexBuffer(builder.vertices.data(), static_cast<uint32_t>(builder.vertices.size()));
     createIndexBuffer(builder.indices);
+    drawRanges = builder.drawRanges;
+    if (drawRanges.empty())
+    {
+        drawRanges.push_back({0, indexCount, 0});
+    }
+    initLods(builder.lods);
+    meshlets = builder.meshlets;
+    createMeshletBuffers();
+    // 所有buffer的拷贝都录在staging ring的同一批命令中，最后只等待一次
+    finishUpload();
+}
+
+KongModel::KongModel(KongDevice& device, const KongMeshCache& cache, const KongVertexLayout& vertexLayout, KongGeometryPool* geometryPool)
+    : m_kongDevice{device}, vertexLayout{vertexLayout}
+{
+    initGeometryPool(geometryPool);
+    const auto& header = cache.header();
+    // 缓存中保存的是未压缩的顶点，上传时再按vertexLayout转换
+    assert(header.vertexStride == sizeof(Vertex) && "unexpected vertex stride in mesh cache");
+    setBounds(glm::vec3{header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]},
+        glm::vec3{header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]});
+    createVertexBuffer(static_cast<const Vertex*>(cache.vertexData()), header.vertexCount);
+    createIndexBuffer(cache.indexData(), header.indexCount, cache.indexType());
+    drawRanges.assign(cache.drawRanges(), cache.drawRanges() + header.rangeCount);
+    initLods(std::vector<Lod>(cache.lods(), cache.lods() + header.lodCount));
+    meshlets.meshlets.assign(cache.meshlets(), cache.meshlets() + header.meshletCount);
+    meshlets.vertices.assign(cache.meshletVertices(), cache.meshletVertices() + header.meshletVertexCount);
+    meshlets.triangles.assign(cache.meshletTriangles(), cache.meshletTriangles() + header.meshletTriangleSize);
+    createMeshletBuffers();
+    finishUpload();
+}
+
+KongModel::KongModel(KongDevice& device, const StreamedMesh& mesh, KongGeometryPool* geometryPool)
+    : m_kongDevice{device}, vertexLayout{mesh.vertexLayout}, vertexCount{mesh.vertexCount}, indexType{mesh.indexType},
+      drawRanges{mesh.drawRanges}
+{
+    assert(vertexCount >= 3 && "Vertex count must be greater than 3");
+    initGeometryPool(geometryPool);
+    setBounds(mesh.boundsMin, mesh.boundsMax);
+    if (vertexLayout.format == KongVertexFormat::Full && !vertexLayout.splitPositions)
+    {
+        this->geometryPool->allocateVertices(geometry, vertexLayout, vertexCount);
+        uploadTicket = this->geometryPool->uploadVertices(geometry,
+            [&](void* mapped, uint32_t first, uint32_t count) { mesh.writeVertices(static_cast<Vertex*>(mapped), first, count); });
+    }
+    else
+    {
+        // 需要转换格式时先写出完整的顶点再打包
+        std::vector<Vertex> vertices(vertexCount);
+        mesh.writeVertices(vertices.data(), 0, vertexCount);
+        createVertexBuffer(vertices.data(), vertexCount);
+    }
+
+    indexCount = 0;
+    for (const auto& range : drawRanges)
+    {
+        indexCount = std::max(indexCount, range.firstIndex + range.indexCount);
+    }
+    hasIndexBuffer = indexCount > 0;
+    if (hasIndexBuffer)
+    {
+        this->geometryPool->allocateIndices(geometry, indexType, indexCount);
+        uploadTicket = this->geometryPool->uploadIndices(geometry, mesh.writeIndices);
+    }
+    initLods(mesh.lods);
+    meshlets = mesh.meshlets;
+    createMeshletBuffers();
+    finishUpload();
+}
+
+void KongModel::packVertices(const Vertex* vertices, uint32_t count, const KongVertexLayout& layout,
+    const glm::vec3& boundsMin, const glm::vec3& boundsMax, void* dst)
+{
+    if (layout.splitPositions)
+    {
+        // 分块打包成交错格式再拆成两个数据流，position在每个顶点的开头
+        constexpr uint32_t CHUNK_SIZE = 256;
+        const KongVertexLayout interleaved{layout.format, false};
+        const uint32_t stride = KongVertexFormats::stride(layout.format);
+        const uint32_t positionSize = KongVertexFormats::positionSize(layout.format);
+        const uint32_t attributeSize = stride - positionSize;
+        auto* positions = static_cast<uint8_t*>(dst);
+        auto* attributes = positions + static_cast<size_t>(positionSize) * count;
+        std::vector<uint8_t> chunk(static_cast<size_t>(stride) * CHUNK_SIZE);
+        for (uint32_t first = 0; first < count; first += CHUNK_SIZE)
+        {
+            const uint32_t chunkCount = std::min(CHUNK_SIZE, count - first);
+            packVertices(vertices + first, chunkCount, interleaved, boundsMin, boundsMax, chunk.data());
+            for (uint32_t i = 0; i < chunkCount; i++)
+            {
+                const uint8_t* vertex = chunk.data() + static_cast<size_t>(stride) * i;
+                std::memcpy(positions + static_cast<size_t>(positionSize) * (first + i), vertex, positionSize);
+                std::memcpy(attributes + static_cast<size_t>(attributeSize) * (first + i), vertex + positionSize, attributeSize);
+            }
+        }
+        return;
+    }
+
+    auto packCommon = [](const Vertex& vertex, auto& packed)
+    {
+        const glm::vec2 normal = KongVertexFormats::octEncode(vertex.normal);
+        packed.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(normal.x));
+        packed.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(normal.y));
+        // uv可能超出[0, 1]（平铺的贴图），所以用half而不是unorm16
+        packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+        packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+        const glm::u8vec4 color = glm::round(glm::clamp(glm::vec4{vertex.color, 1.0f}, 0.0f, 1.0f) * 255.0f);
+        std::memcpy(packed.color, &color, sizeof(packed.color));
+    };
+
+    switch (layout.format)
+    {
+    case KongVertexFormat::Full:
+        std::memcpy(dst, vertices, sizeof(Vertex) * count);
+        break;
+    case KongVertexFormat::Packed:
+        {
+            auto* out = static_cast<KongPackedVertex*>(dst);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                std::memcpy(out[i].position, &vertices[i].position, sizeof(out[i].position));
+                packCommon(vertices[i], out[i]);
+            }
+        }
+        break;
+    case KongVertexFormat::PackedQuantized:
+        {
+            const glm::mat4 dequantize = KongVertexFormats::dequantizeMatrix(boundsMin, boundsMax);
+            const glm::vec3 offset = glm::vec3(dequantize[3]);
+            const glm::vec3 scale = 65535.0f / glm::vec3{dequantize[0][0], dequantize[1][1], dequantize[2][2]};
+            auto* out = static_cast<KongQuantizedVertex*>(dst);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const glm::vec3 quantized = glm::round(glm::clamp((vertices[i].position - offset) * scale, 0.0f, 65535.0f));
+                out[i].position[0] = static_cast<uint16_t>(quantized.x);
+                out[i].position[1] = static_cast<uint16_t>(quantized.y);
+                out[i].position[2] = static_cast<uint16_t>(quantized.z);
+                out[i].position[3] = 0;
+                packCommon(vertices[i], out[i]);
+            }
+        }
+        break;
+    default:
+        assert(false && "unknown vertex format");
+        break;
+    }
+}
+
+void KongModel::initGeometryPool(KongGeometryPool* pool)
+{
+    if (!pool)
+    {
+        ownedGeometryPool = std::make_unique<KongGeometryPool>(m_kongDevice, KongGeometryPoolSettings{0, 0});
+        pool = ownedGeometryPool.get();
+    }
+    geometryPool = pool;
+}
+
+void KongModel::finishUpload()
+{
+    m_kongDevice.stagingRing().wait(uploadTicket);
+    // 之后不会再写入，单独占页的几何数据可以被碎片整理移动
+    geometryPool->setMovable(geometry);
+}
+
+void KongModel::initLods(const std::vector<Lod>& sourceLods)
+{
+    lods = sourceLods;
+    if (lods.empty())
+    {
+        lods.push_back({0, static_cast<uint32_t>(drawRanges.size()), 0.0f, 0});
+    }
+
+    for (auto& lod : lods)
+    {
+        lod.triangleCount = 0;
+        for (uint32_t i = 0; i < lod.rangeCount; i++)
+        {
+            lod.triangleCount += drawRanges[lod.firstRange + i].indexCount / 3;
+        }
+    }
+}
+
+void KongModel::createMeshletBuffers()
+{
+    if (meshlets.empty())
+    {
+        return;
+    }
+
+    meshletBuffer = uploadDeviceLocalBuffer(sizeof(KongMeshlet), static_cast<uint32_t>(meshlets.meshlets.size()),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        [&](void* mapped, VkDeviceSize offset, VkDeviceSize size)
+        {
+            memcpy(mapped, reinterpret_cast<const uint8_t*>(meshlets.meshlets.data()) + offset, static_cast<size_t>(size));
+        });
+    meshletVertexBuffer = uploadDeviceLocalBuffer(sizeof(uint32_t), static_cast<uint32_t>(meshlets.vertices.size()),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        [&](void* mapped, VkDeviceSize offset, VkDeviceSize size)
+        {
+            memcpy(mapped, reinterpret_cast<const uint8_t*>(meshlets.vertices.data()) + offset, static_cast<size_t>(size));
+        });
+
+    const size_t triangleBytes = meshlets.triangles.size();
+    const size_t paddedBytes = (triangleBytes + 3) & ~static_cast<size_t>(3);
+    meshletTriangleBuffer = uploadDeviceLocalBuffer(1, static_cast<uint32_t>(paddedBytes), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        [&](void* mapped, VkDeviceSize offset, VkDeviceSize size)
+        {
+            // 末尾补齐到4字节的部分填0
+            const size_t copyBytes = offset < triangleBytes ? std::min(static_cast<size_t>(size), triangleBytes - static_cast<size_t>(offset)) : 0;
+            if (copyBytes > 0)
+            {
+                memcpy(mapped, meshlets.triangles.data() + offset, copyBytes);
+            }
+            memset(static_cast<uint8_t*>(mapped) + copyBytes, 0, static_cast<size_t>(size) - copyBytes);
+        });
+}
+
+void KongModel::setBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    this->boundsMin = boundsMin;
+    this->boundsMax = boundsMax;
+    positionTransform = vertexLayout.format == KongVertexFormat::PackedQuantized
+        ? KongVertexFormats::dequantizeMatrix(boundsMin, boundsMax)
+        : glm::mat4{1.0f};
+    boundsCenter = (boundsMin + boundsMax) * 0.5f;
+    boundsRadius = glm::length(boundsMax - boundsMin) * 0.5f;
 }
 
 KongModel::~KongModel()
 {
     /*
      * buffer和memory分开，是由于分配内存是需要时间的，并且GPU有分配内存的操作数的上限（几千），在复杂场景下很容易遇到瓶颈
-     * 所以正确的做法是请求大块内存并将内存的部分分配给不同资源。
-     * 了解Vulkan memory allocator（VMA）库
+     * 所以KongBuffer的内存由KongMemoryAllocator从大块内存中子分配，顶点和index再从KongGeometryPool的大buffer中分配
      */
+    geometryPool->free(geometry);
     // vkDestroyBuffer(m_kongDevice.device(), vertexBuffer, nullptr);
     // vkFreeMemory(m_kongDevice.device(), vertexBufferMemory, nullptr);
     //
@@ -130,68 +637,98 @@ KongModel::~KongModel()
     // }
 }
 
-void KongModel::draw(VkCommandBuffer commandBuffer)
+void KongModel::draw(VkCommandBuffer commandBuffer, uint32_t lodIndex, uint32_t instanceCount, uint32_t firstInstance) const
 {
     if (hasIndexBuffer)
     {
-        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+        // 每个子mesh一次draw call，共用同一组vertex/index buffer的绑定，range是相对于模型在池中的起点的
+        const Lod& lod = lods[std::min(lodIndex, static_cast<uint32_t>(lods.size()) - 1)];
+        for (uint32_t i = 0; i < lod.rangeCount; i++)
+        {
+            const DrawRange& range = drawRanges[lod.firstRange + i];
+            vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount, geometry.firstIndex + range.firstIndex,
+                static_cast<int32_t>(geometry.firstVertex) + range.vertexOffset, firstInstance);
+        }
     }
     else
     {
-        vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);    
+        vkCmdDraw(commandBuffer, vertexCount, instanceCount, geometry.firstVertex, firstInstance);
     }
 }
 
-std::unique_ptr<KongModel> KongModel::createModelFromFile(KongDevice& device, const std::string& filepath)
+std::unique_ptr<KongModel> KongModel::createModelFromFile(KongDevice& device, const std::string& filepath,
+    const KongVertexLayout& vertexLayout, KongGeometryPool* geometryPool)
 {
+    using clock = std::chrono::high_resolution_clock;
+    auto startTime = clock::now();
+
+    const std::string cachePath = KongMeshCache::cachePathFor(filepath);
+    KongMeshCache cache;
+    if (cache.open(cachePath, filepath))
+    {
+        auto model = std::make_unique<KongModel>(device, cache, vertexLayout, geometryPool);
+        std::cout << "load " << cachePath << " (kvmesh): "
+            << std::chrono::duration<float, std::milli>(clock::now() - startTime).count() << " ms" << std::endl;
+        return model;
+    }
+    std::cout << filepath << " is not cooked, run kv_assetc to skip importing at runtime" << std::endl;
+
+    // 没有缓存时obj走自己的解析器并顺便写出缓存，其余格式（.blend/.fbx/.gltf等）交给Assimp直接上传
+    std::string extension = std::filesystem::path(filepath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension != ".obj")
+    {
+        return KongAssimpImporter::importModel(device, filepath, vertexLayout, geometryPool);
+    }
+    
     Builder builder;
     builder.loadModel(filepath);
+    builder.cook();
 
-    std::cout << "vertex size:" << builder.vertices.size() << std::endl;
-    return std::make_unique<KongModel>(device, builder);
-}
-
-void KongModel::bind(VkCommandBuffer commandBuffer)
-{
-    // 绑定command buffer和vertex buffer
-    VkBuffer buffers[] = { vertexBuffer->getBuffer() };
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+    std::cout << "vertex size:" << builder.vertices.size() << ", index size:" << builder.indices.size() << std::endl;
+    auto model = std::make_unique<KongModel>(device, builder, vertexLayout, geometryPool);
+    std::cout << "load " << filepath << " (obj): "
+        << std::chrono::duration<float, std::milli>(clock::now() - startTime).count() << " ms" << std::endl;
 
-    if (hasIndexBuffer)
+    // 缓存写在计时之后，下一次启动直接读取缓存
+    if (!KongMeshCache::write(cachePath, filepath, builder))
     {
-        vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+        std::cerr << "failed to create mesh cache for " << filepath << std::endl;
     }
+    return model;
 }
 
-void KongModel::createVertexBuffer(const std::vector<Vertex>& vertices)
+void KongModel::bind(VkCommandBuffer commandBuffer, KongGeometryBindState& state, uint32_t streams) const
 {
-    vertexCount = static_cast<uint32_t>(vertices.size());
-    assert(vertexCount >= 3 && "Vertex count must be greater than 3");
-
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
-    uint32_t vertexSize = sizeof(vertices[0]);
+    KongGeometryPool::bind(commandBuffer, geometry, streams, state);
+}
 
-    KongBuffer staggingBuffer {
+template <typename FillFunc>
+std::unique_ptr<KongBuffer> KongModel::uploadDeviceLocalBuffer(uint32_t instanceSize, uint32_t instanceCount,
+    VkBufferUsageFlags usage, FillFunc&& fillStaging)
+{
+    auto deviceBuffer = std::make_unique<KongBuffer>(
         m_kongDevice,
-        vertexSize,
-        vertexCount,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    };
-
-    staggingBuffer.map();
-    staggingBuffer.writeToBuffer((void*)vertices.data());
-
-    vertexBuffer = std::make_unique<KongBuffer>(
-    m_kongDevice,
-        vertexSize,
-        vertexCount,
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        instanceSize,
+        instanceCount,
+        usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
     );
 
-    m_kongDevice.copyBuffer(staggingBuffer.getBuffer(), vertexBuffer->getBuffer(), bufferSize);
+    uploadTicket = m_kongDevice.stagingRing().uploadBuffer(deviceBuffer->getBuffer(), 0,
+        static_cast<VkDeviceSize>(instanceSize) * instanceCount, fillStaging);
+    return deviceBuffer;
+}
+
+void KongModel::createVertexBuffer(const Vertex* vertices, uint32_t count)
+{
+    vertexCount = count;
+    assert(vertexCount >= 3 && "Vertex count must be greater than 3");
+
+    // 直接在staging memory上打包，不需要额外的临时数组
+    geometryPool->allocateVertices(geometry, vertexLayout, vertexCount);
+    uploadTicket = geometryPool->uploadVertices(geometry,
+        [&](void* mapped, uint32_t first, uint32_t count) { packVertices(vertices + first, count, vertexLayout, boundsMin, boundsMax, mapped); });
     
     // /*
     //  * staging buffer:
@@ -234,8 +771,41 @@ void KongModel::createVertexBuffer(const std::vector<Vertex>& vertices)
 
 void KongModel::createIndexBuffer(const std::vector<uint32_t>& indices)
 {
+    // index都在16位范围内时使用uint16 index（带draw range时index是相对值，顶点总数可以超过65535）
+    uint32_t maxIndex = indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end());
+    VkIndexType type = maxIndex <= std::numeric_limits<uint16_t>::max() ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    if (type == VK_INDEX_TYPE_UINT32)
+    {
+        createIndexBuffer(indices.data(), static_cast<uint32_t>(indices.size()), type);
+        return;
+    }
+
     indexCount = static_cast<uint32_t>(indices.size());
     hasIndexBuffer = indexCount > 0;
+    indexType = type;
+    if (!hasIndexBuffer)
+    {
+        return;
+    }
+
+    geometryPool->allocateIndices(geometry, indexType, indexCount);
+    uploadTicket = geometryPool->uploadIndices(geometry,
+        [&](void* mapped, uint32_t first, uint32_t count)
+        {
+            // 直接在staging memory上做截断，不需要额外的临时数组
+            auto* shortIndices = static_cast<uint16_t*>(mapped);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                shortIndices[i] = static_cast<uint16_t>(indices[first + i]);
+            }
+        });
+}
+
+void KongModel::createIndexBuffer(const void* indices, uint32_t count, VkIndexType type)
+{
+    indexCount = count;
+    hasIndexBuffer = indexCount > 0;
+    indexType = type;
 
     if (!hasIndexBuffer)
     {
@@ -246,19 +816,7 @@ void KongModel::createIndexBuffer(const std::vector<uint32_t>& indices)
     // VkBuffer stagingBuffer = VK_NULL_HANDLE;
     // VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
     
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
-    uint32_t indexSize = sizeof(indices[0]);
-    KongBuffer staggingBuffer{
-        m_kongDevice,
-        indexSize,
-        indexCount,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    };
-
-    staggingBuffer.map();
-    staggingBuffer.writeToBuffer((void*)indices.data());
-    
+    uint32_t indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
     
     // m_kongDevice.createBuffer(bufferSize,
     //     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
@@ -273,20 +831,17 @@ void KongModel::createIndexBuffer(const std::vector<uint32_t>& indices)
     // memcpy(data, indices.data(), static_cast<size_t>(bufferSize));
     // vkUnmapMemory(m_kongDevice.device(), stagingBufferMemory);
 
-    indexBuffer = std::make_unique<KongBuffer>(
-        m_kongDevice,
-        indexSize,
-        indexCount,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    geometryPool->allocateIndices(geometry, indexType, indexCount);
+    uploadTicket = geometryPool->uploadIndices(geometry, [&](void* mapped, uint32_t first, uint32_t count)
+    {
+        memcpy(mapped, static_cast<const uint8_t*>(indices) + static_cast<size_t>(indexSize) * first, static_cast<size_t>(indexSize) * count);
+    });
 
     //
     // m_kongDevice.createBuffer(bufferSize,
     //     VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
     //     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
     //     indexBuffer, indexBufferMemory);
-
-    m_kongDevice.copyBuffer(staggingBuffer.getBuffer(), indexBuffer->getBuffer(), bufferSize);
     
     // vkDestroyBuffer(m_kongDevice.device(), stagingBuffer, nullptr);
     // vkFreeMemory(m_kongDevice.device(), stagingBufferMemory, nullptr);
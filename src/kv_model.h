@@ -4,13 +4,21 @@
 #define GLM_FORCE_RADIANS
 // depth from 0 to 1, not -1 to 1 (opengl)
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <functional>
 #include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 
 #include "kv_buffer.h"
+#include "kv_geometry_pool.h"
+#include "kv_mesh_simplifier.h"
+#include "kv_meshlet.h"
+#include "kv_vertex_format.h"
 
 namespace kong
 {
+    class KongMeshCache;
+    
     class KongModel
     {
     public:
@@ -23,38 +31,170 @@ namespace kong
             
             static std::vector<VkVertexInputBindingDescription> getBindingDescription();
             static std::vector<VkVertexInputAttributeDescription> getAttributeDescription();
+
+            bool operator==(const Vertex& other) const
+            {
+                return position == other.position && color == other.color && normal == other.normal && uv == other.uv;
+            }
+        };
+
+        // 一个子mesh在共享vertex/index buffer中的范围，对应一次vkCmdDrawIndexed
+        struct DrawRange
+        {
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            int32_t vertexOffset = 0;
+        };
+
+        // 一级LOD对应drawRanges中连续的rangeCount个range，所有LOD共用同一个vertex buffer
+        struct Lod
+        {
+            uint32_t firstRange = 0;
+            uint32_t rangeCount = 0;
+            float error = 0.0f;         // 相对LOD0的简化误差，模型空间的长度
+            uint32_t triangleCount = 0;
         };
 
         struct Builder
         {
             std::vector<Vertex> vertices{};
             std::vector<uint32_t> indices{};
+            // 为空时整个index buffer作为一个draw range；非空时index相对于各自的vertexOffset
+            std::vector<DrawRange> drawRanges{};
+            // 为空时只有一级LOD，包含全部draw range
+            std::vector<Lod> lods{};
+            // LOD0切分出的meshlet，顶点编号是vertices中的绝对编号
+            KongMeshletData meshlets{};
 
             void loadModel(const std::string& filepath);
+            // 按扩展名选择：obj用loadModel，其余格式用Assimp把所有mesh拼成draw range
+            void loadAsset(const std::string& filepath);
+            // 对每个draw range做vertex cache、overdraw和vertex fetch优化，模型导入之后、写缓存之前调用
+            void optimizeMesh();
+            // 用QEM简化为每个draw range生成LOD链，简化后的index追加在indices后面，需要在optimizeMesh之后调用
+            void generateLods(const KongLodSettings& settings = {});
+            // 把LOD0的每个draw range切分成meshlet，需要在optimizeMesh之后调用
+            void buildMeshlets();
+            // 依次做optimizeMesh、generateLods和buildMeshlets，得到可以直接写成.kvmesh的数据
+            void cook(const KongLodSettings& settings = {});
+        };
+
+        /*
+         * 由调用方直接把顶点和index写进staging buffer，不经过Builder中转
+         * index是相对于各自drawRange.vertexOffset的，类型由indexType决定
+         */
+        // 写入第first个开始的count个顶点或index，数据大时分块上传，每块调用一次
+        using VertexWriter = std::function<void(Vertex* vertices, uint32_t first, uint32_t count)>;
+        using IndexWriter = std::function<void(void* indices, uint32_t first, uint32_t count)>;
+        struct StreamedMesh
+        {
+            uint32_t vertexCount = 0;
+            VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+            std::vector<DrawRange> drawRanges{};
+            std::vector<Lod> lods{};
+            glm::vec3 boundsMin{};
+            glm::vec3 boundsMax{};
+            KongVertexLayout vertexLayout{};
+            KongMeshletData meshlets{};
+            VertexWriter writeVertices;
+            IndexWriter writeIndices;
         };
         
-        KongModel(KongDevice& device, const Builder& builder);
+        /*
+         * vertexLayout决定上传到GPU的顶点格式和数据流划分，在写入staging buffer时转换
+         * 顶点和index放在geometryPool中，为空时模型单独创建刚好大小的vertex/index buffer
+         */
+        KongModel(KongDevice& device, const Builder& builder, const KongVertexLayout& vertexLayout = {},
+            KongGeometryPool* geometryPool = nullptr);
+        // 从mmap的.kvmesh缓存创建，默认布局时数据直接拷贝进staging buffer
+        KongModel(KongDevice& device, const KongMeshCache& cache, const KongVertexLayout& vertexLayout = {},
+            KongGeometryPool* geometryPool = nullptr);
+        KongModel(KongDevice& device, const StreamedMesh& mesh, KongGeometryPool* geometryPool = nullptr);
         ~KongModel();
     
         KongModel(const KongModel&) = delete;
         KongModel& operator=(const KongModel&) = delete;
 
-        static std::unique_ptr<KongModel> createModelFromFile(KongDevice& device, const std::string& filepath);
+        // 优先读取kv_assetc生成的.kvmesh，没有或者过期时才在运行时导入
+        static std::unique_ptr<KongModel> createModelFromFile(KongDevice& device, const std::string& filepath,
+            const KongVertexLayout& vertexLayout = {}, KongGeometryPool* geometryPool = nullptr);
+        /*
+         * 按layout转换顶点写入dst，PackedQuantized的position相对于[boundsMin, boundsMax]量化
+         * position分开存放时dst中先是count个position，紧接着是count个其余属性
+         */
+        static void packVertices(const Vertex* vertices, uint32_t count, const KongVertexLayout& layout,
+            const glm::vec3& boundsMin, const glm::vec3& boundsMax, void* dst);
         
-        void bind(VkCommandBuffer commandBuffer);
-        void draw(VkCommandBuffer commandBuffer);
+        // streams为pipeline读取的数据流，position分开存放时只绑定需要的binding；和state中已经绑定的页相同时跳过
+        void bind(VkCommandBuffer commandBuffer, KongGeometryBindState& state, uint32_t streams = KongVertexFormats::STREAM_ALL) const;
+        // 实例化绘制时着色器用gl_InstanceIndex（从firstInstance开始）读取每个实例的数据
+        void draw(VkCommandBuffer commandBuffer, uint32_t lodIndex = 0, uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
+
+        const std::vector<DrawRange>& getDrawRanges() const { return drawRanges; }
+        uint32_t getLodCount() const { return static_cast<uint32_t>(lods.size()); }
+        const Lod& getLod(uint32_t lodIndex) const { return lods[lodIndex]; }
+        // 模型空间（反量化之后）的包围盒，加载时计算
+        const glm::vec3& getBoundsMin() const { return boundsMin; }
+        const glm::vec3& getBoundsMax() const { return boundsMax; }
+        // 模型空间的包围球，由包围盒得到
+        const glm::vec3& getBoundsCenter() const { return boundsCenter; }
+        float getBoundsRadius() const { return boundsRadius; }
+        const KongVertexLayout& getVertexLayout() const { return vertexLayout; }
+        // 在共享vertex/index buffer中的位置
+        const KongGeometryRange& getGeometry() const { return geometry; }
+        // 顶点position到模型空间的变换，position量化时为反量化矩阵，否则为单位矩阵，需要乘在model matrix右边
+        const glm::mat4& getPositionTransform() const { return positionTransform; }
+
+        // LOD0的meshlet，CPU上保留一份供剔除使用，同时上传到storage buffer供compute shader使用
+        const KongMeshletData& getMeshlets() const { return meshlets; }
+        KongBuffer* getMeshletBuffer() const { return meshletBuffer.get(); }
+        KongBuffer* getMeshletVertexBuffer() const { return meshletVertexBuffer.get(); }
+        // 每个三角形3个byte，末尾补齐到4 byte，shader中按uint读取
+        KongBuffer* getMeshletTriangleBuffer() const { return meshletTriangleBuffer.get(); }
         
     private:
-        void createVertexBuffer(const std::vector<Vertex>& vertices);
+        // 需要在setBounds之后调用，量化position时要用到包围盒
+        void createVertexBuffer(const Vertex* vertices, uint32_t count);
         void createIndexBuffer(const std::vector<uint32_t>& indices);
+        void createIndexBuffer(const void* indices, uint32_t count, VkIndexType type);
+        void initGeometryPool(KongGeometryPool* pool);
+        // 等待构造过程中的所有上传完成
+        void finishUpload();
+        // fillStaging写入staging ring后拷贝到device local的buffer，上传完成之前不能使用
+        template <typename FillFunc>
+        std::unique_ptr<KongBuffer> uploadDeviceLocalBuffer(uint32_t instanceSize, uint32_t instanceCount,
+            VkBufferUsageFlags usage, FillFunc&& fillStaging);
+        // 补全LOD信息（没有LOD时整个模型作为LOD0）并统计每级的三角形数
+        void initLods(const std::vector<Lod>& sourceLods);
+        void setBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+        void createMeshletBuffers();
         
         KongDevice& m_kongDevice;
 
-        std::unique_ptr<KongBuffer> vertexBuffer;
+        KongVertexLayout vertexLayout{};
+        // 没有传入共享的池时模型自己持有一个每次分配都单独建buffer的池
+        std::unique_ptr<KongGeometryPool> ownedGeometryPool;
+        KongGeometryPool* geometryPool = nullptr;
+        KongGeometryRange geometry{};
+        // 构造过程中最后一次上传所在的staging ring批次，构造函数结束前等待
+        uint64_t uploadTicket = 0;
         uint32_t vertexCount;
 
         bool hasIndexBuffer = false;
-        std::unique_ptr<KongBuffer> indexBuffer;
         uint32_t indexCount;
+        // 顶点数不超过65535时使用16位index，减少一半index buffer的大小
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        std::vector<DrawRange> drawRanges{};
+        std::vector<Lod> lods{};
+        glm::vec3 boundsMin{};
+        glm::vec3 boundsMax{};
+        glm::vec3 boundsCenter{};
+        float boundsRadius = 0.0f;
+        glm::mat4 positionTransform{1.0f};
+
+        KongMeshletData meshlets{};
+        std::unique_ptr<KongBuffer> meshletBuffer;
+        std::unique_ptr<KongBuffer> meshletVertexBuffer;
+        std::unique_ptr<KongBuffer> meshletTriangleBuffer;
     };
 }
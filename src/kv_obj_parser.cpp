@@ -0,0 +1,595 @@
+#include "kv_obj_parser.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kv_mapped_file.h"
+#include "kv_thread_pool.h"
+
+using namespace kong;
+
+namespace
+{
+    // 每个chunk至少1MB，太小的话线程调度的开销比解析还大
+    constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+    constexpr size_t CHUNKS_PER_THREAD = 4;
+
+    // 负数index是相对于当前已读到的属性数量，需要在合并时加上前面chunk的数量
+    constexpr uint8_t RELATIVE_VERTEX = 1 << 0;
+    constexpr uint8_t RELATIVE_NORMAL = 1 << 1;
+    constexpr uint8_t RELATIVE_TEXCOORD = 1 << 2;
+
+    struct RawCorner
+    {
+        int vertex;
+        int normal;
+        int texcoord;
+        uint8_t relativeMask;
+    };
+
+    struct ChunkResult
+    {
+        std::vector<float> vertices;
+        std::vector<float> colors;
+        std::vector<float> normals;
+        std::vector<float> texcoords;
+        std::vector<RawCorner> corners;
+        std::vector<uint8_t> faceSizes;     // 每个face的顶点数（3或4）
+        size_t outputIndexCount = 0;
+        bool ok = true;
+    };
+
+    inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+    inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    inline const char* skipSpaces(const char* cur, const char* end)
+    {
+        while (cur < end && isSpace(*cur))
+        {
+            cur++;
+        }
+        return cur;
+    }
+
+    inline const char* tokenEnd(const char* cur, const char* end)
+    {
+        while (cur < end && !isSpace(*cur) && *cur != '\r')
+        {
+            cur++;
+        }
+        return cur;
+    }
+
+    // 和tinyobj的tryParseDouble完全相同的算法，保证解析出的float逐位一致
+    bool tryParseDouble(const char* s, const char* sEnd, double* result)
+    {
+        if (s >= sEnd)
+        {
+            return false;
+        }
+
+        double mantissa = 0.0;
+        int exponent = 0;
+        char sign = '+';
+        char expSign = '+';
+        const char* curr = s;
+        int read = 0;
+        bool endNotReached = false;
+        bool leadingDecimalDots = false;
+
+        if (*curr == '+' || *curr == '-')
+        {
+            sign = *curr;
+            curr++;
+            if (curr != sEnd && *curr == '.')
+            {
+                leadingDecimalDots = true;
+            }
+        }
+        else if (isDigit(*curr))
+        {
+        }
+        else if (*curr == '.')
+        {
+            leadingDecimalDots = true;
+        }
+        else
+        {
+            return false;
+        }
+
+        endNotReached = curr != sEnd;
+        if (!leadingDecimalDots)
+        {
+            while (endNotReached && isDigit(*curr))
+            {
+                mantissa *= 10;
+                mantissa += static_cast<int>(*curr - '0');
+                curr++;
+                read++;
+                endNotReached = curr != sEnd;
+            }
+            if (read == 0)
+            {
+                return false;
+            }
+        }
+
+        if (endNotReached)
+        {
+            bool parseExponent = true;
+            if (*curr == '.')
+            {
+                static const double powLut[] = {1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001};
+                constexpr int lutEntries = sizeof(powLut) / sizeof(powLut[0]);
+
+                curr++;
+                read = 1;
+                endNotReached = curr != sEnd;
+                while (endNotReached && isDigit(*curr))
+                {
+                    mantissa += static_cast<int>(*curr - '0') * (read < lutEntries ? powLut[read] : std::pow(10.0, -read));
+                    read++;
+                    curr++;
+                    endNotReached = curr != sEnd;
+                }
+            }
+            else if (*curr != 'e' && *curr != 'E')
+            {
+                parseExponent = false;
+            }
+
+            if (parseExponent && endNotReached && (*curr == 'e' || *curr == 'E'))
+            {
+                curr++;
+                endNotReached = curr != sEnd;
+                if (endNotReached && (*curr == '+' || *curr == '-'))
+                {
+                    expSign = *curr;
+                    curr++;
+                }
+                else if (endNotReached && isDigit(*curr))
+                {
+                }
+                else
+                {
+                    return false;
+                }
+
+                read = 0;
+                endNotReached = curr != sEnd;
+                while (endNotReached && isDigit(*curr))
+                {
+                    if (exponent > 2147483647 / 10)
+                    {
+                        return false;
+                    }
+                    exponent *= 10;
+                    exponent += static_cast<int>(*curr - '0');
+                    curr++;
+                    read++;
+                    endNotReached = curr != sEnd;
+                }
+                exponent *= expSign == '+' ? 1 : -1;
+                if (read == 0)
+                {
+                    return false;
+                }
+            }
+        }
+
+        *result = (sign == '+' ? 1 : -1) *
+            (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+        return true;
+    }
+
+    inline float parseReal(const char*& cur, const char* end, double defaultValue = 0.0)
+    {
+        cur = skipSpaces(cur, end);
+        const char* tokEnd = tokenEnd(cur, end);
+        double value = defaultValue;
+        tryParseDouble(cur, tokEnd, &value);
+        cur = tokEnd;
+        return static_cast<float>(value);
+    }
+
+    inline bool parseReal(const char*& cur, const char* end, float* out)
+    {
+        cur = skipSpaces(cur, end);
+        const char* tokEnd = tokenEnd(cur, end);
+        double value;
+        bool ok = tryParseDouble(cur, tokEnd, &value);
+        if (ok)
+        {
+            *out = static_cast<float>(value);
+        }
+        cur = tokEnd;
+        return ok;
+    }
+
+    // atoi的语义：可选的正负号加数字，没有数字时返回0
+    inline int parseInt(const char* cur, const char* end)
+    {
+        while (cur < end && (isSpace(*cur) || *cur == '\r'))
+        {
+            cur++;
+        }
+        bool negative = false;
+        if (cur < end && (*cur == '+' || *cur == '-'))
+        {
+            negative = *cur == '-';
+            cur++;
+        }
+        int value = 0;
+        while (cur < end && isDigit(*cur))
+        {
+            value = value * 10 + (*cur - '0');
+            cur++;
+        }
+        return negative ? -value : value;
+    }
+
+    inline const char* skipIndexToken(const char* cur, const char* end)
+    {
+        while (cur < end && *cur != '/' && !isSpace(*cur) && *cur != '\r')
+        {
+            cur++;
+        }
+        return cur;
+    }
+
+    /*
+     * 对应tinyobj的fixIndex，正数转换为从0开始，负数记录为相对于chunk内计数的值
+     * 0对于顶点是非法的，对于normal/uv表示没有（-1）
+     */
+    inline bool fixIndex(int idx, int localCount, bool allowZero, int& out, uint8_t& relativeMask, uint8_t relativeBit)
+    {
+        if (idx > 0)
+        {
+            out = idx - 1;
+            return true;
+        }
+        if (idx == 0)
+        {
+            out = -1;
+            return allowZero;
+        }
+        out = localCount + idx;
+        relativeMask |= relativeBit;
+        return true;
+    }
+
+    bool parseCorner(const char*& cur, const char* end, const ChunkResult& chunk, RawCorner& corner)
+    {
+        corner = {-1, -1, -1, 0};
+        const int vertexCount = static_cast<int>(chunk.vertices.size() / 3);
+        const int normalCount = static_cast<int>(chunk.normals.size() / 3);
+        const int texcoordCount = static_cast<int>(chunk.texcoords.size() / 2);
+
+        if (!fixIndex(parseInt(cur, end), vertexCount, false, corner.vertex, corner.relativeMask, RELATIVE_VERTEX))
+        {
+            return false;
+        }
+        cur = skipIndexToken(cur, end);
+        if (cur >= end || *cur != '/')
+        {
+            return true;
+        }
+        cur++;
+
+        // i//k
+        if (cur < end && *cur == '/')
+        {
+            cur++;
+            if (!fixIndex(parseInt(cur, end), normalCount, true, corner.normal, corner.relativeMask, RELATIVE_NORMAL))
+            {
+                return false;
+            }
+            cur = skipIndexToken(cur, end);
+            return true;
+        }
+
+        // i/j/k 或者 i/j
+        if (!fixIndex(parseInt(cur, end), texcoordCount, true, corner.texcoord, corner.relativeMask, RELATIVE_TEXCOORD))
+        {
+            return false;
+        }
+        cur = skipIndexToken(cur, end);
+        if (cur >= end || *cur != '/')
+        {
+            return true;
+        }
+        cur++;
+        if (!fixIndex(parseInt(cur, end), normalCount, true, corner.normal, corner.relativeMask, RELATIVE_NORMAL))
+        {
+            return false;
+        }
+        cur = skipIndexToken(cur, end);
+        return true;
+    }
+
+    void parseLine(const char* cur, const char* end, ChunkResult& chunk)
+    {
+        cur = skipSpaces(cur, end);
+        if (cur >= end || *cur == '#')
+        {
+            return;
+        }
+
+        const size_t length = static_cast<size_t>(end - cur);
+        if (cur[0] == 'v' && length > 1 && isSpace(cur[1]))
+        {
+            cur += 2;
+            float x = parseReal(cur, end);
+            float y = parseReal(cur, end);
+            float z = parseReal(cur, end);
+            chunk.vertices.push_back(x);
+            chunk.vertices.push_back(y);
+            chunk.vertices.push_back(z);
+
+            // 和tinyobj一致：xyzrgb时为颜色，xyzw时r为w，其余情况为白色
+            float r = 1.0f, g = 1.0f, b = 1.0f;
+            if (!parseReal(cur, end, &r))
+            {
+                r = 1.0f;
+            }
+            else if (!parseReal(cur, end, &g))
+            {
+                g = b = 1.0f;
+            }
+            else if (!parseReal(cur, end, &b))
+            {
+                r = g = b = 1.0f;
+            }
+            chunk.colors.push_back(r);
+            chunk.colors.push_back(g);
+            chunk.colors.push_back(b);
+            return;
+        }
+
+        if (cur[0] == 'v' && length > 2 && cur[1] == 'n' && isSpace(cur[2]))
+        {
+            cur += 3;
+            float x = parseReal(cur, end);
+            float y = parseReal(cur, end);
+            float z = parseReal(cur, end);
+            chunk.normals.push_back(x);
+            chunk.normals.push_back(y);
+            chunk.normals.push_back(z);
+            return;
+        }
+
+        if (cur[0] == 'v' && length > 2 && cur[1] == 't' && isSpace(cur[2]))
+        {
+            cur += 3;
+            float u = parseReal(cur, end);
+            float v = parseReal(cur, end);
+            chunk.texcoords.push_back(u);
+            chunk.texcoords.push_back(v);
+            return;
+        }
+
+        if (cur[0] == 'f' && length > 1 && isSpace(cur[1]))
+        {
+            cur = skipSpaces(cur + 2, end);
+            RawCorner face[4];
+            size_t cornerCount = 0;
+            while (cur < end && *cur != '#')
+            {
+                if (cornerCount == 4)
+                {
+                    // 多于4个顶点的多边形需要tinyobj的ear clipping
+                    chunk.ok = false;
+                    return;
+                }
+                if (!parseCorner(cur, end, chunk, face[cornerCount]))
+                {
+                    chunk.ok = false;
+                    return;
+                }
+                cornerCount++;
+                while (cur < end && (isSpace(*cur) || *cur == '\r'))
+                {
+                    cur++;
+                }
+            }
+
+            // 少于3个顶点的face会被tinyobj跳过
+            if (cornerCount < 3)
+            {
+                return;
+            }
+            chunk.corners.insert(chunk.corners.end(), face, face + cornerCount);
+            chunk.faceSizes.push_back(static_cast<uint8_t>(cornerCount));
+            chunk.outputIndexCount += cornerCount == 3 ? 3 : 6;
+        }
+        // 其余指令（g/o/s/usemtl/mtllib等）不影响几何数据，直接跳过
+    }
+
+    void parseChunk(const char* begin, const char* end, ChunkResult& chunk)
+    {
+        const char* lineStart = begin;
+        while (lineStart < end && chunk.ok)
+        {
+            const char* lineEnd = lineStart;
+            while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')
+            {
+                lineEnd++;
+            }
+            parseLine(lineStart, lineEnd, chunk);
+            lineStart = lineEnd + 1;
+        }
+    }
+
+    // chunk边界放在换行符之后，保证每一行完整地落在一个chunk里
+    std::vector<const char*> splitChunks(const char* data, size_t size, size_t chunkCount)
+    {
+        std::vector<const char*> bounds{data};
+        const char* end = data + size;
+        const size_t step = size / chunkCount;
+        for (size_t i = 1; i < chunkCount; i++)
+        {
+            const char* cut = std::max(bounds.back(), data + i * step);
+            while (cut < end && *cut != '\n')
+            {
+                cut++;
+            }
+            if (cut < end)
+            {
+                cut++;
+            }
+            if (cut > bounds.back() && cut < end)
+            {
+                bounds.push_back(cut);
+            }
+        }
+        bounds.push_back(end);
+        return bounds;
+    }
+
+    template <typename T>
+    void appendAt(std::vector<T>& dst, size_t offset, const std::vector<T>& src)
+    {
+        std::copy(src.begin(), src.end(), dst.begin() + static_cast<std::ptrdiff_t>(offset));
+    }
+}
+
+bool KongObjParser::parseFile(const std::string& filepath, KongObjData& out, uint32_t threadCount)
+{
+    KongMappedFile file{filepath};
+    if (!file.isOpen())
+    {
+        return false;
+    }
+    return parse(reinterpret_cast<const char*>(file.data()), file.size(), out, threadCount);
+}
+
+bool KongObjParser::parse(const char* data, size_t size, KongObjData& out, uint32_t threadCount)
+{
+    auto& pool = KongThreadPool::global();
+    if (threadCount == 0)
+    {
+        threadCount = pool.threadCount();
+    }
+
+    const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount * CHUNKS_PER_THREAD, size / MIN_CHUNK_SIZE));
+    const auto bounds = splitChunks(data, size, chunkCount);
+    std::vector<ChunkResult> chunks(bounds.size() - 1);
+
+    // 1. 并行解析每个chunk
+    pool.parallelFor(chunks.size(), std::min<size_t>(threadCount, chunks.size()), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+        }
+    });
+
+    // 2. 前缀和得到每个chunk在全局数组中的偏移
+    struct ChunkOffset
+    {
+        size_t vertex, normal, texcoord, index;
+    };
+    std::vector<ChunkOffset> offsets(chunks.size());
+    ChunkOffset total{};
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (!chunks[i].ok)
+        {
+            return false;
+        }
+        offsets[i] = total;
+        total.vertex += chunks[i].vertices.size() / 3;
+        total.normal += chunks[i].normals.size() / 3;
+        total.texcoord += chunks[i].texcoords.size() / 2;
+        total.index += chunks[i].outputIndexCount;
+    }
+
+    out.vertices.resize(total.vertex * 3);
+    out.colors.resize(total.vertex * 3);
+    out.normals.resize(total.normal * 3);
+    out.texcoords.resize(total.texcoord * 2);
+    out.indices.resize(total.index);
+
+    // 3. 并行合并属性，再解析index并三角化（四边形的拆分需要用到合并后的顶点位置）
+    pool.parallelFor(chunks.size(), std::min<size_t>(threadCount, chunks.size()), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            appendAt(out.vertices, offsets[i].vertex * 3, chunks[i].vertices);
+            appendAt(out.colors, offsets[i].vertex * 3, chunks[i].colors);
+            appendAt(out.normals, offsets[i].normal * 3, chunks[i].normals);
+            appendAt(out.texcoords, offsets[i].texcoord * 2, chunks[i].texcoords);
+        }
+    });
+
+    std::vector<uint8_t> chunkValid(chunks.size(), 1);
+    pool.parallelFor(chunks.size(), std::min<size_t>(threadCount, chunks.size()), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const auto& chunk = chunks[i];
+            const auto& offset = offsets[i];
+
+            auto resolve = [&](const RawCorner& raw, KongObjIndex& index) -> bool
+            {
+                index.vertex_index = raw.vertex + ((raw.relativeMask & RELATIVE_VERTEX) ? static_cast<int>(offset.vertex) : 0);
+                index.normal_index = raw.normal + ((raw.relativeMask & RELATIVE_NORMAL) ? static_cast<int>(offset.normal) : 0);
+                index.texcoord_index = raw.texcoord + ((raw.relativeMask & RELATIVE_TEXCOORD) ? static_cast<int>(offset.texcoord) : 0);
+                // 越界的index交给tinyobj去报错
+                return index.vertex_index >= 0 && static_cast<size_t>(index.vertex_index) < total.vertex
+                    && index.normal_index >= -1 && index.normal_index < static_cast<int>(total.normal)
+                    && index.texcoord_index >= -1 && index.texcoord_index < static_cast<int>(total.texcoord)
+                    && ((raw.relativeMask & RELATIVE_NORMAL) == 0 || index.normal_index >= 0)
+                    && ((raw.relativeMask & RELATIVE_TEXCOORD) == 0 || index.texcoord_index >= 0);
+            };
+
+            size_t cornerIndex = 0;
+            size_t outIndex = offset.index;
+            for (uint8_t faceSize : chunk.faceSizes)
+            {
+                KongObjIndex face[4];
+                for (uint8_t k = 0; k < faceSize; k++)
+                {
+                    if (!resolve(chunk.corners[cornerIndex + k], face[k]))
+                    {
+                        chunkValid[i] = 0;
+                        return;
+                    }
+                }
+                cornerIndex += faceSize;
+
+                if (faceSize == 3)
+                {
+                    out.indices[outIndex++] = face[0];
+                    out.indices[outIndex++] = face[1];
+                    out.indices[outIndex++] = face[2];
+                    continue;
+                }
+
+                // 和tinyobj一样选择较短的对角线拆分四边形
+                const float* v0 = &out.vertices[3 * static_cast<size_t>(face[0].vertex_index)];
+                const float* v1 = &out.vertices[3 * static_cast<size_t>(face[1].vertex_index)];
+                const float* v2 = &out.vertices[3 * static_cast<size_t>(face[2].vertex_index)];
+                const float* v3 = &out.vertices[3 * static_cast<size_t>(face[3].vertex_index)];
+                float e02x = v2[0] - v0[0], e02y = v2[1] - v0[1], e02z = v2[2] - v0[2];
+                float e13x = v3[0] - v1[0], e13y = v3[1] - v1[1], e13z = v3[2] - v1[2];
+                float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+                float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+                if (sqr02 < sqr13)
+                {
+                    const int order[6] = {0, 1, 2, 0, 2, 3};
+                    for (int k : order) out.indices[outIndex++] = face[k];
+                }
+                else
+                {
+                    const int order[6] = {0, 1, 3, 1, 2, 3};
+                    for (int k : order) out.indices[outIndex++] = face[k];
+                }
+            }
+        }
+    });
+
+    return std::all_of(chunkValid.begin(), chunkValid.end(), [](uint8_t valid) { return valid != 0; });
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kong
+{
+    // 和tinyobj::index_t字段一致，-1表示没有该属性
+    struct KongObjIndex
+    {
+        int vertex_index = -1;
+        int normal_index = -1;
+        int texcoord_index = -1;
+    };
+
+    // 和tinyobj::attrib_t布局一致的解析结果，indices已经三角化，按文件中的顺序排列
+    struct KongObjData
+    {
+        std::vector<float> vertices{};
+        std::vector<float> colors{};
+        std::vector<float> normals{};
+        std::vector<float> texcoords{};
+        std::vector<KongObjIndex> indices{};
+    };
+
+    /*
+     * 多线程OBJ解析器
+     * mmap整个文件，按行切成多个chunk，在线程池上并行解析v/vn/vt/f，
+     * 再用各chunk计数的前缀和得到全局偏移，合并成一份结果
+     *
+     * 浮点解析和四边形拆分和tinyobj保持一致，输出和tinyobj的结果完全相同；
+     * 遇到不支持的情况（超过4个顶点的多边形、非法index）返回false，由调用方退回tinyobj
+     */
+    class KongObjParser
+    {
+    public:
+        // threadCount为0时使用全局线程池的全部线程
+        static bool parseFile(const std::string& filepath, KongObjData& out, uint32_t threadCount = 0);
+        static bool parse(const char* data, size_t size, KongObjData& out, uint32_t threadCount = 0);
+    };
+}
@@ -118,6 +118,9 @@ void KongPipeline::defaultPipeLineConfigInfo(PipelineConfigInfo& configInfo)
     configInfo.dynamicStateInfo.pDynamicStates = configInfo.dynamicStateEnables.data();
     configInfo.dynamicStateInfo.dynamicStateCount = static_cast<uint32_t>(configInfo.dynamicStateEnables.size());
     configInfo.dynamicStateInfo.flags = 0;
+
+    configInfo.bindingDescriptions = KongModel::Vertex::getBindingDescription();
+    configInfo.attributeDescriptions = KongModel::Vertex::getAttributeDescription();
 }
 
 vector<char> KongPipeline::readFile(const string& filePath)
@@ -145,13 +148,16 @@ void KongPipeline::createGraphicsPipeline(const string& vertFilePath, const stri
     assert(configInfo.renderPass != VK_NULL_HANDLE, "Cannot create pipeline layout: no renderPass provided");
     
     auto vertData = readFile(vertFilePath);
-    auto fragData = readFile(fragFilePath);
-
     std::cout << "vert code size:" << vertData.size() << "\n";
-    std::cout << "frag code size:" << fragData.size() << "\n";
-
     createShaderModule(vertData, &vertShaderModule);
-    createShaderModule(fragData, &fragShaderModule);
+
+    const bool hasFragmentStage = !fragFilePath.empty();
+    if (hasFragmentStage)
+    {
+        auto fragData = readFile(fragFilePath);
+        std::cout << "frag code size:" << fragData.size() << "\n";
+        createShaderModule(fragData, &fragShaderModule);
+    }
 
     VkPipelineShaderStageCreateInfo shaderStages[2];
     shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -170,8 +176,8 @@ void KongPipeline::createGraphicsPipeline(const string& vertFilePath, const stri
     shaderStages[1].pNext = nullptr;
     shaderStages[1].pSpecializationInfo = nullptr;
 
-    auto bindingDesc = KongModel::Vertex::getBindingDescription();
-    auto attributeDesc = KongModel::Vertex::getAttributeDescription();
+    auto& bindingDesc = configInfo.bindingDescriptions;
+    auto& attributeDesc = configInfo.attributeDescriptions;
     
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -183,7 +189,7 @@ void KongPipeline::createGraphicsPipeline(const string& vertFilePath, const stri
     
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = hasFragmentStage ? 2 : 1;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &configInfo.inputAssemblyInfo;
@@ -220,3 +226,46 @@ void KongPipeline::createShaderModule(const std::vector<char>& code, VkShaderMod
         throw std::runtime_error("Failed to create shader module!");
     }
 }
+
+KongComputePipeline::KongComputePipeline(KongDevice& device, const string& compFilePath, VkPipelineLayout pipelineLayout)
+    : kv_device(device)
+{
+    assert(pipelineLayout != VK_NULL_HANDLE && "Cannot create compute pipeline: no pipeline layout provided");
+
+    auto compData = KongPipeline::readFile(compFilePath);
+    VkShaderModuleCreateInfo moduleInfo = {};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = compData.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t*>(compData.data());
+    if (vkCreateShaderModule(kv_device.device(), &moduleInfo, nullptr, &compShaderModule) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create shader module!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main"; // 入口函数名称
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.basePipelineIndex = -1;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+    if (vkCreateComputePipelines(kv_device.device(), VK_NULL_HANDLE, 1,
+        &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to create compute pipeline!");
+    }
+}
+
+KongComputePipeline::~KongComputePipeline()
+{
+    vkDestroyShaderModule(kv_device.device(), compShaderModule, nullptr);
+    vkDestroyPipeline(kv_device.device(), computePipeline, nullptr);
+}
+
+void KongComputePipeline::bind(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+}
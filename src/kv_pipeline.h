@@ -22,6 +22,10 @@ namespace kong
         VkPipelineColorBlendStateCreateInfo colorBlendInfo;
         VkPipelineDepthStencilStateCreateInfo depthStencilInfo;
 
+        // 顶点输入布局，默认为KongModel::Vertex，使用压缩顶点格式的pipeline需要替换
+        std::vector<VkVertexInputBindingDescription> bindingDescriptions{};
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+
         std::vector<VkDynamicState> dynamicStateEnables;
         VkPipelineDynamicStateCreateInfo dynamicStateInfo;
         
@@ -33,6 +37,7 @@ namespace kong
     class KongPipeline
     {
     public:
+        // fragFilePath为空时只有vertex shader，用于只写深度的pass
         KongPipeline(
             KongDevice& device,
             const std::string& vertFilePath,
@@ -49,6 +54,7 @@ namespace kong
             PipelineConfigInfo& configInfo);
         
     private:
+        friend class KongComputePipeline;
         static std::vector<char> readFile(const std::string& filePath);
 
         void createGraphicsPipeline(
@@ -61,6 +67,24 @@ namespace kong
         KongDevice& kv_device;
         VkPipeline graphicsPipeline;
         VkShaderModule vertShaderModule;
-        VkShaderModule fragShaderModule;
+        VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+    };
+
+    // 只有一个compute shader的pipeline，pipeline layout由使用者创建和销毁
+    class KongComputePipeline
+    {
+    public:
+        KongComputePipeline(KongDevice& device, const std::string& compFilePath, VkPipelineLayout pipelineLayout);
+        ~KongComputePipeline();
+
+        KongComputePipeline(const KongComputePipeline&) = delete;
+        KongComputePipeline& operator=(const KongComputePipeline&) = delete;
+
+        void bind(VkCommandBuffer commandBuffer);
+
+    private:
+        KongDevice& kv_device;
+        VkPipeline computePipeline = VK_NULL_HANDLE;
+        VkShaderModule compShaderModule = VK_NULL_HANDLE;
     };
 }
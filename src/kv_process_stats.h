@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+
+namespace kong
+{
+    // 进程启动以来的峰值常驻内存（字节），用于统计资源导入的内存开销；不支持的平台返回0
+    size_t queryPeakResidentBytes();
+}
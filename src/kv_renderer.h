@@ -27,6 +27,7 @@ namespace kong
 
         VkRenderPass getSwapChainRenderPass() const {return m_swapChain->getRenderPass();}
         float getAspectRatio() const {return m_swapChain->extentAspectRatio();}
+        VkExtent2D getSwapChainExtent() const {return m_swapChain->getSwapChainExtent();}
     private:
         void createCommandBuffers();
         void freeCommandBuffers();
@@ -1,23 +1,39 @@
 #include "kv_simple_render_system.h"
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <iostream>
+#include <limits>
 #include <stdexcept>
 
+#include "kv_swap_chain.h"
 #include "glm/ext/matrix_transform.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
 
 using namespace kong;
 
-struct SimplePushConstantData
+namespace
 {
-    glm::mat4 modelMatrix {1.0f};
-    alignas(16) glm::mat4 normalMatrix {1.0f};
-};
+    // 非均匀缩放时取最大的缩放，投影大小只会被高估
+    float maxScale(const glm::mat4& modelView)
+    {
+        return std::max({glm::length(glm::vec3(modelView[0])), glm::length(glm::vec3(modelView[1])),
+            glm::length(glm::vec3(modelView[2]))});
+    }
+
+}
+
+static_assert(sizeof(KongInstanceData) == 144, "InstanceData must match the std430 layout in the shaders");
 
-SimpleRenderSystem::SimpleRenderSystem(KongDevice& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout)
-    : m_device(device)
+SimpleRenderSystem::SimpleRenderSystem(KongDevice& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout,
+    KongSamplerCache& samplerCache)
+    : m_device(device), m_renderPass(renderPass)
 {
+    createTextureResources(samplerCache);
+    createInstanceResources();
     createPipelineLayout(globalSetLayout);
-    createPipeline(renderPass);
+    getPipeline(KongVertexLayout{}, false);
 }
 
 SimpleRenderSystem::~SimpleRenderSystem()
@@ -25,15 +41,52 @@ SimpleRenderSystem::~SimpleRenderSystem()
     vkDestroyPipelineLayout(m_device.device(), m_pipelineLayout, nullptr);
 }
 
-void SimpleRenderSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
+void SimpleRenderSystem::createTextureResources(KongSamplerCache& samplerCache)
 {
-    VkPushConstantRange pushConstantRange{};
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(SimplePushConstantData);
+    m_textureSetLayout = KongDescriptorSetLayout::Builder(m_device)
+        .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .build();
+    // 流式贴图换精度时会释放旧贴图的set
+    m_texturePool = KongDescriptorPool::Builder(m_device)
+        .setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
+        .setMaxSets(MAX_TEXTURE_SETS)
+        .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURE_SETS)
+        .build();
+
+    // 没有贴图的物体采样1x1的白色贴图，shader中不需要分支
+    KongImageData white{1, 1, {255, 255, 255, 255}};
+    KongTextureSettings settings{};
+    settings.generateMips = false;
+    m_defaultTexture = std::make_shared<KongTexture>(m_device, samplerCache, white, settings);
+    // 默认贴图的set在这里分配并一直保留，pool用完时的回退不会再失败
+    auto imageInfo = m_defaultTexture->descriptorInfo();
+    if (!KongDescriptorWriter(*m_textureSetLayout, *m_texturePool)
+        .writeImage(0, &imageInfo)
+        .build(m_defaultTextureSet))
+    {
+        throw std::runtime_error("failed to allocate descriptor set for the default texture!");
+    }
+}
 
+void SimpleRenderSystem::createInstanceResources()
+{
+    // 每帧的实例数据从frame allocator中分配，descriptor指向整个buffer，用firstInstance选择这一帧的数据
+    // 不用dynamic offset：VK_WHOLE_SIZE的dynamic descriptor只能用0偏移，而实例数每帧不同，没有固定的range
+    m_instanceSetLayout = KongDescriptorSetLayout::Builder(m_device)
+        .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+        .build();
+    m_instancePool = KongDescriptorPool::Builder(m_device)
+        .setMaxSets(KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        .build();
+    m_instanceSets.resize(KongSwapChain::MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+}
+
+void SimpleRenderSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
+{
     // set按顺序存在vector中，set0,set1,set2 ...
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout};
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout, m_textureSetLayout->getDescriptorSetLayout(),
+        m_instanceSetLayout->getDescriptorSetLayout()};
     
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -41,9 +94,9 @@ void SimpleRenderSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLay
     // descriptor set layout
     pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
     pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-    // 用于将一些小量的数据送到shader中
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    // 每个物体的矩阵放在set 2的instance buffer中，不再使用push constant
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
 
     if (vkCreatePipelineLayout(m_device.device(), &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
     {
@@ -51,47 +104,562 @@ void SimpleRenderSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLay
     }
 }
 
-void SimpleRenderSystem::createPipeline(VkRenderPass renderPass)
+KongPipeline& SimpleRenderSystem::getPipeline(const KongVertexLayout& vertexLayout, bool depthOnly)
 {
     assert(m_pipelineLayout != nullptr && "pipelineLayout is null");
     
+    const size_t index = (static_cast<size_t>(vertexLayout.format) * 2 + vertexLayout.splitPositions) * 2 + depthOnly;
+    auto& pipeline = m_pipelines[index];
+    if (pipeline)
+    {
+        return *pipeline;
+    }
+
     // 使用swapchain的大小而不是Windows的，因为这两个有可能不是一一对应
     PipelineConfigInfo pipelineConfig{};
     KongPipeline::defaultPipeLineConfigInfo(pipelineConfig);
-    pipelineConfig.renderPass = renderPass;
+    pipelineConfig.renderPass = m_renderPass;
     pipelineConfig.pipelineLayout = m_pipelineLayout;
-    m_pipeline = std::make_unique<KongPipeline>(m_device,
-        "../resource/shader/simple_shader.vert.spv",
+    if (depthOnly)
+    {
+        // 只读取position数据流，不写颜色
+        pipelineConfig.bindingDescriptions = KongVertexFormats::bindingDescriptions(vertexLayout, KongVertexFormats::STREAM_POSITION);
+        pipelineConfig.attributeDescriptions = KongVertexFormats::attributeDescriptions(vertexLayout, KongVertexFormats::STREAM_POSITION);
+        pipelineConfig.colorBlendAttachment.colorWriteMask = 0;
+        pipeline = std::make_unique<KongPipeline>(m_device,
+            KongVertexFormats::depthOnlyVertexShaderPath(), "", pipelineConfig);
+        return *pipeline;
+    }
+
+    pipelineConfig.bindingDescriptions = KongVertexFormats::bindingDescriptions(vertexLayout);
+    pipelineConfig.attributeDescriptions = KongVertexFormats::attributeDescriptions(vertexLayout);
+    // 深度prepass之后着色pass的深度和prepass写入的相等，两个shader中的gl_Position都声明为invariant
+    pipelineConfig.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    pipeline = std::make_unique<KongPipeline>(m_device,
+        KongVertexFormats::vertexShaderPath(vertexLayout.format),
         "../resource/shader/simple_shader.frag.spv",
         pipelineConfig);
+    return *pipeline;
+}
+
+void SimpleRenderSystem::setGpuCulling(bool enabled)
+{
+    m_gpuCulling = enabled && KongGpuCuller::isSupported(m_device);
+    if (enabled && !m_gpuCulling)
+    {
+        std::cout << "gpu culling needs multiDrawIndirect and drawIndirectFirstInstance, drawing on the cpu path" << std::endl;
+    }
+    if (m_gpuCulling && !m_gpuCuller)
+    {
+        m_gpuCuller = std::make_unique<KongGpuCuller>(m_device, KongSwapChain::MAX_FRAMES_IN_FLIGHT);
+    }
+}
+
+void SimpleRenderSystem::prepareFrame(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects)
+{
+    prepare(frameInfo, gameObjects, m_gpuCulling);
+}
+
+void SimpleRenderSystem::prepare(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects, bool gpuCulling)
+{
+    m_frameNumber++;
+    m_lodStats = {};
+    m_drawStats = {};
+    m_prepared = true;
+    m_preparedInstanceCount = 0;
+    m_gpuBatches.clear();
+    m_pendingObjectCount = swapInLoadedAssets(gameObjects);
+
+    // 两个pass必须使用相同的LOD和矩阵，否则深度对不上
+    buildDrawGroups(frameInfo, gameObjects, !gpuCulling);
+    const uint32_t instanceCount = m_drawGroups.empty()
+        ? 0 : m_drawGroups.back().firstInstance + m_drawGroups.back().instanceCount;
+    if (instanceCount == 0)
+    {
+        return;
+    }
+
+    // 按组的顺序写入实例数据，同一组的实例连续
+    // descriptor指向整个buffer，实例的位置通过firstInstance传给shader：gl_InstanceIndex = baseInstance + 组的firstInstance + 组内序号
+    KongFrameAllocation instances = frameInfo.frameAllocator.allocateElements(sizeof(KongInstanceData), instanceCount, m_baseInstance);
+    if (!instances)
+    {
+        // frame allocator已经报告过溢出，这一帧不画物体
+        return;
+    }
+    auto* instanceData = static_cast<KongInstanceData*>(instances.data);
+    for (auto& group : m_drawGroups)
+    {
+        group.instanceCount = 0;
+    }
+    for (uint32_t i : m_visibleObjects)
+    {
+        DrawGroup& group = m_drawGroups[m_objectGroups[i]];
+        const glm::mat4& world = m_worldMatrices[i];
+        KongInstanceData& instance = instanceData[group.firstInstance + group.instanceCount++];
+        // position量化的模型需要先反量化到模型空间
+        instance.modelMatrix = world * group.key.model->getPositionTransform();
+        instance.normalMatrix = glm::mat4(glm::inverseTranspose(glm::mat3(world)));
+        instance.color = glm::vec4(gameObjects[i].color, 1.0f);
+    }
+    m_preparedInstanceCount = instanceCount;
+
+    if (gpuCulling && !cullOnGpu(frameInfo, instanceCount))
+    {
+        m_preparedInstanceCount = 0;
+    }
+}
+
+bool SimpleRenderSystem::cullOnGpu(const FrameInfo& frameInfo, uint32_t instanceCount)
+{
+    // 使用同一个pipeline、贴图和几何页的组合成一个batch，每个batch一次indirect draw；没有index的模型仍然按组直接画
+    m_gpuBatchLookup.clear();
+    uint32_t lodCount = 0;
+    uint32_t templateCount = 0;
+    for (auto& group : m_drawGroups)
+    {
+        const KongModel& model = *group.key.model;
+        const KongGeometryRange& geometry = model.getGeometry();
+        group.gpuBatch = NO_GROUP;
+        if (!geometry.indexPage)
+        {
+            continue;
+        }
+        const GpuBatchKey key{geometry.vertexPage, geometry.indexPage, group.key.textureSet};
+        group.gpuBatch = m_gpuBatchLookup.emplace(key, static_cast<uint32_t>(m_gpuBatches.size())).first->second;
+        if (group.gpuBatch == m_gpuBatches.size())
+        {
+            m_gpuBatches.push_back({&model, group.key.textureSet, 0, 0});
+        }
+        uint32_t maxRanges = 0;
+        for (uint32_t lod = 0; lod < model.getLodCount(); lod++)
+        {
+            maxRanges = std::max(maxRanges, model.getLod(lod).rangeCount);
+            templateCount += model.getLod(lod).rangeCount;
+        }
+        lodCount += model.getLodCount();
+        m_gpuBatches[group.gpuBatch].commandCapacity += group.instanceCount * maxRanges;
+    }
+    uint32_t commandCount = 0;
+    for (auto& batch : m_gpuBatches)
+    {
+        batch.firstCommand = commandCount;
+        commandCount += batch.commandCapacity;
+    }
+
+    KongFrameAllocator& allocator = frameInfo.frameAllocator;
+    KongGpuCullParams params{};
+    const auto groupCount = static_cast<uint32_t>(m_drawGroups.size());
+    KongFrameAllocation instanceMeshes = allocator.allocateElements(sizeof(uint32_t), instanceCount, params.instanceMeshBase);
+    KongFrameAllocation meshes = allocator.allocateElements(sizeof(KongGpuCullMesh), groupCount, params.meshBase);
+    KongFrameAllocation lods = allocator.allocateElements(sizeof(KongGpuCullLod), std::max(lodCount, 1u), params.lodBase);
+    KongFrameAllocation templates = allocator.allocateElements(sizeof(KongGpuDrawTemplate), std::max(templateCount, 1u), params.templateBase);
+    uint32_t paramsIndex = 0;
+    KongFrameAllocation paramsAllocation = allocator.allocateElements(sizeof(KongGpuCullParams), 1, paramsIndex);
+    if (!instanceMeshes || !meshes || !lods || !templates || !paramsAllocation)
+    {
+        return false;
+    }
 
+    // 每个组是一个mesh，它的实例都指向它
+    auto* instanceMeshData = static_cast<uint32_t*>(instanceMeshes.data);
+    auto* meshData = static_cast<KongGpuCullMesh*>(meshes.data);
+    auto* lodData = static_cast<KongGpuCullLod*>(lods.data);
+    auto* templateData = static_cast<KongGpuDrawTemplate*>(templates.data);
+    uint32_t lodIndex = 0;
+    uint32_t templateIndex = 0;
+    for (uint32_t g = 0; g < groupCount; g++)
+    {
+        DrawGroup& group = m_drawGroups[g];
+        std::fill_n(instanceMeshData + group.firstInstance, group.instanceCount, g);
+
+        KongGpuCullMesh& mesh = meshData[g];
+        mesh = {};
+        if (group.gpuBatch == NO_GROUP)
+        {
+            // lodCount为0的mesh不会被compute shader处理
+            continue;
+        }
+        const KongModel& model = *group.key.model;
+        const KongGeometryRange& geometry = model.getGeometry();
+        mesh.inversePositionTransform = glm::inverse(model.getPositionTransform());
+        mesh.boundingSphere = glm::vec4(model.getBoundsCenter(), model.getBoundsRadius());
+        mesh.firstLod = lodIndex;
+        mesh.lodCount = model.getLodCount();
+        mesh.batch = group.gpuBatch;
+        mesh.firstCommand = m_gpuBatches[group.gpuBatch].firstCommand;
+        for (uint32_t lod = 0; lod < model.getLodCount(); lod++)
+        {
+            const KongModel::Lod& modelLod = model.getLod(lod);
+            lodData[lodIndex++] = {templateIndex, modelLod.rangeCount, modelLod.error, 0};
+            for (uint32_t r = 0; r < modelLod.rangeCount; r++)
+            {
+                const KongModel::DrawRange& range = model.getDrawRanges()[modelLod.firstRange + r];
+                templateData[templateIndex++] = {range.indexCount, geometry.firstIndex + range.firstIndex,
+                    static_cast<int32_t>(geometry.firstVertex) + range.vertexOffset, 0};
+            }
+        }
+        // batch中实例在命令区间中的位置由原子计数决定，之后的组从同一个起点开始
+    }
+
+    params.setCamera(frameInfo.camera.GetProjectionMatrix(), frameInfo.camera.GetViewMatrix());
+    params.projectionScale = std::abs(frameInfo.camera.GetProjectionMatrix()[1][1]) * 0.5f;
+    params.maxScreenError = m_lodSettings.maxScreenError;
+    params.instanceCount = instanceCount;
+    params.batchCount = static_cast<uint32_t>(m_gpuBatches.size());
+    params.instanceBase = m_baseInstance;
+    params.commandCount = commandCount;
+    std::memcpy(paramsAllocation.data, &params, sizeof(params));
+    m_gpuCuller->cull(frameInfo, params, paramsIndex);
+    return true;
 }
 
 void SimpleRenderSystem::renderGameObjects(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects)
 {
-    m_pipeline->bind(frameInfo.commandBuffer);
-    // 绑定descriptor set
+    // 没有在render pass之前调用prepareFrame时在这里准备，这时不能录制GPU剔除
+    if (!m_prepared)
+    {
+        prepare(frameInfo, gameObjects, false);
+    }
+    m_prepared = false;
+    if (m_preparedInstanceCount == 0)
+    {
+        releaseUnusedTextures();
+        return;
+    }
+
+    // 绑定descriptor set，所有顶点格式的pipeline共用同一个layout，切换pipeline之后仍然有效
+    VkDescriptorSet instanceSet = getInstanceDescriptorSet(frameInfo);
     vkCmdBindDescriptorSets(
         frameInfo.commandBuffer,
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         m_pipelineLayout,
-        0, 1, &frameInfo.globalDescriptorSet, 0, nullptr);
-    
-    
-    auto projectionView = frameInfo.camera.GetProjectionMatrix() * frameInfo.camera.GetViewMatrix();
-    
+        0, 1, &frameInfo.globalDescriptorSet, 1, &frameInfo.globalUboOffset);
+    vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+        m_pipelineLayout, 2, 1, &instanceSet, 0, nullptr);
+
+    const bool gpuCulled = !m_gpuBatches.empty();
+    auto drawPass = [&](bool depthOnly, uint32_t& drawCalls)
+    {
+        KongPipeline* boundPipeline = nullptr;
+        VkDescriptorSet boundTextureSet = VK_NULL_HANDLE;
+        // 切换pipeline不影响已经绑定的vertex/index buffer，整个pass共用一个状态
+        KongGeometryBindState bindState{};
+        auto bindDrawState = [&](const KongModel& model, VkDescriptorSet textureSet)
+        {
+            KongPipeline& pipeline = getPipeline(model.getVertexLayout(), depthOnly);
+            if (&pipeline != boundPipeline)
+            {
+                pipeline.bind(frameInfo.commandBuffer);
+                boundPipeline = &pipeline;
+            }
+            if (!depthOnly && textureSet != boundTextureSet)
+            {
+                vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    m_pipelineLayout, 1, 1, &textureSet, 0, nullptr);
+                boundTextureSet = textureSet;
+            }
+            model.bind(frameInfo.commandBuffer, bindState,
+                depthOnly ? KongVertexFormats::STREAM_POSITION : KongVertexFormats::STREAM_ALL);
+        };
+
+        for (uint32_t b = 0; b < m_gpuBatches.size(); b++)
+        {
+            const GpuBatch& batch = m_gpuBatches[b];
+            bindDrawState(*batch.model, batch.textureSet);
+            m_gpuCuller->drawBatch(frameInfo.commandBuffer, frameInfo.frameIndex, b, batch.firstCommand, batch.commandCapacity);
+            drawCalls++;
+        }
+        for (const DrawGroup& group : m_drawGroups)
+        {
+            if (gpuCulled && group.gpuBatch != NO_GROUP)
+            {
+                continue;
+            }
+            bindDrawState(*group.key.model, group.key.textureSet);
+            group.key.model->draw(frameInfo.commandBuffer, group.key.lod, group.instanceCount, m_baseInstance + group.firstInstance);
+            drawCalls++;
+        }
+        m_drawStats.geometryBinds += bindState.bindCount;
+    };
+
+    // 物体数只在这里统计一次，prepass的draw call单独记录
+    for (const DrawGroup& group : m_drawGroups)
+    {
+        m_drawStats.drawnObjects += group.instanceCount;
+    }
+    if (m_depthPrepass)
+    {
+        drawPass(true, m_drawStats.prepassDrawCalls);
+    }
+    drawPass(false, m_drawStats.drawCalls);
+    releaseUnusedTextures();
+}
+
+void SimpleRenderSystem::buildDrawGroups(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects, bool cpuCulling)
+{
+    // proj[1][1] = 1 / tan(fov / 2)，乘上0.5把[-1, 1]的NDC范围换算成相对视口高度的比例
+    const float projectionScale = std::abs(frameInfo.camera.GetProjectionMatrix()[1][1]) * 0.5f;
+    const float viewportHeight = static_cast<float>(frameInfo.extent.height);
+    const glm::mat4 view = frameInfo.camera.GetViewMatrix();
+
+    m_drawGroups.clear();
+    m_drawGroupLookup.clear();
+    m_objectGroups.assign(gameObjects.size(), NO_GROUP);
+    m_worldMatrices.resize(gameObjects.size());
+    m_visibleObjects.clear();
+    for (size_t i = 0; i < gameObjects.size(); i++)
+    {
+        if (gameObjects[i].model)
+        {
+            m_worldMatrices[i] = gameObjects[i].transform.mat4();
+            m_visibleObjects.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    if (cpuCulling && m_frustumCulling && m_sceneBvh)
+    {
+        cullWithSceneBvh(frameInfo, gameObjects);
+        m_drawStats.culledObjects = static_cast<uint32_t>(m_visibleObjects.size() - m_cullResult.size());
+        std::swap(m_visibleObjects, m_cullResult);
+    }
+    // 包围体写入SoA之后一次剔除，剔除结果是在m_visibleObjects中的位置，再换算回物体编号
+    else if (cpuCulling && m_frustumCulling)
+    {
+        m_cullingBounds.resize(m_visibleObjects.size());
+        for (size_t b = 0; b < m_visibleObjects.size(); b++)
+        {
+            const KongModel& model = *gameObjects[m_visibleObjects[b]].model;
+            m_cullingBounds.set(b, m_worldMatrices[m_visibleObjects[b]], model.getBoundsMin(), model.getBoundsMax());
+        }
+        KongFrustumCuller::cull(frameInfo.camera.GetFrustumPlanes(), m_cullingBounds, m_cullResult);
+        m_drawStats.culledObjects = static_cast<uint32_t>(m_visibleObjects.size() - m_cullResult.size());
+        for (auto& index : m_cullResult)
+        {
+            index = m_visibleObjects[index];
+        }
+        std::swap(m_visibleObjects, m_cullResult);
+    }
+
+    for (uint32_t i : m_visibleObjects)
+    {
+        KongGameObject& object = gameObjects[i];
+        const KongModel& model = *object.model;
+        if (cpuCulling || object.streamedTexture)
+        {
+            const glm::mat4 modelView = view * m_worldMatrices[i];
+            if (cpuCulling)
+            {
+                object.currentLod = selectLod(model, modelView, projectionScale, object.currentLod);
+                const uint32_t drawnTriangles = model.getLod(object.currentLod).triangleCount;
+                m_lodStats.drawnTriangles += drawnTriangles;
+                m_lodStats.savedTriangles += model.getLod(0).triangleCount - drawnTriangles;
+            }
+            if (object.streamedTexture)
+            {
+                object.streamedTexture->requestScreenSize(projectedDiameter(model, modelView, projectionScale) * viewportHeight);
+            }
+        }
+
+        const std::shared_ptr<KongTexture>* texture = &m_defaultTexture;
+        if (object.streamedTexture && object.streamedTexture->current())
+        {
+            texture = &object.streamedTexture->current();
+        }
+        else if (object.texture)
+        {
+            texture = &object.texture;
+        }
+        // GPU剔除时LOD在compute shader中选择
+        const DrawGroupKey key{&model, cpuCulling ? object.currentLod : 0, getTextureDescriptorSet(*texture)};
+
+        // 关闭instancing时每个物体单独一组
+        uint32_t groupIndex = static_cast<uint32_t>(m_drawGroups.size());
+        if (m_instancing)
+        {
+            groupIndex = m_drawGroupLookup.emplace(key, groupIndex).first->second;
+        }
+        if (groupIndex == m_drawGroups.size())
+        {
+            m_drawGroups.push_back({key, 0, 0, NO_GROUP});
+        }
+        m_drawGroups[groupIndex].instanceCount++;
+        m_objectGroups[i] = groupIndex;
+    }
+
+    uint32_t firstInstance = 0;
+    for (auto& group : m_drawGroups)
+    {
+        group.firstInstance = firstInstance;
+        firstInstance += group.instanceCount;
+    }
+}
+
+void SimpleRenderSystem::cullWithSceneBvh(const FrameInfo& frameInfo, const std::vector<KongGameObject>& gameObjects)
+{
+    // 没有模型的物体包围盒为空，不会进入树中，也不会被查询到
+    m_objectBounds.resize(gameObjects.size());
+    for (size_t i = 0; i < gameObjects.size(); i++)
+    {
+        const auto& model = gameObjects[i].model;
+        m_objectBounds[i] = model ? KongAabb::transform(m_worldMatrices[i], model->getBoundsMin(), model->getBoundsMax()) : KongAabb{};
+    }
+    // 物体增删之后编号会变，只能重建
+    if (m_sceneBvh->size() != gameObjects.size())
+    {
+        m_sceneBvh->build(m_objectBounds);
+    }
+    else
+    {
+        for (size_t i = 0; i < gameObjects.size(); i++)
+        {
+            m_sceneBvh->setBounds(static_cast<uint32_t>(i), m_objectBounds[i]);
+        }
+    }
+    m_sceneBvh->update();
+
+    m_sceneBvh->bvh().queryFrustum(frameInfo.camera.GetFrustumPlanes(), m_cullResult);
+    // 查询结果按树中的顺序，后面的分组按物体顺序
+    std::sort(m_cullResult.begin(), m_cullResult.end());
+}
+
+VkDescriptorSet SimpleRenderSystem::getInstanceDescriptorSet(const FrameInfo& frameInfo)
+{
+    VkDescriptorSet& set = m_instanceSets[frameInfo.frameIndex];
+    if (set != VK_NULL_HANDLE)
+    {
+        return set;
+    }
+    auto bufferInfo = frameInfo.frameAllocator.descriptorInfo(frameInfo.frameIndex, VK_WHOLE_SIZE);
+    if (!KongDescriptorWriter(*m_instanceSetLayout, *m_instancePool)
+        .writeBuffer(0, &bufferInfo)
+        .build(set))
+    {
+        throw std::runtime_error("failed to allocate instance descriptor set!");
+    }
+    return set;
+}
+
+uint32_t SimpleRenderSystem::swapInLoadedAssets(std::vector<KongGameObject>& gameObjects)
+{
+    uint32_t pendingCount = 0;
     for (auto& object : gameObjects)
     {
-        SimplePushConstantData push{};
-        push.modelMatrix = projectionView * object.transform.mat4();
-        
-        
-        vkCmdPushConstants(frameInfo.commandBuffer, m_pipelineLayout,
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-            0, sizeof(SimplePushConstantData), &push);
-        
-        object.model->bind(frameInfo.commandBuffer);
-        object.model->draw(frameInfo.commandBuffer);
+        // 加载失败时保留代理模型/默认贴图
+        if (object.pendingModel && object.pendingModel->isDone())
+        {
+            if (object.pendingModel->isResident())
+            {
+                object.model = object.pendingModel->get();
+                object.currentLod = 0;
+            }
+            object.pendingModel.reset();
+        }
+        if (object.pendingTexture && object.pendingTexture->isDone())
+        {
+            if (object.pendingTexture->isResident())
+            {
+                object.texture = object.pendingTexture->get();
+            }
+            object.pendingTexture.reset();
+        }
+        if (object.pendingModel || object.pendingTexture)
+        {
+            pendingCount++;
+        }
+    }
+    return pendingCount;
+}
+
+VkDescriptorSet SimpleRenderSystem::getTextureDescriptorSet(const std::shared_ptr<KongTexture>& texture)
+{
+    if (texture == m_defaultTexture)
+    {
+        return m_defaultTextureSet;
+    }
+    auto it = m_textureBindings.find(texture.get());
+    if (it != m_textureBindings.end())
+    {
+        it->second.lastUsedFrame = m_frameNumber;
+        return it->second.descriptorSet;
+    }
+
+    TextureBinding binding{texture, VK_NULL_HANDLE, m_frameNumber};
+    auto imageInfo = texture->descriptorInfo();
+    if (!KongDescriptorWriter(*m_textureSetLayout, *m_texturePool)
+        .writeImage(0, &imageInfo)
+        .build(binding.descriptorSet))
+    {
+        std::cerr << "texture descriptor pool exhausted, falling back to the default texture" << std::endl;
+        return m_defaultTextureSet;
+    }
+    m_textureBindings.emplace(texture.get(), binding);
+    return binding.descriptorSet;
+}
+
+void SimpleRenderSystem::releaseUnusedTextures()
+{
+    std::vector<VkDescriptorSet> unusedSets;
+    for (auto it = m_textureBindings.begin(); it != m_textureBindings.end();)
+    {
+        // 最后一次使用它的帧已经执行完毕
+        if (m_frameNumber - it->second.lastUsedFrame > KongSwapChain::MAX_FRAMES_IN_FLIGHT)
+        {
+            unusedSets.push_back(it->second.descriptorSet);
+            it = m_textureBindings.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    if (!unusedSets.empty())
+    {
+        m_texturePool->freeDescriptors(unusedSets);
     }
 }
 
+float SimpleRenderSystem::projectedDiameter(const KongModel& model, const glm::mat4& modelView, float projectionScale)
+{
+    const float scale = maxScale(modelView);
+    const glm::vec3 viewCenter = glm::vec3(modelView * glm::vec4(model.getBoundsCenter(), 1.0f));
+    const float distance = glm::length(viewCenter) - model.getBoundsRadius() * scale;
+    if (distance <= 0.0f)
+    {
+        return std::numeric_limits<float>::max();
+    }
+    return 2.0f * model.getBoundsRadius() * scale * projectionScale / distance;
+}
+
+uint32_t SimpleRenderSystem::selectLod(const KongModel& model, const glm::mat4& modelView, float projectionScale, uint32_t previousLod) const
+{
+    const uint32_t lodCount = model.getLodCount();
+    if (lodCount <= 1)
+    {
+        return 0;
+    }
+
+    // 非均匀缩放时按最大的缩放计算，误差只会被高估
+    const float scale = maxScale(modelView);
+    const glm::vec3 viewCenter = glm::vec3(modelView * glm::vec4(model.getBoundsCenter(), 1.0f));
+    const float distance = glm::length(viewCenter) - model.getBoundsRadius() * scale;
+    if (distance <= 0.0f)
+    {
+        // 相机在包围球内部
+        return 0;
+    }
+
+    const float errorToScreen = scale * projectionScale / distance;
+    auto screenError = [&](uint32_t lod) { return model.getLod(lod).error * errorToScreen; };
+
+    uint32_t lod = std::min(previousLod, lodCount - 1);
+    while (lod > 0 && screenError(lod) > m_lodSettings.maxScreenError)
+    {
+        lod--;
+    }
+    while (lod + 1 < lodCount && screenError(lod + 1) <= m_lodSettings.maxScreenError * (1.0f - m_lodSettings.hysteresis))
+    {
+        lod++;
+    }
+    return lod;
+}
@@ -1,10 +1,19 @@
 #pragma once
+#include <array>
+#include <limits>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "kv_bvh.h"
 #include "kv_camera.h"
+#include "kv_descriptor.h"
 #include "kv_frame_info.h"
+#include "kv_frustum_culler.h"
 #include "kv_game_object.h"
+#include "kv_gpu_culler.h"
 #include "kv_pipeline.h"
+#include "kv_utils.h"
 namespace kong
 {
     /* 
@@ -14,22 +23,218 @@ namespace kong
     class SimpleRenderSystem
     {
     public:
-        SimpleRenderSystem(KongDevice& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout);
+        struct LodSelectionSettings
+        {
+            // LOD误差投影到屏幕上允许的最大值，相对于视口高度
+            float maxScreenError = 0.002f;
+            // 切换到更粗的LOD时要求误差低于阈值的(1 - hysteresis)倍，避免在阈值附近来回切换
+            float hysteresis = 0.2f;
+        };
+
+        // 每帧重置的统计
+        struct LodStats
+        {
+            uint64_t drawnTriangles = 0;
+            uint64_t savedTriangles = 0;    // 相比全部使用LOD0少画的三角形数
+        };
+
+        // 每帧重置，所有pass的合计
+        struct DrawStats
+        {
+            uint32_t drawnObjects = 0;
+            // CPU视锥剔除掉的物体数
+            uint32_t culledObjects = 0;
+            // vkCmdDrawIndexed/vkCmdDraw的调用次数，开启instancing时同一个模型、LOD和贴图的物体只画一次
+            // GPU剔除时每个batch的indirect draw算一次，drawnObjects为剔除之前的数量
+            // 只统计着色pass
+            uint32_t drawCalls = 0;
+            // 深度prepass的draw call次数，没有开启prepass时为0
+            uint32_t prepassDrawCalls = 0;
+            // vkCmdBindVertexBuffers和vkCmdBindIndexBuffer的调用次数，模型共用几何池的同一页时只绑定一次
+            uint32_t geometryBinds = 0;
+        };
+
+        // 贴图的descriptor set最多这么多个，超出之后的贴图用默认贴图代替
+        static constexpr uint32_t MAX_TEXTURE_SETS = 1024;
+
+        SimpleRenderSystem(KongDevice& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout,
+            KongSamplerCache& samplerCache);
         ~SimpleRenderSystem();
     
         SimpleRenderSystem(const SimpleRenderSystem&) = delete;
         SimpleRenderSystem& operator=(const SimpleRenderSystem&) = delete;
+        /*
+         * 在render pass之前调用：分组、写入实例数据，开启GPU剔除时录制剔除的compute dispatch
+         * 不调用时renderGameObjects在render pass中自己准备，这时只能走CPU路径
+         */
+        void prepareFrame(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects);
         void renderGameObjects(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects);
+
+        void setLodSelectionSettings(const LodSelectionSettings& settings) { m_lodSettings = settings; }
+        // 开启后先只用position数据流写一遍深度，着色pass中被遮挡的片元不会执行fragment shader
+        void setDepthPrepass(bool enabled) { m_depthPrepass = enabled; }
+        // 关闭后每个物体单独一次draw，用于对比
+        void setInstancing(bool enabled) { m_instancing = enabled; }
+        // CPU路径上用包围体做视锥剔除，关闭后所有物体都提交绘制，用于对比
+        void setFrustumCulling(bool enabled) { m_frustumCulling = enabled; }
+        // 设置之后CPU视锥剔除改为在场景BVH上查询，每帧用物体的世界包围盒refit；由调用者持有，nullptr时逐个测试
+        void setSceneBvh(KongSceneBvh* sceneBvh) { m_sceneBvh = sceneBvh; }
+        // 开启后视锥剔除和LOD选择在compute shader中完成，每个batch一次indirect draw；设备不支持时保持关闭
+        // GPU上选择LOD没有滞后，LodStats为0
+        void setGpuCulling(bool enabled);
+        bool gpuCullingEnabled() const { return m_gpuCulling; }
+        const LodStats& getLodStats() const { return m_lodStats; }
+        const DrawStats& getDrawStats() const { return m_drawStats; }
+        // 上一帧中还在等待异步加载的物体数量
+        uint32_t getPendingObjectCount() const { return m_pendingObjectCount; }
     
     private:
+        // 把已经加载完成的模型和贴图换进去，返回还在等待的物体数量
+        static uint32_t swapInLoadedAssets(std::vector<KongGameObject>& gameObjects);
+        // set 1，每张贴图第一次使用时分配
+        VkDescriptorSet getTextureDescriptorSet(const std::shared_ptr<KongTexture>& texture);
+        // 流式贴图换精度之后旧贴图不再被使用，等所有在途的帧结束再释放它的descriptor set
+        void releaseUnusedTextures();
+        
+        // 根据包围球投影到屏幕上的误差选择LOD
+        uint32_t selectLod(const KongModel& model, const glm::mat4& modelView, float projectionScale, uint32_t previousLod) const;
+        // 包围球投影到屏幕上的直径，相对于视口高度；相机在包围球内部时返回很大的值
+        static float projectedDiameter(const KongModel& model, const glm::mat4& modelView, float projectionScale);
         
+        void createTextureResources(KongSamplerCache& samplerCache);
+        void createInstanceResources();
+        // set 2，指向frameIndex对应的整个frame allocator buffer，第一次使用时写入
+        VkDescriptorSet getInstanceDescriptorSet(const FrameInfo& frameInfo);
+        // 分组并写入这一帧的实例数据，gpuCulling时再录制剔除
+        void prepare(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects, bool gpuCulling);
+        /*
+         * 把物体按(模型, LOD, 贴图)分组，每组的实例在instance buffer中连续
+         * cpuCulling时先做视锥剔除再选择LOD，否则所有有模型的物体都按LOD0分组，交给GPU剔除
+         */
+        void buildDrawGroups(const FrameInfo& frameInfo, std::vector<KongGameObject>& gameObjects, bool cpuCulling);
+        // 更新场景BVH中所有物体的包围盒并查询视锥，可见的有模型的物体按编号顺序写入m_cullResult
+        void cullWithSceneBvh(const FrameInfo& frameInfo, const std::vector<KongGameObject>& gameObjects);
+        // 把有index的组按几何页和贴图合成batch，写入剔除的输入并录制dispatch，frame allocator不够时返回false
+        bool cullOnGpu(const FrameInfo& frameInfo, uint32_t instanceCount);
         void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
-        void createPipeline(VkRenderPass renderPass);
+        // 每种顶点布局的着色pipeline和只写深度的pipeline，第一次用到时创建
+        KongPipeline& getPipeline(const KongVertexLayout& vertexLayout, bool depthOnly);
         
         KongDevice& m_device;
         
-        std::unique_ptr<KongPipeline> m_pipeline;
+        VkRenderPass m_renderPass;
+        // 按(format, splitPositions, depthOnly)索引
+        std::array<std::unique_ptr<KongPipeline>, static_cast<size_t>(KongVertexFormat::Count) * 2 * 2> m_pipelines{};
         VkPipelineLayout m_pipelineLayout;
+
+        struct TextureBinding
+        {
+            // 持有贴图，保证descriptor set引用的image view不会先被销毁
+            std::shared_ptr<KongTexture> texture;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            uint64_t lastUsedFrame = 0;
+        };
+        std::unique_ptr<KongDescriptorSetLayout> m_textureSetLayout;
+        std::unique_ptr<KongDescriptorPool> m_texturePool;
+        std::shared_ptr<KongTexture> m_defaultTexture;
+        // 不放在m_textureBindings中，不会被释放
+        VkDescriptorSet m_defaultTextureSet = VK_NULL_HANDLE;
+        std::unordered_map<const KongTexture*, TextureBinding> m_textureBindings;
+        uint64_t m_frameNumber = 0;
+
+        std::unique_ptr<KongDescriptorSetLayout> m_instanceSetLayout;
+        std::unique_ptr<KongDescriptorPool> m_instancePool;
+        // 按frameIndex索引
+        std::vector<VkDescriptorSet> m_instanceSets;
+
+        struct DrawGroupKey
+        {
+            const KongModel* model;
+            uint32_t lod;
+            VkDescriptorSet textureSet;
+
+            bool operator==(const DrawGroupKey& other) const
+            {
+                return model == other.model && lod == other.lod && textureSet == other.textureSet;
+            }
+        };
+        struct DrawGroupKeyHash
+        {
+            size_t operator()(const DrawGroupKey& key) const
+            {
+                size_t seed = 0;
+                hashCombine(seed, key.model, key.lod, key.textureSet);
+                return seed;
+            }
+        };
+        static constexpr uint32_t NO_GROUP = std::numeric_limits<uint32_t>::max();
+        struct DrawGroup
+        {
+            DrawGroupKey key;
+            uint32_t firstInstance = 0;
+            uint32_t instanceCount = 0;
+            // GPU剔除时所在的batch，没有index的模型为NO_GROUP，仍然直接画
+            uint32_t gpuBatch = NO_GROUP;
+        };
+
+        // 顶点页决定了顶点布局，也就决定了pipeline
+        struct GpuBatchKey
+        {
+            const KongGeometryVertexPage* vertexPage;
+            const KongGeometryIndexPage* indexPage;
+            VkDescriptorSet textureSet;
+
+            bool operator==(const GpuBatchKey& other) const
+            {
+                return vertexPage == other.vertexPage && indexPage == other.indexPage && textureSet == other.textureSet;
+            }
+        };
+        struct GpuBatchKeyHash
+        {
+            size_t operator()(const GpuBatchKey& key) const
+            {
+                size_t seed = 0;
+                hashCombine(seed, key.vertexPage, key.indexPage, key.textureSet);
+                return seed;
+            }
+        };
+        struct GpuBatch
+        {
+            // 用来绑定pipeline和几何页的任意一个模型
+            const KongModel* model;
+            VkDescriptorSet textureSet;
+            uint32_t firstCommand;
+            uint32_t commandCapacity;
+        };
+        // 以下每帧重建，保留容量避免每帧分配
+        std::vector<DrawGroup> m_drawGroups;
+        std::unordered_map<DrawGroupKey, uint32_t, DrawGroupKeyHash> m_drawGroupLookup;
+        // 每个物体所在的组，没有模型或者被剔除的物体为NO_GROUP
+        std::vector<uint32_t> m_objectGroups;
+        std::vector<glm::mat4> m_worldMatrices;
+        // 这一帧要画的物体编号，按物体顺序
+        std::vector<uint32_t> m_visibleObjects;
+        std::vector<uint32_t> m_cullResult;
+        KongCullingBounds m_cullingBounds;
+        KongSceneBvh* m_sceneBvh = nullptr;
+        std::vector<KongAabb> m_objectBounds;
+        // 只有录制了GPU剔除的帧不为空
+        std::vector<GpuBatch> m_gpuBatches;
+        std::unordered_map<GpuBatchKey, uint32_t, GpuBatchKeyHash> m_gpuBatchLookup;
+        // 这一帧实例数据在frame allocator buffer中的第一个元素
+        uint32_t m_baseInstance = 0;
+        uint32_t m_preparedInstanceCount = 0;
+        bool m_prepared = false;
+        std::unique_ptr<KongGpuCuller> m_gpuCuller;
+
+        LodSelectionSettings m_lodSettings{};
+        bool m_depthPrepass = false;
+        bool m_instancing = true;
+        bool m_frustumCulling = true;
+        bool m_gpuCulling = false;
+        uint32_t m_pendingObjectCount = 0;
+        LodStats m_lodStats{};
+        DrawStats m_drawStats{};
          
     };
 }
@@ -0,0 +1,527 @@
+#include "kv_staging_ring.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "kv_buffer.h"
+
+using namespace kong;
+
+namespace
+{
+    VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamily)
+    {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamily;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VkCommandPool pool;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
+        return pool;
+    }
+
+    void allocateCommandBuffers(VkDevice device, VkCommandPool pool, uint32_t count, VkCommandBuffer* commandBuffers)
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = pool;
+        allocInfo.commandBufferCount = count;
+        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate upload command buffers!");
+        }
+    }
+
+    void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t mipCount,
+        VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+        VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage, uint32_t srcFamily, uint32_t dstFamily)
+    {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = srcFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        barrier.image = image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mipCount, 0, 1};
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+}
+
+KongStagingRing::KongStagingRing(KongDevice& device, VkDeviceSize size)
+    : m_device(device), m_size(size),
+      m_graphicsFamily(device.graphicsQueueFamily()), m_transferFamily(device.transferQueueFamily())
+{
+    // 同时满足buffer到image拷贝的对齐要求（4和texel块大小，BC格式最大16）
+    m_alignment = std::max<VkDeviceSize>(16, m_device.properties.limits.optimalBufferCopyOffsetAlignment);
+    m_buffer = std::make_unique<KongBuffer>(m_device, m_size, 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_buffer->map();
+    m_mapped = static_cast<uint8_t*>(m_buffer->getMappedMemory());
+
+    VkCommandBuffer transferCommands[BATCH_COUNT];
+    VkCommandBuffer graphicsCommands[BATCH_COUNT];
+    m_transferPool = createCommandPool(m_device.device(), m_transferFamily);
+    allocateCommandBuffers(m_device.device(), m_transferPool, BATCH_COUNT, transferCommands);
+    if (usesTransferQueue())
+    {
+        m_graphicsPool = createCommandPool(m_device.device(), m_graphicsFamily);
+        allocateCommandBuffers(m_device.device(), m_graphicsPool, BATCH_COUNT, graphicsCommands);
+
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
+        if (vkCreateSemaphore(m_device.device(), &semaphoreInfo, nullptr, &m_timeline) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload timeline semaphore!");
+        }
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    for (uint32_t i = 0; i < BATCH_COUNT; i++)
+    {
+        m_batches[i].transferCommands = transferCommands[i];
+        m_batches[i].graphicsCommands = usesTransferQueue() ? graphicsCommands[i] : transferCommands[i];
+        if (vkCreateFence(m_device.device(), &fenceInfo, nullptr, &m_batches[i].fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+    }
+}
+
+KongStagingRing::~KongStagingRing()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_recording)
+        {
+            submit();
+        }
+        while (m_completed < m_submitted)
+        {
+            waitOldest(lock);
+        }
+    }
+
+    for (auto& batch : m_batches)
+    {
+        vkDestroyFence(m_device.device(), batch.fence, nullptr);
+    }
+    if (m_timeline != VK_NULL_HANDLE)
+    {
+        vkDestroySemaphore(m_device.device(), m_timeline, nullptr);
+    }
+    if (m_graphicsPool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(m_device.device(), m_graphicsPool, nullptr);
+    }
+    vkDestroyCommandPool(m_device.device(), m_transferPool, nullptr);
+}
+
+uint64_t KongStagingRing::upload(VkDeviceSize size, VkDeviceSize alignment, const FillFunc& fill, const RecordFunc& record)
+{
+    assert(size <= maxUploadSize() && "upload larger than the staging ring, split it into chunks");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const VkDeviceSize offset = allocate(lock, size, std::max(alignment, m_alignment));
+    fill(m_mapped + offset, 0, size);
+    record(batch(m_submitted + 1).transferCommands, m_buffer->getBuffer(), offset);
+    m_stats.uploadedBytes += size;
+    m_stats.uploadCount++;
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    return uploadBuffer(dst, dstOffset, size, [bytes](void* mapped, VkDeviceSize offset, VkDeviceSize chunkSize)
+    {
+        std::memcpy(mapped, bytes + offset, static_cast<size_t>(chunkSize));
+    });
+}
+
+uint64_t KongStagingRing::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const FillFunc& fill)
+{
+    uint64_t ticket = 0;
+    for (VkDeviceSize chunkOffset = 0; chunkOffset < size; chunkOffset += maxUploadSize())
+    {
+        const VkDeviceSize chunkSize = std::min(maxUploadSize(), size - chunkOffset);
+        // 每块的拷贝和所有权的release在同一次加锁中录制，保证在同一批中；块之间释放锁，其他线程可以插进来上传
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const VkDeviceSize offset = allocate(lock, chunkSize, m_alignment);
+        fill(m_mapped + offset, chunkOffset, chunkSize);
+        VkBufferCopy region{offset, dstOffset + chunkOffset, chunkSize};
+        Batch& current = batch(m_submitted + 1);
+        vkCmdCopyBuffer(current.transferCommands, m_buffer->getBuffer(), dst, 1, &region);
+        releaseBufferLocked(current, dst, dstOffset + chunkOffset, chunkSize);
+        m_stats.uploadedBytes += chunkSize;
+        m_stats.uploadCount++;
+        ticket = m_submitted + 1;
+    }
+    return ticket;
+}
+
+uint64_t KongStagingRing::uploadBuffers(const std::vector<BufferRegion>& regions, const FillFunc& fill)
+{
+    VkDeviceSize size = 0;
+    for (const auto& region : regions)
+    {
+        size += region.size;
+    }
+    assert(size <= maxUploadSize() && "upload larger than the staging ring, split it into chunks");
+    // 和uploadBuffer一样，所有拷贝和release在同一次加锁中录制
+    std::unique_lock<std::mutex> lock(m_mutex);
+    VkDeviceSize offset = allocate(lock, size, m_alignment);
+    fill(m_mapped + offset, 0, size);
+    Batch& current = batch(m_submitted + 1);
+    for (const auto& region : regions)
+    {
+        VkBufferCopy copy{offset, region.dstOffset, region.size};
+        vkCmdCopyBuffer(current.transferCommands, m_buffer->getBuffer(), region.buffer, 1, &copy);
+        releaseBufferLocked(current, region.buffer, region.dstOffset, region.size);
+        offset += region.size;
+    }
+    m_stats.uploadedBytes += size;
+    m_stats.uploadCount++;
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::record(const std::function<void(VkCommandBuffer commandBuffer)>& record)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    record(recordingBatch(lock).transferCommands);
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::recordGraphics(const std::function<void(VkCommandBuffer commandBuffer)>& record)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    record(recordingBatch(lock).graphicsCommands);
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    releaseBufferLocked(recordingBatch(lock), buffer, offset, size);
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::releaseImage(VkImage image, uint32_t baseMip, uint32_t mipCount,
+    VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Batch& current = recordingBatch(lock);
+    if (!usesTransferQueue())
+    {
+        imageBarrier(current.graphicsCommands, image, baseMip, mipCount, oldLayout, newLayout,
+            VK_ACCESS_TRANSFER_WRITE_BIT, dstAccess, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage,
+            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+        return m_submitted + 1;
+    }
+
+    // release和acquire的layout转换必须一致，转换只执行一次；release的dstAccess和acquire的srcAccess都会被忽略
+    imageBarrier(current.transferCommands, image, baseMip, mipCount, oldLayout, newLayout,
+        VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        m_transferFamily, m_graphicsFamily);
+    imageBarrier(current.graphicsCommands, image, baseMip, mipCount, oldLayout, newLayout,
+        0, dstAccess, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage,
+        m_transferFamily, m_graphicsFamily);
+    return m_submitted + 1;
+}
+
+uint64_t KongStagingRing::flush(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_recording && ticket > m_submitted)
+    {
+        submit();
+    }
+    // 拷贝已经执行完的批次顺便提交graphics部分
+    retire();
+    return m_submitted;
+}
+
+void KongStagingRing::wait(uint64_t ticket)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_recording && ticket > m_submitted)
+    {
+        submit();
+    }
+    ticket = std::min(ticket, m_submitted);
+    while (m_completed < ticket)
+    {
+        waitOldest(lock);
+    }
+}
+
+bool KongStagingRing::isComplete(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    retire();
+    return m_completed >= ticket;
+}
+
+KongStagingRingStats KongStagingRing::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+VkDeviceSize KongStagingRing::allocate(std::unique_lock<std::mutex>& lock, VkDeviceSize size, VkDeviceSize alignment)
+{
+    while (true)
+    {
+        // 先开始录制再分配：分配之后如果还要解锁等待，别的线程可能把这段空间算进前一批提交，前一批执行完就被提前回收
+        recordingBatch(lock);
+        const VkDeviceSize head = m_allocated % m_size;
+        const VkDeviceSize used = m_allocated - m_retired;
+        const VkDeviceSize offset = (head + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= m_size)
+        {
+            if (used + (offset - head) + size <= m_size)
+            {
+                m_allocated += offset - head + size;
+                return offset;
+            }
+        }
+        // 尾部放不下时跳过剩余部分，从环的起点开始
+        else if (used + (m_size - head) + size <= m_size)
+        {
+            m_allocated += m_size - head + size;
+            return 0;
+        }
+
+        // 空间还被GPU使用中：先回收已经执行完的批次，都没有执行完时等待最早的一批，没有提交过时先提交正在录制的批次
+        if (m_completed < m_submitted)
+        {
+            const uint64_t completed = m_completed;
+            retire();
+            if (m_completed == completed)
+            {
+                m_stats.stallCount++;
+                waitOldest(lock);
+            }
+        }
+        else
+        {
+            // 之前的批次都已经回收，剩下的空间被正在录制的这一批占着
+            submit();
+        }
+    }
+}
+
+KongStagingRing::Batch& KongStagingRing::recordingBatch(std::unique_lock<std::mutex>& lock)
+{
+    while (!m_recording && !nextBatchAvailable())
+    {
+        // 这个command buffer上一次使用的批次还没有执行完，或者执行完了但还有线程没从等待它的fence中返回
+        if (m_submitted + 1 - m_completed > BATCH_COUNT)
+        {
+            m_stats.stallCount++;
+            waitOldest(lock);
+        }
+        else
+        {
+            m_batchIdle.wait(lock);
+        }
+    }
+
+    Batch& current = batch(m_submitted + 1);
+    if (!m_recording)
+    {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(current.transferCommands, &beginInfo);
+        if (current.graphicsCommands != current.transferCommands)
+        {
+            vkBeginCommandBuffer(current.graphicsCommands, &beginInfo);
+        }
+        m_recording = true;
+    }
+    return current;
+}
+
+bool KongStagingRing::nextBatchAvailable()
+{
+    const uint64_t ticket = m_submitted + 1;
+    return ticket - m_completed <= BATCH_COUNT && batch(ticket).waiters == 0;
+}
+
+void KongStagingRing::releaseBufferLocked(Batch& current, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    // 同一个queue上由批次末尾的全局barrier保证可见
+    if (!usesTransferQueue())
+    {
+        return;
+    }
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = m_transferFamily;
+    barrier.dstQueueFamilyIndex = m_graphicsFamily;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(current.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    // acquire在拷贝执行完之后才提交，可以直接用最宽的stage
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(current.graphicsCommands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void KongStagingRing::submit()
+{
+    const uint64_t ticket = m_submitted + 1;
+    Batch& current = batch(ticket);
+    current.allocatedEnd = m_allocated;
+    m_submitted++;
+    m_recording = false;
+    m_stats.submitCount++;
+    if (!usesTransferQueue())
+    {
+        submitGraphics(ticket);
+        return;
+    }
+
+    vkEndCommandBuffer(current.transferCommands);
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &ticket;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &current.transferCommands;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &m_timeline;
+
+    std::lock_guard<std::mutex> lock(m_device.transferQueueMutex());
+    if (vkQueueSubmit(m_device.transferQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+}
+
+void KongStagingRing::submitGraphics(uint64_t ticket)
+{
+    Batch& current = batch(ticket);
+
+    // 之后提交到graphics queue的所有命令都能看到这一批写入的数据
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(current.graphicsCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(current.graphicsCommands);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &current.graphicsCommands;
+
+    // 等待这一批的拷贝，调用时timeline已经到达，graphics queue不会真的停下来
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    if (usesTransferQueue())
+    {
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &ticket;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &m_timeline;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    vkResetFences(m_device.device(), 1, &current.fence);
+    {
+        std::lock_guard<std::mutex> lock(m_device.queueMutex());
+        if (vkQueueSubmit(m_device.graphicsQueue(), 1, &submitInfo, current.fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+    }
+    m_graphicsSubmitted = ticket;
+}
+
+uint64_t KongStagingRing::timelineValue() const
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(m_device.device(), m_timeline, &value);
+    return value;
+}
+
+void KongStagingRing::retire()
+{
+    // 拷贝执行完的批次按顺序提交graphics部分
+    while (m_graphicsSubmitted < m_submitted && timelineValue() > m_graphicsSubmitted)
+    {
+        submitGraphics(m_graphicsSubmitted + 1);
+    }
+
+    while (m_completed < m_graphicsSubmitted)
+    {
+        Batch& oldest = batch(m_completed + 1);
+        if (vkGetFenceStatus(m_device.device(), oldest.fence) != VK_SUCCESS)
+        {
+            return;
+        }
+        m_retired = oldest.allocatedEnd;
+        m_completed++;
+    }
+}
+
+void KongStagingRing::waitOldest(std::unique_lock<std::mutex>& lock)
+{
+    const uint64_t ticket = m_completed + 1;
+    if (m_graphicsSubmitted < ticket)
+    {
+        // 拷贝还在transfer queue上执行：timeline的值只增不减，解锁之后不会等错批次
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &m_timeline;
+        waitInfo.pValues = &ticket;
+        lock.unlock();
+        vkWaitSemaphores(m_device.device(), &waitInfo, UINT64_MAX);
+        lock.lock();
+    }
+    else
+    {
+        // fence只在这个槽位开始新的一批之后才会被重置，而waiters不为0时recordingBatch不会开始新的一批
+        Batch& oldest = batch(ticket);
+        const VkFence fence = oldest.fence;
+        oldest.waiters++;
+        lock.unlock();
+        vkWaitForFences(m_device.device(), 1, &fence, VK_TRUE, UINT64_MAX);
+        lock.lock();
+        if (--oldest.waiters == 0)
+        {
+            m_batchIdle.notify_all();
+        }
+    }
+    retire();
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace kong
+{
+    class KongBuffer;
+    class KongDevice;
+
+    struct KongStagingRingStats
+    {
+        uint64_t uploadedBytes = 0;
+        uint64_t uploadCount = 0;
+        uint64_t submitCount = 0;
+        // 环形缓冲区或者command buffer用完，需要等GPU执行完之前批次的次数
+        uint64_t stallCount = 0;
+    };
+
+    /*
+     * 所有上传共用的staging环形缓冲区，创建时映射一次，之后每次上传只是在环中前移写指针
+     * 拷贝命令录制到共享的upload command buffer中，一批命令提交一次，环中的空间在这批命令的fence signal之后回收
+     * 每次上传返回所属批次的编号（ticket），flush保证这一批已经提交，wait等待这一批在GPU上执行完
+     *
+     * 设备有专用的transfer queue时每批分成两部分：
+     * 拷贝和queue family所有权的release在transfer queue上执行，执行完signal timeline semaphore的值ticket
+     * acquire和只能在graphics queue上执行的命令（生成mip的blit等）在timeline到达之后才提交到graphics queue并等待这个值，
+     * 渲染不会因为还在进行的上传停顿，只有用到新数据的这一小段命令等待timeline
+     * 没有专用的transfer queue时所有命令都在graphics queue上，末尾一个全局的memory barrier保证之后的渲染能看到上传的数据
+     *
+     * 可以在加载线程中调用，录制和提交都在锁内完成；等待GPU时不持有锁，不会挡住其他线程的录制
+     */
+    class KongStagingRing
+    {
+    public:
+        static constexpr VkDeviceSize DEFAULT_SIZE = 32ull << 20;
+        // 正在录制和已经提交还没有回收的批次最多这么多个
+        static constexpr uint32_t BATCH_COUNT = 4;
+
+        // 把要上传的数据中[offset, offset + size)的部分写入dst，分块上传时每块调用一次
+        using FillFunc = std::function<void(void* dst, VkDeviceSize offset, VkDeviceSize size)>;
+        // stagingOffset为fill写入的数据在staging buffer中的偏移
+        using RecordFunc = std::function<void(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset)>;
+
+        // uploadBuffers的一个目标范围
+        struct BufferRegion
+        {
+            VkBuffer buffer;
+            VkDeviceSize dstOffset;
+            VkDeviceSize size;
+        };
+
+        KongStagingRing(KongDevice& device, VkDeviceSize size = DEFAULT_SIZE);
+        // 等待所有批次执行完
+        ~KongStagingRing();
+
+        KongStagingRing(const KongStagingRing&) = delete;
+        KongStagingRing& operator=(const KongStagingRing&) = delete;
+
+        // 在环中分配size字节由fill一次写入，再由record录制读取这段数据的拷贝命令，size不能超过maxUploadSize
+        // record录制在transfer queue上，写入的资源需要再调用releaseBuffer/releaseImage交给graphics queue
+        uint64_t upload(VkDeviceSize size, VkDeviceSize alignment, const FillFunc& fill, const RecordFunc& record);
+        // 拷贝到dst的dstOffset处并交给graphics queue，超过maxUploadSize时分块上传
+        uint64_t uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+        // fill直接写进环中，省掉一次内存拷贝；超过maxUploadSize时分块，每块由fill写入对应的范围
+        uint64_t uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, const FillFunc& fill);
+        // 一次分配写入多个范围：fill按regions的顺序连续写入，每段拷贝到对应的buffer并交给graphics queue，总大小不能超过maxUploadSize
+        uint64_t uploadBuffers(const std::vector<BufferRegion>& regions, const FillFunc& fill);
+        // 录制拷贝之前的命令，比如把image转换成TRANSFER_DST，和拷贝在同一个queue上
+        uint64_t record(const std::function<void(VkCommandBuffer commandBuffer)>& record);
+        // 录制只能在graphics queue上执行的命令，在这一批的拷贝和acquire之后执行
+        uint64_t recordGraphics(const std::function<void(VkCommandBuffer commandBuffer)>& record);
+
+        // 拷贝完成的资源交给graphics queue：专用transfer queue时是queue family所有权的release和acquire，否则是普通的barrier
+        uint64_t releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+        uint64_t releaseImage(VkImage image, uint32_t baseMip, uint32_t mipCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+            VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+
+        // 提交ticket所在的批次（还在录制时），返回最近一次提交的ticket
+        uint64_t flush(uint64_t ticket = UINT64_MAX);
+        void wait(uint64_t ticket);
+        // 不等待，只检查ticket所在的批次是否已经在GPU上执行完
+        bool isComplete(uint64_t ticket);
+
+        // 超过这个大小的上传需要分块，留出余量让前一块在GPU上拷贝的同时写入下一块
+        VkDeviceSize maxUploadSize() const { return m_size / 4; }
+        VkDeviceSize size() const { return m_size; }
+        bool usesTransferQueue() const { return m_transferFamily != m_graphicsFamily; }
+        KongStagingRingStats stats() const;
+
+    private:
+        struct Batch
+        {
+            // 没有专用transfer queue时两者是同一个command buffer
+            VkCommandBuffer transferCommands = VK_NULL_HANDLE;
+            VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+            // graphics queue上的部分执行完之后signal，这时拷贝也一定执行完了
+            VkFence fence = VK_NULL_HANDLE;
+            // 提交时的m_allocated，这一批执行完之后环中在此之前的空间都可以回收
+            uint64_t allocatedEnd = 0;
+            // 解锁等待这个fence的线程数，不为0时这个槽位不能开始新的一批（会重置fence）
+            uint32_t waiters = 0;
+        };
+
+        // 以下函数都需要持有m_mutex，带lock参数的可能在等待GPU时暂时解锁
+        // 在环中分配空间，返回时一定有正在录制的批次，分配之后不再解锁，保证这段空间由录制拷贝命令的批次回收
+        VkDeviceSize allocate(std::unique_lock<std::mutex>& lock, VkDeviceSize size, VkDeviceSize alignment);
+        // 正在录制的批次，还没有开始录制时开始一批新的
+        Batch& recordingBatch(std::unique_lock<std::mutex>& lock);
+        // 不录制时下一批的command buffer和fence是否可以重用
+        bool nextBatchAvailable();
+        void releaseBufferLocked(Batch& current, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+        // 提交正在录制的批次，专用transfer queue时只提交拷贝的部分
+        void submit();
+        void submitGraphics(uint64_t ticket);
+        uint64_t timelineValue() const;
+        // 回收已经执行完的批次，不等待
+        void retire();
+        // 解锁等待最早一个没有执行完的批次，回来之后回收
+        void waitOldest(std::unique_lock<std::mutex>& lock);
+        Batch& batch(uint64_t ticket) { return m_batches[ticket % BATCH_COUNT]; }
+
+        KongDevice& m_device;
+        VkDeviceSize m_size;
+        VkDeviceSize m_alignment;
+        std::unique_ptr<KongBuffer> m_buffer;
+        uint8_t* m_mapped = nullptr;
+        uint32_t m_graphicsFamily;
+        uint32_t m_transferFamily;
+        VkCommandPool m_transferPool = VK_NULL_HANDLE;
+        // 只在使用专用transfer queue时创建
+        VkCommandPool m_graphicsPool = VK_NULL_HANDLE;
+        VkSemaphore m_timeline = VK_NULL_HANDLE;
+        Batch m_batches[BATCH_COUNT]{};
+
+        mutable std::mutex m_mutex;
+        // 批次的waiters降到0时通知
+        std::condition_variable m_batchIdle;
+        // 从创建开始累计分配和回收的字节数（包括对齐和绕回时跳过的部分），对m_size取模就是写指针和读指针
+        uint64_t m_allocated = 0;
+        uint64_t m_retired = 0;
+        // 正在录制的批次的ticket为m_submitted + 1，(m_graphicsSubmitted, m_submitted]的拷贝已经提交，graphics部分还没有提交
+        uint64_t m_submitted = 0;
+        uint64_t m_graphicsSubmitted = 0;
+        uint64_t m_completed = 0;
+        bool m_recording = false;
+        KongStagingRingStats m_stats{};
+    };
+}
@@ -0,0 +1,387 @@
+#include "kv_texture.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "kv_staging_ring.h"
+#include "kv_texture_cache.h"
+
+// assimp自带的stb_image，声明为static避免和assimp内部的实现冲突
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "assimp/contrib/stb/stb_image.h"
+
+using namespace kong;
+
+namespace
+{
+    void transitionMips(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t mipCount,
+        VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+        VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+    {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = baseMip;
+        barrier.subresourceRange.levelCount = mipCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    // BC格式的数据按4x4的块一行行存放
+    uint32_t blockHeight(VkFormat format)
+    {
+        return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK ? 4 : 1;
+    }
+
+    VkFormat vulkanFormat(KongTextureFormat format, bool srgb)
+    {
+        switch (format)
+        {
+        case KongTextureFormat::BC1:
+            return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case KongTextureFormat::BC3:
+            return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+        case KongTextureFormat::BC4:
+            return VK_FORMAT_BC4_UNORM_BLOCK;
+        case KongTextureFormat::BC5:
+            return VK_FORMAT_BC5_UNORM_BLOCK;
+        case KongTextureFormat::BC7:
+            return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+        default:
+            return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+        }
+    }
+}
+
+bool KongImageData::decodeFile(const std::string& filepath, KongImageData& out)
+{
+    int width = 0, height = 0, channels = 0;
+    stbi_uc* pixels = stbi_load(filepath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        return false;
+    }
+
+    out.width = static_cast<uint32_t>(width);
+    out.height = static_cast<uint32_t>(height);
+    out.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+    return true;
+}
+
+KongSamplerCache::~KongSamplerCache()
+{
+    for (auto& entry : m_samplers)
+    {
+        vkDestroySampler(m_device.device(), entry.second, nullptr);
+    }
+}
+
+VkSampler KongSamplerCache::get(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_samplers.find(key.packed());
+    if (it != m_samplers.end())
+    {
+        return it->second;
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = key.filter;
+    samplerInfo.minFilter = key.filter;
+    samplerInfo.mipmapMode = key.filter == VK_FILTER_NEAREST ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = key.addressMode;
+    samplerInfo.addressModeV = key.addressMode;
+    samplerInfo.addressModeW = key.addressMode;
+    // createLogicalDevice中已经开启了samplerAnisotropy
+    samplerInfo.anisotropyEnable = key.anisotropy ? VK_TRUE : VK_FALSE;
+    samplerInfo.maxAnisotropy = key.anisotropy ? m_device.properties.limits.maxSamplerAnisotropy : 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    // 不限制mip数量，同一个sampler可以给任意大小的贴图使用
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSampler sampler;
+    if (vkCreateSampler(m_device.device(), &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create texture sampler!");
+    }
+    m_samplers.emplace(key.packed(), sampler);
+    return sampler;
+}
+
+KongTexture::KongTexture(KongDevice& device, KongSamplerCache& samplerCache, const KongImageData& image, const KongTextureSettings& settings)
+    : m_device(device), m_width(image.width), m_height(image.height)
+{
+    assert(m_width > 0 && m_height > 0 && image.pixels.size() == static_cast<size_t>(m_width) * m_height * 4 && "invalid image data");
+    m_format = settings.srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+
+    // blit生成mip需要格式支持linear过滤，不支持时只保留一级
+    if (settings.generateMips && m_device.supportsLinearBlit(m_format))
+    {
+        m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(m_width, m_height)))) + 1;
+    }
+    for (uint32_t mip = 0; mip < m_mipLevels; mip++)
+    {
+        m_sizeBytes += static_cast<VkDeviceSize>(std::max(m_width >> mip, 1u)) * std::max(m_height >> mip, 1u) * 4;
+    }
+
+    createImage();
+    uploadAndGenerateMips(image);
+    createImageView();
+    m_sampler = samplerCache.get(settings.sampler);
+}
+
+KongTexture::KongTexture(KongDevice& device, KongSamplerCache& samplerCache, const KongTextureCache& cache,
+    const KongTextureSettings& settings, uint32_t firstMip)
+    : m_device(device)
+{
+    const auto& header = cache.header();
+    assert(firstMip < header.mipCount && "first mip out of range");
+    m_width = std::max(header.width >> firstMip, 1u);
+    m_height = std::max(header.height >> firstMip, 1u);
+    m_mipLevels = header.mipCount - firstMip;
+    m_format = vulkanFormat(cache.format(), header.srgb != 0);
+    for (uint32_t mip = firstMip; mip < header.mipCount; mip++)
+    {
+        m_sizeBytes += cache.mipSize(mip);
+    }
+
+    createImage();
+    uploadMips(cache, firstMip);
+    createImageView();
+    m_sampler = samplerCache.get(settings.sampler);
+}
+
+KongTexture::~KongTexture()
+{
+    vkDestroyImageView(m_device.device(), m_imageView, nullptr);
+    vkDestroyImage(m_device.device(), m_image, nullptr);
+    m_device.allocator().free(m_memory);
+}
+
+std::unique_ptr<KongTexture> KongTexture::createTextureFromFile(KongDevice& device, KongSamplerCache& samplerCache,
+    const std::string& filepath, const KongTextureSettings& settings)
+{
+    using clock = std::chrono::high_resolution_clock;
+    auto startTime = clock::now();
+
+    const std::string cachePath = KongTextureCache::cachePathFor(filepath);
+    KongTextureCache cache;
+    if (cache.open(cachePath, filepath))
+    {
+        if (isSupported(device, cache))
+        {
+            auto texture = std::make_unique<KongTexture>(device, samplerCache, cache, settings);
+            std::cout << "load " << cachePath << " (kvtex " << KongTextureFormats::name(cache.format()) << "): "
+                << texture->getWidth() << "x" << texture->getHeight() << ", " << texture->getMipLevels() << " mips, "
+                << std::chrono::duration<float, std::milli>(clock::now() - startTime).count() << " ms" << std::endl;
+            return texture;
+        }
+        std::cout << cachePath << " uses " << KongTextureFormats::name(cache.format())
+            << ", which this device cannot sample, decoding the source instead" << std::endl;
+    }
+    else
+    {
+        std::cout << filepath << " is not cooked, run kv_assetc to skip decoding at runtime" << std::endl;
+    }
+
+    KongImageData image;
+    if (!KongImageData::decodeFile(filepath, image))
+    {
+        throw std::runtime_error("failed to decode texture: " + filepath + " (" + stbi_failure_reason() + ")");
+    }
+    auto decodeTime = clock::now();
+
+    auto texture = std::make_unique<KongTexture>(device, samplerCache, image, settings);
+    std::cout << "load texture " << filepath << ": " << image.width << "x" << image.height << ", "
+        << texture->getMipLevels() << " mips, decode "
+        << std::chrono::duration<float, std::milli>(decodeTime - startTime).count() << " ms, upload "
+        << std::chrono::duration<float, std::milli>(clock::now() - decodeTime).count() << " ms" << std::endl;
+    return texture;
+}
+
+bool KongTexture::isSupported(KongDevice& device, const KongTextureCache& cache)
+{
+    if (KongTextureFormats::isBlockCompressed(cache.format()) && !device.supportsTextureCompressionBC())
+    {
+        return false;
+    }
+    return device.supportsSampledFormat(vulkanFormat(cache.format(), cache.header().srgb != 0));
+}
+
+VkDescriptorImageInfo KongTexture::descriptorInfo() const
+{
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = m_sampler;
+    imageInfo.imageView = m_imageView;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return imageInfo;
+}
+
+void KongTexture::createImage()
+{
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {m_width, m_height, 1};
+    imageInfo.mipLevels = m_mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = m_format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // 生成mip时每一级既是blit的目标又是下一级的来源
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    m_device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_memory);
+}
+
+void KongTexture::uploadAndGenerateMips(const KongImageData& image)
+{
+    // 拷贝mip0、逐级blit和最后的layout转换都录在staging ring的同一批命令中，只等待一次
+    KongStagingRing& stagingRing = m_device.stagingRing();
+    stagingRing.record([&](VkCommandBuffer commandBuffer)
+    {
+        transitionMips(commandBuffer, m_image, 0, m_mipLevels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    });
+    uploadMip(0, image.pixels.data(), image.pixels.size());
+    // blit只能在graphics queue上执行，拷贝在专用transfer queue上时先把整张图交过去
+    stagingRing.releaseImage(m_image, 0, m_mipLevels,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    const uint64_t ticket = stagingRing.recordGraphics([&](VkCommandBuffer commandBuffer)
+    {
+        int32_t mipWidth = static_cast<int32_t>(m_width);
+        int32_t mipHeight = static_cast<int32_t>(m_height);
+        for (uint32_t mip = 1; mip < m_mipLevels; mip++)
+        {
+            // 上一级写完之后作为blit的来源
+            transitionMips(commandBuffer, m_image, mip - 1, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            const int32_t nextWidth = std::max(mipWidth / 2, 1);
+            const int32_t nextHeight = std::max(mipHeight / 2, 1);
+            VkImageBlit blit{};
+            blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+            blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 0, 1};
+            blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+            blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+            vkCmdBlitImage(commandBuffer,
+                m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blit, VK_FILTER_LINEAR);
+
+            transitionMips(commandBuffer, m_image, mip - 1, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            mipWidth = nextWidth;
+            mipHeight = nextHeight;
+        }
+
+        // 最后一级只做过blit的目标
+        transitionMips(commandBuffer, m_image, m_mipLevels - 1, 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    });
+    stagingRing.wait(ticket);
+}
+
+void KongTexture::uploadMips(const KongTextureCache& cache, uint32_t firstMip)
+{
+    KongStagingRing& stagingRing = m_device.stagingRing();
+    stagingRing.record([&](VkCommandBuffer commandBuffer)
+    {
+        transitionMips(commandBuffer, m_image, 0, m_mipLevels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    });
+    // .kvtex中的mip已经是GPU的块格式，直接从mmap的文件拷贝到staging ring
+    for (uint32_t mip = 0; mip < m_mipLevels; mip++)
+    {
+        uploadMip(mip, cache.mipData(firstMip + mip), cache.mipSize(firstMip + mip));
+    }
+    const uint64_t ticket = stagingRing.releaseImage(m_image, 0, m_mipLevels,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    stagingRing.wait(ticket);
+}
+
+void KongTexture::uploadMip(uint32_t mip, const uint8_t* data, VkDeviceSize size)
+{
+    KongStagingRing& stagingRing = m_device.stagingRing();
+    const uint32_t width = std::max(m_width >> mip, 1u);
+    const uint32_t height = std::max(m_height >> mip, 1u);
+    const uint32_t rowHeight = blockHeight(m_format);
+    const uint32_t rowCount = (height + rowHeight - 1) / rowHeight;
+    const VkDeviceSize rowBytes = size / rowCount;
+    // 超过ring单次上传大小的mip按行分块拷贝
+    const uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(stagingRing.maxUploadSize() / rowBytes, 1));
+    for (uint32_t row = 0; row < rowCount; row += rowsPerChunk)
+    {
+        const uint32_t rows = std::min(rowsPerChunk, rowCount - row);
+        stagingRing.upload(rowBytes * rows, 1,
+            [&](void* mapped, VkDeviceSize, VkDeviceSize size) { std::memcpy(mapped, data + rowBytes * row, static_cast<size_t>(size)); },
+            [&](VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkDeviceSize stagingOffset)
+            {
+                VkBufferImageCopy region{};
+                region.bufferOffset = stagingOffset;
+                region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.imageSubresource.mipLevel = mip;
+                region.imageSubresource.baseArrayLayer = 0;
+                region.imageSubresource.layerCount = 1;
+                region.imageOffset = {0, static_cast<int32_t>(row * rowHeight), 0};
+                region.imageExtent = {width, std::min(rows * rowHeight, height - row * rowHeight), 1};
+                vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            });
+    }
+}
+
+void KongTexture::createImageView()
+{
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = m_format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = m_mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(m_device.device(), &viewInfo, nullptr, &m_imageView) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create texture image view!");
+    }
+}
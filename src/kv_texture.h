@@ -0,0 +1,115 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kv_device.h"
+
+namespace kong
+{
+    class KongTextureCache;
+
+    // 解码后的RGBA8图片，第一行是图片顶部
+    struct KongImageData
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> pixels{};
+
+        // 用stb_image解码png/tga/jpg等格式，统一转换成4通道，失败时返回false
+        static bool decodeFile(const std::string& filepath, KongImageData& out);
+    };
+
+    /*
+     * 按参数共享VkSampler，sampler数量有上限（maxSamplerAllocationCount），不能每张贴图各建一个
+     * 加载线程也会用到，所以get是线程安全的
+     */
+    class KongSamplerCache
+    {
+    public:
+        struct Key
+        {
+            VkFilter filter = VK_FILTER_LINEAR;
+            VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+            // 开启时使用设备支持的最大各向异性
+            bool anisotropy = true;
+
+            uint32_t packed() const { return static_cast<uint32_t>(filter) | static_cast<uint32_t>(addressMode) << 8 | anisotropy << 16; }
+        };
+
+        explicit KongSamplerCache(KongDevice& device) : m_device(device) {}
+        ~KongSamplerCache();
+
+        KongSamplerCache(const KongSamplerCache&) = delete;
+        KongSamplerCache& operator=(const KongSamplerCache&) = delete;
+
+        VkSampler get(const Key& key);
+
+    private:
+        KongDevice& m_device;
+        std::mutex m_mutex;
+        std::unordered_map<uint32_t, VkSampler> m_samplers;
+    };
+
+    struct KongTextureSettings
+    {
+        // 颜色贴图用srgb，法线、高光之类的数据贴图用unorm
+        bool srgb = true;
+        bool generateMips = true;
+        KongSamplerCache::Key sampler{};
+    };
+
+    class KongTexture
+    {
+    public:
+        // 上传image并在同一个command buffer中用vkCmdBlitImage生成mip链
+        KongTexture(KongDevice& device, KongSamplerCache& samplerCache, const KongImageData& image, const KongTextureSettings& settings = {});
+        // 上传kv_assetc生成的.kvtex，格式、srgb和mip链都以缓存为准，只使用settings中的sampler
+        // firstMip之前的精细mip不上传，贴图的第0级对应缓存中的第firstMip级
+        KongTexture(KongDevice& device, KongSamplerCache& samplerCache, const KongTextureCache& cache,
+            const KongTextureSettings& settings = {}, uint32_t firstMip = 0);
+        ~KongTexture();
+
+        KongTexture(const KongTexture&) = delete;
+        KongTexture& operator=(const KongTexture&) = delete;
+
+        // 优先使用同名的.kvtex，没有缓存或者设备不支持缓存的格式时解码源文件
+        // 解码和上传可以在加载线程中执行，会输出解码和上传各自的耗时
+        static std::unique_ptr<KongTexture> createTextureFromFile(KongDevice& device, KongSamplerCache& samplerCache,
+            const std::string& filepath, const KongTextureSettings& settings = {});
+
+        // 设备能否采样缓存中的格式，BC格式需要textureCompressionBC
+        static bool isSupported(KongDevice& device, const KongTextureCache& cache);
+
+        VkDescriptorImageInfo descriptorInfo() const;
+        uint32_t getWidth() const { return m_width; }
+        uint32_t getHeight() const { return m_height; }
+        uint32_t getMipLevels() const { return m_mipLevels; }
+        // 包括所有mip的大小
+        VkDeviceSize getSizeBytes() const { return m_sizeBytes; }
+
+    private:
+        void createImage();
+        void uploadAndGenerateMips(const KongImageData& image);
+        // 所有mip通过staging ring上传，和layout转换录在同一批命令中
+        void uploadMips(const KongTextureCache& cache, uint32_t firstMip);
+        // 拷贝一级mip，超过ring单次上传大小时按行分块
+        void uploadMip(uint32_t mip, const uint8_t* data, VkDeviceSize size);
+        void createImageView();
+
+        KongDevice& m_device;
+        uint32_t m_width = 0;
+        uint32_t m_height = 0;
+        uint32_t m_mipLevels = 1;
+        VkDeviceSize m_sizeBytes = 0;
+        VkFormat m_format = VK_FORMAT_R8G8B8A8_SRGB;
+
+        VkImage m_image = VK_NULL_HANDLE;
+        KongAllocation m_memory{};
+        VkImageView m_imageView = VK_NULL_HANDLE;
+        // 属于KongSamplerCache，不需要销毁
+        VkSampler m_sampler = VK_NULL_HANDLE;
+    };
+}
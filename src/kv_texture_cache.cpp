@@ -0,0 +1,127 @@
+#include "kv_texture_cache.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace kong;
+
+namespace
+{
+    uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    void writePadding(std::ofstream& file, uint64_t from, uint64_t to)
+    {
+        static const char zeros[KongTextureCache::BLOB_ALIGNMENT]{};
+        file.write(zeros, static_cast<std::streamsize>(to - from));
+    }
+}
+
+bool KongTextureCache::write(const std::string& cachePath, const std::string& sourcePath, const KongCompressedTexture& texture)
+{
+    if (texture.mips.empty() || texture.mips.size() > KongTextureFileHeader::MAX_MIPS)
+    {
+        return false;
+    }
+
+    const auto source = KongSourceStamp::compute(sourcePath);
+    KongTextureFileHeader header{};
+    header.sourceHash = source.hash;
+    header.sourceSize = source.size;
+    header.sourceWriteTime = source.writeTime;
+    header.format = static_cast<uint32_t>(texture.format);
+    header.srgb = texture.srgb ? 1 : 0;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.mipCount = static_cast<uint32_t>(texture.mips.size());
+
+    uint64_t offset = sizeof(KongTextureFileHeader);
+    for (uint32_t mip = 0; mip < header.mipCount; mip++)
+    {
+        header.mipOffsets[mip] = alignOffset(offset, BLOB_ALIGNMENT);
+        header.mipSizes[mip] = texture.mips[mip].size();
+        offset = header.mipOffsets[mip] + header.mipSizes[mip];
+    }
+
+    // 先写临时文件再rename，避免写到一半的缓存被运行时读到
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cerr << "failed to write texture cache: " << cachePath << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t position = sizeof(header);
+        for (uint32_t mip = 0; mip < header.mipCount; mip++)
+        {
+            writePadding(file, position, header.mipOffsets[mip]);
+            file.write(reinterpret_cast<const char*>(texture.mips[mip].data()), static_cast<std::streamsize>(header.mipSizes[mip]));
+            position = header.mipOffsets[mip] + header.mipSizes[mip];
+        }
+
+        if (!file.good())
+        {
+            std::cerr << "failed to write texture cache: " << cachePath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
+
+bool KongTextureCache::open(const std::string& cachePath, const std::string& sourcePath)
+{
+    if (!m_file.open(cachePath))
+    {
+        return false;
+    }
+
+    if (m_file.size() < sizeof(KongTextureFileHeader))
+    {
+        m_file.close();
+        return false;
+    }
+
+    const auto& fileHeader = header();
+    bool valid = fileHeader.magic == KongTextureFileHeader::MAGIC
+        && fileHeader.version == KongTextureFileHeader::VERSION
+        && fileHeader.format < static_cast<uint32_t>(KongTextureFormat::Count)
+        && fileHeader.width > 0 && fileHeader.height > 0
+        && fileHeader.mipCount > 0 && fileHeader.mipCount <= KongTextureFileHeader::MAX_MIPS
+        && fileHeader.mipCount <= KongTextureFormats::mipCount(fileHeader.width, fileHeader.height);
+    for (uint32_t mip = 0; valid && mip < fileHeader.mipCount; mip++)
+    {
+        const uint32_t width = std::max(fileHeader.width >> mip, 1u);
+        const uint32_t height = std::max(fileHeader.height >> mip, 1u);
+        valid = fileHeader.mipSizes[mip] == KongTextureFormats::imageBytes(format(), width, height)
+            && fileHeader.mipOffsets[mip] % BLOB_ALIGNMENT == 0
+            && fileHeader.mipOffsets[mip] + fileHeader.mipSizes[mip] <= m_file.size();
+    }
+    if (!valid)
+    {
+        m_file.close();
+        return false;
+    }
+
+    if (KongSourceStamp{fileHeader.sourceHash, fileHeader.sourceSize, fileHeader.sourceWriteTime}.matches(sourcePath))
+    {
+        return true;
+    }
+
+    m_file.close();
+    return false;
+}
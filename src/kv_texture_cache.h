@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+
+#include "kv_mapped_file.h"
+#include "kv_texture_compressor.h"
+
+namespace kong
+{
+    /*
+     * .kvtex贴图缓存，由kv_assetc离线生成
+     * 保存已经压缩好的完整mip链，运行时mmap之后把每级mip原样拷贝到staging buffer，不需要解码和转码
+     *
+     * 文件布局: [KongTextureFileHeader][mip 0][mip 1]...，每级mip按BLOB_ALIGNMENT对齐
+     */
+    struct KongTextureFileHeader
+    {
+        static constexpr uint32_t MAGIC = 0x5854564b;   // "KVTX"
+        static constexpr uint32_t VERSION = 1;
+        static constexpr uint32_t MAX_MIPS = 16;
+
+        uint32_t magic = MAGIC;
+        uint32_t version = VERSION;
+        // 和.kvmesh一样记录源文件的内容hash、大小和修改时间
+        uint64_t sourceHash = 0;
+        uint64_t sourceSize = 0;
+        int64_t sourceWriteTime = 0;
+
+        uint32_t format = 0;    // KongTextureFormat
+        uint32_t srgb = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipCount = 0;
+        uint32_t reserved = 0;
+
+        uint64_t mipOffsets[MAX_MIPS]{};
+        uint64_t mipSizes[MAX_MIPS]{};
+    };
+
+    class KongTextureCache
+    {
+    public:
+        // 拷贝到staging buffer时偏移需要是块大小的整数倍
+        static constexpr uint64_t BLOB_ALIGNMENT = 64;
+
+        static std::string cachePathFor(const std::string& sourcePath) { return sourcePath + ".kvtex"; }
+
+        static bool write(const std::string& cachePath, const std::string& sourcePath, const KongCompressedTexture& texture);
+
+        // 打开并校验缓存，源文件内容变化或者格式版本不一致时返回false
+        bool open(const std::string& cachePath, const std::string& sourcePath);
+
+        const KongTextureFileHeader& header() const { return *reinterpret_cast<const KongTextureFileHeader*>(m_file.data()); }
+        KongTextureFormat format() const { return static_cast<KongTextureFormat>(header().format); }
+        const uint8_t* mipData(uint32_t mip) const { return m_file.data() + header().mipOffsets[mip]; }
+        uint64_t mipSize(uint32_t mip) const { return header().mipSizes[mip]; }
+
+    private:
+        KongMappedFile m_file;
+    };
+}
@@ -0,0 +1,1070 @@
+#include "kv_texture_compressor.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+
+#include "kv_thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KV_TEXTURE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace kong;
+
+namespace
+{
+    constexpr uint32_t BLOCK_PIXELS = 16;
+    // 固定index之后用最小二乘修正端点的次数
+    constexpr uint32_t REFINE_ITERATIONS = 2;
+    // BC7 4位index的插值权重，总和是64
+    constexpr int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    // 一个4x4块，按通道分开存放，SIMD一次处理4个像素
+    struct alignas(16) BlockPixels
+    {
+        float channels[4][BLOCK_PIXELS];
+    };
+
+    // 128位的块数据，按位从低到高读写
+    struct BlockBits
+    {
+        uint64_t words[2]{};
+        uint32_t position = 0;
+
+        void write(uint32_t value, uint32_t bits)
+        {
+            for (uint32_t i = 0; i < bits; i++, position++)
+            {
+                if (value >> i & 1)
+                {
+                    words[position >> 6] |= 1ull << (position & 63);
+                }
+            }
+        }
+
+        uint32_t read(uint32_t bits)
+        {
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < bits; i++, position++)
+            {
+                value |= static_cast<uint32_t>(words[position >> 6] >> (position & 63) & 1) << i;
+            }
+            return value;
+        }
+
+        void store(uint8_t* out) const
+        {
+            for (uint32_t i = 0; i < 16; i++)
+            {
+                out[i] = static_cast<uint8_t>(words[i / 8] >> (i % 8 * 8));
+            }
+        }
+
+        void load(const uint8_t* data)
+        {
+            words[0] = words[1] = 0;
+            for (uint32_t i = 0; i < 16; i++)
+            {
+                words[i / 8] |= static_cast<uint64_t>(data[i]) << (i % 8 * 8);
+            }
+            position = 0;
+        }
+    };
+
+    float clampColor(float value)
+    {
+        return std::clamp(value, 0.0f, 255.0f);
+    }
+
+    void loadBlock(const KongImageData& image, uint32_t blockX, uint32_t blockY, BlockPixels& block)
+    {
+        for (uint32_t y = 0; y < 4; y++)
+        {
+            // 图片边缘不足4个像素时重复最后一行/列
+            const uint32_t sourceY = std::min(blockY * 4 + y, image.height - 1);
+            for (uint32_t x = 0; x < 4; x++)
+            {
+                const uint32_t sourceX = std::min(blockX * 4 + x, image.width - 1);
+                const uint8_t* pixel = &image.pixels[(static_cast<size_t>(sourceY) * image.width + sourceX) * 4];
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    block.channels[c][y * 4 + x] = pixel[c];
+                }
+            }
+        }
+    }
+
+    /*
+     * 对块中的16个像素在palette中查找最近的一项，只比较前channelCount个通道
+     * 返回16个像素的平方误差之和
+     */
+    float findNearest(const BlockPixels& block, const float (*palette)[4], uint32_t paletteSize, uint32_t channelCount, uint8_t* indices)
+    {
+        float error = 0.0f;
+#ifdef KV_TEXTURE_SSE2
+        for (uint32_t group = 0; group < BLOCK_PIXELS; group += 4)
+        {
+            __m128 pixels[4]{};
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                pixels[c] = _mm_load_ps(&block.channels[c][group]);
+            }
+
+            __m128 bestError = _mm_set1_ps(std::numeric_limits<float>::max());
+            __m128i bestIndex = _mm_setzero_si128();
+            for (uint32_t i = 0; i < paletteSize; i++)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    const __m128 delta = _mm_sub_ps(pixels[c], _mm_set1_ps(palette[i][c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(delta, delta));
+                }
+                // SSE2没有blendv，用与/或选出更近的index
+                const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestError));
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(static_cast<int>(i))), _mm_andnot_si128(closer, bestIndex));
+                bestError = _mm_min_ps(distance, bestError);
+            }
+
+            alignas(16) int32_t groupIndices[4];
+            alignas(16) float groupErrors[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(groupIndices), bestIndex);
+            _mm_store_ps(groupErrors, bestError);
+            for (uint32_t j = 0; j < 4; j++)
+            {
+                indices[group + j] = static_cast<uint8_t>(groupIndices[j]);
+                error += groupErrors[j];
+            }
+        }
+#else
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            float bestError = std::numeric_limits<float>::max();
+            uint8_t bestIndex = 0;
+            for (uint32_t i = 0; i < paletteSize; i++)
+            {
+                float distance = 0.0f;
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    const float delta = block.channels[c][p] - palette[i][c];
+                    distance += delta * delta;
+                }
+                if (distance < bestError)
+                {
+                    bestError = distance;
+                    bestIndex = static_cast<uint8_t>(i);
+                }
+            }
+            indices[p] = bestIndex;
+            error += bestError;
+        }
+#endif
+        return error;
+    }
+
+    /*
+     * 沿块的主轴（协方差矩阵最大特征值对应的特征向量，幂迭代求解）取两个端点
+     * 端点向内收缩inset，减小两端的量化误差
+     */
+    void axisEndpoints(const BlockPixels& block, uint32_t channelCount, float inset, float e0[4], float e1[4])
+    {
+        float mean[4]{};
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+            {
+                mean[c] += block.channels[c][p];
+            }
+            mean[c] /= BLOCK_PIXELS;
+        }
+
+        float covariance[4][4]{};
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            for (uint32_t a = 0; a < channelCount; a++)
+            {
+                for (uint32_t b = 0; b < channelCount; b++)
+                {
+                    covariance[a][b] += (block.channels[a][p] - mean[a]) * (block.channels[b][p] - mean[b]);
+                }
+            }
+        }
+
+        // 从方差最大的通道所在的行开始迭代，不会和特征向量正交
+        uint32_t largest = 0;
+        for (uint32_t c = 1; c < channelCount; c++)
+        {
+            if (covariance[c][c] > covariance[largest][largest])
+            {
+                largest = c;
+            }
+        }
+        float axis[4]{};
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            axis[c] = covariance[largest][c];
+        }
+        for (uint32_t iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4]{};
+            float length = 0.0f;
+            for (uint32_t a = 0; a < channelCount; a++)
+            {
+                for (uint32_t b = 0; b < channelCount; b++)
+                {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            if (length < 1e-8f)
+            {
+                break;
+            }
+            length = 1.0f / std::sqrt(length);
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                axis[c] = next[c] * length;
+            }
+        }
+
+        float minT = 0.0f, maxT = 0.0f;
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            float t = 0.0f;
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                t += (block.channels[c][p] - mean[c]) * axis[c];
+            }
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        const float shrink = (maxT - minT) * inset;
+        minT += shrink;
+        maxT -= shrink;
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            e0[c] = clampColor(mean[c] + axis[c] * minT);
+            e1[c] = clampColor(mean[c] + axis[c] * maxT);
+        }
+    }
+
+    /*
+     * index固定时，每个像素 ≈ (1 - w) * e0 + w * e1，用最小二乘重新求e0和e1
+     * weights[index]是e1的权重，所有像素都用同一个index时无解，返回false
+     */
+    bool refineEndpoints(const BlockPixels& block, uint32_t channelCount, const uint8_t* indices, const float* weights, float e0[4], float e1[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[4]{}, bx[4]{};
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            const float b = weights[indices[p]];
+            const float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                ax[c] += a * block.channels[c][p];
+                bx[c] += b * block.channels[c][p];
+            }
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+        {
+            return false;
+        }
+        const float inverse = 1.0f / determinant;
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            e0[c] = clampColor((ax[c] * bb - bx[c] * ab) * inverse);
+            e1[c] = clampColor((bx[c] * aa - ax[c] * ab) * inverse);
+        }
+        return true;
+    }
+
+    // ---------------------------------------- BC1 ----------------------------------------
+
+    constexpr float BC1_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+    uint16_t packRgb565(const float color[4])
+    {
+        const auto r = static_cast<uint16_t>(std::lround(color[0] * 31.0f / 255.0f));
+        const auto g = static_cast<uint16_t>(std::lround(color[1] * 63.0f / 255.0f));
+        const auto b = static_cast<uint16_t>(std::lround(color[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>(r << 11 | g << 5 | b);
+    }
+
+    void unpackRgb565(uint16_t packed, float color[4])
+    {
+        const uint32_t r = packed >> 11 & 31;
+        const uint32_t g = packed >> 5 & 63;
+        const uint32_t b = packed & 31;
+        color[0] = static_cast<float>(r << 3 | r >> 2);
+        color[1] = static_cast<float>(g << 2 | g >> 4);
+        color[2] = static_cast<float>(b << 3 | b >> 2);
+        color[3] = 255.0f;
+    }
+
+    // 4色模式的调色板：c0, c1, 2/3*c0 + 1/3*c1, 1/3*c0 + 2/3*c1
+    void bc1Palette(uint16_t c0, uint16_t c1, float palette[4][4])
+    {
+        unpackRgb565(c0, palette[0]);
+        unpackRgb565(c1, palette[1]);
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+    }
+
+    // BC1以及BC3的颜色部分，总是使用4色模式
+    void encodeColorBlock(const BlockPixels& block, uint8_t* out)
+    {
+        float e0[4]{}, e1[4]{};
+        axisEndpoints(block, 3, 1.0f / 16.0f, e0, e1);
+
+        uint16_t c0 = packRgb565(e0);
+        uint16_t c1 = packRgb565(e1);
+        float palette[4][4];
+        uint8_t indices[BLOCK_PIXELS];
+        bc1Palette(c0, c1, palette);
+        float error = findNearest(block, palette, 4, 3, indices);
+
+        for (uint32_t iteration = 0; iteration < REFINE_ITERATIONS; iteration++)
+        {
+            if (!refineEndpoints(block, 3, indices, BC1_WEIGHTS, e0, e1))
+            {
+                break;
+            }
+            const uint16_t refinedC0 = packRgb565(e0);
+            const uint16_t refinedC1 = packRgb565(e1);
+            uint8_t refinedIndices[BLOCK_PIXELS];
+            bc1Palette(refinedC0, refinedC1, palette);
+            const float refinedError = findNearest(block, palette, 4, 3, refinedIndices);
+            if (refinedError >= error)
+            {
+                break;
+            }
+            c0 = refinedC0;
+            c1 = refinedC1;
+            error = refinedError;
+            std::memcpy(indices, refinedIndices, sizeof(indices));
+        }
+
+        // c0 > c1才是4色模式，交换端点时index 0<->1、2<->3
+        if (c0 < c1)
+        {
+            std::swap(c0, c1);
+            for (auto& index : indices)
+            {
+                index ^= 1;
+            }
+        }
+        else if (c0 == c1)
+        {
+            std::memset(indices, 0, sizeof(indices));
+        }
+
+        uint32_t bits = 0;
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            bits |= static_cast<uint32_t>(indices[p]) << (p * 2);
+        }
+        out[0] = static_cast<uint8_t>(c0);
+        out[1] = static_cast<uint8_t>(c0 >> 8);
+        out[2] = static_cast<uint8_t>(c1);
+        out[3] = static_cast<uint8_t>(c1 >> 8);
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            out[4 + i] = static_cast<uint8_t>(bits >> (i * 8));
+        }
+    }
+
+    void decodeColorBlock(const uint8_t* data, bool forceFourColor, uint8_t pixels[BLOCK_PIXELS][4])
+    {
+        const uint16_t c0 = static_cast<uint16_t>(data[0] | data[1] << 8);
+        const uint16_t c1 = static_cast<uint16_t>(data[2] | data[3] << 8);
+        float palette[4][4];
+        bc1Palette(c0, c1, palette);
+        if (c0 <= c1 && !forceFourColor)
+        {
+            // 3色模式：第三项是中点，第四项是透明黑
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) * 0.5f;
+                palette[3][c] = 0.0f;
+            }
+            palette[3][3] = 0.0f;
+        }
+
+        const uint32_t bits = data[4] | data[5] << 8 | data[6] << 16 | static_cast<uint32_t>(data[7]) << 24;
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            const float* color = palette[bits >> (p * 2) & 3];
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                pixels[p][c] = static_cast<uint8_t>(std::lround(color[c]));
+            }
+        }
+    }
+
+    // ---------------------------------------- BC4 ----------------------------------------
+
+    constexpr float BC4_WEIGHTS[8] = {0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f};
+
+    // 8值模式（e0 > e1）的调色板：e0, e1, 再加6个插值
+    void bc4Palette(uint8_t e0, uint8_t e1, float palette[8][4])
+    {
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            palette[i][0] = (1.0f - BC4_WEIGHTS[i]) * e0 + BC4_WEIGHTS[i] * e1;
+        }
+    }
+
+    void encodeAlphaBlock(const BlockPixels& block, uint32_t channel, uint8_t* out)
+    {
+        // 只压缩一个通道，放到第0个通道上复用findNearest
+        BlockPixels single;
+        std::memcpy(single.channels[0], block.channels[channel], sizeof(single.channels[0]));
+
+        float low = 255.0f, high = 0.0f;
+        for (float value : single.channels[0])
+        {
+            low = std::min(low, value);
+            high = std::max(high, value);
+        }
+        auto e0 = static_cast<uint8_t>(std::lround(high));
+        auto e1 = static_cast<uint8_t>(std::lround(low));
+        uint8_t indices[BLOCK_PIXELS]{};
+
+        if (e0 != e1)
+        {
+            float palette[8][4];
+            bc4Palette(e0, e1, palette);
+            float error = findNearest(single, palette, 8, 1, indices);
+
+            for (uint32_t iteration = 0; iteration < REFINE_ITERATIONS; iteration++)
+            {
+                float refined0[4]{}, refined1[4]{};
+                if (!refineEndpoints(single, 1, indices, BC4_WEIGHTS, refined0, refined1))
+                {
+                    break;
+                }
+                const auto refinedE0 = static_cast<uint8_t>(std::lround(std::max(refined0[0], refined1[0])));
+                const auto refinedE1 = static_cast<uint8_t>(std::lround(std::min(refined0[0], refined1[0])));
+                if (refinedE0 == refinedE1)
+                {
+                    break;
+                }
+                uint8_t refinedIndices[BLOCK_PIXELS];
+                bc4Palette(refinedE0, refinedE1, palette);
+                const float refinedError = findNearest(single, palette, 8, 1, refinedIndices);
+                if (refinedError >= error)
+                {
+                    break;
+                }
+                e0 = refinedE0;
+                e1 = refinedE1;
+                error = refinedError;
+                std::memcpy(indices, refinedIndices, sizeof(indices));
+            }
+        }
+
+        uint64_t bits = 0;
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            bits |= static_cast<uint64_t>(indices[p]) << (p * 3);
+        }
+        out[0] = e0;
+        out[1] = e1;
+        for (uint32_t i = 0; i < 6; i++)
+        {
+            out[2 + i] = static_cast<uint8_t>(bits >> (i * 8));
+        }
+    }
+
+    void decodeAlphaBlock(const uint8_t* data, uint32_t channel, uint8_t pixels[BLOCK_PIXELS][4])
+    {
+        const uint32_t e0 = data[0];
+        const uint32_t e1 = data[1];
+        uint32_t palette[8] = {e0, e1};
+        if (e0 > e1)
+        {
+            for (uint32_t i = 1; i < 7; i++)
+            {
+                palette[i + 1] = ((7 - i) * e0 + i * e1 + 3) / 7;
+            }
+        }
+        else
+        {
+            // 6值模式，最后两项固定是0和255
+            for (uint32_t i = 1; i < 5; i++)
+            {
+                palette[i + 1] = ((5 - i) * e0 + i * e1 + 2) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        uint64_t bits = 0;
+        for (uint32_t i = 0; i < 6; i++)
+        {
+            bits |= static_cast<uint64_t>(data[2 + i]) << (i * 8);
+        }
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            pixels[p][channel] = static_cast<uint8_t>(palette[bits >> (p * 3) & 7]);
+        }
+    }
+
+    // ---------------------------------------- BC7 ----------------------------------------
+
+    // mode 6的端点：每个通道7位，p-bit作为最低位由四个通道共用
+    struct Bc7Endpoint
+    {
+        uint8_t color[4]{};
+        uint8_t pbit = 0;
+
+        float expanded(uint32_t channel) const { return static_cast<float>(color[channel] << 1 | pbit); }
+    };
+
+    Bc7Endpoint quantizeBc7Endpoint(const float value[4])
+    {
+        Bc7Endpoint best{};
+        float bestError = std::numeric_limits<float>::max();
+        for (uint8_t pbit = 0; pbit < 2; pbit++)
+        {
+            Bc7Endpoint endpoint{};
+            endpoint.pbit = pbit;
+            float error = 0.0f;
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                endpoint.color[c] = static_cast<uint8_t>(std::clamp(std::lround((value[c] - pbit) * 0.5f), 0l, 127l));
+                const float delta = endpoint.expanded(c) - value[c];
+                error += delta * delta;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                best = endpoint;
+            }
+        }
+        return best;
+    }
+
+    void bc7Palette(const Bc7Endpoint& e0, const Bc7Endpoint& e1, float palette[16][4])
+    {
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                const int a = static_cast<int>(e0.expanded(c));
+                const int b = static_cast<int>(e1.expanded(c));
+                palette[i][c] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * a + BC7_WEIGHTS[i] * b + 32) >> 6);
+            }
+        }
+    }
+
+    void encodeBc7Block(const BlockPixels& block, uint8_t* out)
+    {
+        float e0[4]{}, e1[4]{};
+        axisEndpoints(block, 4, 1.0f / 32.0f, e0, e1);
+
+        Bc7Endpoint endpoint0 = quantizeBc7Endpoint(e0);
+        Bc7Endpoint endpoint1 = quantizeBc7Endpoint(e1);
+        float palette[16][4];
+        uint8_t indices[BLOCK_PIXELS];
+        bc7Palette(endpoint0, endpoint1, palette);
+        float error = findNearest(block, palette, 16, 4, indices);
+
+        float weights[16];
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            weights[i] = BC7_WEIGHTS[i] / 64.0f;
+        }
+        for (uint32_t iteration = 0; iteration < REFINE_ITERATIONS; iteration++)
+        {
+            if (!refineEndpoints(block, 4, indices, weights, e0, e1))
+            {
+                break;
+            }
+            const Bc7Endpoint refined0 = quantizeBc7Endpoint(e0);
+            const Bc7Endpoint refined1 = quantizeBc7Endpoint(e1);
+            uint8_t refinedIndices[BLOCK_PIXELS];
+            bc7Palette(refined0, refined1, palette);
+            const float refinedError = findNearest(block, palette, 16, 4, refinedIndices);
+            if (refinedError >= error)
+            {
+                break;
+            }
+            endpoint0 = refined0;
+            endpoint1 = refined1;
+            error = refinedError;
+            std::memcpy(indices, refinedIndices, sizeof(indices));
+        }
+
+        // 第一个像素是anchor，index最高位省略为0，不满足时交换端点
+        if (indices[0] >= 8)
+        {
+            std::swap(endpoint0, endpoint1);
+            for (auto& index : indices)
+            {
+                index = static_cast<uint8_t>(15 - index);
+            }
+        }
+
+        BlockBits bits;
+        bits.write(1 << 6, 7);
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            bits.write(endpoint0.color[c], 7);
+            bits.write(endpoint1.color[c], 7);
+        }
+        bits.write(endpoint0.pbit, 1);
+        bits.write(endpoint1.pbit, 1);
+        bits.write(indices[0], 3);
+        for (uint32_t p = 1; p < BLOCK_PIXELS; p++)
+        {
+            bits.write(indices[p], 4);
+        }
+        bits.store(out);
+    }
+
+    void decodeBc7Block(const uint8_t* data, uint8_t pixels[BLOCK_PIXELS][4])
+    {
+        BlockBits bits;
+        bits.load(data);
+        if (bits.read(7) != 1 << 6)
+        {
+            // encode只输出mode 6，其他mode用品红标出来
+            for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+            {
+                pixels[p][0] = 255;
+                pixels[p][1] = 0;
+                pixels[p][2] = 255;
+                pixels[p][3] = 255;
+            }
+            return;
+        }
+
+        Bc7Endpoint e0{}, e1{};
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            e0.color[c] = static_cast<uint8_t>(bits.read(7));
+            e1.color[c] = static_cast<uint8_t>(bits.read(7));
+        }
+        e0.pbit = static_cast<uint8_t>(bits.read(1));
+        e1.pbit = static_cast<uint8_t>(bits.read(1));
+        float palette[16][4];
+        bc7Palette(e0, e1, palette);
+        for (uint32_t p = 0; p < BLOCK_PIXELS; p++)
+        {
+            const float* color = palette[bits.read(p == 0 ? 3 : 4)];
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                pixels[p][c] = static_cast<uint8_t>(color[c]);
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------------------------------
+
+    using BlockEncoder = void (*)(const BlockPixels&, uint8_t*);
+
+    BlockEncoder blockEncoder(KongTextureFormat format)
+    {
+        switch (format)
+        {
+        case KongTextureFormat::BC1:
+            return encodeColorBlock;
+        case KongTextureFormat::BC3:
+            return [](const BlockPixels& block, uint8_t* out)
+            {
+                encodeAlphaBlock(block, 3, out);
+                encodeColorBlock(block, out + 8);
+            };
+        case KongTextureFormat::BC4:
+            return [](const BlockPixels& block, uint8_t* out) { encodeAlphaBlock(block, 0, out); };
+        case KongTextureFormat::BC5:
+            return [](const BlockPixels& block, uint8_t* out)
+            {
+                encodeAlphaBlock(block, 0, out);
+                encodeAlphaBlock(block, 1, out + 8);
+            };
+        case KongTextureFormat::BC7:
+            return encodeBc7Block;
+        default:
+            return nullptr;
+        }
+    }
+
+    bool hasTransparentPixels(const KongImageData& image)
+    {
+        for (size_t i = 3; i < image.pixels.size(); i += 4)
+        {
+            if (image.pixels[i] != 255)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+const char* KongTextureFormats::name(KongTextureFormat format)
+{
+    static const char* names[] = {"RGBA8", "BC1", "BC3", "BC4", "BC5", "BC7"};
+    return format < KongTextureFormat::Count ? names[static_cast<uint32_t>(format)] : "unknown";
+}
+
+bool KongTextureFormats::fromName(const std::string& name, KongTextureFormat& format)
+{
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    for (uint32_t i = 0; i < static_cast<uint32_t>(KongTextureFormat::Count); i++)
+    {
+        if (upper == KongTextureFormats::name(static_cast<KongTextureFormat>(i)))
+        {
+            format = static_cast<KongTextureFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t KongTextureFormats::blockBytes(KongTextureFormat format)
+{
+    switch (format)
+    {
+    case KongTextureFormat::BC1:
+    case KongTextureFormat::BC4:
+        return 8;
+    case KongTextureFormat::BC3:
+    case KongTextureFormat::BC5:
+    case KongTextureFormat::BC7:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+uint64_t KongTextureFormats::imageBytes(KongTextureFormat format, uint32_t width, uint32_t height)
+{
+    if (!isBlockCompressed(format))
+    {
+        return static_cast<uint64_t>(width) * height * 4;
+    }
+    return static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+uint32_t KongTextureFormats::channelCount(KongTextureFormat format)
+{
+    switch (format)
+    {
+    case KongTextureFormat::BC1:
+        return 3;
+    case KongTextureFormat::BC4:
+        return 1;
+    case KongTextureFormat::BC5:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+uint32_t KongTextureFormats::mipCount(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+uint64_t KongCompressedTexture::sizeBytes() const
+{
+    uint64_t size = 0;
+    for (const auto& mip : mips)
+    {
+        size += mip.size();
+    }
+    return size;
+}
+
+KongTextureEncodeSettings KongTextureCompressor::settingsForFile(const std::string& filepath, const KongImageData& image,
+    KongTextureFormat albedoFormat)
+{
+    std::string name = std::filesystem::path(filepath).stem().string();
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    auto contains = [&](const char* token) { return name.find(token) != std::string::npos; };
+
+    KongTextureEncodeSettings settings{};
+    if (contains("_ddn") || contains("tangent") || contains("normal"))
+    {
+        // 切线空间法线的z总是正的，运行时由xy重建
+        settings.format = KongTextureFormat::BC5;
+        settings.srgb = false;
+        settings.normalMap = true;
+    }
+    else if (contains("_nm"))
+    {
+        // 物体空间法线（diablo3_pose_nm）的z有正有负，必须保留三个通道
+        settings.format = KongTextureFormat::BC7;
+        settings.srgb = false;
+        settings.normalMap = true;
+    }
+    else if (contains("spec"))
+    {
+        settings.format = KongTextureFormat::BC4;
+        settings.srgb = false;
+    }
+    else
+    {
+        settings.format = albedoFormat;
+        if (albedoFormat == KongTextureFormat::BC1 && hasTransparentPixels(image))
+        {
+            settings.format = KongTextureFormat::BC3;
+        }
+    }
+    return settings;
+}
+
+std::vector<KongImageData> KongTextureCompressor::buildMipChain(const KongImageData& image, bool srgb, bool normalMap)
+{
+    static const std::array<float, 256> srgbToLinear = []()
+    {
+        std::array<float, 256> table{};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            const float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+    auto linearToSrgb = [](float c)
+    {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return static_cast<uint8_t>(std::lround(std::clamp(c, 0.0f, 1.0f) * 255.0f));
+    };
+
+    std::vector<KongImageData> chain;
+    const uint32_t mipCount = KongTextureFormats::mipCount(image.width, image.height);
+    chain.reserve(mipCount);
+    chain.push_back(image);
+    for (uint32_t mip = 1; mip < mipCount; mip++)
+    {
+        const KongImageData& source = chain.back();
+        KongImageData target;
+        target.width = std::max(source.width / 2, 1u);
+        target.height = std::max(source.height / 2, 1u);
+        target.pixels.resize(static_cast<size_t>(target.width) * target.height * 4);
+
+        for (uint32_t y = 0; y < target.height; y++)
+        {
+            const uint32_t y0 = std::min(y * 2, source.height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, source.height - 1);
+            for (uint32_t x = 0; x < target.width; x++)
+            {
+                const uint32_t x0 = std::min(x * 2, source.width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, source.width - 1);
+                const uint8_t* samples[4] = {
+                    &source.pixels[(static_cast<size_t>(y0) * source.width + x0) * 4],
+                    &source.pixels[(static_cast<size_t>(y0) * source.width + x1) * 4],
+                    &source.pixels[(static_cast<size_t>(y1) * source.width + x0) * 4],
+                    &source.pixels[(static_cast<size_t>(y1) * source.width + x1) * 4]
+                };
+                uint8_t* pixel = &target.pixels[(static_cast<size_t>(y) * target.width + x) * 4];
+
+                if (normalMap)
+                {
+                    // 法线平均之后长度会变短，重新归一化
+                    float normal[3]{};
+                    for (const uint8_t* sample : samples)
+                    {
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                            normal[c] += sample[c] / 127.5f - 1.0f;
+                        }
+                    }
+                    float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                    if (length < 1e-6f)
+                    {
+                        normal[0] = normal[1] = 0.0f;
+                        normal[2] = length = 1.0f;
+                    }
+                    for (uint32_t c = 0; c < 3; c++)
+                    {
+                        pixel[c] = static_cast<uint8_t>(std::lround(std::clamp((normal[c] / length + 1.0f) * 127.5f, 0.0f, 255.0f)));
+                    }
+                }
+                else
+                {
+                    for (uint32_t c = 0; c < 3; c++)
+                    {
+                        if (srgb)
+                        {
+                            // 颜色在线性空间中平均，否则缩小后会偏暗
+                            float sum = 0.0f;
+                            for (const uint8_t* sample : samples)
+                            {
+                                sum += srgbToLinear[sample[c]];
+                            }
+                            pixel[c] = linearToSrgb(sum * 0.25f);
+                        }
+                        else
+                        {
+                            pixel[c] = static_cast<uint8_t>((samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c] + 2) / 4);
+                        }
+                    }
+                }
+                pixel[3] = static_cast<uint8_t>((samples[0][3] + samples[1][3] + samples[2][3] + samples[3][3] + 2) / 4);
+            }
+        }
+        chain.push_back(std::move(target));
+    }
+    return chain;
+}
+
+std::vector<uint8_t> KongTextureCompressor::encode(const KongImageData& image, KongTextureFormat format, uint32_t taskCount)
+{
+    BlockEncoder encoder = blockEncoder(format);
+    if (!encoder)
+    {
+        return image.pixels;
+    }
+
+    const uint32_t blocksX = (image.width + 3) / 4;
+    const uint32_t blocksY = (image.height + 3) / 4;
+    const uint32_t blockBytes = KongTextureFormats::blockBytes(format);
+    std::vector<uint8_t> output(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+
+    // 块之间没有依赖，每个任务处理连续的若干块行
+    KongThreadPool& threadPool = KongThreadPool::global();
+    threadPool.parallelFor(blocksY, taskCount == 0 ? threadPool.threadCount() : taskCount, [&](size_t begin, size_t end)
+    {
+        BlockPixels block;
+        for (size_t blockY = begin; blockY < end; blockY++)
+        {
+            uint8_t* row = &output[blockY * blocksX * blockBytes];
+            for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+            {
+                loadBlock(image, blockX, static_cast<uint32_t>(blockY), block);
+                encoder(block, row + static_cast<size_t>(blockX) * blockBytes);
+            }
+        }
+    });
+    return output;
+}
+
+KongImageData KongTextureCompressor::decode(const uint8_t* data, KongTextureFormat format, uint32_t width, uint32_t height)
+{
+    KongImageData image;
+    image.width = width;
+    image.height = height;
+    if (!KongTextureFormats::isBlockCompressed(format))
+    {
+        image.pixels.assign(data, data + static_cast<size_t>(width) * height * 4);
+        return image;
+    }
+
+    image.pixels.resize(static_cast<size_t>(width) * height * 4);
+    const uint32_t blocksX = (width + 3) / 4;
+    const uint32_t blocksY = (height + 3) / 4;
+    const uint32_t blockBytes = KongTextureFormats::blockBytes(format);
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++)
+    {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+        {
+            const uint8_t* block = data + (static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes;
+            uint8_t pixels[BLOCK_PIXELS][4]{};
+            for (auto& pixel : pixels)
+            {
+                pixel[3] = 255;
+            }
+
+            switch (format)
+            {
+            case KongTextureFormat::BC1:
+                decodeColorBlock(block, false, pixels);
+                break;
+            case KongTextureFormat::BC3:
+                decodeColorBlock(block + 8, true, pixels);
+                decodeAlphaBlock(block, 3, pixels);
+                break;
+            case KongTextureFormat::BC4:
+                decodeAlphaBlock(block, 0, pixels);
+                break;
+            case KongTextureFormat::BC5:
+                decodeAlphaBlock(block, 0, pixels);
+                decodeAlphaBlock(block + 8, 1, pixels);
+                break;
+            default:
+                decodeBc7Block(block, pixels);
+                break;
+            }
+
+            for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; y++)
+            {
+                for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; x++)
+                {
+                    const size_t offset = (static_cast<size_t>(blockY * 4 + y) * width + blockX * 4 + x) * 4;
+                    std::memcpy(&image.pixels[offset], pixels[y * 4 + x], 4);
+                }
+            }
+        }
+    }
+    return image;
+}
+
+KongCompressedTexture KongTextureCompressor::compress(const KongImageData& image, const KongTextureEncodeSettings& settings, uint32_t taskCount)
+{
+    KongCompressedTexture texture{};
+    texture.format = settings.format;
+    texture.srgb = settings.srgb;
+    texture.width = image.width;
+    texture.height = image.height;
+    if (!settings.generateMips)
+    {
+        texture.mips.push_back(encode(image, settings.format, taskCount));
+        return texture;
+    }
+
+    for (const auto& mip : buildMipChain(image, settings.srgb, settings.normalMap))
+    {
+        texture.mips.push_back(encode(mip, settings.format, taskCount));
+    }
+    return texture;
+}
+
+double KongTextureCompressor::psnr(const KongImageData& reference, const KongImageData& image, uint32_t channelCount)
+{
+    if (reference.width != image.width || reference.height != image.height || reference.pixels.size() != image.pixels.size())
+    {
+        return 0.0;
+    }
+
+    double squaredError = 0.0;
+    for (size_t i = 0; i < reference.pixels.size(); i += 4)
+    {
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            const double delta = static_cast<double>(reference.pixels[i + c]) - image.pixels[i + c];
+            squaredError += delta * delta;
+        }
+    }
+    const double meanSquaredError = squaredError / (static_cast<double>(reference.pixels.size() / 4) * channelCount);
+    if (meanSquaredError <= 0.0)
+    {
+        return 99.0;
+    }
+    return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kv_texture.h"
+
+namespace kong
+{
+    enum class KongTextureFormat : uint32_t
+    {
+        RGBA8,
+        BC1,    // RGB，4bpp，不透明的颜色贴图
+        BC3,    // BC1颜色 + BC4 alpha，8bpp
+        BC4,    // 单通道，4bpp，高光之类的灰度贴图
+        BC5,    // 双通道，8bpp，切线空间法线只保存xy
+        BC7,    // RGBA，8bpp，颜色贴图的质量比BC1/BC3好
+        Count
+    };
+
+    struct KongTextureFormats
+    {
+        static const char* name(KongTextureFormat format);
+        static bool fromName(const std::string& name, KongTextureFormat& format);
+        static bool isBlockCompressed(KongTextureFormat format) { return format != KongTextureFormat::RGBA8; }
+        // 每个4x4块的字节数，RGBA8返回0
+        static uint32_t blockBytes(KongTextureFormat format);
+        // 一级mip的字节数，BC格式的宽高按4向上取整
+        static uint64_t imageBytes(KongTextureFormat format, uint32_t width, uint32_t height);
+        // 格式实际保存的通道数，计算PSNR时只比较这几个通道
+        static uint32_t channelCount(KongTextureFormat format);
+        static uint32_t mipCount(uint32_t width, uint32_t height);
+    };
+
+    // 压缩参数，颜色贴图在srgb空间压缩、在线性空间生成mip，法线贴图生成mip后重新归一化
+    struct KongTextureEncodeSettings
+    {
+        KongTextureFormat format = KongTextureFormat::BC7;
+        bool srgb = true;
+        bool normalMap = false;
+        bool generateMips = true;
+    };
+
+    struct KongCompressedTexture
+    {
+        KongTextureFormat format = KongTextureFormat::RGBA8;
+        bool srgb = false;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // mips[0]是原始大小
+        std::vector<std::vector<uint8_t>> mips{};
+
+        uint64_t sizeBytes() const;
+    };
+
+    /*
+     * BC1/BC3/BC4/BC5/BC7的CPU编码器，离线处理贴图时使用
+     * 每个4x4块求主轴确定端点，用SSE2一次处理4个像素查找最近的调色板颜色，再做一次最小二乘修正端点
+     * BC7只使用mode 6（单个subset、RGBA 7.7.7.7 + p-bit、4位index），速度和BC1同一量级
+     * 一张图按块行拆分到线程池中并行压缩
+     */
+    class KongTextureCompressor
+    {
+    public:
+        // 按文件名选择格式：_nm/_ddn/normal用BC5，spec用BC4，其余按颜色贴图处理
+        // 颜色贴图默认用albedoFormat，albedoFormat是BC1且图片带alpha时改用BC3
+        static KongTextureEncodeSettings settingsForFile(const std::string& filepath, const KongImageData& image,
+            KongTextureFormat albedoFormat = KongTextureFormat::BC7);
+
+        // 包括原图在内的完整mip链，每级宽高减半直到1x1
+        static std::vector<KongImageData> buildMipChain(const KongImageData& image, bool srgb, bool normalMap);
+        // 压缩一级图片，taskCount为0时按全局线程池的线程数拆分
+        static std::vector<uint8_t> encode(const KongImageData& image, KongTextureFormat format, uint32_t taskCount = 0);
+        // 解压回RGBA8，用于计算PSNR；BC7只支持encode输出的mode 6，BC4/BC5没有的通道填0
+        static KongImageData decode(const uint8_t* data, KongTextureFormat format, uint32_t width, uint32_t height);
+        static KongCompressedTexture compress(const KongImageData& image, const KongTextureEncodeSettings& settings, uint32_t taskCount = 0);
+
+        // 只比较前channelCount个通道，两张图完全一样时返回99
+        static double psnr(const KongImageData& reference, const KongImageData& image, uint32_t channelCount);
+    };
+}
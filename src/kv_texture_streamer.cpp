@@ -0,0 +1,248 @@
+#include "kv_texture_streamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+using namespace kong;
+
+void KongStreamedTexture::requestScreenSize(float screenPixels)
+{
+    // 贴图大致覆盖整个物体一次，屏幕上的一个像素对应一个texel时不需要更精细的mip
+    const auto& header = m_cache.header();
+    const float size = static_cast<float>(std::max(header.width, header.height));
+    uint32_t mip = 0;
+    if (screenPixels > 0.0f && screenPixels < size)
+    {
+        mip = static_cast<uint32_t>(std::floor(std::log2(size / screenPixels)));
+    }
+    m_requestedMip = std::min({m_requestedMip, mip, header.mipCount - 1});
+}
+
+uint64_t KongStreamedTexture::bytesFrom(uint32_t mip) const
+{
+    uint64_t size = 0;
+    for (uint32_t level = mip; level < mipCount(); level++)
+    {
+        size += m_cache.mipSize(level);
+    }
+    return size;
+}
+
+KongTextureStreamer::KongTextureStreamer(KongDevice& device, KongSamplerCache& samplerCache,
+    const KongTextureStreamerSettings& settings, KongThreadPool& threadPool)
+    : m_device(device), m_samplerCache(samplerCache), m_threadPool(threadPool), m_settings(settings)
+{
+}
+
+KongTextureStreamer::~KongTextureStreamer()
+{
+    for (auto& texture : m_textures)
+    {
+        if (texture->m_upload.valid())
+        {
+            texture->m_upload.wait();
+        }
+    }
+}
+
+std::shared_ptr<KongStreamedTexture> KongTextureStreamer::load(const std::string& filepath, const KongTextureSettings& settings)
+{
+    auto texture = std::make_shared<KongStreamedTexture>();
+    texture->m_filepath = filepath;
+    texture->m_settings = settings;
+    if (!texture->m_cache.open(KongTextureCache::cachePathFor(filepath), filepath) || !KongTexture::isSupported(m_device, texture->m_cache))
+    {
+        return nullptr;
+    }
+
+    // 初始只上传尾部的几级小mip，之后按屏幕上的大小逐步升级
+    const auto& header = texture->m_cache.header();
+    uint32_t initialMip = 0;
+    while (initialMip + 1 < header.mipCount
+        && std::max(header.width >> initialMip, header.height >> initialMip) > m_settings.initialMaxSize)
+    {
+        initialMip++;
+    }
+    texture->m_initialMip = initialMip;
+    texture->m_residentMip = header.mipCount;
+    startUpload(*texture, initialMip);
+
+    m_textures.push_back(texture);
+    return texture;
+}
+
+void KongTextureStreamer::startUpload(KongStreamedTexture& texture, uint32_t mip)
+{
+    texture.m_uploadMip = mip;
+    KongStreamedTexture* target = &texture;
+    texture.m_upload = m_threadPool.submit([this, target, mip]()
+    {
+        return std::make_unique<KongTexture>(m_device, m_samplerCache, target->m_cache, target->m_settings, mip);
+    });
+}
+
+bool KongTextureStreamer::finishUpload(KongStreamedTexture& texture)
+{
+    if (!texture.m_upload.valid() || texture.m_upload.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return false;
+    }
+
+    try
+    {
+        // 旧的贴图可能还被正在执行的帧引用，由渲染系统的descriptor set缓存负责延后释放
+        texture.m_current = texture.m_upload.get();
+        texture.m_residentMip = texture.m_uploadMip;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "failed to stream " << texture.m_filepath << " from mip " << texture.m_uploadMip << ": " << e.what() << std::endl;
+    }
+    return true;
+}
+
+void KongTextureStreamer::update()
+{
+    m_frameNumber++;
+    // 只剩streamer持有并且没有在上传的贴图不会再被用到
+    m_textures.erase(std::remove_if(m_textures.begin(), m_textures.end(), [](const std::shared_ptr<KongStreamedTexture>& texture)
+    {
+        return texture.use_count() == 1 && !texture->m_upload.valid();
+    }), m_textures.end());
+
+    struct Change
+    {
+        KongStreamedTexture* texture;
+        uint32_t mip;
+    };
+    std::vector<Change> upgrades;
+    std::vector<Change> downgrades;
+
+    m_stats = {};
+    m_stats.textureCount = static_cast<uint32_t>(m_textures.size());
+    // 按上传完成之后的大小估算显存，降级释放的显存要等渲染系统放掉旧贴图才真正回收，预算会短暂超出几帧
+    int64_t projectedBytes = 0;
+    uint32_t pendingUploads = 0;
+    for (auto& pointer : m_textures)
+    {
+        KongStreamedTexture& texture = *pointer;
+        finishUpload(texture);
+
+        const uint32_t requestedMip = texture.m_requestedMip;
+        texture.m_requestedMip = UINT32_MAX;
+        if (requestedMip != UINT32_MAX)
+        {
+            texture.m_lastRequestFrame = m_frameNumber;
+        }
+
+        const bool resident = texture.m_current != nullptr;
+        if (resident)
+        {
+            m_stats.residentBytes += texture.bytesFrom(texture.m_residentMip);
+            projectedBytes += static_cast<int64_t>(texture.bytesFrom(texture.m_residentMip));
+        }
+        if (texture.m_upload.valid())
+        {
+            pendingUploads++;
+            projectedBytes += static_cast<int64_t>(texture.bytesFrom(texture.m_uploadMip))
+                - (resident ? static_cast<int64_t>(texture.bytesFrom(texture.m_residentMip)) : 0);
+            continue;
+        }
+        if (!resident)
+        {
+            // 初始上传失败
+            continue;
+        }
+
+        if (requestedMip < texture.m_residentMip)
+        {
+            m_stats.mipMisses++;
+        }
+        // 没有被请求的贴图保持现状，长时间没有被请求时退回初始精度
+        uint32_t wantedMip = requestedMip;
+        if (wantedMip == UINT32_MAX)
+        {
+            wantedMip = m_frameNumber - texture.m_lastRequestFrame > m_settings.idleFrames ? texture.m_initialMip : texture.m_residentMip;
+        }
+        wantedMip = std::min(wantedMip, texture.m_initialMip);
+
+        if (wantedMip < texture.m_residentMip)
+        {
+            upgrades.push_back({&texture, wantedMip});
+        }
+        else if (wantedMip > texture.m_residentMip)
+        {
+            downgrades.push_back({&texture, wantedMip});
+        }
+    }
+
+    // 先淘汰最久没有被请求的，同样久的先淘汰省得多的
+    std::sort(downgrades.begin(), downgrades.end(), [](const Change& a, const Change& b)
+    {
+        if (a.texture->m_lastRequestFrame != b.texture->m_lastRequestFrame)
+        {
+            return a.texture->m_lastRequestFrame < b.texture->m_lastRequestFrame;
+        }
+        return a.texture->bytesFrom(a.texture->m_residentMip) - a.texture->bytesFrom(a.mip)
+            > b.texture->bytesFrom(b.texture->m_residentMip) - b.texture->bytesFrom(b.mip);
+    });
+    size_t nextDowngrade = 0;
+    // 显存预算（包括其他进程和驱动）不够时，即使没有超过设置的预算也不再升级，已经驻留和正在上传的部分已经计在使用量中
+    const auto deviceBudget = projectedBytes + static_cast<int64_t>(m_device.allocator().availableBytes(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+    const auto budget = std::min(static_cast<int64_t>(m_settings.budgetBytes), deviceBudget);
+    auto evict = [&]()
+    {
+        if (nextDowngrade >= downgrades.size())
+        {
+            return false;
+        }
+        const Change& change = downgrades[nextDowngrade++];
+        projectedBytes -= static_cast<int64_t>(change.texture->bytesFrom(change.texture->m_residentMip) - change.texture->bytesFrom(change.mip));
+        startUpload(*change.texture, change.mip);
+        pendingUploads++;
+        m_stats.evictions++;
+        return true;
+    };
+
+    // 差得越多的越先升级
+    std::sort(upgrades.begin(), upgrades.end(), [](const Change& a, const Change& b)
+    {
+        return a.texture->m_residentMip - a.mip > b.texture->m_residentMip - b.mip;
+    });
+    for (const Change& change : upgrades)
+    {
+        if (pendingUploads >= m_settings.maxPendingUploads)
+        {
+            break;
+        }
+
+        KongStreamedTexture& texture = *change.texture;
+        const auto residentBytes = static_cast<int64_t>(texture.bytesFrom(texture.m_residentMip));
+        auto extraBytes = [&](uint32_t mip) { return static_cast<int64_t>(texture.bytesFrom(mip)) - residentBytes; };
+        while (projectedBytes + extraBytes(change.mip) > budget && evict())
+        {
+        }
+
+        // 预算不够时退而求其次，升级到放得下的最精细的一级
+        uint32_t mip = change.mip;
+        while (mip < texture.m_residentMip && projectedBytes + extraBytes(mip) > budget)
+        {
+            mip++;
+        }
+        if (mip < texture.m_residentMip)
+        {
+            projectedBytes += extraBytes(mip);
+            startUpload(texture, mip);
+            pendingUploads++;
+        }
+    }
+
+    // 预算被调小之后继续淘汰，直到放得下
+    while (projectedBytes > budget && evict())
+    {
+    }
+    m_stats.pendingRequests = pendingUploads;
+}
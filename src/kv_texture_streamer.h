@@ -0,0 +1,116 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kv_texture.h"
+#include "kv_texture_cache.h"
+#include "kv_thread_pool.h"
+
+namespace kong
+{
+    struct KongTextureStreamerSettings
+    {
+        // 所有流式贴图驻留mip的显存上限
+        uint64_t budgetBytes = 256ull << 20;
+        // 第一次加载只上传宽高都不超过这个值的mip
+        uint32_t initialMaxSize = 64;
+        // 这么多帧没有被请求的贴图只保留初始的低精度mip
+        uint32_t idleFrames = 120;
+        // 同时在后台上传的贴图数量
+        uint32_t maxPendingUploads = 4;
+    };
+
+    // update中统计，只反映最近一帧
+    struct KongTextureStreamerStats
+    {
+        uint64_t residentBytes = 0;
+        // 正在后台上传的贴图数量，包括升级和降级
+        uint32_t pendingRequests = 0;
+        // 上一帧需要的mip比驻留的更精细的贴图数量
+        uint32_t mipMisses = 0;
+        // 本次update中为了腾出预算而降级的贴图数量
+        uint32_t evictions = 0;
+        uint32_t textureCount = 0;
+    };
+
+    /*
+     * 按mip流式加载的贴图，数据来自kv_assetc生成的.kvtex
+     * 显存中只有[residentMip, mipCount)这几级，换成其他精度时在后台创建一张新的KongTexture再整体替换
+     */
+    class KongStreamedTexture
+    {
+    public:
+        // 当前可以使用的贴图，初始的低精度mip上传完成之前为空
+        const std::shared_ptr<KongTexture>& current() const { return m_current; }
+        const std::string& filepath() const { return m_filepath; }
+        uint32_t mipCount() const { return m_cache.header().mipCount; }
+        uint32_t residentMip() const { return m_residentMip; }
+
+        // 渲染时按物体在屏幕上的直径（像素）登记需要的mip，同一帧内取最精细的一次
+        void requestScreenSize(float screenPixels);
+
+    private:
+        friend class KongTextureStreamer;
+
+        // 从mip开始到最后一级的显存大小
+        uint64_t bytesFrom(uint32_t mip) const;
+
+        std::string m_filepath;
+        KongTextureSettings m_settings{};
+        // 保持映射，换精度时直接从文件中取需要的mip
+        KongTextureCache m_cache;
+
+        std::shared_ptr<KongTexture> m_current{};
+        uint32_t m_residentMip = 0;
+        uint32_t m_initialMip = 0;
+
+        // 渲染线程在两次update之间登记，UINT32_MAX表示没有被请求
+        uint32_t m_requestedMip = UINT32_MAX;
+        uint64_t m_lastRequestFrame = 0;
+
+        std::future<std::unique_ptr<KongTexture>> m_upload{};
+        uint32_t m_uploadMip = 0;
+    };
+
+    /*
+     * mip级别的贴图流送，只在渲染线程中调用
+     * 每帧开始前update：换入上传完成的贴图，再按上一帧登记的需求和显存预算发起新的升级/降级
+     * 上传在线程池中完成，渲染线程不会等待GPU；被替换的旧贴图由渲染系统在所有帧都不再使用之后释放
+     */
+    class KongTextureStreamer
+    {
+    public:
+        KongTextureStreamer(KongDevice& device, KongSamplerCache& samplerCache,
+            const KongTextureStreamerSettings& settings = {}, KongThreadPool& threadPool = KongThreadPool::global());
+        // 等待还在进行的上传，必须在KongDevice之前析构
+        ~KongTextureStreamer();
+
+        KongTextureStreamer(const KongTextureStreamer&) = delete;
+        KongTextureStreamer& operator=(const KongTextureStreamer&) = delete;
+
+        // 打开.kvtex并在后台上传低精度的mip，没有cook过或者设备不支持缓存的格式时返回空
+        std::shared_ptr<KongStreamedTexture> load(const std::string& filepath, const KongTextureSettings& settings = {});
+
+        void update();
+
+        void setBudget(uint64_t budgetBytes) { m_settings.budgetBytes = budgetBytes; }
+        const KongTextureStreamerStats& stats() const { return m_stats; }
+
+    private:
+        void startUpload(KongStreamedTexture& texture, uint32_t mip);
+        // 换入已经完成的上传，返回是否有上传完成
+        bool finishUpload(KongStreamedTexture& texture);
+
+        KongDevice& m_device;
+        KongSamplerCache& m_samplerCache;
+        KongThreadPool& m_threadPool;
+        KongTextureStreamerSettings m_settings;
+        KongTextureStreamerStats m_stats{};
+        uint64_t m_frameNumber = 0;
+
+        std::vector<std::shared_ptr<KongStreamedTexture>> m_textures;
+    };
+}
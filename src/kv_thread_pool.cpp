@@ -0,0 +1,112 @@
+#include "kv_thread_pool.h"
+
+#include <algorithm>
+
+using namespace kong;
+
+KongThreadPool::KongThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_workers.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        m_workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+KongThreadPool::~KongThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+KongThreadPool& KongThreadPool::global()
+{
+    static KongThreadPool pool{};
+    return pool;
+}
+
+void KongThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping && m_tasks.empty())
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+        }
+        task();
+    }
+}
+
+bool KongThreadPool::runPendingTask()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(m_tasks.front());
+        m_tasks.pop();
+    }
+    task();
+    return true;
+}
+
+void KongThreadPool::parallelFor(size_t count, size_t taskCount, const std::function<void(size_t, size_t)>& func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    taskCount = std::clamp<size_t>(taskCount, 1, count);
+    if (taskCount == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    const size_t step = (count + taskCount - 1) / taskCount;
+    std::vector<std::future<void>> futures;
+    futures.reserve(taskCount - 1);
+    for (size_t begin = step; begin < count; begin += step)
+    {
+        size_t end = std::min(begin + step, count);
+        futures.push_back(submit([&func, begin, end]() { func(begin, end); }));
+    }
+
+    // 第一段在当前线程执行，等待的时候顺便帮忙处理队列中的任务
+    func(0, std::min(step, count));
+    for (auto& future : futures)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!runPendingTask())
+            {
+                future.wait();
+                break;
+            }
+        }
+        future.get();
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace kong
+{
+    /*
+     * 固定线程数的线程池，模型解析、资源加载之类的CPU任务都丢到这里执行
+     */
+    class KongThreadPool
+    {
+    public:
+        explicit KongThreadPool(uint32_t threadCount = 0);
+        ~KongThreadPool();
+
+        KongThreadPool(const KongThreadPool&) = delete;
+        KongThreadPool& operator=(const KongThreadPool&) = delete;
+
+        // 全局共享的线程池，线程数等于CPU核数
+        static KongThreadPool& global();
+
+        uint32_t threadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+        template <typename Func>
+        auto submit(Func&& func) -> std::future<decltype(func())>
+        {
+            using Result = decltype(func());
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+            std::future<Result> future = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.emplace([task]() { (*task)(); });
+            }
+            m_condition.notify_one();
+            return future;
+        }
+
+        /*
+         * 把[0, count)分成taskCount份并行执行func(begin, end)，阻塞直到全部完成
+         * 调用线程也会参与执行，所以在worker线程里调用也不会死锁
+         */
+        void parallelFor(size_t count, size_t taskCount, const std::function<void(size_t, size_t)>& func);
+
+    private:
+        void workerLoop();
+        bool runPendingTask();
+
+        std::vector<std::thread> m_workers;
+        std::queue<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        bool m_stopping = false;
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+namespace kong
+{
+    // from: https://stackoverflow.com/a/57595105
+    template <typename T, typename... Rest>
+    void hashCombine(std::size_t& seed, const T& v, const Rest&... rest)
+    {
+        seed ^= std::hash<T>{}(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        (hashCombine(seed, rest), ...);
+    }
+
+    // 64位FNV-1a的变体，每次处理8个字节，用于给大文件做内容hash
+    inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+    {
+        constexpr uint64_t prime = 1099511628211ull;
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * prime;
+        }
+        return hash;
+    }
+}
@@ -0,0 +1,183 @@
+#include "kv_vertex_format.h"
+
+#include <cmath>
+
+#include "glm/ext/matrix_transform.hpp"
+
+using namespace kong;
+
+namespace
+{
+    float signNotZero(float value)
+    {
+        return value >= 0.0f ? 1.0f : -1.0f;
+    }
+}
+
+const char* KongVertexFormats::name(KongVertexFormat format)
+{
+    switch (format)
+    {
+    case KongVertexFormat::Packed:
+        return "packed";
+    case KongVertexFormat::PackedQuantized:
+        return "quantized";
+    default:
+        return "full";
+    }
+}
+
+bool KongVertexFormats::fromName(const std::string& name, KongVertexFormat& format)
+{
+    for (uint32_t i = 0; i < static_cast<uint32_t>(KongVertexFormat::Count); i++)
+    {
+        if (name == KongVertexFormats::name(static_cast<KongVertexFormat>(i)))
+        {
+            format = static_cast<KongVertexFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t KongVertexFormats::stride(KongVertexFormat format)
+{
+    switch (format)
+    {
+    case KongVertexFormat::Packed:
+        return sizeof(KongPackedVertex);
+    case KongVertexFormat::PackedQuantized:
+        return sizeof(KongQuantizedVertex);
+    default:
+        // 和KongModel::Vertex一致：position, color, normal各3个float，uv 2个float
+        return sizeof(float) * 11;
+    }
+}
+
+uint32_t KongVertexFormats::positionSize(KongVertexFormat format)
+{
+    return format == KongVertexFormat::PackedQuantized ? sizeof(KongQuantizedVertex::position) : sizeof(float) * 3;
+}
+
+uint32_t KongVertexFormats::streamStride(const KongVertexLayout& layout, uint32_t stream)
+{
+    if (!layout.splitPositions)
+    {
+        return stride(layout.format);
+    }
+    return stream == STREAM_POSITION ? positionSize(layout.format) : stride(layout.format) - positionSize(layout.format);
+}
+
+std::vector<VkVertexInputBindingDescription> KongVertexFormats::bindingDescriptions(const KongVertexLayout& layout, uint32_t streams)
+{
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions{};
+    if (!layout.splitPositions)
+    {
+        bindingDescriptions.push_back({0, stride(layout.format), VK_VERTEX_INPUT_RATE_VERTEX});
+        return bindingDescriptions;
+    }
+
+    if (streams & STREAM_POSITION)
+    {
+        bindingDescriptions.push_back({0, streamStride(layout, STREAM_POSITION), VK_VERTEX_INPUT_RATE_VERTEX});
+    }
+    if (streams & STREAM_ATTRIBUTES)
+    {
+        bindingDescriptions.push_back({1, streamStride(layout, STREAM_ATTRIBUTES), VK_VERTEX_INPUT_RATE_VERTEX});
+    }
+    return bindingDescriptions;
+}
+
+std::vector<VkVertexInputAttributeDescription> KongVertexFormats::attributeDescriptions(const KongVertexLayout& layout, uint32_t streams)
+{
+    // location和shader中的顺序一致：0 position, 1 color, 2 normal, 3 uv，offset是在完整顶点中的偏移
+    std::vector<VkVertexInputAttributeDescription> interleaved{};
+    switch (layout.format)
+    {
+    case KongVertexFormat::Packed:
+        interleaved.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(KongPackedVertex, position)});
+        interleaved.push_back({1, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(KongPackedVertex, color)});
+        interleaved.push_back({2, 0, VK_FORMAT_R16G16_SNORM, offsetof(KongPackedVertex, normal)});
+        interleaved.push_back({3, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(KongPackedVertex, uv)});
+        break;
+    case KongVertexFormat::PackedQuantized:
+        interleaved.push_back({0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(KongQuantizedVertex, position)});
+        interleaved.push_back({1, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(KongQuantizedVertex, color)});
+        interleaved.push_back({2, 0, VK_FORMAT_R16G16_SNORM, offsetof(KongQuantizedVertex, normal)});
+        interleaved.push_back({3, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(KongQuantizedVertex, uv)});
+        break;
+    default:
+        interleaved.push_back({0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0});
+        interleaved.push_back({1, 0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3});
+        interleaved.push_back({2, 0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 6});
+        interleaved.push_back({3, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 9});
+        break;
+    }
+
+    // position在顶点开头，分开存放时其余属性在binding 1中的偏移需要减去position的大小
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
+    for (auto attribute : interleaved)
+    {
+        const bool isPosition = attribute.location == 0;
+        if (!(streams & (isPosition ? STREAM_POSITION : STREAM_ATTRIBUTES)))
+        {
+            continue;
+        }
+        if (layout.splitPositions && !isPosition)
+        {
+            attribute.binding = 1;
+            attribute.offset -= positionSize(layout.format);
+        }
+        attributeDescriptions.push_back(attribute);
+    }
+    return attributeDescriptions;
+}
+
+const char* KongVertexFormats::vertexShaderPath(KongVertexFormat format)
+{
+    return format == KongVertexFormat::Full
+        ? "../resource/shader/simple_shader.vert.spv"
+        : "../resource/shader/simple_shader_packed.vert.spv";
+}
+
+const char* KongVertexFormats::depthOnlyVertexShaderPath()
+{
+    return "../resource/shader/depth_only.vert.spv";
+}
+
+glm::vec2 KongVertexFormats::octEncode(const glm::vec3& normal)
+{
+    // 投影到八面体|x|+|y|+|z|=1上，下半球沿对角线翻折到外侧的三角形
+    const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1 == 0.0f)
+    {
+        return glm::vec2{0.0f};
+    }
+    glm::vec2 encoded = glm::vec2{normal.x, normal.y} / l1;
+    if (normal.z < 0.0f)
+    {
+        encoded = glm::vec2{
+            (1.0f - std::abs(encoded.y)) * signNotZero(encoded.x),
+            (1.0f - std::abs(encoded.x)) * signNotZero(encoded.y)
+        };
+    }
+    return encoded;
+}
+
+glm::vec3 KongVertexFormats::octDecode(const glm::vec2& encoded)
+{
+    glm::vec3 normal{encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y)};
+    if (normal.z < 0.0f)
+    {
+        normal.x = (1.0f - std::abs(encoded.y)) * signNotZero(encoded.x);
+        normal.y = (1.0f - std::abs(encoded.x)) * signNotZero(encoded.y);
+    }
+    return glm::normalize(normal);
+}
+
+glm::mat4 KongVertexFormats::dequantizeMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    // 扁平的模型某个轴的范围为0，保留一个很小的缩放避免除0
+    const glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3{1e-6f});
+    return glm::scale(glm::translate(glm::mat4{1.0f}, boundsMin), extent);
+}
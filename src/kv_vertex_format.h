@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace kong
+{
+    /*
+     * GPU上的顶点格式，按模型选择
+     * Full: KongModel::Vertex原样上传，全部是float
+     * Packed: position保持float，normal用八面体编码的2x snorm16，uv用half，color用rgba8
+     * PackedQuantized: 在Packed的基础上把position量化为相对包围盒的unorm16，反量化矩阵合并到model matrix中
+     */
+    enum class KongVertexFormat : uint32_t
+    {
+        Full = 0,
+        Packed,
+        PackedQuantized,
+        Count
+    };
+
+    // 顶点数据的存放方式，按模型选择
+    struct KongVertexLayout
+    {
+        KongVertexFormat format = KongVertexFormat::Full;
+        /*
+         * 为true时position单独存放在binding 0，其余属性（color/normal/uv）存放在binding 1，
+         * 只需要position的深度pass和阴影pass不用读取整个顶点
+         */
+        bool splitPositions = false;
+    };
+
+    struct KongPackedVertex
+    {
+        float position[3];
+        int16_t normal[2];
+        uint16_t uv[2];
+        uint8_t color[4];
+    };
+
+    struct KongQuantizedVertex
+    {
+        // R16G16B16的顶点格式很多设备不支持，第四个分量只用于对齐
+        uint16_t position[4];
+        int16_t normal[2];
+        uint16_t uv[2];
+        uint8_t color[4];
+    };
+
+    static_assert(sizeof(KongPackedVertex) == 24, "unexpected packed vertex size");
+    static_assert(sizeof(KongQuantizedVertex) == 20, "unexpected quantized vertex size");
+
+    class KongVertexFormats
+    {
+    public:
+        // pipeline声明自己读取哪些顶点数据流，position分开存放时只声明STREAM_POSITION的pipeline只会绑定binding 0
+        static constexpr uint32_t STREAM_POSITION = 1 << 0;
+        static constexpr uint32_t STREAM_ATTRIBUTES = 1 << 1;
+        static constexpr uint32_t STREAM_ALL = STREAM_POSITION | STREAM_ATTRIBUTES;
+
+        static const char* name(KongVertexFormat format);
+        // 按名字解析命令行参数（full/packed/quantized），不认识的名字返回false
+        static bool fromName(const std::string& name, KongVertexFormat& format);
+
+        // 完整顶点的大小，所有格式中position都位于顶点的开头
+        static uint32_t stride(KongVertexFormat format);
+        static uint32_t positionSize(KongVertexFormat format);
+        // 单个顶点在某个数据流中占用的byte数，position没有分开存放时每个数据流都是完整的顶点
+        static uint32_t streamStride(const KongVertexLayout& layout, uint32_t stream);
+
+        static std::vector<VkVertexInputBindingDescription> bindingDescriptions(const KongVertexLayout& layout,
+            uint32_t streams = STREAM_ALL);
+        static std::vector<VkVertexInputAttributeDescription> attributeDescriptions(const KongVertexLayout& layout,
+            uint32_t streams = STREAM_ALL);
+        // 解码所需的vertex shader，Packed和PackedQuantized共用一个
+        static const char* vertexShaderPath(KongVertexFormat format);
+        // 只输出深度的vertex shader，只读取location 0的position，所有格式通用
+        static const char* depthOnlyVertexShaderPath();
+
+        // 单位向量的八面体编码，和shader中的octDecode对应
+        static glm::vec2 octEncode(const glm::vec3& normal);
+        static glm::vec3 octDecode(const glm::vec2& encoded);
+
+        // 量化position时把包围盒映射到[0, 1]，返回从[0, 1]还原到模型空间的矩阵
+        static glm::mat4 dequantizeMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+    };
+}
@@ -1,11 +1,18 @@
 #include <iostream>
 #include "kv_app.h"
+#include "kv_benchmark.h"
 
-int main()
+int main(int argc, char** argv)
 {
-    kong::KongApp app;
     try
     {
+        // 性能测试不启动程序本身
+        if (kong::KongBenchmark::run(argc, argv))
+        {
+            return EXIT_SUCCESS;
+        }
+
+        kong::KongApp app{kong::KongAppSettings::fromCommandLine(argc, argv)};
         app.run();    
     }
     catch (const std::exception& e)
@@ -15,4 +22,4 @@ int main()
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
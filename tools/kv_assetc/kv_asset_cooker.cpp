@@ -0,0 +1,372 @@
+#include "kv_asset_cooker.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "kv_mapped_file.h"
+#include "kv_mesh_cache.h"
+#include "kv_model.h"
+#include "kv_texture_cache.h"
+#include "kv_thread_pool.h"
+#include "kv_utils.h"
+
+using namespace kong;
+namespace fs = std::filesystem;
+
+namespace
+{
+    std::string lowerExtension(const fs::path& path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return extension;
+    }
+
+    uint64_t fileSize(const fs::path& path)
+    {
+        std::error_code ec;
+        const auto size = fs::file_size(path, ec);
+        return ec ? 0 : static_cast<uint64_t>(size);
+    }
+
+    bool hashFile(const fs::path& path, uint64_t& hash)
+    {
+        KongMappedFile file{path.string()};
+        if (!file.isOpen())
+        {
+            return false;
+        }
+        hash = hashBytes(file.data(), file.size());
+        return true;
+    }
+
+    // 同样大小的完整mip链用RGBA8存储时的字节数
+    uint64_t uncompressedMipChainBytes(uint32_t width, uint32_t height)
+    {
+        uint64_t size = 0;
+        const uint32_t mipCount = KongTextureFormats::mipCount(width, height);
+        for (uint32_t mip = 0; mip < mipCount; mip++)
+        {
+            size += KongTextureFormats::imageBytes(KongTextureFormat::RGBA8, std::max(width >> mip, 1u), std::max(height >> mip, 1u));
+        }
+        return size;
+    }
+
+    std::string quote(const std::string& path)
+    {
+        return "\"" + path + "\"";
+    }
+}
+
+KongAssetCooker::KongAssetCooker(const KongCookOptions& options) : m_options(options)
+{
+    m_glslc = findGlslc();
+    loadManifest();
+}
+
+bool KongAssetCooker::isMeshSource(const fs::path& path)
+{
+    // 和KongModel::Builder::loadAsset支持的格式一致，.blend1之类的备份文件不处理
+    static const char* extensions[] = {".obj", ".fbx", ".gltf", ".glb", ".blend", ".dae"};
+    const std::string extension = lowerExtension(path);
+    return std::any_of(std::begin(extensions), std::end(extensions), [&](const char* e) { return extension == e; });
+}
+
+bool KongAssetCooker::isShaderSource(const fs::path& path)
+{
+    static const char* extensions[] = {".vert", ".frag", ".comp", ".geom", ".tesc", ".tese"};
+    const std::string extension = lowerExtension(path);
+    return std::any_of(std::begin(extensions), std::end(extensions), [&](const char* e) { return extension == e; });
+}
+
+bool KongAssetCooker::isTextureSource(const fs::path& path)
+{
+    static const char* extensions[] = {".png", ".tga", ".jpg", ".jpeg"};
+    const std::string extension = lowerExtension(path);
+    return std::any_of(std::begin(extensions), std::end(extensions), [&](const char* e) { return extension == e; });
+}
+
+std::vector<KongCookResult> KongAssetCooker::cookAll()
+{
+    std::vector<fs::path> sources;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(m_options.resourceDir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+    {
+        if (it->is_regular_file() && (isMeshSource(it->path()) || isShaderSource(it->path()) || isTextureSource(it->path())))
+        {
+            sources.push_back(it->path());
+        }
+    }
+    if (ec)
+    {
+        std::cerr << "failed to scan " << m_options.resourceDir << ": " << ec.message() << std::endl;
+    }
+    std::sort(sources.begin(), sources.end());
+
+    // 每个资源一个任务，模型内部的OBJ解析和贴图的块压缩还会用parallelFor继续拆分
+    std::vector<std::future<KongCookResult>> futures;
+    futures.reserve(sources.size());
+    for (const auto& source : sources)
+    {
+        futures.push_back(KongThreadPool::global().submit([this, source]()
+        {
+            if (isShaderSource(source))
+            {
+                return cookShader(source);
+            }
+            return isTextureSource(source) ? cookTexture(source) : cookMesh(source);
+        }));
+    }
+
+    std::vector<KongCookResult> results;
+    results.reserve(futures.size());
+    for (auto& future : futures)
+    {
+        results.push_back(future.get());
+    }
+    saveManifest();
+    return results;
+}
+
+KongCookResult KongAssetCooker::cookMesh(const fs::path& source)
+{
+    using clock = std::chrono::high_resolution_clock;
+    const auto startTime = clock::now();
+
+    KongCookResult result{};
+    result.source = source.string();
+    result.output = KongMeshCache::cachePathFor(result.source);
+    result.inputBytes = fileSize(source);
+
+    // .kvmesh中记录了源文件的hash，能打开说明没有过期；检查完立刻unmap，否则Windows上无法覆盖这个文件
+    if (!m_options.force && KongMeshCache{}.open(result.output, result.source))
+    {
+        result.status = KongCookResult::Status::UpToDate;
+        result.outputBytes = fileSize(result.output);
+        return result;
+    }
+
+    try
+    {
+        KongModel::Builder builder;
+        builder.loadAsset(result.source);
+        builder.cook();
+        if (!KongMeshCache::write(result.output, result.source, builder))
+        {
+            throw std::runtime_error("failed to write " + result.output);
+        }
+        result.status = KongCookResult::Status::Cooked;
+        result.outputBytes = fileSize(result.output);
+    }
+    catch (const std::exception& e)
+    {
+        result.status = KongCookResult::Status::Failed;
+        result.message = e.what();
+    }
+    result.milliseconds = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+    return result;
+}
+
+KongCookResult KongAssetCooker::cookTexture(const fs::path& source)
+{
+    using clock = std::chrono::high_resolution_clock;
+    const auto startTime = clock::now();
+
+    KongCookResult result{};
+    result.source = source.string();
+    result.output = KongTextureCache::cachePathFor(result.source);
+    result.inputBytes = fileSize(source);
+
+    {
+        // 颜色贴图的格式取决于--albedo，换了参数之后需要重新压缩
+        KongTextureCache cache;
+        if (!m_options.force && cache.open(result.output, result.source))
+        {
+            const KongTextureFormat format = cache.format();
+            const bool albedoChanged = cache.header().srgb != 0 && (format == KongTextureFormat::BC7) != (m_options.albedoFormat == KongTextureFormat::BC7);
+            if (!albedoChanged)
+            {
+                result.status = KongCookResult::Status::UpToDate;
+                result.outputBytes = fileSize(result.output);
+                for (uint32_t mip = 0; mip < cache.header().mipCount; mip++)
+                {
+                    result.gpuBytes += cache.mipSize(mip);
+                }
+                result.uncompressedGpuBytes = uncompressedMipChainBytes(cache.header().width, cache.header().height);
+                return result;
+            }
+        }
+    }
+
+    KongImageData image;
+    if (!KongImageData::decodeFile(result.source, image))
+    {
+        result.message = "failed to decode image";
+        return result;
+    }
+
+    const KongTextureEncodeSettings settings = KongTextureCompressor::settingsForFile(result.source, image, m_options.albedoFormat);
+    const auto encodeStart = clock::now();
+    const KongCompressedTexture texture = KongTextureCompressor::compress(image, settings);
+    const float encodeSeconds = std::chrono::duration<float>(clock::now() - encodeStart).count();
+    if (!KongTextureCache::write(result.output, result.source, texture))
+    {
+        result.message = "failed to write " + result.output;
+        return result;
+    }
+
+    // 只用mip0衡量质量，吞吐量按包括mip在内的所有像素计算
+    const KongImageData decoded = KongTextureCompressor::decode(texture.mips[0].data(), texture.format, image.width, image.height);
+    const double psnr = KongTextureCompressor::psnr(image, decoded, KongTextureFormats::channelCount(texture.format));
+    uint64_t pixelCount = 0;
+    for (size_t mip = 0; mip < texture.mips.size(); mip++)
+    {
+        pixelCount += static_cast<uint64_t>(std::max(image.width >> mip, 1u)) * std::max(image.height >> mip, 1u);
+    }
+
+    result.status = KongCookResult::Status::Cooked;
+    result.outputBytes = fileSize(result.output);
+    result.gpuBytes = texture.sizeBytes();
+    result.uncompressedGpuBytes = uncompressedMipChainBytes(image.width, image.height);
+    std::ostringstream message;
+    message << std::fixed << std::setprecision(1) << KongTextureFormats::name(texture.format) << (texture.srgb ? " srgb" : "")
+        << ", " << image.width << "x" << image.height << ", " << texture.mips.size() << " mips, PSNR " << psnr << " dB, "
+        << (encodeSeconds > 0.0f ? pixelCount / 1.0e6f / encodeSeconds : 0.0f) << " MPix/s";
+    result.message = message.str();
+    result.milliseconds = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+    return result;
+}
+
+KongCookResult KongAssetCooker::cookShader(const fs::path& source)
+{
+    using clock = std::chrono::high_resolution_clock;
+    const auto startTime = clock::now();
+
+    KongCookResult result{};
+    result.source = source.string();
+    result.output = result.source + ".spv";
+    result.inputBytes = fileSize(source);
+
+    uint64_t sourceHash = 0;
+    if (!hashFile(source, sourceHash))
+    {
+        result.message = "failed to read source";
+        return result;
+    }
+
+    const std::string key = fs::relative(result.output, m_options.resourceDir).generic_string();
+    {
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        auto it = m_manifest.find(key);
+        if (!m_options.force && it != m_manifest.end() && it->second == sourceHash && fs::exists(result.output))
+        {
+            result.status = KongCookResult::Status::UpToDate;
+            result.outputBytes = fileSize(result.output);
+            return result;
+        }
+    }
+
+    if (m_glslc.empty())
+    {
+        result.message = "glslc not found, set VULKAN_SDK or pass --glslc";
+        return result;
+    }
+
+    const std::string command = quote(m_glslc) + " " + quote(result.source) + " -o " + quote(result.output);
+    if (std::system(command.c_str()) != 0)
+    {
+        result.message = "glslc failed";
+    }
+    else
+    {
+        result.status = KongCookResult::Status::Cooked;
+        result.outputBytes = fileSize(result.output);
+        std::lock_guard<std::mutex> lock(m_manifestMutex);
+        m_manifest[key] = sourceHash;
+    }
+    result.milliseconds = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+    return result;
+}
+
+std::string KongAssetCooker::findGlslc() const
+{
+    if (!m_options.glslcPath.empty())
+    {
+        return m_options.glslcPath;
+    }
+
+    std::vector<fs::path> candidates;
+    if (const char* sdk = std::getenv("VULKAN_SDK"))
+    {
+        candidates.push_back(fs::path(sdk) / "Bin" / "glslc.exe");
+        candidates.push_back(fs::path(sdk) / "Bin" / "glslc");
+        candidates.push_back(fs::path(sdk) / "bin" / "glslc");
+    }
+    if (const char* path = std::getenv("PATH"))
+    {
+#ifdef _WIN32
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif
+        std::string paths = path;
+        size_t begin = 0;
+        while (begin <= paths.size())
+        {
+            size_t end = paths.find(separator, begin);
+            if (end == std::string::npos)
+            {
+                end = paths.size();
+            }
+            if (end > begin)
+            {
+                candidates.push_back(fs::path(paths.substr(begin, end - begin)) / "glslc.exe");
+                candidates.push_back(fs::path(paths.substr(begin, end - begin)) / "glslc");
+            }
+            begin = end + 1;
+        }
+    }
+
+    for (const auto& candidate : candidates)
+    {
+        std::error_code ec;
+        if (fs::is_regular_file(candidate, ec))
+        {
+            return candidate.string();
+        }
+    }
+    return {};
+}
+
+void KongAssetCooker::loadManifest()
+{
+    // 每行: <源文件hash> <输出文件相对resource目录的路径>
+    std::ifstream file(m_options.resourceDir / MANIFEST_NAME);
+    uint64_t hash = 0;
+    std::string output;
+    while (file >> std::hex >> hash && std::getline(file >> std::ws, output))
+    {
+        m_manifest[output] = hash;
+    }
+}
+
+void KongAssetCooker::saveManifest()
+{
+    std::lock_guard<std::mutex> lock(m_manifestMutex);
+    std::vector<std::pair<std::string, uint64_t>> entries(m_manifest.begin(), m_manifest.end());
+    std::sort(entries.begin(), entries.end());
+
+    std::ofstream file(m_options.resourceDir / MANIFEST_NAME, std::ios::trunc);
+    for (const auto& entry : entries)
+    {
+        file << std::hex << entry.second << " " << entry.first << "\n";
+    }
+}
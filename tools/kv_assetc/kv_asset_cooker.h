@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kv_texture_compressor.h"
+
+namespace kong
+{
+    struct KongCookOptions
+    {
+        std::filesystem::path resourceDir = "../resource";
+        // 忽略hash，全部重新处理
+        bool force = false;
+        // 为空时依次尝试$VULKAN_SDK/Bin/glslc、$VULKAN_SDK/bin/glslc和PATH中的glslc
+        std::string glslcPath{};
+        // 颜色贴图的压缩格式，BC1带alpha的贴图会改用BC3
+        KongTextureFormat albedoFormat = KongTextureFormat::BC7;
+    };
+
+    struct KongCookResult
+    {
+        enum class Status
+        {
+            Cooked,
+            UpToDate,
+            Failed
+        };
+
+        std::string source;
+        std::string output;
+        Status status = Status::Failed;
+        uint64_t inputBytes = 0;
+        uint64_t outputBytes = 0;
+        float milliseconds = 0.0f;
+        // 失败原因，贴图成功时是格式和压缩质量
+        std::string message{};
+        // 只有贴图有：包括mip链在内占用的显存，以及同样的mip链用RGBA8时的大小
+        uint64_t gpuBytes = 0;
+        uint64_t uncompressedGpuBytes = 0;
+    };
+
+    /*
+     * kv_assetc的实现：遍历resource目录，把模型处理成.kvmesh，贴图压缩成.kvtex，把glsl编译成spv
+     * 每个资源是线程池中的一个任务，.kvmesh/.kvtex自带源文件hash，shader的源文件hash记录在manifest中
+     */
+    class KongAssetCooker
+    {
+    public:
+        static constexpr const char* MANIFEST_NAME = ".kv_assetc_manifest";
+
+        explicit KongAssetCooker(const KongCookOptions& options);
+
+        // 按路径排序的结果，和资源的处理顺序无关
+        std::vector<KongCookResult> cookAll();
+
+        static bool isMeshSource(const std::filesystem::path& path);
+        static bool isShaderSource(const std::filesystem::path& path);
+        static bool isTextureSource(const std::filesystem::path& path);
+
+    private:
+        KongCookResult cookMesh(const std::filesystem::path& source);
+        KongCookResult cookShader(const std::filesystem::path& source);
+        KongCookResult cookTexture(const std::filesystem::path& source);
+
+        std::string findGlslc() const;
+        void loadManifest();
+        void saveManifest();
+
+        KongCookOptions m_options;
+        std::string m_glslc;
+
+        // 输出文件（相对resource目录）-> 生成它时源文件的内容hash
+        std::mutex m_manifestMutex;
+        std::unordered_map<std::string, uint64_t> m_manifest;
+    };
+}
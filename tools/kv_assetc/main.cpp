@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "kv_asset_cooker.h"
+
+using namespace kong;
+
+namespace
+{
+    void printUsage()
+    {
+        std::cout << "usage: kv_assetc [resource dir] [--force] [--glslc <path>] [--albedo bc7|bc1]\n"
+            << "  cooks meshes into .kvmesh, block-compresses textures into .kvtex and compiles shaders into .spv,\n"
+            << "  skipping up-to-date outputs" << std::endl;
+    }
+
+    const char* statusName(KongCookResult::Status status)
+    {
+        switch (status)
+        {
+        case KongCookResult::Status::Cooked:
+            return "cooked";
+        case KongCookResult::Status::UpToDate:
+            return "up-to-date";
+        default:
+            return "FAILED";
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    KongCookOptions options{};
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--force")
+        {
+            options.force = true;
+        }
+        else if (arg == "--glslc" && i + 1 < argc)
+        {
+            options.glslcPath = argv[++i];
+        }
+        else if (arg == "--albedo" && i + 1 < argc)
+        {
+            KongTextureFormat format;
+            if (!KongTextureFormats::fromName(argv[++i], format) || (format != KongTextureFormat::BC1 && format != KongTextureFormat::BC7))
+            {
+                std::cerr << "--albedo must be bc1 or bc7" << std::endl;
+                return EXIT_FAILURE;
+            }
+            options.albedoFormat = format;
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return EXIT_SUCCESS;
+        }
+        else
+        {
+            options.resourceDir = arg;
+        }
+    }
+
+    using clock = std::chrono::high_resolution_clock;
+    const auto startTime = clock::now();
+    KongAssetCooker cooker{options};
+    const auto results = cooker.cookAll();
+    const float totalSeconds = std::chrono::duration<float>(clock::now() - startTime).count();
+
+    uint32_t cooked = 0, upToDate = 0, failed = 0;
+    uint64_t cookedInputBytes = 0, cookedOutputBytes = 0;
+    uint64_t textureGpuBytes = 0, textureUncompressedBytes = 0;
+    float cookMilliseconds = 0.0f;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& result : results)
+    {
+        std::cout << std::setw(10) << statusName(result.status) << "  " << result.source;
+        if (result.status == KongCookResult::Status::Cooked)
+        {
+            std::cout << "  " << result.milliseconds << " ms, " << result.inputBytes / 1024 << " KB -> "
+                << result.outputBytes / 1024 << " KB";
+            cooked++;
+            cookedInputBytes += result.inputBytes;
+            cookedOutputBytes += result.outputBytes;
+            cookMilliseconds += result.milliseconds;
+            if (!result.message.empty())
+            {
+                std::cout << ", " << result.message;
+            }
+        }
+        else if (result.status == KongCookResult::Status::UpToDate)
+        {
+            upToDate++;
+        }
+        else
+        {
+            std::cout << "  " << result.message;
+            failed++;
+        }
+        std::cout << std::endl;
+        textureGpuBytes += result.gpuBytes;
+        textureUncompressedBytes += result.uncompressedGpuBytes;
+    }
+
+    // 吞吐量按实际处理的源文件大小和总的墙钟时间计算，cpu时间/墙钟时间反映并行度
+    const float inputMegabytes = static_cast<float>(cookedInputBytes) / (1024.0f * 1024.0f);
+    std::cout << results.size() << " assets: " << cooked << " cooked, " << upToDate << " up-to-date, " << failed << " failed\n"
+        << "total " << totalSeconds * 1000.0f << " ms, " << inputMegabytes << " MB in -> "
+        << static_cast<float>(cookedOutputBytes) / (1024.0f * 1024.0f) << " MB out, "
+        << (totalSeconds > 0.0f ? inputMegabytes / totalSeconds : 0.0f) << " MB/s, parallelism "
+        << std::setprecision(2) << (totalSeconds > 0.0f ? cookMilliseconds / (totalSeconds * 1000.0f) : 0.0f) << "x" << std::endl;
+    if (textureUncompressedBytes > 0)
+    {
+        // 包括up-to-date的贴图，对比全部贴图用RGBA8上传时的显存
+        std::cout << std::setprecision(1) << "texture VRAM with mips: " << static_cast<float>(textureUncompressedBytes) / (1024.0f * 1024.0f)
+            << " MB as RGBA8 -> " << static_cast<float>(textureGpuBytes) / (1024.0f * 1024.0f) << " MB compressed ("
+            << static_cast<float>(textureUncompressedBytes) / static_cast<float>(std::max<uint64_t>(textureGpuBytes, 1)) << "x smaller)" << std::endl;
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}